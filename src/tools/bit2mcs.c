@@ -1,81 +1,357 @@
+/*
+  Convert bitstreams to .mcs (Intel HEX) files for flashing, and back.
+
+  The data of a .bit file is found from its header, and .bin and .cor
+  files are used whole. Each image goes at the start of a flash slot, as
+  megaflash lays them out: slot n starts at n times the slot size of the
+  MEGA65 model, and a .cor file starts with the core header that megaflash
+  reads, with the bitstream 4KB in. Several images can go into one .mcs
+  file, to make a whole flash image.
+
+  The other way, an .mcs file is turned back into binary, for the whole
+  flash, or one slot, with anything not in the file left as 0xff, as
+  erased flash reads.
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+
+#define OUTPUT_BUFFER (1024 * 1024)
+#define RECORD_BYTES 16
+#define MAX_IMAGES 16
+#define MAX_FLASH (256 * 1024 * 1024)
+
+// Slot sizes in MB, as in megaflash's mega65_target table
+struct {
+  char *name;
+  int slot_mb;
+} models[] = { { "R1", 8 }, { "R2", 4 }, { "R3", 8 }, { "R4", 8 }, { "R5", 8 }, { "R6", 8 }, { NULL, 0 } };
+
+struct image {
+  char *name;
+  int slot;
+  uint32_t address;
+  bitstream *b;
+  const uint8_t *data;
+  int size;
+} images[MAX_IMAGES];
+int image_count = 0;
+
+uint32_t slot_size = 8 * 1024 * 1024;
+int quiet = 0;
+
+FILE *outfile;
+char output[OUTPUT_BUFFER];
+int output_len = 0;
+char hex_pairs[256][2];
+signed char hex_value[256];
 
 void error(char *fmt, ...)
 {
   va_list ap;
 
   va_start(ap, fmt);
-  printf("Error: ");
-  vprintf(fmt, ap);
-  printf("\n");
+  fprintf(stderr, "ERROR: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
   va_end(ap);
   exit(1);
 }
 
-int main(int argc, char *argv[])
+void usage(void)
 {
-  unsigned int loadAddr = 0;
-  FILE *infile;
-  FILE *outfile;
-  int numBytes, i;
-  int c;
-  unsigned char lineData[16];
-  unsigned int chksum;
-
-  // loadAddr=0;
-
-  if (argc != 3) {
-    printf("bit2mcs - Converts XILINX bitstream files to flashable files\n"
-           "Usage: bit2mcs <input file> <output file>\nExample: bit2mcs mega65.bit mega65.mcs\n");
-    exit(1);
+  fprintf(stderr, "bit2mcs - Converts XILINX bitstream files to flashable files\n"
+                  "usage: bit2mcs [-q] [-m model] [-s slot] [-a slot:file]... <input file> <output file>\n"
+                  "       bit2mcs -r [-m model] [-s slot] <input.mcs> <output.bin>\n"
+                  "Example: bit2mcs mega65.bit mega65.mcs\n"
+                  "  -m  MEGA65 model (R1 to R6), or the slot size in MB, for the flash layout (default R3 and later).\n"
+                  "  -s  the slot to put the input in (default 0), or with -r, the slot to extract.\n"
+                  "  -a  put another bitstream or core file in a slot, as well.\n"
+                  "  -r  convert an .mcs file back to binary.\n"
+                  "  -q  don't report what goes where.\n");
+  exit(-3);
+}
+
+void make_tables(void)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  memset(hex_value, -1, sizeof(hex_value));
+  for (int i = 0; i < 256; i++) {
+    hex_pairs[i][0] = digits[i >> 4];
+    hex_pairs[i][1] = digits[i & 15];
+  }
+  for (int i = 0; i < 16; i++) {
+    hex_value[(unsigned char)digits[i]] = i;
+    hex_value[(unsigned char)(digits[i] | 0x20)] = i;
   }
+}
+
+void flush_output(void)
+{
+  if (output_len && fwrite(output, output_len, 1, outfile) != 1)
+    error("could not write output file: %s", strerror(errno));
+  output_len = 0;
+}
 
-  infile = fopen(argv[1], "rb");
+char *hex_byte(char *p, uint8_t b)
+{
+  memcpy(p, hex_pairs[b], 2);
+  return p + 2;
+}
 
-  if (infile == NULL) {
-    error("cannot open input file %s", argv[2]);
-  }
-  fseek(infile, 120, SEEK_SET);
-  outfile = fopen(argv[2], "wt");
-  if (outfile == NULL) {
-    error("cannot open output file %s", argv[3]);
+void write_record(int type, uint16_t address, const uint8_t *data, int count)
+{
+  // ':', count, address, type, data and checksum, and the newline
+  if (output_len + 1 + 2 * (count + 5) + 1 > OUTPUT_BUFFER)
+    flush_output();
+  char *p = output + output_len;
+  unsigned int checksum = count + (address >> 8) + (address & 0xff) + type;
+  *p++ = ':';
+  p = hex_byte(p, count);
+  p = hex_byte(p, address >> 8);
+  p = hex_byte(p, address & 0xff);
+  p = hex_byte(p, type);
+  for (int i = 0; i < count; i++) {
+    checksum += data[i];
+    p = hex_byte(p, data[i]);
   }
-  while (1) {
-    if ((loadAddr & 0xFFFF) == 0) {
-      fprintf(outfile, ":02000004");
-      fprintf(outfile, "%04X", loadAddr >> 16);
-      chksum = 0x02 + 0x04 + ((loadAddr >> 24) & 0xFF) + ((loadAddr >> 16) & 0xFF);
-      fprintf(outfile, "%02X\n", (-chksum) & 0xFF);
+  p = hex_byte(p, -checksum);
+  *p++ = '\n';
+  output_len = p - output;
+}
+
+void write_image(const struct image *image)
+{
+  uint32_t address = image->address;
+  for (int offset = 0; offset < image->size; offset += RECORD_BYTES, address += RECORD_BYTES) {
+    if (offset == 0 || (address & 0xffff) == 0) {
+      uint8_t upper[2] = { address >> 24, address >> 16 };
+      write_record(4, 0, upper, 2);
     }
-    chksum = 0;
-    for (numBytes = 0; numBytes < 16; numBytes++) {
-      c = fgetc(infile);
-      if (c == EOF) {
-        break;
-      }
-      lineData[numBytes] = c;
-      chksum += c;
+    int count = image->size - offset < RECORD_BYTES ? image->size - offset : RECORD_BYTES;
+    write_record(0, address & 0xffff, image->data + offset, count);
+  }
+}
+
+void add_image(char *name, int slot)
+{
+  if (image_count == MAX_IMAGES)
+    error("too many images");
+  struct image *image = &images[image_count++];
+  image->name = name;
+  image->slot = slot;
+  if (slot >= MAX_FLASH / slot_size)
+    error("slot %d of %d MB is past the end of the flash", slot, slot_size >> 20);
+  image->address = slot * slot_size;
+  // The configuration data of a .bit file, or the whole of anything else,
+  // which could be any data to be put in the flash
+  image->b = bitstream_read_data(name);
+  if (!image->b)
+    exit(1);
+  image->data = image->b->data;
+  image->size = image->b->data_size;
+  if (image->size > slot_size)
+    fprintf(stderr, "WARNING: %s is %d bytes, which is more than a slot of %d\n", name, image->size, slot_size);
+  for (int i = 0; i < image_count - 1; i++)
+    if (images[i].slot == slot)
+      error("%s and %s are both in slot %d", images[i].name, name, slot);
+
+  if (!quiet) {
+    printf("Slot %d at $%07x: %s, %d bytes", slot, image->address, name, image->size);
+    if (image->b->design[0])
+      printf(", design '%s' for %s, built %s %s", image->b->design, image->b->part, image->b->date, image->b->time);
+    else if (image->size >= 16 && !memcmp(image->data, "MEGA65BITSTREAM0", 16))
+      printf(", core '%.32s'", image->data + 0x10);
+    printf("\n");
+  }
+  if (slot && (image->size < 16 || memcmp(image->data, "MEGA65BITSTREAM0", 16)))
+    fprintf(stderr, "WARNING: %s has no core header, so megaflash won't recognise slot %d\n", name, slot);
+}
+
+int compare_images(const void *a, const void *b)
+{
+  return ((const struct image *)a)->slot - ((const struct image *)b)->slot;
+}
+
+int hex_field(const char *p, int digits, const char *name, int line_number)
+{
+  int value = 0;
+  for (int i = 0; i < digits; i++) {
+    int v = hex_value[(unsigned char)p[i]];
+    if (v < 0)
+      error("%s:%d: bad hex digit", name, line_number);
+    value = (value << 4) | v;
+  }
+  return value;
+}
+
+// Read an .mcs file into flash, returning the end of what it writes below limit
+uint32_t read_mcs(const char *name, uint8_t *flash, uint32_t limit)
+{
+  FILE *f = fopen(name, "rb");
+  if (!f)
+    error("cannot open input file %s: %s", name, strerror(errno));
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *text = malloc(size + 1);
+  if (!text || fread(text, 1, size, f) != size)
+    error("cannot read input file %s", name);
+  fclose(f);
+  text[size] = 0;
+
+  uint32_t base = 0, end = 0;
+  int line_number = 0, done = 0;
+  for (char *p = text, *next; *p && !done; p = next) {
+    next = strchr(p, '\n');
+    next = next ? next + 1 : p + strlen(p);
+    line_number++;
+    if (*p == '\r' || *p == '\n')
+      continue;
+    if (*p != ':')
+      error("%s:%d: expected a record starting with ':'", name, line_number);
+    int count = hex_field(p + 1, 2, name, line_number);
+    if (next - p < 11 + 2 * count)
+      error("%s:%d: record is too short", name, line_number);
+    int address = hex_field(p + 3, 4, name, line_number);
+    int type = hex_field(p + 7, 2, name, line_number);
+    uint8_t data[256];
+    unsigned int checksum = count + (address >> 8) + (address & 0xff) + type;
+    for (int i = 0; i < count; i++)
+      checksum += data[i] = hex_field(p + 9 + 2 * i, 2, name, line_number);
+    if ((uint8_t)(checksum + hex_field(p + 9 + 2 * count, 2, name, line_number)))
+      error("%s:%d: bad checksum", name, line_number);
+
+    switch (type) {
+    case 0:
+      // (base + address can be past 4GB)
+      if (base >= MAX_FLASH || address + count > MAX_FLASH - base)
+        error("%s:%d: address $%llx is past the end of the flash", name, line_number,
+            (unsigned long long)base + address);
+      memcpy(flash + base + address, data, count);
+      if (base + address < limit && base + address + count > end)
+        end = base + address + count < limit ? base + address + count : limit;
+      break;
+    case 1:
+      done = 1;
+      break;
+    case 2:
+      base = (data[0] << 8 | data[1]) << 4;
+      break;
+    case 4:
+      base = (data[0] << 8 | data[1]) << 16;
+      break;
     }
-    if (numBytes == 0) {
+  }
+  if (!done)
+    fprintf(stderr, "WARNING: %s has no end of file record\n", name);
+  free(text);
+  return end;
+}
+
+int mcs_to_binary(const char *input, const char *output_name, int slot)
+{
+  uint8_t *flash = malloc(MAX_FLASH);
+  if (!flash)
+    error("out of memory");
+  memset(flash, 0xff, MAX_FLASH);
+  uint32_t start = 0, limit = MAX_FLASH;
+  if (slot >= 0) {
+    if (slot >= MAX_FLASH / slot_size)
+      error("slot %d of %d MB is past the end of the flash", slot, slot_size >> 20);
+    start = slot * slot_size;
+    limit = start + slot_size;
+  }
+  uint32_t end = read_mcs(input, flash, limit);
+  if (end <= start)
+    error("%s has nothing in slot %d", input, slot);
+
+  FILE *f = fopen(output_name, "wb");
+  if (!f)
+    error("cannot open output file %s: %s", output_name, strerror(errno));
+  if (end > start && fwrite(flash + start, end - start, 1, f) != 1)
+    error("could not write output file %s: %s", output_name, strerror(errno));
+  if (fclose(f))
+    error("could not write output file %s: %s", output_name, strerror(errno));
+  if (!quiet)
+    printf("Wrote %d bytes from $%07x to %s\n", end - start, start, output_name);
+  free(flash);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, reverse = 0, slot = -1;
+  char *extra[MAX_IMAGES];
+  int extra_slot[MAX_IMAGES], extra_count = 0;
+
+  while ((opt = getopt(argc, argv, "qm:s:a:r")) != -1) {
+    switch (opt) {
+    case 'q':
+      quiet = 1;
+      break;
+    case 'm': {
+      int i, mb = atoi(optarg);
+      for (i = 0; models[i].name; i++)
+        if (!strcasecmp(optarg, models[i].name))
+          mb = models[i].slot_mb;
+      if (mb < 1 || mb > 64 || (mb & (mb - 1)))
+        error("unknown model or slot size '%s'", optarg);
+      slot_size = mb * 1024 * 1024;
       break;
     }
-    fprintf(outfile, ":%02X%04X00", numBytes, loadAddr & 0xFFFF);
-    for (i = 0; i < numBytes; i++) {
-      fprintf(outfile, "%02X", lineData[i]);
+    case 's':
+      slot = atoi(optarg);
+      break;
+    case 'a': {
+      char *colon = strchr(optarg, ':');
+      if (!colon || extra_count == MAX_IMAGES - 1)
+        usage();
+      *colon = 0;
+      extra_slot[extra_count] = atoi(optarg);
+      extra[extra_count++] = colon + 1;
+      break;
     }
-    chksum += numBytes;
-    chksum += ((loadAddr >> 8) & 0xFF) + ((loadAddr >> 0) & 0xFF);
-    fprintf(outfile, "%02X\n", (-chksum) & 0xFF);
-    loadAddr += numBytes;
-    if (c == EOF) {
+    case 'r':
+      reverse = 1;
       break;
+    default:
+      usage();
     }
   }
-  fprintf(outfile, ":00000001FF\n");
-  fclose(infile);
-  fclose(outfile);
+  if (optind != argc - 2 || slot < -1 || (reverse && extra_count))
+    usage();
+
+  make_tables();
+  if (reverse)
+    return mcs_to_binary(argv[optind], argv[optind + 1], slot);
+
+  add_image(argv[optind], slot < 0 ? 0 : slot);
+  for (int i = 0; i < extra_count; i++)
+    add_image(extra[i], extra_slot[i]);
+  qsort(images, image_count, sizeof(struct image), compare_images);
+  for (int i = 1; i < image_count; i++)
+    if (images[i - 1].address + images[i - 1].size > images[i].address)
+      error("%s runs into slot %d", images[i - 1].name, images[i].slot);
+
+  outfile = fopen(argv[optind + 1], "wb");
+  if (outfile == NULL)
+    error("cannot open output file %s: %s", argv[optind + 1], strerror(errno));
+  for (int i = 0; i < image_count; i++)
+    write_image(&images[i]);
+  write_record(1, 0, NULL, 0);
+  flush_output();
+  if (fclose(outfile))
+    error("could not write output file %s: %s", argv[optind + 1], strerror(errno));
+  for (int i = 0; i < image_count; i++)
+    bitstream_free(images[i].b);
   return 0;
 }
@@ -0,0 +1,143 @@
+/*
+  Make bitstreams quicker to load over JTAG, by writing repeated frames
+  with multiple frame writes (MFW), and leaving out blank frames. Given the
+  bitstream already on the FPGA, it makes a partial bitstream of only the
+  frames that have changed instead. See bitstream.h.
+
+  The result is always checked by expanding it again, and comparing the
+  frames it writes with those of the original bitstream.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "bitstream.h"
+
+bitstream_part *part = NULL;
+int quiet = 0;
+
+void usage(void)
+{
+  fprintf(stderr, "usage: bitcompress [-q] -p <part> [-r reference.bit] -o <output.bit> <bitstream>\n");
+  fprintf(stderr, "       bitcompress -p <part> -c <bitstream> <bitstream>\n");
+  fprintf(stderr, "Rewrites a Xilinx 7-series bitstream to write fewer frames.\n");
+  fprintf(stderr, "  -p  the frame addresses of the FPGA, one column per line (see bitstream.h).\n");
+  fprintf(stderr, "  -r  write only the frames that differ from this bitstream, as a partial bitstream.\n");
+  fprintf(stderr, "  -o  where to write the result, which has the .bit header of the original.\n");
+  fprintf(stderr, "  -c  compare the frames that two bitstreams write.\n");
+  fprintf(stderr, "  -q  only report errors.\n");
+  exit(-3);
+}
+
+bitstream_frames *read_frames(const char *name, bitstream **b)
+{
+  *b = bitstream_read(name);
+  if (!*b)
+    exit(-1);
+  bitstream_frames *f = bitstream_new_frames(part);
+  if (!f || bitstream_expand(*b, f)) {
+    fprintf(stderr, "ERROR: Could not read the frames of '%s'\n", name);
+    exit(-1);
+  }
+  return f;
+}
+
+void write_output(const char *name, const bitstream *b, const uint8_t *data, int size)
+{
+  FILE *f = fopen(name, "wb");
+  if (!f) {
+    fprintf(stderr, "ERROR: Could not create '%s': %s\n", name, strerror(errno));
+    exit(-1);
+  }
+  if (b->data != b->file) {
+    // The same .bit header, with the new length
+    uint8_t length[4] = { size >> 24, size >> 16, size >> 8, size };
+    fwrite(b->file, b->data - b->file - sizeof(length), 1, f);
+    fwrite(length, sizeof(length), 1, f);
+  }
+  fwrite(data, size, 1, f);
+  if (fclose(f)) {
+    fprintf(stderr, "ERROR: Could not write '%s': %s\n", name, strerror(errno));
+    exit(-1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int opt, compare = 0;
+  char *part_name = NULL, *reference_name = NULL, *output_name = NULL;
+
+  while ((opt = getopt(argc, argv, "qp:r:o:c")) != -1) {
+    switch (opt) {
+    case 'q':
+      quiet = 1;
+      break;
+    case 'p':
+      part_name = optarg;
+      break;
+    case 'r':
+      reference_name = optarg;
+      break;
+    case 'o':
+      output_name = optarg;
+      break;
+    case 'c':
+      compare = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (!part_name || optind != argc - 1 - compare || (!compare && !output_name))
+    usage();
+
+  part = bitstream_read_part(part_name);
+  if (!part)
+    exit(-1);
+
+  bitstream *b, *other;
+  bitstream_frames *frames = read_frames(argv[optind], &b);
+
+  if (compare) {
+    bitstream_frames *other_frames = read_frames(argv[optind + 1], &other);
+    int differ = bitstream_compare(frames, other_frames, 100);
+    printf("%d of %d frames differ\n", differ, part->frame_count);
+    return differ ? 1 : 0;
+  }
+
+  bitstream_frames *reference = NULL;
+  if (reference_name)
+    reference = read_frames(reference_name, &other);
+
+  bitstream_stats stats;
+  int size;
+  uint8_t *data = bitstream_compress(b, frames, reference, &size, &stats);
+  if (!data)
+    exit(-1);
+  write_output(output_name, b, data, size);
+
+  // Read back what was written, and check that it writes the same frames
+  bitstream *check = bitstream_read(output_name);
+  if (!check)
+    exit(-1);
+  int differ = bitstream_verify(check->data, check->data_size, frames, reference);
+  if (differ) {
+    if (differ > 0)
+      fprintf(stderr, "ERROR: %d frames written by '%s' differ from '%s'\n", differ, output_name, argv[optind]);
+    exit(-1);
+  }
+
+  if (!quiet) {
+    printf("%s: %d of %d frames to write%s\n", argv[optind], stats.frames, part->frame_count,
+        reference ? " (differing from the reference)" : " (not blank)");
+    printf("  %d frames in %d runs, %d frames with %d multiple frame writes\n", stats.run_frames, stats.runs,
+        stats.mfw_frames, stats.mfw_groups);
+    printf("  %d words, down from %d (%.1f%%)\n", stats.words_out, stats.words_in,
+        stats.words_in ? 100.0 * stats.words_out / stats.words_in : 0);
+    printf("%s: checked, writes the same frames\n", output_name);
+  }
+  return 0;
+}
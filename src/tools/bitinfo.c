@@ -2,15 +2,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 
-// 4M x 32 bit words = 16MB
-unsigned int data[4 * 1024 * 1024];
-
-unsigned int swap_bytes(unsigned int v, int swapP)
-{
-  if (!swapP)
-    return v;
-  return (v >> 24) | (((v >> 16) & 0xff) << 8) | (((v >> 8) & 0xff) << 16) | ((v & 0xff) << 24);
-}
+#include "bitstream.h"
 
 int main(int argc, char **argv)
 {
@@ -19,52 +11,36 @@ int main(int argc, char **argv)
     exit(-1);
   }
 
-  FILE *f = fopen(argv[1], "r");
-  if (!f) {
-    fprintf(stderr, "Could not read bitstream file '%s'\n", argv[1]);
-    perror("fopen");
+  bitstream *b = bitstream_read(argv[1]);
+  if (!b)
     exit(-1);
-  }
-  int size = fread(&data[1], 4, 4 * 1024 * 1024 * 4, f);
 
-  printf("Bitstream file is %d words long.\n", size);
+  printf("Bitstream file is %d words long.\n", b->data_size / 4);
+  if (b->design[0])
+    printf("Design '%s' for %s, built %s %s.\n", b->design, b->part, b->date, b->time);
 
+  bitstream_packet packet = { 0 };
   int w = 0;
-  int rev = 0;
-
-  while (w < size) {
-    if (data[w] == 0xAA995566)
-      break;
-    if (data[w] == 0x665599AA) {
-      rev = 1;
-      break;
-    }
-    w++;
-  }
-  if (w >= size) {
-    fprintf(stderr, "ERROR: Could not find sync word in bitstream.\n");
-    exit(-1);
-  }
-  if (rev)
-    printf("CPU and bitstream have opposite endianness.\n");
-
   unsigned int count, reg, val;
+  const uint32_t *data;
 
-  while (w < size) {
+  while (bitstream_next_packet(b, &w, &packet)) {
     // Skip Type 1 NOOPs
-    if (swap_bytes(data[w], rev) == 0x20000000) {
-      w++;
+    if (b->words[packet.offset] == BIT_NOOP)
       continue;
-    }
 
-    printf("$%x:  word $%08x (was $%08x)\n", w, swap_bytes(data[w], rev), data[w]);
-    if ((swap_bytes(data[w], rev) & 0xf0000000) == 0x30000000) {
-      // Type 1 record: write or reserved operation.
-      count = swap_bytes(data[w], rev) & 0x7ff;
-      reg = (swap_bytes(data[w], rev) >> 13) & 0x1f;
-      w++;
+    printf("$%x:  word $%08x\n", packet.offset, b->words[packet.offset]);
+    if (packet.type == 2) {
+      printf("Writing %d words to %s\n", packet.count, bitstream_reg_name(packet.reg));
+      continue;
+    }
+    if (packet.type == 1 && packet.op == BIT_OP_WRITE) {
+      // Type 1 record: write operation.
+      count = packet.count;
+      reg = packet.reg;
+      data = packet.data;
       while (count--) {
-        val = swap_bytes(data[w++], rev);
+        val = *data++;
         switch (reg) {
         case 0b00000:
           printf("Setting CRC value to $%08x\n", val);
@@ -182,11 +158,8 @@ int main(int argc, char **argv)
         }
       }
     }
-    else {
-      // Unknown data
-      w++;
-    }
   }
 
-  fclose(f);
+  bitstream_free(b);
+  return 0;
 }
@@ -0,0 +1,720 @@
+/*
+  Reading Xilinx 7-series configuration bitstreams. See bitstream.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bitstream.h"
+
+static const uint8_t bit_header[] = { 0, 9, 0xf, 0xf0, 0xf, 0xf0, 0xf, 0xf0, 0xf, 0xf0, 0, 0, 1 };
+
+static void copy_field(char *out, int size, const uint8_t *field, int len)
+{
+  if (len > size - 1)
+    len = size - 1;
+  memcpy(out, field, len);
+  out[len] = 0;
+}
+
+// Find the fields of a .bit header, and where the data starts
+static int parse_header(bitstream *b)
+{
+  b->data = b->file;
+  b->data_size = b->file_size;
+  if (b->file_size < sizeof(bit_header) || memcmp(b->file, bit_header, sizeof(bit_header)))
+    return 0;
+
+  const uint8_t *p = b->file + sizeof(bit_header), *end = b->file + b->file_size;
+  while (p + 3 <= end) {
+    int key = *p++;
+    if (key == 'e') {
+      if (p + 4 > end)
+        break;
+      uint32_t len = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+      p += 4;
+      b->data = (uint8_t *)p;
+      b->data_size = len < end - p ? len : end - p;
+      return 0;
+    }
+    int len = (p[0] << 8) | p[1];
+    p += 2;
+    if (p + len > end)
+      break;
+    switch (key) {
+    case 'a':
+      copy_field(b->design, sizeof(b->design), p, len);
+      break;
+    case 'b':
+      copy_field(b->part, sizeof(b->part), p, len);
+      break;
+    case 'c':
+      copy_field(b->date, sizeof(b->date), p, len);
+      break;
+    case 'd':
+      copy_field(b->time, sizeof(b->time), p, len);
+      break;
+    }
+    p += len;
+  }
+  fprintf(stderr, "ERROR: The .bit header is truncated\n");
+  return -1;
+}
+
+static uint8_t *read_file(const char *name, int *size)
+{
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    fprintf(stderr, "ERROR: Could not open '%s': %s\n", name, strerror(errno));
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long file_size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *file = file_size > 0 ? malloc(file_size) : NULL;
+  if (!file || fread(file, file_size, 1, f) != 1) {
+    fprintf(stderr, "ERROR: Could not read '%s'\n", name);
+    fclose(f);
+    free(file);
+    return NULL;
+  }
+  fclose(f);
+  *size = file_size;
+  return file;
+}
+
+bitstream *bitstream_read(const char *name)
+{
+  int size;
+  uint8_t *file = read_file(name, &size);
+  if (!file)
+    return NULL;
+  bitstream *b = bitstream_parse(file, size);
+  if (!b)
+    fprintf(stderr, "ERROR: '%s' is not a bitstream\n", name);
+  return b;
+}
+
+bitstream *bitstream_read_data(const char *name)
+{
+  int size;
+  uint8_t *file = read_file(name, &size);
+  if (!file)
+    return NULL;
+  bitstream *b = calloc(1, sizeof(bitstream));
+  if (!b) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    free(file);
+    return NULL;
+  }
+  b->file = file;
+  b->file_size = size;
+  if (parse_header(b)) {
+    fprintf(stderr, "ERROR: Could not read '%s'\n", name);
+    bitstream_free(b);
+    return NULL;
+  }
+  return b;
+}
+
+bitstream *bitstream_parse(uint8_t *file, int size)
+{
+  bitstream *b = calloc(1, sizeof(bitstream));
+  if (!b) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    free(file);
+    return NULL;
+  }
+  b->file = file;
+  b->file_size = size;
+  if (parse_header(b)) {
+    bitstream_free(b);
+    return NULL;
+  }
+
+  // The sync word can be at any byte, and may have been byte swapped
+  int i, swapped = 0;
+  for (i = 0; i + 4 <= b->data_size; i++) {
+    uint8_t *p = b->data + i;
+    if (p[0] == 0xaa && p[1] == 0x99 && p[2] == 0x55 && p[3] == 0x66)
+      break;
+    if (p[0] == 0x66 && p[1] == 0x55 && p[2] == 0x99 && p[3] == 0xaa) {
+      swapped = 1;
+      break;
+    }
+  }
+  if (i + 4 > b->data_size) {
+    fprintf(stderr, "ERROR: Could not find the sync word\n");
+    bitstream_free(b);
+    return NULL;
+  }
+  b->sync_offset = i;
+  b->word_count = (b->data_size - i) / 4;
+  b->words = malloc(b->word_count * sizeof(uint32_t));
+  if (!b->words) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    bitstream_free(b);
+    return NULL;
+  }
+  for (int w = 0; w < b->word_count; w++) {
+    uint8_t *p = b->data + i + w * 4;
+    if (swapped)
+      b->words[w] = (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+    else
+      b->words[w] = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+  }
+  return b;
+}
+
+void bitstream_free(bitstream *b)
+{
+  if (!b)
+    return;
+  free(b->file);
+  free(b->words);
+  free(b);
+}
+
+/*
+  A Type 2 header carries on with the register of the Type 1 header
+  before it, so p should be the packet from the previous call.
+*/
+int bitstream_next_packet(const bitstream *b, int *offset, bitstream_packet *p)
+{
+  if (*offset >= b->word_count)
+    return 0;
+  uint32_t w = b->words[*offset];
+  p->offset = *offset;
+  p->type = w >> 29;
+  p->op = (w >> 27) & 3;
+  p->data = b->words + *offset + 1;
+  switch (p->type) {
+  case 1:
+    p->reg = (w >> 13) & 0x3fff;
+    p->count = w & 0x7ff;
+    break;
+  case 2:
+    p->count = w & 0x07ffffff;
+    break;
+  default:
+    // Not a packet, such as the sync word
+    p->op = BIT_OP_NOP;
+    p->count = 0;
+  }
+  if (p->op != BIT_OP_WRITE)
+    p->count = 0;
+  if (p->count > b->word_count - *offset - 1)
+    p->count = b->word_count - *offset - 1;
+  *offset += 1 + p->count;
+  return 1;
+}
+
+const char *bitstream_reg_name(int reg)
+{
+  static const char *names[] = { "CRC", "FAR", "FDRI", "FDRO", "CMD", "CTL0", "MASK", "STAT", "LOUT", "COR0", "MFWR", "CBC",
+    "IDCODE", "AXSS", "COR1", NULL, "WBSTAR", "TIMER", NULL, NULL, NULL, NULL, "BOOTSTS", NULL, "CTL1", NULL, NULL, NULL, NULL,
+    NULL, NULL, "BSPI" };
+  if (reg < 0 || reg >= sizeof(names) / sizeof(names[0]) || !names[reg])
+    return "unknown";
+  return names[reg];
+}
+
+/*
+  Part descriptions
+*/
+static int compare_address(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+bitstream_part *bitstream_read_part(const char *name)
+{
+  FILE *f = fopen(name, "r");
+  if (!f) {
+    fprintf(stderr, "ERROR: Could not open '%s': %s\n", name, strerror(errno));
+    return NULL;
+  }
+  bitstream_part *part = calloc(1, sizeof(bitstream_part));
+  int allocated = 0, line_number = 0;
+  char line[1024];
+  if (!part) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    fclose(f);
+    return NULL;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    char block_name[64], half_name[64];
+    int row, column, frames, block, half;
+    line_number++;
+    if (line[0] == '#' || sscanf(line, "%63s", block_name) != 1)
+      continue;
+    if (sscanf(line, "%63s %63s %d %d %d", block_name, half_name, &row, &column, &frames) != 5) {
+      fprintf(stderr, "ERROR: %s:%d: Expected <block type> <top|bottom> <row> <column> <frame count>\n", name, line_number);
+      goto error;
+    }
+    if (!strcmp(block_name, "CLB_IO_CLK"))
+      block = 0;
+    else if (!strcmp(block_name, "BLOCK_RAM"))
+      block = 1;
+    else if (!strcmp(block_name, "CFG_CLB"))
+      block = 2;
+    else
+      block = atoi(block_name);
+    half = !strcmp(half_name, "bottom") || !strcmp(half_name, "1");
+    if (block < 0 || block > 7 || row < 0 || row > 31 || column < 0 || column > 1023 || frames < 0 || frames > 128) {
+      fprintf(stderr, "ERROR: %s:%d: Column out of range\n", name, line_number);
+      goto error;
+    }
+    if (part->frame_count + frames > allocated) {
+      allocated = (allocated + frames) * 2;
+      uint32_t *address = realloc(part->address, allocated * sizeof(uint32_t));
+      if (!address) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        goto error;
+      }
+      part->address = address;
+    }
+    for (int minor = 0; minor < frames; minor++)
+      part->address[part->frame_count++] = block << 23 | half << 22 | row << 17 | column << 7 | minor;
+  }
+  if (!part->frame_count) {
+    fprintf(stderr, "ERROR: No columns in '%s'\n", name);
+    goto error;
+  }
+  fclose(f);
+
+  // FAR counts up through the fields from the minor address to the block type
+  qsort(part->address, part->frame_count, sizeof(uint32_t), compare_address);
+  for (int i = 1; i < part->frame_count; i++)
+    if (part->address[i] == part->address[i - 1]) {
+      fprintf(stderr, "ERROR: Frame address $%08x is in '%s' twice\n", part->address[i], name);
+      bitstream_free_part(part);
+      return NULL;
+    }
+  return part;
+
+error:
+  fclose(f);
+  bitstream_free_part(part);
+  return NULL;
+}
+
+void bitstream_free_part(bitstream_part *part)
+{
+  if (!part)
+    return;
+  free(part->address);
+  free(part);
+}
+
+int bitstream_frame_index(const bitstream_part *part, uint32_t address)
+{
+  int low = 0, high = part->frame_count - 1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    if (part->address[mid] == address)
+      return mid;
+    if (part->address[mid] < address)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+  return -1;
+}
+
+int bitstream_row_end(const bitstream_part *part, int index)
+{
+  // The block type, half and row are above the column
+  return index == part->frame_count - 1 || (part->address[index] >> 17) != (part->address[index + 1] >> 17);
+}
+
+/*
+  Frames
+*/
+bitstream_frames *bitstream_new_frames(const bitstream_part *part)
+{
+  bitstream_frames *f = calloc(1, sizeof(bitstream_frames));
+  if (f) {
+    f->part = part;
+    f->data = calloc(part->frame_count, FRAME_WORDS * sizeof(uint32_t));
+    f->written = calloc(part->frame_count, 1);
+  }
+  if (!f || !f->data || !f->written) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    bitstream_free_frames(f);
+    return NULL;
+  }
+  return f;
+}
+
+void bitstream_free_frames(bitstream_frames *f)
+{
+  if (!f)
+    return;
+  free(f->data);
+  free(f->written);
+  free(f);
+}
+
+int bitstream_frame_blank(const bitstream_frames *f, int index)
+{
+  const uint32_t *d = f->data + index * FRAME_WORDS;
+  for (int i = 0; i < FRAME_WORDS; i++)
+    if (d[i])
+      return 0;
+  return 1;
+}
+
+static void write_frame(bitstream_frames *f, int index, const uint32_t *data)
+{
+  memcpy(f->data + index * FRAME_WORDS, data, FRAME_WORDS * sizeof(uint32_t));
+  if (!f->written[index]) {
+    f->written[index] = 1;
+    f->frames_written++;
+  }
+}
+
+int bitstream_expand(const bitstream *b, bitstream_frames *f)
+{
+  const bitstream_part *part = f->part;
+  bitstream_packet p = { 0 };
+  int offset = 0, command = 0, far = -1;
+  uint32_t far_address = 0;
+  const uint32_t *frame_buffer = NULL;
+
+  while (bitstream_next_packet(b, &offset, &p)) {
+    if (p.op != BIT_OP_WRITE || !p.count)
+      continue;
+    switch (p.reg) {
+    case BIT_REG_FAR:
+      // Bitstreams end by setting FAR to an address that isn't there
+      far_address = p.data[p.count - 1];
+      far = bitstream_frame_index(part, far_address);
+      break;
+    case BIT_REG_CMD:
+      command = p.data[p.count - 1];
+      break;
+    case BIT_REG_FDRI: {
+      int frames = p.count / FRAME_WORDS, pads = 0;
+      for (int i = 0; i < frames; i++) {
+        frame_buffer = p.data + i * FRAME_WORDS;
+        if (pads) {
+          pads--;
+          continue;
+        }
+        if (far < 0) {
+          fprintf(stderr, "ERROR: FDRI at word $%x writes to frame address $%08x, which the part doesn't have\n", p.offset,
+              far_address);
+          return -1;
+        }
+        if (far == part->frame_count) {
+          fprintf(stderr, "ERROR: FDRI at word $%x writes past the last frame of the part\n", p.offset);
+          return -1;
+        }
+        // The last frame only reaches the frame buffer
+        if (i < frames - 1)
+          write_frame(f, far, frame_buffer);
+        if (bitstream_row_end(part, far))
+          pads = 2;
+        far_address = part->address[far];
+        far++;
+      }
+      break;
+    }
+    case BIT_REG_MFWR:
+      if (command != BIT_CMD_MFW)
+        break;
+      if (far < 0 || !frame_buffer) {
+        fprintf(stderr, "ERROR: MFWR at word $%x writes to frame address $%08x, which the part doesn't have\n", p.offset,
+            far_address);
+        return -1;
+      }
+      write_frame(f, far, frame_buffer);
+      f->mfw_writes++;
+      break;
+    }
+  }
+  return 0;
+}
+
+static int frames_equal(const bitstream_frames *a, const bitstream_frames *b, int index)
+{
+  return !memcmp(a->data + index * FRAME_WORDS, b->data + index * FRAME_WORDS, FRAME_WORDS * sizeof(uint32_t));
+}
+
+int bitstream_compare(const bitstream_frames *a, const bitstream_frames *b, int report)
+{
+  int differ = 0;
+  for (int i = 0; i < a->part->frame_count; i++)
+    if (!frames_equal(a, b, i) && differ++ < report)
+      fprintf(stderr, "Frame $%08x differs\n", a->part->address[i]);
+  return differ;
+}
+
+/*
+  Compression
+*/
+enum { FRAME_SKIP, FRAME_RUN, FRAME_MFW };
+
+typedef struct word_buffer {
+  uint32_t *words;
+  int count, size, failed;
+} word_buffer;
+
+static void emit_words(word_buffer *o, const uint32_t *w, int n)
+{
+  if (o->count + n > o->size) {
+    int size = (o->size + n) * 2;
+    uint32_t *words = realloc(o->words, size * sizeof(uint32_t));
+    if (!words) {
+      o->failed = 1;
+      return;
+    }
+    o->words = words;
+    o->size = size;
+  }
+  if (w)
+    memcpy(o->words + o->count, w, n * sizeof(uint32_t));
+  else
+    memset(o->words + o->count, 0, n * sizeof(uint32_t));
+  o->count += n;
+}
+
+static void emit(word_buffer *o, uint32_t w)
+{
+  emit_words(o, &w, 1);
+}
+
+static void emit_header(word_buffer *o, int reg, int n)
+{
+  if (n <= 0x7ff)
+    emit(o, BIT_TYPE1(BIT_OP_WRITE, reg, n));
+  else {
+    emit(o, BIT_TYPE1(BIT_OP_WRITE, reg, 0));
+    emit(o, BIT_TYPE2(BIT_OP_WRITE, n));
+  }
+}
+
+static void emit_write(word_buffer *o, int reg, const uint32_t *data, int n)
+{
+  emit_header(o, reg, n);
+  emit_words(o, data, n);
+}
+
+static void emit_register(word_buffer *o, int reg, uint32_t value)
+{
+  emit_write(o, reg, &value, 1);
+}
+
+static void emit_command(word_buffer *o, uint32_t command)
+{
+  emit_register(o, BIT_REG_CMD, command);
+  emit(o, BIT_NOOP);
+}
+
+// Find frames with the same contents, returning how many there are of each
+static int *group_frames(const bitstream_frames *f, const uint8_t *how, int *group)
+{
+  int n = f->part->frame_count, slots = 1;
+  while (slots < 2 * n)
+    slots *= 2;
+  int *table = malloc(slots * sizeof(int)), *count = calloc(n, sizeof(int));
+  if (!table || !count) {
+    free(table);
+    free(count);
+    return NULL;
+  }
+  memset(table, -1, slots * sizeof(int));
+  for (int i = 0; i < n; i++) {
+    if (how[i] == FRAME_SKIP)
+      continue;
+    const uint32_t *d = f->data + i * FRAME_WORDS;
+    uint32_t hash = 2166136261u;
+    for (int w = 0; w < FRAME_WORDS; w++)
+      hash = (hash ^ d[w]) * 16777619u;
+    int slot = hash & (slots - 1);
+    while (table[slot] >= 0 && memcmp(f->data + table[slot] * FRAME_WORDS, d, FRAME_WORDS * sizeof(uint32_t)))
+      slot = (slot + 1) & (slots - 1);
+    if (table[slot] < 0)
+      table[slot] = i;
+    group[i] = table[slot];
+    count[group[i]]++;
+  }
+  free(table);
+  return count;
+}
+
+static void emit_frames(word_buffer *o, const bitstream_frames *f, uint8_t *how, const int *group, bitstream_stats *stats)
+{
+  const bitstream_part *part = f->part;
+  int n = part->frame_count;
+
+  emit_command(o, BIT_CMD_WCFG);
+  for (int a = 0; a < n; a++) {
+    if (how[a] != FRAME_RUN)
+      continue;
+    int b = a;
+    while (b + 1 < n && how[b + 1] == FRAME_RUN)
+      b++;
+    // The frames, the pads between rows, and one to write the last frame
+    int words = (b - a + 2) * FRAME_WORDS;
+    for (int i = a; i < b; i++)
+      if (bitstream_row_end(part, i))
+        words += 2 * FRAME_WORDS;
+    emit_register(o, BIT_REG_FAR, part->address[a]);
+    emit_header(o, BIT_REG_FDRI, words);
+    for (int i = a; i <= b; i++) {
+      emit_words(o, f->data + i * FRAME_WORDS, FRAME_WORDS);
+      if (i < b && bitstream_row_end(part, i))
+        emit_words(o, NULL, 2 * FRAME_WORDS);
+    }
+    emit_words(o, NULL, FRAME_WORDS);
+    stats->runs++;
+    stats->run_frames += b - a + 1;
+    a = b;
+  }
+
+  // Load each repeated frame, and write it everywhere it goes
+  for (int a = 0; a < n; a++) {
+    if (how[a] != FRAME_MFW)
+      continue;
+    if (stats->mfw_groups)
+      emit_command(o, BIT_CMD_WCFG);
+    emit_register(o, BIT_REG_FAR, part->address[a]);
+    emit_write(o, BIT_REG_FDRI, f->data + a * FRAME_WORDS, FRAME_WORDS);
+    emit_command(o, BIT_CMD_MFW);
+    for (int i = a; i < n; i++)
+      if (how[i] == FRAME_MFW && group[i] == group[a]) {
+        static const uint32_t mfwr[2] = { 0, 0 };
+        emit_register(o, BIT_REG_FAR, part->address[i]);
+        emit_write(o, BIT_REG_MFWR, mfwr, 2);
+        how[i] = FRAME_SKIP;
+        stats->mfw_frames++;
+      }
+    stats->mfw_groups++;
+  }
+}
+
+uint8_t *bitstream_compress(
+    const bitstream *b, const bitstream_frames *f, const bitstream_frames *reference, int *size, bitstream_stats *stats)
+{
+  const bitstream_part *part = f->part;
+  int n = part->frame_count;
+  uint8_t *how = calloc(n, 1);
+  int *group = calloc(n, sizeof(int)), *count = NULL;
+  word_buffer o = { 0 };
+  uint8_t *out = NULL;
+
+  memset(stats, 0, sizeof(bitstream_stats));
+  if (!how || !group)
+    goto done;
+  for (int i = 0; i < n; i++)
+    if (reference ? !frames_equal(f, reference, i) : !bitstream_frame_blank(f, i)) {
+      how[i] = FRAME_RUN;
+      stats->frames++;
+    }
+  count = group_frames(f, how, group);
+  if (!count)
+    goto done;
+  for (int i = 0; i < n; i++)
+    if (how[i] == FRAME_RUN && count[group[i]] > 1)
+      how[i] = FRAME_MFW;
+  // Splitting a run costs about a frame
+  for (int i = 1; i < n - 1; i++)
+    if (how[i] != FRAME_RUN && how[i - 1] == FRAME_RUN && how[i + 1] == FRAME_RUN) {
+      if (how[i] == FRAME_MFW)
+        count[group[i]]--;
+      how[i] = FRAME_RUN;
+    }
+
+  /*
+    Copy the packets, leaving out the frame writes and CRC checks, which
+    would fail, and putting the new frame writes where the first FDRI
+    write was. A partial bitstream leaves out the startup commands as well.
+  */
+  bitstream_packet p = { 0 };
+  int offset = 0, frames_done = 0;
+  while (bitstream_next_packet(b, &offset, &p)) {
+    int skip = 0;
+    if (p.op == BIT_OP_WRITE) {
+      switch (p.reg) {
+      case BIT_REG_FDRI:
+        if (!frames_done)
+          emit_frames(&o, f, how, group, stats);
+        frames_done = 1;
+        skip = 1;
+        break;
+      case BIT_REG_CMD:
+        skip = !p.count || p.data[0] == BIT_CMD_WCFG || p.data[0] == BIT_CMD_MFW
+               || (reference && frames_done && p.data[0] != BIT_CMD_DESYNC);
+        break;
+      case BIT_REG_FAR:
+      case BIT_REG_MFWR:
+      case BIT_REG_CRC:
+        skip = 1;
+        break;
+      default:
+        skip = reference && frames_done;
+      }
+    }
+    if (!skip)
+      emit_words(&o, b->words + p.offset, 1 + p.count);
+  }
+  if (!frames_done) {
+    fprintf(stderr, "ERROR: The bitstream doesn't write any frames\n");
+    goto done;
+  }
+  if (o.failed)
+    goto done;
+
+  // As words from the sync word, after whatever came before it
+  *size = b->sync_offset + o.count * 4;
+  out = malloc(*size);
+  if (!out)
+    goto done;
+  memcpy(out, b->data, b->sync_offset);
+  for (int i = 0; i < o.count; i++) {
+    uint8_t *q = out + b->sync_offset + i * 4;
+    q[0] = o.words[i] >> 24;
+    q[1] = o.words[i] >> 16;
+    q[2] = o.words[i] >> 8;
+    q[3] = o.words[i];
+  }
+  stats->words_in = b->word_count;
+  stats->words_out = o.count;
+
+done:
+  if (!out)
+    fprintf(stderr, "ERROR: Could not compress the bitstream\n");
+  free(how);
+  free(group);
+  free(count);
+  free(o.words);
+  return out;
+}
+
+int bitstream_verify(const uint8_t *data, int size, const bitstream_frames *expected, const bitstream_frames *reference)
+{
+  const bitstream_part *part = expected->part;
+  uint8_t *copy = malloc(size);
+  bitstream_frames *f = bitstream_new_frames(part);
+  bitstream *b = NULL;
+  int differ = -1;
+
+  if (copy && f) {
+    memcpy(copy, data, size);
+    b = bitstream_parse(copy, size);
+    if (reference)
+      memcpy(f->data, reference->data, part->frame_count * FRAME_WORDS * sizeof(uint32_t));
+    if (b && !bitstream_expand(b, f))
+      differ = bitstream_compare(f, expected, 10);
+  }
+  else
+    free(copy);
+  bitstream_free(b);
+  bitstream_free_frames(f);
+  return differ;
+}
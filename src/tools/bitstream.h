@@ -0,0 +1,163 @@
+/*
+  Reading Xilinx 7-series configuration bitstreams, as used by bitinfo,
+  bitcompress and fpgajtag. See UG470, chapter 5.
+
+  A bitstream is an optional .bit file header, some padding and the bus
+  width pattern, then the sync word, after which everything is 32 bit
+  packets. A packet header is a register and a word count: Type 1 for a
+  count of up to 2047, or a Type 1 header with a count of zero followed by
+  a Type 2 header with up to 2^27.
+
+  The configuration memory is written a frame of 101 words at a time, by
+  writing the address of the first frame to FAR, then the frames to FDRI.
+  FAR counts up through the frames of each column, then the columns of
+  each row, then the rows of the top and bottom halves, and the block
+  types. Which addresses exist depends on the part, which bitstreams
+  don't say, so anything dealing with frames needs a part description
+  (bitstream_read_part()). Two pad frames follow the last frame of each
+  row in FDRI, and one pad frame the last frame written: a frame is only
+  written to the memory once the next one has been loaded.
+*/
+
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stdint.h>
+
+#define FRAME_WORDS 101
+
+#define BIT_REG_CRC 0x00
+#define BIT_REG_FAR 0x01
+#define BIT_REG_FDRI 0x02
+#define BIT_REG_CMD 0x04
+#define BIT_REG_COR0 0x09
+#define BIT_REG_MFWR 0x0a
+#define BIT_REG_IDCODE 0x0c
+
+#define BIT_CMD_WCFG 0x01
+#define BIT_CMD_MFW 0x02
+#define BIT_CMD_START 0x05
+#define BIT_CMD_RCRC 0x07
+#define BIT_CMD_DESYNC 0x0d
+
+#define BIT_OP_NOP 0
+#define BIT_OP_READ 1
+#define BIT_OP_WRITE 2
+
+#define BIT_TYPE1(OP, REG, COUNT) (0x20000000 | ((OP) << 27) | ((REG) << 13) | (COUNT))
+#define BIT_TYPE2(OP, COUNT) (0x40000000 | ((OP) << 27) | (COUNT))
+#define BIT_NOOP BIT_TYPE1(BIT_OP_NOP, 0, 0)
+#define BIT_SYNC 0xaa995566
+
+typedef struct bitstream {
+  // The whole file, and the .bit header fields, which are empty without one
+  uint8_t *file;
+  int file_size;
+  char design[256], part[64], date[32], time[32];
+  // The configuration data, after the header
+  uint8_t *data;
+  int data_size;
+  // From the sync word to the end, as words in host order
+  int sync_offset; // in data
+  uint32_t *words;
+  int word_count;
+} bitstream;
+
+typedef struct bitstream_packet {
+  int offset; // of the header in words
+  int type, op, reg, count;
+  const uint32_t *data;
+} bitstream_packet;
+
+// The frame addresses of a part, in the order FAR counts through them
+typedef struct bitstream_part {
+  uint32_t *address;
+  int frame_count;
+} bitstream_part;
+
+// Configuration memory, or what a bitstream writes to it
+typedef struct bitstream_frames {
+  const bitstream_part *part;
+  uint32_t *data;   // FRAME_WORDS for each frame of the part
+  uint8_t *written; // whether each frame was written
+  int frames_written, mfw_writes;
+} bitstream_frames;
+
+// Read a .bit or .bin file. Returns NULL, having said why, on an error.
+bitstream *bitstream_read(const char *name);
+// Or from memory, which the bitstream then owns
+bitstream *bitstream_parse(uint8_t *file, int size);
+// Or only find the data after any .bit header, which needn't be a bitstream,
+// leaving words empty
+bitstream *bitstream_read_data(const char *name);
+void bitstream_free(bitstream *b);
+
+// The packet at *offset, advancing *offset past it. Returns 0 at the end.
+int bitstream_next_packet(const bitstream *b, int *offset, bitstream_packet *p);
+const char *bitstream_reg_name(int reg);
+
+/*
+  A part description lists each column of the part, one per line:
+
+    <block type> <top|bottom> <row> <column> <frame count>
+
+  where the block type is CLB_IO_CLK, BLOCK_RAM or CFG_CLB, or a number.
+  These are the configuration_columns of prjxray-db's part.json, e.g.
+
+    jq -r '.global_clock_regions | to_entries[] | .key as $h | .value.rows | to_entries[] | .key as $r
+           | .value.configuration_buses | to_entries[] | .key as $b | .value.configuration_columns
+           | to_entries[] | "\($b) \($h) \($r) \(.key) \(.value.frame_count)"' part.json
+*/
+bitstream_part *bitstream_read_part(const char *name);
+void bitstream_free_part(bitstream_part *part);
+// The index of a frame address, or -1 if the part doesn't have it
+int bitstream_frame_index(const bitstream_part *part, uint32_t address);
+// Whether FDRI has pad frames between frame index and the next
+int bitstream_row_end(const bitstream_part *part, int index);
+
+/*
+  Play the frame writes of a bitstream (FAR, FDRI, WCFG, MFW and MFWR)
+  into frames, which start out blank. Returns 0, or -1, having said why,
+  if it writes somewhere the part doesn't have.
+*/
+bitstream_frames *bitstream_new_frames(const bitstream_part *part);
+void bitstream_free_frames(bitstream_frames *f);
+int bitstream_expand(const bitstream *b, bitstream_frames *f);
+// Whether frame index is all zeros
+int bitstream_frame_blank(const bitstream_frames *f, int index);
+// The frames that differ, reporting the first few to stderr
+int bitstream_compare(const bitstream_frames *a, const bitstream_frames *b, int report);
+
+/*
+  Compression rewrites the frame writes of a bitstream, leaving the rest.
+  A full bitstream needn't write blank frames, as the configuration memory
+  is cleared when the FPGA is programmed. Given the frames of the design
+  already on the FPGA as a reference, it writes only the frames that
+  differ, as a partial bitstream that doesn't restart the FPGA.
+
+  Frames that are written more than once are loaded once, and written to
+  each address with MFW (multiple frame write). Others are written in runs
+  of consecutive frames, each needing a FAR write and a pad frame, so a
+  run carries on over a single frame that needn't be written.
+
+  Returns the configuration data, without a .bit header, or NULL on an
+  error.
+*/
+typedef struct bitstream_stats {
+  int frames;                  // to be written
+  int runs, run_frames;        // as runs, with pad frames
+  int mfw_groups, mfw_frames;  // loaded, and written with MFW
+  int words_in, words_out;
+} bitstream_stats;
+
+uint8_t *bitstream_compress(
+    const bitstream *b, const bitstream_frames *f, const bitstream_frames *reference, int *size, bitstream_stats *stats);
+
+/*
+  Check that what compressed data writes over the reference, or over blank
+  frames, is what was expected. Returns the number of frames that differ,
+  or -1 if the data can't be expanded.
+*/
+int bitstream_verify(const uint8_t *data, int size, const bitstream_frames *expected, const bitstream_frames *reference);
+
+#endif
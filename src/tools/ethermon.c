@@ -39,6 +39,10 @@
 #include <signal.h>
 #include <netdb.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <pcap.h>
 
 char *match_string = NULL;
@@ -130,10 +134,20 @@ struct annotation *annotations[0x10000] = { NULL };
 char *opnames[256] = { NULL };
 char *modes[256] = { NULL };
 
-int instruction_address = 0xFFFF;
+/*
+  What decoding an instruction record needs from the records before it.
+  The record gives the address of the next instruction, rather than of its
+  own, which is why a capture has to be decoded from the start, or from a
+  point where this was saved (see build_index()).
+*/
+typedef struct trace_state {
+  int instruction_address;
+  unsigned int instruction_count;
+} trace_state;
+
+trace_state live_state = { 0xFFFF, 0 };
 
 int last_d031_toggle = 0;
-unsigned int instruction_count = 0;
 
 int one_frame = 0;
 int one_frame_active = 0;
@@ -141,69 +155,66 @@ int one_frame_active = 0;
 int logged_instruction_count = 0;
 char *logged_instructions[16] = { NULL };
 
-int decode_instruction(const unsigned char *b)
+// Records that are raster markers, rather than instructions
+int is_raster_marker(const unsigned char *b)
 {
-  char out[8192] = "";
-  int out_len = 0;
-
-  // Limit number of instructions shown
-  // (unless we have a match string, in which case we display 16 instructions before and after each match)
-  if (num_instructions)
-    num_instructions--;
-  else {
-    if (!match_string)
-      exit(-1);
-  }
-  if (0)
-    out_len += snprintf(&out[out_len], 8192 - out_len, "INSTRUCTION: %02x %02x %02x %02x %02x %02x %02x %02x\n", b[0], b[1],
-        b[2], b[3], b[4], b[5], b[6], b[7]);
-
-  if ((b[0] & b[1] & b[2]) == 0xff) {
-    // Raster / badline marker
-    int viciv_raster = b[3] | ((b[4] & 0xf) << 4);
-    int vicii_raster = (b[4] >> 4) + (b[5] << 4);
-    int raster = b[7] & 0x80;
-    int badline = b[7] & 0x40;
-
-    if (one_frame && (one_frame_active)) {
-      if (raster && (!viciv_raster)) {
-        // Start of next frame after single raster display, so stop
-        exit(0);
-      }
-    }
+  return (b[0] & b[1] & b[2]) == 0xff;
+}
 
-    if (one_frame && (!one_frame_active)) {
-      if (raster && (!viciv_raster)) {
-        // Start of single frame to display
-        one_frame_active = 1;
-      }
-    }
+// VIC-IV (physical) raster line in a raster marker
+int viciv_raster_line(const unsigned char *b)
+{
+  return b[3] | ((b[4] & 0xf) << 8);
+}
 
-    // Don't display anything if we are not yet in the active frame to be displayed
-    if (one_frame && (!one_frame_active))
-      return 0;
+// Raster marker for the start of a frame
+int is_frame_start(const unsigned char *b)
+{
+  int viciv_raster = viciv_raster_line(b);
+  int raster = b[7] & 0x80;
+  return is_raster_marker(b) && raster && (!viciv_raster);
+}
 
-    out_len += snprintf(&out[out_len], 8192 - out_len, "VIC-II raster $%03x (VIC-IV raster $%03x)%s%s\n", vicii_raster,
-        viciv_raster, raster ? " [NEW RASTER]" : "", badline ? " [BADLINE TRIGGERED]" : "");
-    return 0;
+// Work out the address of the next instruction, from the one in the record
+int next_instruction_address(const unsigned char *b, int load_address)
+{
+  int instruction_address = (b[1] << 8) + b[0];
+  // JSR passes PC+1 instead of PC of next instruction, so adjust
+  switch (b[2]) {
+  case 0x6c:
+  case 0x4c:
+    // jump leaves correct address
+    break;
+  case 0xf0:
+  case 0xd0:
+    // Branches taken leave correct address, but
+    // untaken branches do not.
+    if (instruction_address != (load_address + 2))
+      break;
+    /* fall through */
+  default:
+    instruction_address--;
   }
+  return instruction_address;
+}
 
-  // Don't display anything if we are not yet in the active frame to be displayed
-  if (one_frame && (!one_frame_active))
-    return 0;
+/*
+  Describe an instruction record in out (which is 8192 bytes), and move the
+  state on past it. Returns the address of the instruction.
+*/
+int describe_instruction(trace_state *s, const unsigned char *b, char *out)
+{
+  int out_len = 0;
+  out[0] = 0;
 
   int d031_toggle = b[7] & 0x80;
 
-  out_len += snprintf(&out[out_len], 8192 - out_len, "%08x ", instruction_count++);
-  //    if (d031_toggle!=last_d031_toggle) {
-  //      out_len+=snprintf(&out[out_len],8192-out_len,"[$D031 written to!] ");
-  //    }
-  last_d031_toggle = d031_toggle;
+  out_len += snprintf(&out[out_len], 8192 - out_len, "%08x ", s->instruction_count++);
 
   out_len += snprintf(&out[out_len], 8192 - out_len, "%c %c%c%c%c%c%c%c%c($%02X) SP=$xx%02X, A=$%02X : $%04X : %02X",
       d031_toggle ? 'Y' : 'N', b[5] & 0x80 ? 'N' : '-', b[5] & 0x40 ? 'V' : '-', b[5] & 0x20 ? 'E' : '-',
       b[5] & 0x10 ? 'B' : '-', b[5] & 0x08 ? 'D' : '-', b[5] & 0x04 ? 'I' : '-', b[5] & 0x02 ? 'Z' : '-',
-      b[5] & 0x01 ? 'C' : '-', b[5], b[6], b[7], instruction_address, b[2]);
+      b[5] & 0x01 ? 'C' : '-', b[5], b[6], b[7], s->instruction_address, b[2]);
 
   int opcode = b[2];
   int mem[3] = { b[2], b[3], b[4] };
@@ -214,13 +225,7 @@ int decode_instruction(const unsigned char *b)
   int value;
   int digits;
 
-  int load_address = instruction_address;
-
-  // Display until 32 instructions after BRK instruction if requested
-  // XXX -- We should also just cache instructions before the BRK, so we just display the period when things
-  // go wrong.
-  if ((!b[2]) && wait_for_break)
-    num_instructions = 32;
+  int load_address = s->instruction_address;
 
   for (int j = 0; modes[opcode][j];) {
     args[o] = 0;
@@ -307,23 +312,74 @@ int decode_instruction(const unsigned char *b)
   out_len += snprintf(&out[out_len], 8192 - out_len, "\n");
 
   // Remember instruction address for next display
-  instruction_address = (b[1] << 8) + b[0];
-  // JSR passes PC+1 instead of PC of next instruction, so adjust
-  switch (opcode) {
-  case 0x6c:
-  case 0x4c:
-    // jump leaves correct address
-    break;
-  case 0xf0:
-  case 0xd0:
-    // Branches taken leave correct address, but
-    // untaken branches do not.
-    if (instruction_address != (load_address + 2))
-      break;
-    /* fall through */
-  default:
-    instruction_address--;
+  s->instruction_address = next_instruction_address(b, load_address);
+
+  return load_address;
+}
+
+int decode_instruction(const unsigned char *b)
+{
+  char out[8192] = "";
+  int out_len = 0;
+
+  // Limit number of instructions shown
+  // (unless we have a match string, in which case we display 16 instructions before and after each match)
+  if (num_instructions)
+    num_instructions--;
+  else {
+    if (!match_string)
+      exit(-1);
   }
+  if (0)
+    out_len += snprintf(&out[out_len], 8192 - out_len, "INSTRUCTION: %02x %02x %02x %02x %02x %02x %02x %02x\n", b[0], b[1],
+        b[2], b[3], b[4], b[5], b[6], b[7]);
+
+  if (is_raster_marker(b)) {
+    // Raster / badline marker
+    int viciv_raster = viciv_raster_line(b);
+    int vicii_raster = (b[4] >> 4) + (b[5] << 4);
+    int raster = b[7] & 0x80;
+    int badline = b[7] & 0x40;
+
+    if (one_frame && (one_frame_active)) {
+      if (is_frame_start(b)) {
+        // Start of next frame after single raster display, so stop
+        exit(0);
+      }
+    }
+
+    if (one_frame && (!one_frame_active)) {
+      if (is_frame_start(b)) {
+        // Start of single frame to display
+        one_frame_active = 1;
+      }
+    }
+
+    // Don't display anything if we are not yet in the active frame to be displayed
+    if (one_frame && (!one_frame_active))
+      return 0;
+
+    out_len += snprintf(&out[out_len], 8192 - out_len, "VIC-II raster $%03x (VIC-IV raster $%03x)%s%s\n", vicii_raster,
+        viciv_raster, raster ? " [NEW RASTER]" : "", badline ? " [BADLINE TRIGGERED]" : "");
+    return 0;
+  }
+
+  // Don't display anything if we are not yet in the active frame to be displayed
+  if (one_frame && (!one_frame_active))
+    return 0;
+
+  //    if (d031_toggle!=last_d031_toggle) {
+  //      out_len+=snprintf(&out[out_len],8192-out_len,"[$D031 written to!] ");
+  //    }
+  last_d031_toggle = b[7] & 0x80;
+
+  describe_instruction(&live_state, b, out);
+
+  // Display until 32 instructions after BRK instruction if requested
+  // XXX -- We should also just cache instructions before the BRK, so we just display the period when things
+  // go wrong.
+  if ((!b[2]) && wait_for_break)
+    num_instructions = 32;
 
   if (match_string) {
     if (strstr(out, match_string)) {
@@ -506,18 +562,889 @@ int read_annotation_file(char *an)
   return 0;
 }
 
+// Set by Ctrl-C, when capturing until then
+pcap_t *capture_pcap = NULL;
+volatile sig_atomic_t stop_capture = 0;
+
+void stop_capture_signal(int signal)
+{
+  stop_capture = 1;
+  if (capture_pcap)
+    pcap_breakloop(capture_pcap);
+}
+
+/* ----------------------------------------------------------------------------------------------------------
+   Profiling
+
+   ethermon -p counts the instructions run at each address, and from that by source line (using the
+   annotation files), by raster line and by frame. It also follows JSR and RTS to keep a call stack, and
+   counts the instructions run in each distinct stack, which is written out as folded stacks for flame
+   graph tools. The trace has no timing, so these are counts of instructions, not of cycles.
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+char *profile_file = NULL;
+
+uint64_t pc_samples[0x10000] = { 0 };
+uint64_t raster_samples[4096] = { 0 };
+uint64_t profile_total = 0;
+int profile_raster = 0;
+
+// Instructions in each frame; those before the first frame are counted in frame -1
+uint64_t *frame_samples = NULL;
+int profile_frame = -1, profile_frames_allocated = 0;
+
+trace_state profile_state = { 0xFFFF, 0 };
+
+/*
+  Each call stack is a node in a tree, whose parent is the stack without the
+  most recent call. Nodes are found by parent and call address in a hash table.
+*/
+struct stack_node {
+  int parent;
+  int address;
+  int depth;
+  uint64_t samples;
+};
+
+struct stack_node *stack_nodes = NULL;
+int stack_node_count = 0, stack_nodes_allocated = 0;
+int *stack_hash = NULL;
+int stack_hash_size = 0;
+int current_stack = 0;
+// Calls made at MAX_STACK_DEPTH, which have no node for their RTS to pop
+int stack_overflow = 0;
+
+#define MAX_STACK_DEPTH 256
+
+unsigned int stack_hash_of(int parent, int address)
+{
+  return ((unsigned int)parent * 2654435761u) ^ address;
+}
+
+void init_stack_nodes(void)
+{
+  // Node 0 is the empty stack
+  stack_nodes_allocated = 4096;
+  stack_nodes = calloc(stack_nodes_allocated, sizeof(struct stack_node));
+  stack_nodes[0].parent = -1;
+  stack_node_count = 1;
+  current_stack = 0;
+  stack_overflow = 0;
+}
+
+int stack_node(int parent, int address)
+{
+  if (stack_node_count * 2 >= stack_hash_size) {
+    free(stack_hash);
+    stack_hash_size = stack_hash_size ? stack_hash_size * 2 : 8192;
+    stack_hash = malloc(stack_hash_size * sizeof(int));
+    memset(stack_hash, 0xff, stack_hash_size * sizeof(int));
+    for (int n = 0; n < stack_node_count; n++) {
+      unsigned int h = stack_hash_of(stack_nodes[n].parent, stack_nodes[n].address) & (stack_hash_size - 1);
+      while (stack_hash[h] != -1)
+        h = (h + 1) & (stack_hash_size - 1);
+      stack_hash[h] = n;
+    }
+  }
+
+  unsigned int h = stack_hash_of(parent, address) & (stack_hash_size - 1);
+  while (stack_hash[h] != -1) {
+    struct stack_node *n = &stack_nodes[stack_hash[h]];
+    if (n->parent == parent && n->address == address)
+      return stack_hash[h];
+    h = (h + 1) & (stack_hash_size - 1);
+  }
+
+  if (stack_node_count == stack_nodes_allocated) {
+    stack_nodes_allocated *= 2;
+    stack_nodes = realloc(stack_nodes, stack_nodes_allocated * sizeof(struct stack_node));
+    if (!stack_nodes) {
+      fprintf(stderr, "ERROR: Out of memory\n");
+      exit(-1);
+    }
+  }
+  struct stack_node *n = &stack_nodes[stack_node_count];
+  n->parent = parent;
+  n->address = address;
+  n->depth = stack_nodes[parent].depth + 1;
+  n->samples = 0;
+  stack_hash[h] = stack_node_count;
+  return stack_node_count++;
+}
+
+void profile_record(const unsigned char *b)
+{
+  if (is_raster_marker(b)) {
+    if (b[7] & 0x80)
+      profile_raster = viciv_raster_line(b);
+    if (is_frame_start(b)) {
+      profile_frame++;
+      if (profile_frame == profile_frames_allocated) {
+        profile_frames_allocated = profile_frames_allocated ? profile_frames_allocated * 2 : 4096;
+        frame_samples = realloc(frame_samples, profile_frames_allocated * sizeof(uint64_t));
+        if (!frame_samples) {
+          fprintf(stderr, "ERROR: Out of memory\n");
+          exit(-1);
+        }
+      }
+      frame_samples[profile_frame] = 0;
+    }
+    return;
+  }
+
+  int load_address = profile_state.instruction_address & 0xffff;
+  profile_state.instruction_address = next_instruction_address(b, profile_state.instruction_address);
+  profile_total++;
+  pc_samples[load_address]++;
+  raster_samples[profile_raster]++;
+  if (profile_frame >= 0)
+    frame_samples[profile_frame]++;
+  if (!stack_nodes)
+    init_stack_nodes();
+  stack_nodes[current_stack].samples++;
+
+  switch (b[2]) {
+  case 0x20: // JSR $nnnn
+  case 0x22: // JSR ($nnnn)
+  case 0x23: // JSR ($nnnn,X)
+    if (stack_nodes[current_stack].depth < MAX_STACK_DEPTH)
+      current_stack = stack_node(current_stack, profile_state.instruction_address & 0xffff);
+    else
+      stack_overflow++;
+    break;
+  case 0x60: // RTS
+  case 0x62: // RTS #$nn
+    // Interrupts aren't seen entering, so RTI is not followed
+    if (stack_overflow)
+      stack_overflow--;
+    else if (current_stack)
+      current_stack = stack_nodes[current_stack].parent;
+    break;
+  }
+}
+
+// The source line of an address, if the annotation files give one
+const char *profile_annotation(int address)
+{
+  return annotations[address] ? annotations[address]->text : "";
+}
+
+struct profile_line {
+  const char *text;
+  uint64_t samples;
+};
+
+int compare_profile_text(const void *a, const void *b)
+{
+  return strcmp(((const struct profile_line *)a)->text, ((const struct profile_line *)b)->text);
+}
+
+int compare_profile_samples(const void *a, const void *b)
+{
+  uint64_t sa = ((const struct profile_line *)a)->samples, sb = ((const struct profile_line *)b)->samples;
+  if (sa != sb)
+    return sa < sb ? 1 : -1;
+  return strcmp(((const struct profile_line *)a)->text, ((const struct profile_line *)b)->text);
+}
+
+int compare_pc_samples(const void *a, const void *b)
+{
+  uint64_t sa = pc_samples[*(const int *)a], sb = pc_samples[*(const int *)b];
+  if (sa != sb)
+    return sa < sb ? 1 : -1;
+  return *(const int *)a - *(const int *)b;
+}
+
+// How a call stack entry is named in the folded stacks
+void write_stack_name(FILE *f, int address)
+{
+  fprintf(f, "$%04X", address);
+  const char *text = profile_annotation(address);
+  if (text[0]) {
+    // Just file:line, and no ; which separates the entries
+    fputc(' ', f);
+    for (int colons = 0; *text && colons < 2; text++) {
+      if (*text == ':')
+        colons++;
+      if (colons < 2)
+        fputc(*text == ';' ? ',' : *text, f);
+    }
+  }
+}
+
+void write_folded_stack(FILE *f, int node)
+{
+  if (!node) {
+    fprintf(f, "[no calls]");
+    return;
+  }
+  if (stack_nodes[node].parent > 0) {
+    write_folded_stack(f, stack_nodes[node].parent);
+    fputc(';', f);
+  }
+  write_stack_name(f, stack_nodes[node].address);
+}
+
+int write_profile(void)
+{
+  FILE *f = fopen(profile_file, "w");
+  if (!f) {
+    fprintf(stderr, "ERROR: Could not create '%s': %s\n", profile_file, strerror(errno));
+    return -1;
+  }
+  double total = profile_total ? profile_total : 1;
+
+  fprintf(f, "%llu instructions, in %d frames.\n\n", (unsigned long long)profile_total, profile_frame + 1);
+
+  fprintf(f, "By address:\n\n  instructions       %%  cumul%%  address  source\n");
+  int addresses[0x10000], address_count = 0;
+  for (int i = 0; i < 0x10000; i++)
+    if (pc_samples[i])
+      addresses[address_count++] = i;
+  qsort(addresses, address_count, sizeof(int), compare_pc_samples);
+  uint64_t cumulative = 0;
+  for (int i = 0; i < address_count; i++) {
+    cumulative += pc_samples[addresses[i]];
+    fprintf(f, "  %12llu  %6.2f  %6.2f  $%04X    %s\n", (unsigned long long)pc_samples[addresses[i]],
+        pc_samples[addresses[i]] * 100.0 / total, cumulative * 100.0 / total, addresses[i],
+        profile_annotation(addresses[i]));
+  }
+
+  // Source lines can have several addresses, e.g., from macros
+  struct profile_line *lines = malloc((address_count + 1) * sizeof(struct profile_line));
+  int line_count = 0;
+  for (int i = 0; i < address_count; i++)
+    if (annotations[addresses[i]]) {
+      lines[line_count].text = profile_annotation(addresses[i]);
+      lines[line_count++].samples = pc_samples[addresses[i]];
+    }
+  qsort(lines, line_count, sizeof(struct profile_line), compare_profile_text);
+  int merged = 0;
+  for (int i = 0; i < line_count; i++) {
+    if (merged && !strcmp(lines[merged - 1].text, lines[i].text))
+      lines[merged - 1].samples += lines[i].samples;
+    else
+      lines[merged++] = lines[i];
+  }
+  qsort(lines, merged, sizeof(struct profile_line), compare_profile_samples);
+  if (merged) {
+    fprintf(f, "\nBy source line:\n\n  instructions       %%  source\n");
+    for (int i = 0; i < merged; i++)
+      fprintf(f, "  %12llu  %6.2f  %s\n", (unsigned long long)lines[i].samples, lines[i].samples * 100.0 / total,
+          lines[i].text);
+  }
+  free(lines);
+
+  fprintf(f, "\nBy VIC-IV raster line:\n\n  raster  instructions       %%\n");
+  for (int i = 0; i < 4096; i++)
+    if (raster_samples[i])
+      fprintf(f, "  $%03X    %12llu  %6.2f\n", i, (unsigned long long)raster_samples[i], raster_samples[i] * 100.0 / total);
+
+  if (profile_frame >= 0) {
+    // The last frame is usually cut short, so leave it out of the summary
+    int frames = profile_frame ? profile_frame : 1;
+    uint64_t min = frame_samples[0], max = frame_samples[0], sum = 0;
+    for (int i = 0; i < frames; i++) {
+      if (frame_samples[i] < min)
+        min = frame_samples[i];
+      if (frame_samples[i] > max)
+        max = frame_samples[i];
+      sum += frame_samples[i];
+    }
+    fprintf(f, "\nBy frame: %llu to %llu instructions, %llu on average.\n\n   frame  instructions\n",
+        (unsigned long long)min, (unsigned long long)max, (unsigned long long)(sum / frames));
+    for (int i = 0; i <= profile_frame; i++)
+      fprintf(f, "  %6d  %12llu\n", i, (unsigned long long)frame_samples[i]);
+  }
+  fclose(f);
+
+  char folded_file[1024];
+  snprintf(folded_file, sizeof(folded_file), "%s.folded", profile_file);
+  f = fopen(folded_file, "w");
+  if (!f) {
+    fprintf(stderr, "ERROR: Could not create '%s': %s\n", folded_file, strerror(errno));
+    return -1;
+  }
+  for (int n = 0; n < stack_node_count; n++)
+    if (stack_nodes[n].samples) {
+      write_folded_stack(f, n);
+      fprintf(f, " %llu\n", (unsigned long long)stack_nodes[n].samples);
+    }
+  fclose(f);
+
+  fprintf(stderr, "Wrote profile of %llu instructions to '%s' and '%s'.\n", (unsigned long long)profile_total,
+      profile_file, folded_file);
+  return 0;
+}
+
+// Size of the packets of CPU trace (and compressed video) that the MEGA65 sends
+#define TRACE_PACKET_SIZE 2132
+// Offset of the first 8 byte record in a packet
+#define TRACE_RECORD_OFFSET (0x48 + 14)
+// The records in a packet. The last is only 6 bytes, so keep room to read it as a whole one.
+#define TRACE_RECORDS_SIZE (TRACE_PACKET_SIZE - TRACE_RECORD_OFFSET)
+#define TRACE_RECORDS_ROOM (TRACE_RECORDS_SIZE + 2)
+
+void process_records(const unsigned char *records, int len)
+{
+  int bit52set = 0;
+  for (int offset = 0; (offset + 6) < len; offset += 8) {
+    if (records[offset + 6] & 0x10) {
+#if 0
+      printf(">>> Bit52 set at offset $%X+6\n",offset+TRACE_RECORD_OFFSET-14);
+      for(int j=0;j<8;j++) printf(" %02X",records[offset+j]);
+      printf("\n");
+#endif
+      bit52set = 1;
+      break;
+    }
+  }
+  // For now only support instruction decode
+  if (1 || bit52set) {
+    for (int offset = 0; offset < len; offset += 8) {
+      if (profile_file)
+        profile_record(&records[offset]);
+      else if (instruction_frequency) {
+        if ((records[offset + 0] & records[offset + 1] & records[offset + 2]) != 0xff) {
+          instruction_counts[records[offset + 2]]++;
+          num_instructions++;
+          if (!(num_instructions & 0xffff)) {
+            report_instruction_frequencies();
+          }
+        }
+      }
+      else
+        decode_instruction(&records[offset]);
+    }
+  }
+  else {
+    for (int offset = 0; offset < len; offset += 8) {
+      decode_busaccess(&records[offset]);
+    }
+  }
+}
+
+/* ----------------------------------------------------------------------------------------------------------
+   Recordings
+
+   Decoding and printing take much longer than capturing, so ethermon -w does neither: it just appends the
+   records of each trace packet, and when it was captured, to a file that is mapped into memory. ethermon -r
+   decodes it afterwards, as it does pcap files. The file is in the byte order of the computer that wrote
+   it, and the packet count in its header is kept up to date, so a recording that was cut short can still
+   be read.
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+#define RECORDING_MAGIC "M65TRACE"
+#define RECORDING_VERSION 1
+// How much the file is grown by at a time
+#define RECORDING_GROWTH (256 * 1024 * 1024)
+
+typedef struct recording_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t packet_size;
+  uint64_t packets;
+} recording_header;
+
+typedef struct recorded_packet {
+  uint32_t seconds, microseconds;
+  unsigned char records[TRACE_RECORDS_ROOM];
+} recorded_packet;
+
+int recording_fd = -1;
+unsigned char *recording = NULL;
+size_t recording_size = 0;
+void grow_recording(void)
+{
+  if (recording)
+    munmap(recording, recording_size);
+  recording_size += RECORDING_GROWTH;
+  if (ftruncate(recording_fd, recording_size)) {
+    fprintf(stderr, "ERROR: Could not grow recording to %lu bytes: %s\n", (unsigned long)recording_size, strerror(errno));
+    exit(-1);
+  }
+  recording = mmap(NULL, recording_size, PROT_READ | PROT_WRITE, MAP_SHARED, recording_fd, 0);
+  if (recording == MAP_FAILED) {
+    fprintf(stderr, "ERROR: Could not map recording: %s\n", strerror(errno));
+    exit(-1);
+  }
+}
+
+void record_packet(u_char *user, const struct pcap_pkthdr *hdr, const u_char *packet)
+{
+  if (hdr->caplen != TRACE_PACKET_SIZE)
+    return;
+
+  recording_header *h = (recording_header *)recording;
+  if (sizeof(recording_header) + (h->packets + 1) * sizeof(recorded_packet) > recording_size) {
+    grow_recording();
+    h = (recording_header *)recording;
+  }
+  recorded_packet *p = (recorded_packet *)(recording + sizeof(recording_header)) + h->packets;
+  p->seconds = hdr->ts.tv_sec;
+  p->microseconds = hdr->ts.tv_usec;
+  // The bytes after the last record are still 0 from when the file was grown
+  memcpy(p->records, &packet[TRACE_RECORD_OFFSET], TRACE_RECORDS_SIZE);
+  h->packets++;
+}
+
+int record_trace(char *dev, char *file)
+{
+  char errbuf[PCAP_ERRBUF_SIZE];
+
+  // A large capture buffer, so that no packets are lost while the file grows
+  pcap_t *descr = pcap_create(dev, errbuf);
+  if (descr == NULL) {
+    fprintf(stderr, "ERROR: pcap_create() failed due to [%s]\n", errbuf);
+    return -1;
+  }
+  pcap_set_snaplen(descr, 8192);
+  pcap_set_promisc(descr, 1);
+  pcap_set_timeout(descr, 10);
+  pcap_set_buffer_size(descr, 64 * 1024 * 1024);
+  if (pcap_activate(descr) < 0) {
+    fprintf(stderr, "ERROR: Could not capture on %s: %s\n", dev, pcap_geterr(descr));
+    return -1;
+  }
+
+  recording_fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (recording_fd < 0) {
+    fprintf(stderr, "ERROR: Could not create '%s': %s\n", file, strerror(errno));
+    return -1;
+  }
+  grow_recording();
+  recording_header *h = (recording_header *)recording;
+  memcpy(h->magic, RECORDING_MAGIC, sizeof(h->magic));
+  h->version = RECORDING_VERSION;
+  h->packet_size = sizeof(recorded_packet);
+  h->packets = 0;
+
+  capture_pcap = descr;
+  signal(SIGINT, stop_capture_signal);
+  signal(SIGTERM, stop_capture_signal);
+
+  fprintf(stderr, "Recording to '%s'. Press Ctrl-C to stop.\n", file);
+  time_t last_report = time(0);
+  while (!stop_capture) {
+    if (pcap_dispatch(descr, -1, record_packet, NULL) == PCAP_ERROR) {
+      fprintf(stderr, "ERROR: Could not capture on %s: %s\n", dev, pcap_geterr(descr));
+      break;
+    }
+    if (time(0) != last_report) {
+      last_report = time(0);
+      struct pcap_stat stats;
+      h = (recording_header *)recording;
+      fprintf(stderr, "\r%llu packets (%llu MB)", (unsigned long long)h->packets,
+          (unsigned long long)(h->packets * sizeof(recorded_packet)) >> 20);
+      if (!pcap_stats(descr, &stats))
+        fprintf(stderr, ", %u dropped", stats.ps_drop);
+      fflush(stderr);
+    }
+  }
+  capture_pcap = NULL;
+
+  h = (recording_header *)recording;
+  uint64_t packets = h->packets;
+  munmap(recording, recording_size);
+  if (ftruncate(recording_fd, sizeof(recording_header) + packets * sizeof(recorded_packet)))
+    fprintf(stderr, "ERROR: Could not trim '%s': %s\n", file, strerror(errno));
+  close(recording_fd);
+  pcap_close(descr);
+  fprintf(stderr, "\nRecorded %llu trace packets.\n", (unsigned long long)packets);
+  return 0;
+}
+
+/* ----------------------------------------------------------------------------------------------------------
+   Reading capture files and recordings
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+typedef struct trace_reader {
+  // A capture file
+  pcap_t *pcap;
+  unsigned char records[TRACE_RECORDS_ROOM];
+  // Or a recording, mapped into memory
+  const unsigned char *recording;
+  size_t recording_size;
+  uint64_t packets, next_packet;
+} trace_reader;
+
+int open_trace(trace_reader *t, const char *file)
+{
+  char errbuf[PCAP_ERRBUF_SIZE];
+  memset(t, 0, sizeof(trace_reader));
+
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: Could not open '%s': %s\n", file, strerror(errno));
+    return -1;
+  }
+  recording_header h;
+  struct stat st;
+  if (read(fd, &h, sizeof(h)) == sizeof(h) && !memcmp(h.magic, RECORDING_MAGIC, sizeof(h.magic)) && !fstat(fd, &st)) {
+    if (h.version != RECORDING_VERSION || h.packet_size != sizeof(recorded_packet)) {
+      fprintf(stderr, "ERROR: '%s' is a recording from a different version of ethermon.\n", file);
+      close(fd);
+      return -1;
+    }
+    t->recording_size = st.st_size;
+    t->recording = mmap(NULL, t->recording_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (t->recording == MAP_FAILED) {
+      fprintf(stderr, "ERROR: Could not map '%s': %s\n", file, strerror(errno));
+      return -1;
+    }
+    madvise((void *)t->recording, t->recording_size, MADV_SEQUENTIAL);
+    // Believe the header, unless the file was cut short
+    t->packets = (t->recording_size - sizeof(recording_header)) / sizeof(recorded_packet);
+    if (h.packets < t->packets)
+      t->packets = h.packets;
+    return 0;
+  }
+  close(fd);
+
+  t->pcap = pcap_open_offline(file, errbuf);
+  if (t->pcap == NULL) {
+    fprintf(stderr, "ERROR: pcap_open_offline() failed due to [%s]\n", errbuf);
+    return -1;
+  }
+  if (!pcap_file(t->pcap)) {
+    fprintf(stderr, "ERROR: Cannot seek in '%s', as pcap_file() is not supported here.\n", file);
+    pcap_close(t->pcap);
+    return -1;
+  }
+  return 0;
+}
+
+void close_trace(trace_reader *t)
+{
+  if (t->pcap)
+    pcap_close(t->pcap);
+  else
+    munmap((void *)t->recording, t->recording_size);
+}
+
+/*
+  Read the next trace packet, skipping any other packets in a capture file.
+  Returns 1 with its records, and where it is for trace_packet_at(), 0 at the
+  end of the file, or -1 if it can't be read.
+*/
+int next_trace_packet(trace_reader *t, long *position, const unsigned char **records)
+{
+  if (!t->pcap) {
+    if (t->next_packet >= t->packets)
+      return 0;
+    *position = t->next_packet++;
+    *records = ((const recorded_packet *)(t->recording + sizeof(recording_header)))[*position].records;
+    return 1;
+  }
+
+  while (1) {
+    long offset = ftell(pcap_file(t->pcap));
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+    int r = pcap_next_ex(t->pcap, &hdr, &data);
+    if (r == -2)
+      return 0;
+    if (r != 1) {
+      fprintf(stderr, "ERROR: Could not read capture file: %s\n", pcap_geterr(t->pcap));
+      return -1;
+    }
+    if (hdr->caplen == TRACE_PACKET_SIZE) {
+      memcpy(t->records, &data[TRACE_RECORD_OFFSET], TRACE_RECORDS_SIZE);
+      *position = offset;
+      *records = t->records;
+      return 1;
+    }
+  }
+}
+
+int trace_packet_at(trace_reader *t, long position, const unsigned char **records)
+{
+  if (t->pcap) {
+    if (fseek(pcap_file(t->pcap), position, SEEK_SET))
+      return -1;
+  }
+  else
+    t->next_packet = position;
+  return next_trace_packet(t, &position, records);
+}
+
+/* ----------------------------------------------------------------------------------------------------------
+   Capture files
+
+   The first pass through a capture file or recording indexes it: where each
+   trace packet is in the file and the trace state at its start, and which
+   packet and record each frame starts at.
+   With that, any packet can be decoded on its own, so the packets wanted
+   are decoded by several threads at once, a chunk of packets at a time.
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+typedef struct packet_entry {
+  // Where the packet is in the file, for trace_packet_at()
+  long position;
+  trace_state state;
+  // Pages ($xx00 - $xxFF) that instructions in the packet are in
+  uint32_t pages[8];
+} packet_entry;
+
+packet_entry *packet_index = NULL;
+int packet_count = 0;
+// Instructions in all the packets
+unsigned int indexed_instructions = 0;
+
+// Where each frame starts: the packet, and the record within it
+typedef struct frame_entry {
+  int packet;
+  int record;
+} frame_entry;
+
+frame_entry *frame_index = NULL;
+int frame_count = 0;
+
+char *capture_file = NULL;
+char *recording_file = NULL;
+
+int build_index(trace_reader *t)
+{
+  trace_state state = { 0xFFFF, 0 };
+  int packets_allocated = 0, frames_allocated = 0;
+
+  while (1) {
+    long position;
+    const unsigned char *records;
+    int r = next_trace_packet(t, &position, &records);
+    if (r < 0)
+      return -1;
+    if (!r)
+      break;
+
+    if (packet_count == packets_allocated) {
+      packets_allocated = packets_allocated ? packets_allocated * 2 : 65536;
+      packet_index = realloc(packet_index, packets_allocated * sizeof(packet_entry));
+      if (!packet_index) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        exit(-1);
+      }
+    }
+    packet_entry *e = &packet_index[packet_count];
+    e->position = position;
+    e->state = state;
+    memset(e->pages, 0, sizeof(e->pages));
+
+    for (int offset = 0, record = 0; offset < TRACE_RECORDS_SIZE; offset += 8, record++) {
+      const unsigned char *b = &records[offset];
+      if (is_raster_marker(b)) {
+        if (is_frame_start(b)) {
+          if (frame_count == frames_allocated) {
+            frames_allocated = frames_allocated ? frames_allocated * 2 : 4096;
+            frame_index = realloc(frame_index, frames_allocated * sizeof(frame_entry));
+            if (!frame_index) {
+              fprintf(stderr, "ERROR: Out of memory\n");
+              exit(-1);
+            }
+          }
+          frame_index[frame_count].packet = packet_count;
+          frame_index[frame_count].record = record;
+          frame_count++;
+        }
+        continue;
+      }
+      int load_address = state.instruction_address & 0xffff;
+      e->pages[load_address >> 13] |= 1 << ((load_address >> 8) & 0x1f);
+      state.instruction_count++;
+      state.instruction_address = next_instruction_address(b, state.instruction_address);
+    }
+    packet_count++;
+  }
+  indexed_instructions = state.instruction_count;
+  return 0;
+}
+
+// What to show: every instruction, or just those of one frame, or at one address
+int show_frame = -1;
+int show_address = -1;
+int first_packet, first_record, end_packet, end_record;
+
+// Which packets to decode
+int *wanted_packets = NULL;
+int wanted_count = 0;
+
+#define CHUNK_PACKETS 64
+
+struct chunk {
+  char *text;
+  size_t len;
+  int done;
+};
+
+struct chunk *chunks = NULL;
+int chunk_count = 0;
+int next_chunk = 0;
+int printed_chunks = 0;
+int decoder_threads = 4;
+pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t chunk_cond = PTHREAD_COND_INITIALIZER;
+
+// Decode one packet, as ethermon would show it live
+void decode_indexed_packet(trace_reader *t, int n, FILE *out)
+{
+  packet_entry *e = &packet_index[n];
+  const unsigned char *records;
+  if (trace_packet_at(t, e->position, &records) != 1) {
+    fprintf(out, "ERROR: Could not read packet %d again.\n", n);
+    return;
+  }
+
+  trace_state state = e->state;
+  for (int offset = 0, record = 0; offset < TRACE_RECORDS_SIZE; offset += 8, record++) {
+    const unsigned char *b = &records[offset];
+    if (is_raster_marker(b))
+      continue;
+    char text[8192];
+    int load_address = describe_instruction(&state, b, text);
+    if (show_address != -1 && load_address != show_address)
+      continue;
+    if (show_frame != -1) {
+      if (n == first_packet && record < first_record)
+        continue;
+      if (n == end_packet && record >= end_record)
+        continue;
+    }
+    fprintf(out, "    %s", text);
+  }
+}
+
+void *decoder_thread(void *arg)
+{
+  trace_reader t;
+  if (open_trace(&t, capture_file))
+    exit(-1);
+
+  while (1) {
+    // Stay not too far ahead of the output
+    pthread_mutex_lock(&chunk_lock);
+    while (next_chunk < chunk_count && next_chunk >= printed_chunks + 4 * decoder_threads)
+      pthread_cond_wait(&chunk_cond, &chunk_lock);
+    int c = next_chunk++;
+    pthread_mutex_unlock(&chunk_lock);
+    if (c >= chunk_count)
+      break;
+
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    for (int i = c * CHUNK_PACKETS; i < wanted_count && i < (c + 1) * CHUNK_PACKETS; i++)
+      decode_indexed_packet(&t, wanted_packets[i], out);
+    fclose(out);
+
+    pthread_mutex_lock(&chunk_lock);
+    chunks[c].text = text;
+    chunks[c].len = len;
+    chunks[c].done = 1;
+    pthread_cond_broadcast(&chunk_cond);
+    pthread_mutex_unlock(&chunk_lock);
+  }
+  close_trace(&t);
+  return NULL;
+}
+
+// Decode the wanted packets with several threads, showing them in order
+void decode_wanted_packets(void)
+{
+  chunk_count = (wanted_count + CHUNK_PACKETS - 1) / CHUNK_PACKETS;
+  chunks = calloc(chunk_count + 1, sizeof(struct chunk));
+  pthread_t threads[decoder_threads];
+  for (int i = 0; i < decoder_threads; i++)
+    pthread_create(&threads[i], NULL, decoder_thread, NULL);
+
+  for (int c = 0; c < chunk_count; c++) {
+    pthread_mutex_lock(&chunk_lock);
+    while (!chunks[c].done)
+      pthread_cond_wait(&chunk_cond, &chunk_lock);
+    pthread_mutex_unlock(&chunk_lock);
+
+    fwrite(chunks[c].text, 1, chunks[c].len, stdout);
+    free(chunks[c].text);
+
+    pthread_mutex_lock(&chunk_lock);
+    printed_chunks++;
+    pthread_cond_broadcast(&chunk_cond);
+    pthread_mutex_unlock(&chunk_lock);
+  }
+
+  for (int i = 0; i < decoder_threads; i++)
+    pthread_join(threads[i], NULL);
+  free(chunks);
+}
+
+int replay_indexed(trace_reader *t)
+{
+  time_t start = time(0);
+  if (build_index(t))
+    return -1;
+  fprintf(stderr, "Indexed %d trace packets, %d frames, %u instructions in %d seconds.\n", packet_count, frame_count,
+      indexed_instructions, (int)(time(0) - start));
+
+  wanted_packets = malloc((packet_count + 1) * sizeof(int));
+  if (show_frame != -1) {
+    if (show_frame >= frame_count) {
+      fprintf(stderr, "ERROR: There are only %d frames in '%s'.\n", frame_count, capture_file);
+      return -1;
+    }
+    first_packet = frame_index[show_frame].packet;
+    first_record = frame_index[show_frame].record;
+    if (show_frame + 1 < frame_count) {
+      end_packet = frame_index[show_frame + 1].packet;
+      end_record = frame_index[show_frame + 1].record;
+    }
+    else {
+      end_packet = packet_count;
+      end_record = 0;
+    }
+    for (int i = first_packet; i <= end_packet && i < packet_count; i++)
+      wanted_packets[wanted_count++] = i;
+  }
+  else if (show_address != -1) {
+    for (int i = 0; i < packet_count; i++)
+      if (packet_index[i].pages[show_address >> 13] & (1 << ((show_address >> 8) & 0x1f)))
+        wanted_packets[wanted_count++] = i;
+  }
+  else
+    for (int i = 0; i < packet_count; i++)
+      wanted_packets[wanted_count++] = i;
+
+  decode_wanted_packets();
+  return 0;
+}
+
 int usage(void)
 {
-  fprintf(stderr, "usage: ethermon [-F] [-n num instructions] [-m match string] <network interface> [.list, .map or other "
-                  "supported memory annotation files]\n");
+  fprintf(stderr, "usage: ethermon [-F] [-n num instructions] [-m match string] [-p profile] <network interface> [.list, "
+                  ".map or other supported memory annotation files]\n");
+  fprintf(stderr, "       ethermon -w <recording> <network interface>\n");
+  fprintf(stderr, "       ethermon -r <capture file or recording> [-g frame | -a address] [-j threads] [other options] "
+                  "[annotation files]\n");
   fprintf(stderr, "If -m is specified, then no instructions are displayed until <match string> appears in the output.\n");
   fprintf(stderr, "If -F is specified, the instruction stream is collected for a single frame of video display.\n");
+  fprintf(stderr, "If -r is specified, a pcap or pcapng capture file is read instead of a network interface. It is\n"
+                  "indexed first, so that -g can go straight to a frame (counting from 0), and -a can show every\n"
+                  "instruction at an address (in hex). These are decoded by several threads (-j, default 4).\n"
+                  "-b, -f, -F, -m, -n and -p read the file from start to end, as they would when live.\n");
+  fprintf(stderr, "If -p <file> is specified, a profile of where the CPU spends its time is written to <file> (by\n"
+                  "address, source line, raster line and frame), and <file>.folded gets the call stacks for flame\n"
+                  "graph tools. When live, profiling stops with Ctrl-C.\n");
+  fprintf(stderr, "If -w is specified, the trace is recorded to a file without being decoded. Stop with Ctrl-C, and\n"
+                  "then decode it with -r.\n");
   exit(-3);
 }
 
 int main(int argc, char **argv)
 {
-  char *dev;
+  char *dev = NULL;
   char errbuf[PCAP_ERRBUF_SIZE];
   pcap_t *descr;
   //    struct bpf_program fp;        /* to hold compiled program */
@@ -528,9 +1455,32 @@ int main(int argc, char **argv)
   for (int i = 0; i < 0x10000; i++)
     annotations[i] = NULL;
 
+  int sequential = 0;
   int opt;
-  while ((opt = getopt(argc, argv, "bfFm:n:")) != -1) {
+  while ((opt = getopt(argc, argv, "a:bfFg:j:m:n:p:r:w:")) != -1) {
+    if (strchr("bfFmnp", opt))
+      sequential = 1;
     switch (opt) {
+    case 'a':
+      show_address = strtol(optarg, NULL, 16) & 0xffff;
+      break;
+    case 'g':
+      show_frame = atoi(optarg);
+      break;
+    case 'j':
+      decoder_threads = atoi(optarg);
+      if (decoder_threads < 1)
+        usage();
+      break;
+    case 'p':
+      profile_file = optarg;
+      break;
+    case 'r':
+      capture_file = optarg;
+      break;
+    case 'w':
+      recording_file = optarg;
+      break;
     case 'f':
       instruction_frequency = 1;
       num_instructions = 0;
@@ -557,10 +1507,30 @@ int main(int argc, char **argv)
     }
   }
 
-  if (optind >= argc)
+  if (optind >= argc && !capture_file)
     usage();
 
-  if (argv[optind])
+  if (capture_file && recording_file) {
+    fprintf(stderr, "ERROR: -r and -w cannot be combined.\n");
+    exit(-1);
+  }
+  if (capture_file) {
+    if (sequential && (show_frame != -1 || show_address != -1)) {
+      fprintf(stderr, "ERROR: -g and -a cannot be combined with -b, -f, -F, -m, -n or -p.\n");
+      exit(-1);
+    }
+    if (show_frame != -1 && show_address != -1) {
+      fprintf(stderr, "ERROR: -g and -a cannot be combined.\n");
+      exit(-1);
+    }
+    // With no interface to name, any further arguments are annotation files
+    optind--;
+  }
+  else if (show_frame != -1 || show_address != -1) {
+    fprintf(stderr, "ERROR: -g and -a need a capture file (-r).\n");
+    exit(-1);
+  }
+  else if (argv[optind])
     dev = argv[optind];
   else {
     fprintf(stderr, "You must specify the interface to listen on.\n");
@@ -589,6 +1559,31 @@ int main(int argc, char **argv)
     }
   }
 
+  if (capture_file) {
+    trace_reader t;
+    if (open_trace(&t, capture_file))
+      return -1;
+    if (!sequential) {
+      int r = replay_indexed(&t);
+      close_trace(&t);
+      return r;
+    }
+
+    long position;
+    const unsigned char *records;
+    while (next_trace_packet(&t, &position, &records) == 1)
+      process_records(records, TRACE_RECORDS_SIZE);
+    close_trace(&t);
+    if (profile_file)
+      return write_profile();
+    if (instruction_frequency)
+      report_instruction_frequencies();
+    return 0;
+  }
+
+  if (recording_file)
+    return record_trace(dev, recording_file);
+
   // Prepare a list of all the devices
   if (pcap_findalldevs(&alldevs, errbuf) == -1) {
     fprintf(stderr, "Error in pcap_findalldevs: %s\n", errbuf);
@@ -616,52 +1611,22 @@ int main(int argc, char **argv)
   printf("Started.\n");
   fflush(stdout);
 
-  int bit52set = 0;
-
-  while (1) {
+  if (profile_file) {
+    // Profile until Ctrl-C
+    signal(SIGINT, stop_capture_signal);
+    signal(SIGTERM, stop_capture_signal);
+  }
 
+  while (!stop_capture) {
     struct pcap_pkthdr hdr;
     hdr.caplen = 0;
     const unsigned char *packet = pcap_next(descr, &hdr);
-    if (packet) {
-      if (hdr.caplen == 2132) {
-        bit52set = 0;
-        for (int offset = 0x48 + 14; (offset + 6) < hdr.caplen; offset += 8) {
-          if (packet[offset + 6] & 0x10) {
-#if 0
-	      printf(">>> Bit52 set at offset $%X+6\n",offset-14);
-	      for(int j=0;j<8;j++) printf(" %02X",packet[offset+j]);
-	      printf("\n");
-#endif
-            bit52set = 1;
-            break;
-          }
-        }
-        // For now only support instruction decode
-        if (1 || bit52set) {
-          for (int offset = 0x48 + 14; offset < hdr.caplen; offset += 8) {
-            if (instruction_frequency) {
-              if ((packet[offset + 0] & packet[offset + 1] & packet[offset + 2]) != 0xff) {
-                instruction_counts[packet[offset + 2]]++;
-                num_instructions++;
-                if (!(num_instructions & 0xffff)) {
-                  report_instruction_frequencies();
-                }
-              }
-            }
-            else
-              decode_instruction(&packet[offset]);
-          }
-        }
-        else {
-          for (int offset = 0x48 + 14; offset < hdr.caplen; offset += 8) {
-            decode_busaccess(&packet[offset]);
-          }
-        }
-      }
-    }
+    if (packet && hdr.caplen == TRACE_PACKET_SIZE)
+      process_records(&packet[TRACE_RECORD_OFFSET], hdr.caplen - TRACE_RECORD_OFFSET);
   }
   printf("Exiting.\n");
 
+  if (profile_file)
+    return write_profile();
   return 0;
 }
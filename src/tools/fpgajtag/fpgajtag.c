@@ -41,8 +41,10 @@
 #include <inttypes.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/time.h>
 #include "util.h"
 #include "fpga.h"
+#include "../bitstream.h"
 
 #ifdef USE_LOGGING
 #define ENTER()                                                                                                             \
@@ -71,12 +73,14 @@
 
 #define FILE_READSIZE 6464
 #define MAX_SINGLE_USB_DATA 4046
+#define MIN_FRAME_ROOM 16 /* don't start a frame with less room than this in the buffer */
 #define IDCODE_ARRAY_SIZE 20
 #define SEGMENT_LENGTH 256 /* sizes above 256bytes seem to get more bytes back in response than were requested */
 
 extern char *serial_port;
 
 uint8_t *input_fileptr;
+const char *fpgajtag_part_file, *fpgajtag_reference_file;
 int input_filesize, found_cortex = -1, jtag_index = -1, dcount, idcode_count;
 int tracep; //= 1;
 
@@ -269,20 +273,26 @@ void write_bytes(
   ENTER();
   ENTER_TMS_STATE('S');
   while (size > 0) {
-    int i, rlen = size;
-    if (rlen > max_frame_size)
-      rlen = max_frame_size;
+    /* frames fill up what is left of the buffer, which may already hold
+     * the end of the previous call, and the buffer is sent when full */
+    if (max_frame_size - buffer_current_size() < MIN_FRAME_ROOM)
+      flush_write(NULL);
+    int room = max_frame_size - buffer_current_size(), rlen = size;
+    if (rlen > room)
+      rlen = room;
+    int last = rlen == size;
     int tlen = rlen;
-    if (rlen < max_frame_size && opttail > 0)
+    if (last && opttail > 0)
       tlen--; // last byte is actually loaded with DATAWBIT command
-    write_item(DITEM(DATAW(read, tlen)));
-    uint8_t *cptr = buffer_current_ptr();
-    write_data(ptrin, tlen);
-    if (swapbits)
-      for (i = 0; i < tlen; i++)
-        cptr[i] = bitswap[cptr[i]];
+    if (tlen) {
+      write_item(DITEM(DATAW(read, tlen)));
+      if (swapbits)
+        write_data_bitswap(ptrin, tlen);
+      else
+        write_data(ptrin, tlen);
+    }
     ptrin += tlen;
-    if (rlen < max_frame_size) {
+    if (last) {
       if (opttail > 0) {
         exchar = *ptrin++;
         if (swapbits)
@@ -293,7 +303,7 @@ void write_bytes(
         write_fill(0, dc2trail, 0);
       write_bit(read, -opttail, exchar, target_state);
     }
-    size -= max_frame_size;
+    size -= rlen;
     if (size > 0)
       flush_write(NULL);
   }
@@ -546,16 +556,16 @@ static void send_data_file(
   for (tremain = 0; tremain < (1 + mid) && idcode_count > 1; tremain++)
     write_req(0, zerod, idcode_count - 9 + tremain * (found_cortex != -1) - mid * (idcode_count - 1 - jtag_index));
   write_int32(post);
-  int limit_len = MAX_SINGLE_USB_DATA - buffer_current_size();
   while (psize) {
     int size = FILE_READSIZE;
     if (psize < size)
       size = psize;
     psize -= size;
-    write_bytes(0, (!psize && !extra_shift) ? 'E' : 'P', pdata, size, limit_len, psize || opttail, swapbits, 1);
-    flush_write(NULL);
-    limit_len = MAX_SINGLE_USB_DATA;
-    pdata += size;
+    /* no pdata means the input file, which is read as it is sent */
+    uint8_t *data = pdata ? pdata : input_next(size);
+    write_bytes(0, (!psize && !extra_shift) ? 'E' : 'P', data, size, MAX_SINGLE_USB_DATA, psize || opttail, swapbits, 1);
+    if (pdata)
+      pdata += size;
   };
   if (extra_shift)
     write_fill(0, 0, 'E');
@@ -750,6 +760,8 @@ void init_fpgajtag(const char *serialno, const char *filename, uint32_t file_idc
     else if (!serialno || !strcmp(serialno, (char *)uinfo[usb_index].iSerialNumber)) {
       // Found the correct interface.
       // Now extract the real serial port name as well, so that monitor_load can use it.
+      if (jtag_transport != &usb_transport)
+        break;
 
 #if 0
 	    fprintf(stderr,"USB device info: dev=%p, idVendor=%x, idProduct=%x, bcdDevice=%x(0d%d)\n",
@@ -822,6 +834,55 @@ int min(int a, int b)
     return b;
 }
 
+/*
+ * Rewrite the input file to write fewer frames, and check that it still
+ * writes the same ones (see bitstream.h)
+ */
+static uint8_t *compress_input(int *size)
+{
+  bitstream *reference = NULL;
+  bitstream_frames *reference_frames = NULL;
+  bitstream_stats stats;
+  bitstream_part *part = bitstream_read_part(fpgajtag_part_file);
+  uint8_t *file = malloc(input_filesize);
+  if (!part || !file) {
+    printf("fpgajtag: Unable to compress '%s'\n", fpgajtag_part_file);
+    exit(-1);
+  }
+  for (int done = 0, len; done < input_filesize; done += len) {
+    len = min(input_filesize - done, FILE_READSIZE);
+    memcpy(file + done, input_next(len), len);
+  }
+  bitstream *b = bitstream_parse(file, input_filesize);
+  bitstream_frames *frames = bitstream_new_frames(part);
+  if (!b || !frames || bitstream_expand(b, frames)) {
+    printf("fpgajtag: Unable to read the frames of the input file\n");
+    exit(-1);
+  }
+  if (fpgajtag_reference_file) {
+    reference = bitstream_read(fpgajtag_reference_file);
+    reference_frames = bitstream_new_frames(part);
+    if (!reference || !reference_frames || bitstream_expand(reference, reference_frames)) {
+      printf("fpgajtag: Unable to read the frames of '%s'\n", fpgajtag_reference_file);
+      exit(-1);
+    }
+  }
+  uint8_t *data = bitstream_compress(b, frames, reference_frames, size, &stats);
+  if (!data || bitstream_verify(data, *size, frames, reference_frames)) {
+    printf("fpgajtag: Compressed bitstream does not write the same frames\n");
+    exit(-1);
+  }
+  printf("fpgajtag: %s %d of %d frames, %d in %d runs, %d by multiple frame write: %d bytes, down from %d\n",
+      reference ? "partial," : "compressed,", stats.frames, part->frame_count, stats.run_frames, stats.runs,
+      stats.mfw_frames, *size, input_filesize);
+  bitstream_free(b);
+  bitstream_free(reference);
+  bitstream_free_frames(frames);
+  bitstream_free_frames(reference_frames);
+  bitstream_free_part(part);
+  return data;
+}
+
 int fpgajtag_main(char *bitstream, char *serialport)
 {
   ENTER();
@@ -844,24 +905,12 @@ int fpgajtag_main(char *bitstream, char *serialport)
     setuid(0);
 
   if (xflag || mflag) {
-    int magic[2];
+    int magic[2], swap;
     memcpy(&magic, input_fileptr + 32, 8);
-    if (magic[0] != 0x000000bb || magic[1] != 0x11220044) {
-      uint8_t *buffer = (uint8_t *)malloc(input_filesize);
-      int i;
-      if (debug)
-        fprintf(stderr, "mismatched magic: %08x.%08x expected %08x.%08x\n", magic[0], magic[1], 0x000000bb, 0x11220044);
-      memcpy(buffer, input_fileptr, input_filesize);
-      for (i = 0; i < input_filesize / 4; i++) {
-        int *bufl = (int *)buffer;
-        int *inputl = (int *)input_fileptr;
-        bufl[i] = ntohl(inputl[i]);
-      }
-      memcpy(&magic, buffer + 32, 8);
-      if (debug)
-        fprintf(stderr, "updated magic: %08x.%08x expected %08x.%08x\n", magic[0], magic[1], 0x000000bb, 0x11220044);
-      input_fileptr = buffer;
-    }
+    swap = magic[0] != 0x000000bb || magic[1] != 0x11220044;
+    if (swap && debug)
+      fprintf(stderr, "mismatched magic: %08x.%08x expected %08x.%08x, swapping words\n", magic[0], magic[1], 0x000000bb,
+          0x11220044);
     int rc = setuid(0);
     const char *filename = (mflag) ? "/lib/firmware/fpga.bin" : "/dev/xdevcfg";
     if (rc != 0)
@@ -872,15 +921,23 @@ int fpgajtag_main(char *bitstream, char *serialport)
           strerror(errno));
       exit(-1);
     }
-    while (input_filesize) {
-      int len = write(fd, input_fileptr, min(input_filesize, 4096));
-      if (len <= 0) {
+    int remain = input_filesize;
+    while (remain) {
+      int len = min(remain, 4096);
+      uint8_t *data = input_next(len);
+      if (swap)
+        for (i = 0; i < len / 4; i++) {
+          uint32_t word;
+          memcpy(&word, data + 4 * i, 4);
+          word = ntohl(word);
+          memcpy(data + 4 * i, &word, 4);
+        }
+      if (write(fd, data, len) != len) {
         fprintf(stderr, "[%s:%d] failed to write to %s: len=%d errno=%d %s\n", __FUNCTION__, __LINE__, filename, len, errno,
             strerror(errno));
         exit(-1);
       }
-      input_filesize -= len;
-      input_fileptr += len;
+      remain -= len;
     }
     close(fd);
     if (mflag) {
@@ -898,6 +955,13 @@ int fpgajtag_main(char *bitstream, char *serialport)
     exit(0);
   }
 
+  /* a partial bitstream goes onto what is there, without programming */
+  int partial = fpgajtag_part_file && fpgajtag_reference_file;
+  uint8_t *send_data = NULL; /* the input file */
+  int send_size = input_filesize;
+  if (fpgajtag_part_file)
+    send_data = compress_input(&send_size);
+
   dcount = idcode_count - (found_cortex != -1) - 1;
   trailing_len = idcode_count - 1 - jtag_index;
   dc2trail = dcount == 2 && !trailing_len;
@@ -927,6 +991,7 @@ int fpgajtag_main(char *bitstream, char *serialport)
     goto exit_label;
   }
 
+  fpgausb_mark("check chain");
   reset_mark_clock(1);
   marker_for_reset(0);
   write_tms_transition("RR1");
@@ -951,24 +1016,44 @@ int fpgajtag_main(char *bitstream, char *serialport)
   /*
    * Step 2: Initialization
    */
-  marker_for_reset(0);
-  write_cirreg(0, IRREG_JPROGRAM);
-  write_cirreg(0, IRREG_ISC_NOOP);
-  pulse_gpio(12500 /*msec*/);
-  if ((ret = write_cirreg(DREAD, IRREG_ISC_NOOP)) != INPROGRAMMING)
-    printf("[%s:%d] NOOP/INPROGRAMMING mismatch %x\n", __FUNCTION__, __LINE__, ret);
+  if (!partial) {
+    fpgausb_mark("initialization");
+    marker_for_reset(0);
+    write_cirreg(0, IRREG_JPROGRAM);
+    write_cirreg(0, IRREG_ISC_NOOP);
+    pulse_gpio(12500 /*msec*/);
+    if ((ret = write_cirreg(DREAD, IRREG_ISC_NOOP)) != INPROGRAMMING)
+      printf("[%s:%d] NOOP/INPROGRAMMING mismatch %x\n", __FUNCTION__, __LINE__, ret);
+  }
 
   /*
    * Step 6: Load Configuration Data Frames
    */
   printf("fpgajtag: Starting to send file\n");
+  fpgausb_mark("send file");
+  struct timeval send_start, send_end;
+  uint64_t bytes_before = usb_bytes_written;
+  int writes_before = usb_write_count;
+  gettimeofday(&send_start, NULL);
   send_data_file(
-      DREAD, !dcount && jtag_index, input_fileptr, input_filesize, NULL, DITEM(INT32(0)), !(jtag_index && dcount), 1);
-  printf("fpgajtag: Done sending file\n");
+      DREAD, !dcount && jtag_index, send_data, send_size, NULL, DITEM(INT32(0)), !(jtag_index && dcount), 1);
+  flush_write(NULL);
+  fpgausb_wait();
+  gettimeofday(&send_end, NULL);
+  double send_time = (send_end.tv_sec - send_start.tv_sec) + (send_end.tv_usec - send_start.tv_usec) / 1000000.0;
+  printf("fpgajtag: Done sending file: %d bytes (%" PRIu64 " on the wire, %d USB writes) in %.3f s, %.1f KB/s\n",
+      send_size, usb_bytes_written - bytes_before, usb_write_count - writes_before, send_time,
+      send_time > 0 ? send_size / send_time / 1024 : 0);
+  free(send_data);
+  if (partial) {
+    access_mdm(0, 0, 1);
+    goto exit_label;
+  }
 
   /*
    * Step 8: Startup
    */
+  fpgausb_mark("startup");
   pulse_gpio(1250 /*msec*/);
   if ((ret = read_config_reg(CONFIG_REG_BOOTSTS)) != (jtag_index ? 0x03000000 : 0x01000000))
     printf("[%s:%d] CONFIG_REG_BOOTSTS mismatch %x\n", __FUNCTION__, __LINE__, ret);
@@ -997,7 +1082,7 @@ int fpgajtag_main(char *bitstream, char *serialport)
   printf("STATUS %08x done %x release_done %x eos %x startup_state %x\n", status, status & 0x4000, status & 0x2000,
       status & 0x10, (status >> 18) & 7);
   access_mdm(0, 0, 1);
-  rescan = 1;
+  rescan = jtag_transport == &usb_transport; /* no PCI bus behind a simulated board */
 
   /*
    * Cleanup and free USB device
@@ -0,0 +1,686 @@
+/*
+ * The loopback transport for fpgajtag.
+ *
+ * Instead of going over USB to an FTDI chip, the MPSSE commands are run
+ * against a model of the chip's JTAG engine, wired to the TAP controller of
+ * a single Xilinx 7-series FPGA.  The FPGA answers IDCODE, USERCODE, CFG_IN
+ * and CFG_OUT, and its configuration logic follows the packets of the
+ * bitstream, as far as fpgajtag uses them (ug470_7Series_Config.pdf).
+ *
+ * Time is modelled, not measured.  Each bulk write costs TRANSFER_US plus
+ * its bytes at USB_BYTES_PER_US, with at most USB_TRANSFERS in flight and
+ * one on the bus at a time.  The chip only holds one transfer ahead of the
+ * one it is working on, and clocks TCK at the rate its divisor gives.  A
+ * read waits for the chip to get through everything ahead of it, and then
+ * costs a round trip of loopback_latency microseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include "util.h"
+#include "fpga.h"
+
+#define USB_TRANSFERS 8         /* as in util.c */
+#define TRANSFER_US 20.0        /* to schedule a bulk transfer */
+#define USB_BYTES_PER_US 40.0   /* high speed bulk, in practice */
+#define USB_PACKET_SIZE 512     /* each read packet starts with 2 status bytes */
+#define STARTUP_CLOCKS 8        /* in Run-Test/Idle after JSTART */
+#define READ_FIFO_SIZE 16
+
+#define DEFAULT_IDCODE 0x13636093 /* XC7A200T */
+
+uint32_t loopback_idcode = DEFAULT_IDCODE;
+int loopback_latency = 250; /* microseconds for a read round trip */
+
+/*
+ * TAP controller
+ */
+enum {
+  TAP_RESET,
+  TAP_IDLE,
+  TAP_SELECT_DR,
+  TAP_CAPTURE_DR,
+  TAP_SHIFT_DR,
+  TAP_EXIT1_DR,
+  TAP_PAUSE_DR,
+  TAP_EXIT2_DR,
+  TAP_UPDATE_DR,
+  TAP_SELECT_IR,
+  TAP_CAPTURE_IR,
+  TAP_SHIFT_IR,
+  TAP_EXIT1_IR,
+  TAP_PAUSE_IR,
+  TAP_EXIT2_IR,
+  TAP_UPDATE_IR
+};
+
+static const uint8_t tap_next[16][2] = {
+  [TAP_RESET] = { TAP_IDLE, TAP_RESET },
+  [TAP_IDLE] = { TAP_IDLE, TAP_SELECT_DR },
+  [TAP_SELECT_DR] = { TAP_CAPTURE_DR, TAP_SELECT_IR },
+  [TAP_CAPTURE_DR] = { TAP_SHIFT_DR, TAP_EXIT1_DR },
+  [TAP_SHIFT_DR] = { TAP_SHIFT_DR, TAP_EXIT1_DR },
+  [TAP_EXIT1_DR] = { TAP_PAUSE_DR, TAP_UPDATE_DR },
+  [TAP_PAUSE_DR] = { TAP_PAUSE_DR, TAP_EXIT2_DR },
+  [TAP_EXIT2_DR] = { TAP_SHIFT_DR, TAP_UPDATE_DR },
+  [TAP_UPDATE_DR] = { TAP_IDLE, TAP_SELECT_DR },
+  [TAP_SELECT_IR] = { TAP_CAPTURE_IR, TAP_RESET },
+  [TAP_CAPTURE_IR] = { TAP_SHIFT_IR, TAP_EXIT1_IR },
+  [TAP_SHIFT_IR] = { TAP_SHIFT_IR, TAP_EXIT1_IR },
+  [TAP_EXIT1_IR] = { TAP_PAUSE_IR, TAP_UPDATE_IR },
+  [TAP_PAUSE_IR] = { TAP_PAUSE_IR, TAP_EXIT2_IR },
+  [TAP_EXIT2_IR] = { TAP_SHIFT_IR, TAP_UPDATE_IR },
+  [TAP_UPDATE_IR] = { TAP_IDLE, TAP_SELECT_DR },
+};
+
+#define IR_MASK ((1 << XILINX_IR_LENGTH) - 1)
+
+static int tap_state;
+static uint8_t ir, ir_shift;
+static uint64_t dr_shift;
+static int dr_length;
+
+/*
+ * Configuration logic
+ */
+static struct {
+  uint32_t shift;
+  int bits, synced;
+  int op, reg, words_left;
+  int init_complete, isc_done, start, done, id_error;
+  int startup_clocks;
+  uint64_t words, fdri_words;
+  int syncs, desyncs;
+  int command, mfw_writes;
+  int programmed; /* JPROGRAM seen, so not a partial load */
+} cfg;
+
+/* Words for CFG_OUT, each repeated count times */
+static struct {
+  uint32_t value, count;
+} read_fifo[READ_FIFO_SIZE];
+static int read_head, read_tail;
+static uint32_t out_word;
+static int out_bits;
+
+/*
+ * FTDI chip
+ */
+static int tck_divisor, divide_by_5, tms_pin, tdi_pin;
+static uint8_t read_shift; /* bit mode reads all shift in here */
+static uint8_t *reply;
+static int reply_len, reply_size;
+static uint8_t *pending; /* a command split between writes */
+static int pending_len, pending_size;
+static uint64_t cycles;   /* since the time was last brought up to date */
+static double clocked_us; /* TCK time of the current write */
+
+/*
+ * Timeline
+ */
+typedef struct {
+  char direction; /* 'W'rite, 'R'ead or 'M'ark */
+  int bytes;
+  uint64_t tck;
+  double submit, start, end, chip_done;
+  const char *label;
+} TRANSFER;
+
+static TRANSFER *timeline;
+static int timeline_len, timeline_size;
+static double host_time, usb_free, chip_time, in_flight[USB_TRANSFERS];
+static uint64_t tck_total, bytes_written, bytes_read;
+static int writes, reads;
+
+static TRANSFER *add_transfer(char direction)
+{
+  if (timeline_len == timeline_size) {
+    timeline_size = timeline_size ? timeline_size * 2 : 4096;
+    timeline = realloc(timeline, timeline_size * sizeof(TRANSFER));
+    if (!timeline) {
+      fprintf(stderr, "fpgajtag: loopback: out of memory\n");
+      exit(-1);
+    }
+  }
+  TRANSFER *t = &timeline[timeline_len++];
+  memset(t, 0, sizeof(*t));
+  t->direction = direction;
+  return t;
+}
+
+static double tck_mhz(void)
+{
+  return (divide_by_5 ? 6.0 : 30.0) / (1 + tck_divisor);
+}
+
+static void add_clocked_time(void)
+{
+  clocked_us += cycles / tck_mhz();
+  tck_total += cycles;
+  cycles = 0;
+}
+
+/*
+ * Configuration logic
+ */
+static void queue_read(uint32_t value, uint32_t count)
+{
+  if ((read_tail + 1) % READ_FIFO_SIZE == read_head)
+    return;
+  read_fifo[read_tail].value = value;
+  read_fifo[read_tail].count = count;
+  read_tail = (read_tail + 1) % READ_FIFO_SIZE;
+}
+
+static uint32_t next_read(void)
+{
+  if (read_head == read_tail)
+    return 0;
+  uint32_t value = read_fifo[read_head].value;
+  if (!--read_fifo[read_head].count)
+    read_head = (read_head + 1) % READ_FIFO_SIZE;
+  return value;
+}
+
+static uint32_t config_register(int reg)
+{
+  switch (reg) {
+  case CONFIG_REG_STAT:
+    /* as read back from a configured part, without what startup sets */
+    return cfg.done ? 0x401079fc : 0x4000190c | (cfg.id_error << 15);
+  case CONFIG_REG_BOOTSTS:
+    return 0x00000001; /* VALID_0 */
+  case CONFIG_REG_IDCODE:
+    return loopback_idcode;
+  default:
+    return 0;
+  }
+}
+
+static void config_write(int reg, uint32_t value)
+{
+  switch (reg) {
+  case CONFIG_REG_CMD:
+    cfg.command = value;
+    if (value == 0x05) /* START */
+      cfg.start = 1;
+    else if (value == 0x0d) { /* DESYNC */
+      cfg.synced = 0;
+      cfg.desyncs++;
+      cfg.isc_done = !cfg.id_error && cfg.fdri_words;
+    }
+    break;
+  case CONFIG_REG_FDRI:
+    cfg.fdri_words++;
+    break;
+  case CONFIG_REG_IDCODE:
+    if ((value & 0x0fffffff) != (loopback_idcode & 0x0fffffff))
+      cfg.id_error = 1;
+    break;
+  }
+}
+
+static void config_word(uint32_t word)
+{
+  cfg.words++;
+  if (cfg.words_left) {
+    cfg.words_left--;
+    if (cfg.op == CONFIG_OP_WRITE)
+      config_write(cfg.reg, word);
+    return;
+  }
+  switch (word >> 29) {
+  case 1:
+    cfg.op = (word >> CONFIG_TYPE1_OPCODE_SHIFT) & CONFIG_TYPE1_OPCODE_MASK;
+    cfg.reg = (word >> CONFIG_TYPE1_REG_SHIFT) & CONFIG_TYPE1_REG_MASK;
+    if (cfg.op == CONFIG_OP_WRITE)
+      cfg.words_left = word & CONFIG_TYPE1_WORDCNT_MASK;
+    else if (cfg.op == CONFIG_OP_READ && (word & CONFIG_TYPE1_WORDCNT_MASK))
+      queue_read(config_register(cfg.reg), word & CONFIG_TYPE1_WORDCNT_MASK);
+    if (cfg.op == CONFIG_OP_WRITE && cfg.reg == CONFIG_REG_MFWR && cfg.command == 0x02) /* MFW */
+      cfg.mfw_writes++;
+    break;
+  case 2:
+    if (cfg.op == CONFIG_OP_WRITE)
+      cfg.words_left = word & 0x07ffffff;
+    else if (cfg.op == CONFIG_OP_READ && (word & 0x07ffffff))
+      queue_read(config_register(cfg.reg), word & 0x07ffffff);
+    break;
+  }
+}
+
+static void config_bit(int bit)
+{
+  cfg.shift = (cfg.shift << 1) | bit;
+  if (!cfg.synced) {
+    /* the sync word can come at any bit */
+    if (cfg.shift == 0xaa995566) {
+      cfg.synced = 1;
+      cfg.syncs++;
+      cfg.bits = 0;
+      cfg.words_left = 0;
+    }
+    return;
+  }
+  if (++cfg.bits == 32) {
+    cfg.bits = 0;
+    config_word(cfg.shift);
+  }
+}
+
+/*
+ * TAP controller and registers
+ */
+static void capture_dr(void)
+{
+  switch (ir) {
+  case IRREG_IDCODE & IR_MASK:
+    dr_shift = loopback_idcode;
+    dr_length = 32;
+    break;
+  case IRREG_USERCODE & IR_MASK:
+    dr_shift = 0xffffffff;
+    dr_length = 32;
+    break;
+  case IRREG_CFG_OUT:
+    out_word = next_read();
+    out_bits = 32;
+    break;
+  default: /* BYPASS */
+    dr_shift = 0;
+    dr_length = 1;
+  }
+}
+
+static int shift_dr(int tdi)
+{
+  int tdo;
+  switch (ir) {
+  case IRREG_CFG_IN:
+    config_bit(tdi);
+    return 0;
+  case IRREG_CFG_OUT: /* most significant bit first */
+    tdo = out_word >> 31;
+    out_word <<= 1;
+    if (!--out_bits) {
+      out_word = next_read();
+      out_bits = 32;
+    }
+    return tdo;
+  default:
+    tdo = dr_shift & 1;
+    dr_shift = (dr_shift >> 1) | ((uint64_t)tdi << (dr_length - 1));
+    return tdo;
+  }
+}
+
+static void update_ir(void)
+{
+  ir = ir_shift & IR_MASK;
+  switch (ir) {
+  case IRREG_JPROGRAM:
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.init_complete = 1;
+    cfg.programmed = 1;
+    read_head = read_tail = 0;
+    break;
+  case IRREG_JSHUTDOWN:
+    cfg.done = 0;
+    break;
+  case IRREG_JSTART:
+    cfg.startup_clocks = 0;
+    break;
+  }
+}
+
+/* One TCK cycle, returning TDO */
+static int clock_tap(int tms, int tdi)
+{
+  int tdo = 1;
+  cycles++;
+  switch (tap_state) {
+  case TAP_SHIFT_DR:
+    tdo = shift_dr(tdi);
+    break;
+  case TAP_SHIFT_IR:
+    tdo = ir_shift & 1;
+    ir_shift = (ir_shift >> 1) | (tdi << (XILINX_IR_LENGTH - 1));
+    break;
+  case TAP_IDLE:
+    if (ir == IRREG_JSTART && cfg.start && cfg.isc_done && ++cfg.startup_clocks >= STARTUP_CLOCKS)
+      cfg.done = 1;
+    break;
+  }
+  tap_state = tap_next[tap_state][tms];
+  switch (tap_state) {
+  case TAP_RESET:
+    ir = IRREG_IDCODE;
+    break;
+  case TAP_CAPTURE_DR:
+    capture_dr();
+    break;
+  case TAP_CAPTURE_IR:
+    /* DONE, INIT_COMPLETE, ISC_ENABLED, ISC_DONE, 0, 1 */
+    ir_shift = (cfg.done << 5) | (cfg.init_complete << 4) | (cfg.isc_done << 2) | 1;
+    break;
+  case TAP_UPDATE_IR:
+    update_ir();
+    break;
+  }
+  return tdo;
+}
+
+/*
+ * FTDI MPSSE engine
+ */
+static void send_reply(uint8_t byte)
+{
+  if (reply_len == reply_size) {
+    reply_size = reply_size ? reply_size * 2 : 4096;
+    reply = realloc(reply, reply_size);
+    if (!reply) {
+      fprintf(stderr, "fpgajtag: loopback: out of memory\n");
+      exit(-1);
+    }
+  }
+  reply[reply_len++] = byte;
+}
+
+/* Run one command, returning its length, or 0 if it isn't all there yet */
+static int run_command(const uint8_t *p, int size)
+{
+  uint8_t op = p[0];
+  int i, j, len, tdo;
+
+  if (!(op & 0x80)) {
+    int write = op & MPSSE_DO_WRITE, read = op & MPSSE_DO_READ;
+    if (op & MPSSE_WRITE_TMS) {
+      /* TMS bits from the bottom of the byte, with bit 7 on TDI; a read
+       * is of TDO on the first clock */
+      if (size < 3)
+        return 0;
+      tdi_pin = p[2] >> 7;
+      for (i = 0; i <= p[1]; i++) {
+        tms_pin = (p[2] >> i) & 1;
+        tdo = clock_tap(tms_pin, tdi_pin);
+        if (read && !i)
+          read_shift = (read_shift >> 1) | (tdo << 7);
+      }
+      if (read)
+        send_reply(read_shift);
+      return 3;
+    }
+    if (op & MPSSE_BITMODE) {
+      len = 2 + !!write;
+      if (size < len)
+        return 0;
+      for (i = 0; i <= p[1]; i++) {
+        if (write)
+          tdi_pin = (p[2] >> i) & 1;
+        tdo = clock_tap(tms_pin, tdi_pin);
+        read_shift = (read_shift >> 1) | (tdo << 7);
+      }
+      if (read)
+        send_reply(read_shift);
+      return len;
+    }
+    if (size < 3)
+      return 0;
+    int bytes = (p[1] | (p[2] << 8)) + 1;
+    len = 3 + (write ? bytes : 0);
+    if (size < len)
+      return 0;
+    for (i = 0; i < bytes; i++) {
+      uint8_t in = 0;
+      for (j = 0; j < 8; j++) {
+        if (write)
+          tdi_pin = (p[3 + i] >> j) & 1;
+        in |= clock_tap(tms_pin, tdi_pin) << j;
+      }
+      if (read)
+        send_reply(in);
+    }
+    return len;
+  }
+
+  switch (op) {
+  case SET_BITS_LOW:
+  case SET_BITS_HIGH:
+    return size < 3 ? 0 : 3;
+  case 0x81: /* read the GPIO pins */
+  case 0x83:
+    send_reply(0xff);
+    return 1;
+  case 0x84: /* loopback on */
+  case LOOPBACK_END:
+  case SEND_IMMEDIATE:
+  case 0x88: /* wait on GPIOL1 */
+  case 0x89:
+  case 0x8d: /* 3 phase clocking off */
+  case 0x97: /* adaptive clocking off */
+    return 1;
+  case TCK_DIVISOR:
+    if (size < 3)
+      return 0;
+    add_clocked_time();
+    tck_divisor = p[1] | (p[2] << 8);
+    return 3;
+  case DIS_DIV_5:
+  case 0x8b:
+    add_clocked_time();
+    divide_by_5 = op == 0x8b;
+    return 1;
+  case 0x8e: /* clock bits */
+    if (size < 2)
+      return 0;
+    for (i = 0; i <= p[1]; i++)
+      clock_tap(tms_pin, tdi_pin);
+    return 2;
+  case CLK_BYTES:
+    if (size < 3)
+      return 0;
+    len = ((p[1] | (p[2] << 8)) + 1) * 8;
+    for (i = 0; i < len; i++)
+      clock_tap(tms_pin, tdi_pin);
+    return 3;
+  default:
+    send_reply(0xfa); /* bad command */
+    send_reply(op);
+    return 1;
+  }
+}
+
+static void run_commands(const uint8_t *buf, int size)
+{
+  if (pending_len + size > pending_size) {
+    pending_size = pending_len + size;
+    pending = realloc(pending, pending_size);
+    if (!pending) {
+      fprintf(stderr, "fpgajtag: loopback: out of memory\n");
+      exit(-1);
+    }
+  }
+  memcpy(pending + pending_len, buf, size);
+  pending_len += size;
+
+  int done = 0, len;
+  while (done < pending_len && (len = run_command(pending + done, pending_len - done)))
+    done += len;
+  memmove(pending, pending + done, pending_len - done);
+  pending_len -= done;
+}
+
+/*
+ * The transport
+ */
+static USB_INFO loopback_info[2];
+
+static USB_INFO *loopback_init(void)
+{
+  loopback_info[0].dev = loopback_info; /* anything but NULL */
+  loopback_info[0].idVendor = 0x403;
+  loopback_info[0].idProduct = 0x6010;
+  loopback_info[0].bcdDevice = 0x700; /* FT2232H */
+  loopback_info[0].bNumConfigurations = 1;
+  strcpy((char *)loopback_info[0].iManufacturer, "Simulated");
+  strcpy((char *)loopback_info[0].iProduct, "Loopback JTAG");
+  strcpy((char *)loopback_info[0].iSerialNumber, "loopback");
+  return loopback_info;
+}
+
+static void loopback_mark(const char *label)
+{
+  TRANSFER *t = add_transfer('M');
+  t->submit = t->start = t->end = host_time;
+  t->chip_done = chip_time;
+  t->label = label;
+}
+
+static void loopback_open(int device_index, int interface)
+{
+  tap_state = TAP_RESET;
+  ir = IRREG_IDCODE;
+  memset(&cfg, 0, sizeof(cfg));
+  read_head = read_tail = 0;
+  tck_divisor = 0;
+  divide_by_5 = 1;
+  tms_pin = 1;
+  tdi_pin = 0;
+  reply_len = pending_len = 0;
+  loopback_mark("identify");
+}
+
+static int loopback_write(const uint8_t *buf, int size)
+{
+  TRANSFER *t = add_transfer('W');
+  t->bytes = size;
+  t->submit = host_time;
+
+  uint64_t tck_before = tck_total;
+  clocked_us = 0;
+  run_commands(buf, size);
+  add_clocked_time();
+  t->tck = tck_total - tck_before;
+
+  /* wait for a free transfer, then for the bus, and for the chip to have
+   * room for it */
+  int slot = writes++ % USB_TRANSFERS;
+  if (in_flight[slot] > host_time)
+    host_time = in_flight[slot];
+  t->start = host_time > usb_free ? host_time : usb_free;
+  t->end = t->start + TRANSFER_US + size / USB_BYTES_PER_US;
+  if (t->end < chip_time)
+    t->end = chip_time;
+  usb_free = in_flight[slot] = t->end;
+  chip_time = t->end + clocked_us;
+  t->chip_done = chip_time;
+  bytes_written += size;
+  return size;
+}
+
+static int loopback_read(uint8_t *buf, int size)
+{
+  TRANSFER *t = add_transfer('R');
+  int len = reply_len < size ? reply_len : size;
+  int packets = (len + USB_PACKET_SIZE - 3) / (USB_PACKET_SIZE - 2);
+
+  t->bytes = len;
+  t->submit = host_time;
+  t->start = chip_time > usb_free ? chip_time : usb_free;
+  if (t->start < host_time)
+    t->start = host_time;
+  host_time = t->end = t->start + loopback_latency + (len + 2 * packets) / USB_BYTES_PER_US;
+  t->chip_done = chip_time;
+  reads++;
+  bytes_read += len + 2 * (packets ? packets : 1);
+
+  if (!len) {
+    fprintf(stderr, "fpgajtag: loopback: nothing to read\n");
+    return -1;
+  }
+  if (reply_len != size)
+    fprintf(stderr, "fpgajtag: loopback: %d bytes waiting, %d read\n", reply_len, size);
+  memcpy(buf, reply, len);
+  memmove(reply, reply + len, reply_len - len);
+  reply_len -= len;
+  return len;
+}
+
+static void loopback_wait(void)
+{
+  if (usb_free > host_time)
+    host_time = usb_free;
+}
+
+static void loopback_close(void)
+{
+  loopback_wait();
+}
+
+static void loopback_release(void)
+{
+}
+
+JTAG_TRANSPORT loopback_transport = { loopback_init, loopback_open, loopback_write, loopback_read, loopback_wait,
+  loopback_mark, loopback_close, loopback_release };
+
+/*
+ * Results
+ */
+static double end_time(void)
+{
+  return host_time > chip_time ? host_time : chip_time;
+}
+
+void loopback_report(FILE *f)
+{
+  int i, j;
+  fprintf(f, "USB writes:       %d, %" PRIu64 " bytes\n", writes, bytes_written);
+  fprintf(f, "USB round trips:  %d, %" PRIu64 " bytes read\n", reads, bytes_read);
+  fprintf(f, "Bytes on wire:    %" PRIu64 "\n", bytes_written + bytes_read);
+  fprintf(f, "TCK cycles:       %" PRIu64 "\n", tck_total);
+  fprintf(f, "Modelled time:    %.3f s\n", end_time() / 1000000);
+  for (i = 0; i < timeline_len; i++) {
+    if (timeline[i].direction != 'M')
+      continue;
+    double end = end_time();
+    int phase_writes = 0, phase_reads = 0;
+    for (j = i + 1; j < timeline_len && timeline[j].direction != 'M'; j++) {
+      if (timeline[j].direction == 'W')
+        phase_writes++;
+      else
+        phase_reads++;
+    }
+    if (j < timeline_len)
+      end = timeline[j].start;
+    fprintf(f, "  %-16s %10.3f ms, %6d writes, %5d round trips\n", timeline[i].label, (end - timeline[i].start) / 1000,
+        phase_writes, phase_reads);
+  }
+  fprintf(f, "FPGA:             IDCODE %08x, %d sync%s, %" PRIu64 " configuration words, %" PRIu64 " to FDRI\n",
+      loopback_idcode, cfg.syncs, cfg.syncs == 1 ? "" : "s", cfg.words, cfg.fdri_words);
+  if (cfg.mfw_writes)
+    fprintf(f, "                  %d frames by multiple frame write\n", cfg.mfw_writes);
+  if (cfg.programmed)
+    fprintf(f, "                  %s%s\n", cfg.done ? "DONE" : "not DONE", cfg.id_error ? ", IDCODE mismatch" : "");
+  else
+    /* the model starts unconfigured, so it can't be DONE after a partial load */
+    fprintf(f, "                  partial load, without JPROGRAM or startup%s\n", cfg.id_error ? ", IDCODE mismatch" : "");
+}
+
+int loopback_timeline(const char *filename)
+{
+  int i;
+  FILE *f = fopen(filename, "w");
+  if (!f)
+    return -1;
+  fprintf(f, "transfer,direction,bytes,tck,submit_us,start_us,end_us,chip_done_us,label\n");
+  for (i = 0; i < timeline_len; i++) {
+    TRANSFER *t = &timeline[i];
+    fprintf(f, "%d,%c,%d,%" PRIu64 ",%.2f,%.2f,%.2f,%.2f,%s\n", i, t->direction, t->bytes, t->tck, t->submit, t->start,
+        t->end, t->chip_done, t->label ? t->label : "");
+  }
+  return fclose(f);
+}
@@ -22,11 +22,12 @@
 // SOFTWARE.
 
 #include <stdio.h>
-#include <sys/select.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <zlib.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -43,11 +44,11 @@
 
 int ftdi_interface;
 
-#define BUFFER_MAX_LEN 100000000
 #define USB_TIMEOUT 5000
 #define ENDPOINT_IN ((ftdi_interface == 0) ? 0x02 : 0x04)
 #define ENDPOINT_OUT ((ftdi_interface == 0) ? 0x81 : 0x83)
 #define USB_CHUNKSIZE 4096
+#define USB_TRANSFERS 8 /* bulk writes in flight at once */
 #define USB_INDEX ((ftdi_interface == 0) ? 1 : 2)
 
 #define USBSIO_RESET 0 /* Reset the port */
@@ -69,6 +70,8 @@ FILE *logfile;
 int usb_bcddevice;
 uint8_t bitswap[256];
 int last_read_data_length;
+uint64_t usb_bytes_written;
+int usb_write_count, usb_read_count;
 struct ftdi_context *global_ftdi;
 #if defined(USE_TRACING)
 int trace = 1;
@@ -122,32 +125,94 @@ void memdump(const uint8_t *p, int len, char *title)
 }
 
 #ifndef USE_LIBFTDI
+#ifndef NO_LIBUSB
+/*
+ * Bulk writes are asynchronous, so that the next buffer can be filled
+ * while the last ones are still going out.  Each write is copied into one
+ * of USB_TRANSFERS transfers and submitted, and we only wait when they are
+ * all in flight, or before reading back, when the FTDI chip has to have
+ * seen everything ahead of the read.
+ */
+static struct {
+  struct libusb_transfer *transfer;
+  uint8_t buffer[USB_CHUNKSIZE];
+  int busy;
+} usb_writes[USB_TRANSFERS];
+static int usb_writes_busy, usb_write_next;
+
+static void usb_write_done(struct libusb_transfer *transfer)
+{
+  int *busy = transfer->user_data;
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED || transfer->actual_length != transfer->length) {
+    fprintf(stderr, "fpgajtag: usb bulk write failed: status %d req size %d act %d\n", transfer->status, transfer->length,
+        transfer->actual_length);
+    exit(-1);
+  }
+  *busy = 0;
+  usb_writes_busy--;
+}
+
+static void usb_wait_writes(int limit)
+{
+  while (usb_writes_busy > limit)
+    if (libusb_handle_events(usb_context) < 0) {
+      fprintf(stderr, "fpgajtag: usb event handling failed\n");
+      exit(-1);
+    }
+}
+
+static void usb_free_writes(void)
+{
+  int i;
+  usb_wait_writes(0);
+  for (i = 0; i < USB_TRANSFERS; i++) {
+    if (usb_writes[i].transfer)
+      libusb_free_transfer(usb_writes[i].transfer);
+    usb_writes[i].transfer = NULL;
+  }
+}
+#endif
+
 static int ftdi_write_data(struct ftdi_context *ftdi, const unsigned char *buf, int size)
 {
-  int actual_length = -1;
   int ret = -1;
   if (logging)
     formatwrite(1, buf, size, "WRITE");
 #ifndef NO_LIBUSB
-  ret = libusb_bulk_transfer(usbhandle, ENDPOINT_IN, (unsigned char *)buf, size, &actual_length, USB_TIMEOUT);
 #ifdef USE_LOGGING
   dump_bytes(log_depth + 2, __FUNCTION__, buf, size);
 #endif
+  usb_wait_writes(USB_TRANSFERS - 1);
+  while (usb_writes[usb_write_next].busy)
+    usb_write_next = (usb_write_next + 1) % USB_TRANSFERS;
+  if (!usb_writes[usb_write_next].transfer)
+    usb_writes[usb_write_next].transfer = libusb_alloc_transfer(0);
+  struct libusb_transfer *transfer = usb_writes[usb_write_next].transfer;
+  if (transfer && size <= USB_CHUNKSIZE) {
+    memcpy(usb_writes[usb_write_next].buffer, buf, size);
+    libusb_fill_bulk_transfer(transfer, usbhandle, ENDPOINT_IN, usb_writes[usb_write_next].buffer, size, usb_write_done,
+        &usb_writes[usb_write_next].busy, USB_TIMEOUT);
+    ret = libusb_submit_transfer(transfer);
+  }
+  if (!ret) {
+    usb_writes[usb_write_next].busy = 1;
+    usb_writes_busy++;
+    usb_write_next = (usb_write_next + 1) % USB_TRANSFERS;
+  }
 #endif
   if (ret < 0) {
-    fprintf(stderr, "fpgajtag: usb bulk write failed: ret %d req size %d act %d\n", ret, size, actual_length);
+    fprintf(stderr, "fpgajtag: usb bulk write failed: ret %d req size %d\n", ret, size);
     exit(-1);
   }
-  struct timeval timeout;
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 100;
-  select(0, NULL, NULL, NULL, &timeout);
-  return actual_length;
+  return size;
 }
 static int ftdi_read_data(struct ftdi_context *ftdi, unsigned char *buf, int size)
 {
   int actual_length = 1;
   int count = 0, ret = -1;
+#ifndef NO_LIBUSB
+  usb_wait_writes(0);
+#endif
   do {
     count++;
 #ifndef NO_LIBUSB
@@ -162,11 +227,9 @@ static int ftdi_read_data(struct ftdi_context *ftdi, unsigned char *buf, int siz
       // exit(-1);
       return -1;
     }
+    /* Until there is data, the FTDI chip answers with just its 2 status
+     * bytes, once per latency timer period, so this doesn't spin */
     actual_length -= 2;
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 100;
-    select(0, NULL, NULL, NULL, &timeout);
   } while (actual_length == 0);
   if (actual_length > 0) {
     memcpy(buf, usbreadbuffer + 2, actual_length);
@@ -182,6 +245,42 @@ static int ftdi_read_data(struct ftdi_context *ftdi, unsigned char *buf, int siz
 }
 #endif // end if not USE_LIBFTDI
 
+static int usb_write(const uint8_t *buf, int size)
+{
+  return ftdi_write_data(global_ftdi, buf, size);
+}
+
+static int usb_read(uint8_t *buf, int size)
+{
+  return ftdi_read_data(global_ftdi, buf, size);
+}
+
+/*
+ * Wait until all the writes have gone out
+ */
+static void usb_wait(void)
+{
+#if !defined(USE_LIBFTDI) && !defined(NO_LIBUSB)
+  usb_wait_writes(0);
+#endif
+}
+
+/*
+ * Everything goes through the transport, counting the traffic
+ */
+static int jtag_write(const uint8_t *buf, int size)
+{
+  usb_bytes_written += size;
+  usb_write_count++;
+  return jtag_transport->write(buf, size);
+}
+
+static int jtag_read(uint8_t *buf, int size)
+{
+  usb_read_count++;
+  return jtag_transport->read(buf, size);
+}
+
 /*
  * Write utility functions
  */
@@ -198,6 +297,19 @@ void write_data(uint8_t *buf, int size)
   EXIT();
 }
 
+/* As write_data(), reversing the bits of each byte on the way */
+void write_data_bitswap(const uint8_t *buf, int size)
+{
+  ENTER();
+  bitswap_copy(usbreadbuffer_ptr, buf, size);
+  usbreadbuffer_ptr += size;
+#ifdef USE_LOGGING
+  dump_bytes(log_depth + 2, "write_data_bitswap()", usbreadbuffer_ptr - size, size);
+#endif
+
+  EXIT();
+}
+
 void write_item(uint8_t *buf)
 {
   ENTER();
@@ -222,7 +334,7 @@ void flush_write(uint8_t *req)
   usbreadbuffer_ptr = usbreadbuffer;
   if (!write_length)
     return;
-  ftdi_write_data(global_ftdi, usbreadbuffer, write_length);
+  jtag_write(usbreadbuffer, write_length);
   read_size_ptr = 0;
 
   const uint8_t *p = usbreadbuffer;
@@ -310,7 +422,7 @@ uint8_t *read_data(void)
     }
   }
   if (expected_len + extra_bytes)
-    ftdi_read_data(global_ftdi, last_read_data, expected_len + extra_bytes);
+    jtag_read(last_read_data, expected_len + extra_bytes);
   last_read_data_length = expected_len;
   if (expected_len) {
     uint8_t *p = last_read_data;
@@ -351,7 +463,7 @@ uint8_t *read_data(void)
 /*
  * USB interface
  */
-USB_INFO *fpgausb_init(void)
+static USB_INFO *usb_init(void)
 {
   int i = 0;
 #ifndef NO_LIBUSB
@@ -406,7 +518,7 @@ USB_INFO *fpgausb_init(void)
   return usbinfo_array;
 }
 
-void fpgausb_open(int device_index, int interface)
+static void usb_open(int device_index, int interface)
 {
   int step = 0;
 #ifndef NO_LIBUSB
@@ -466,26 +578,23 @@ error:
   //    exit(-1);
 }
 
-void fpgausb_close(void)
+static void usb_close(void)
 {
-  flush_write(NULL);
 #ifdef USE_LIBFTDI
   int i;
   for (i = 0; i < 100; i++)
     ftdi_deinit(global_ftdi); /* flush out logfile */
 #else
 #ifndef NO_LIBUSB
+  usb_free_writes();
   if (usbhandle)
     libusb_close(usbhandle);
   usbhandle = NULL;
 #endif
 #endif
-  fflush(stdout);
 }
-void fpgausb_release(void)
+static void usb_release(void)
 {
-  fclose(logfile);
-  close(datafile_fd);
 #ifndef NO_LIBUSB
   libusb_free_device_list(device_list, 1);
 #ifndef USE_LIBFTDI
@@ -494,14 +603,52 @@ void fpgausb_release(void)
 #endif
 }
 
+JTAG_TRANSPORT usb_transport = { usb_init, usb_open, usb_write, usb_read, usb_wait, NULL, usb_close, usb_release };
+JTAG_TRANSPORT *jtag_transport = &usb_transport;
+
+USB_INFO *fpgausb_init(void)
+{
+  return jtag_transport->init();
+}
+
+void fpgausb_open(int device_index, int interface)
+{
+  jtag_transport->open(device_index, interface);
+}
+
+void fpgausb_wait(void)
+{
+  jtag_transport->wait();
+}
+
+void fpgausb_mark(const char *label)
+{
+  if (jtag_transport->mark)
+    jtag_transport->mark(label);
+}
+
+void fpgausb_close(void)
+{
+  flush_write(NULL);
+  jtag_transport->close();
+  fflush(stdout);
+}
+
+void fpgausb_release(void)
+{
+  fclose(logfile);
+  close(datafile_fd);
+  jtag_transport->release();
+}
+
 void sync_ftdi(int val)
 {
   uint8_t illegal_command[] = { val, SEND_IMMEDIATE };
   uint8_t errorcode_ret[] = { 0xfa, val };
   uint8_t retcode[2];
 
-  ftdi_write_data(global_ftdi, illegal_command, sizeof(illegal_command));
-  if (ftdi_read_data(global_ftdi, retcode, sizeof(retcode)) != sizeof(retcode)
+  jtag_write(illegal_command, sizeof(illegal_command));
+  if (jtag_read(retcode, sizeof(retcode)) != sizeof(retcode)
       || memcmp(retcode, errorcode_ret, sizeof(errorcode_ret))) {
     printf("%s: error in sync %x\n", __FUNCTION__, val);
     memdump(retcode, sizeof(retcode), "ACTUAL");
@@ -533,29 +680,185 @@ void init_ftdi(int device_index, int interface)
 
 /*
  * File support
+ *
+ * The input is mapped into memory rather than read, so there is no limit on
+ * its size.  A gzip'ed file is inflated a block at a time, as input_next()
+ * asks for it, so only INFLATE_WINDOW bytes of it are ever held.  Either
+ * way, input_fileptr and input_filesize describe the configuration data
+ * after any .bit header, but for a gzip'ed file only the start of it is at
+ * input_fileptr.
  */
+#define INFLATE_WINDOW (1024 * 1024)
+
+static uint8_t *input_map;     /* the file, mapped or read */
+static size_t input_map_size;
+static int input_map_malloced; /* read from a pipe */
+static char *input_name;       /* the file mapped */
+static int input_offset;       /* how far input_next() has got */
+static struct {
+  int active;
+  z_stream strm;
+  uint8_t *window;
+  int start, end; /* inflated, but not yet used */
+} gz;
+
+static void input_release(void)
+{
+  if (gz.active)
+    inflateEnd(&gz.strm);
+  gz.active = 0;
+  gz.start = gz.end = 0;
+  input_offset = 0;
+  free(input_name);
+  input_name = NULL;
+  if (input_map_malloced)
+    free(input_map);
+  else if (input_map)
+    munmap(input_map, input_map_size);
+  input_map = NULL;
+  input_map_size = 0;
+  input_map_malloced = 0;
+}
+
+static void map_input(int fd, const char *filename)
+{
+  struct stat st;
+  /*
+   * process_command_list() expects a nul after the file, which the end of
+   * the last page of a mapping provides, unless the file fills it.
+   */
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size % sysconf(_SC_PAGESIZE)) {
+    /* private and writable, as process_command_list() writes to it */
+    input_map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (input_map != MAP_FAILED) {
+      madvise(input_map, st.st_size, MADV_SEQUENTIAL);
+      input_map_size = st.st_size;
+      return;
+    }
+    input_map = NULL;
+  }
+
+  /* a pipe, so read it all */
+  size_t size = 1024 * 1024;
+  ssize_t len;
+  input_map = malloc(size);
+  input_map_malloced = 1;
+  while (input_map && (len = read(fd, input_map + input_map_size, size - input_map_size)) > 0) {
+    input_map_size += len;
+    if (input_map_size == size)
+      input_map = realloc(input_map, size *= 2);
+  }
+  if (!input_map) {
+    printf("fpgajtag: Out of memory reading '%s'\n", filename);
+    exit(-1);
+  }
+  input_map[input_map_size] = 0;
+}
+
+/* Inflate until there are size bytes in the window, or the end */
+static void inflate_input(int size)
+{
+  if (gz.end - gz.start >= size || !gz.active)
+    return;
+  memmove(gz.window, gz.window + gz.start, gz.end - gz.start);
+  gz.end -= gz.start;
+  gz.start = 0;
+  while (gz.end < size) {
+    gz.strm.next_out = gz.window + gz.end;
+    gz.strm.avail_out = INFLATE_WINDOW - gz.end;
+    int ret = inflate(&gz.strm, Z_NO_FLUSH);
+    gz.end = INFLATE_WINDOW - gz.strm.avail_out;
+    if (ret == Z_STREAM_END)
+      break;
+    if (ret != Z_OK) {
+      printf("fpgajtag: Error %d inflating input file\n", ret);
+      exit(-1);
+    }
+  }
+}
+
+/*
+ * The next size bytes of the configuration data, which must be no more than
+ * INFLATE_WINDOW.  They are only valid until the next call.
+ */
+uint8_t *input_next(int size)
+{
+  uint8_t *p;
+
+  if (input_offset + size > input_filesize) {
+    printf("fpgajtag: Read past the end of the input file\n");
+    exit(-1);
+  }
+  input_offset += size;
+  if (!gz.active)
+    return input_fileptr + input_offset - size;
+  inflate_input(size);
+  if (gz.end - gz.start < size) {
+    printf("fpgajtag: Input file is shorter than its gzip trailer says\n");
+    exit(-1);
+  }
+  p = gz.window + gz.start;
+  gz.start += size;
+  return p;
+}
+
+/* Reverse the bits of each byte of a word */
+static inline uint64_t bitswap64(uint64_t v)
+{
+  v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+  v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+  return ((v >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((v & 0x0f0f0f0f0f0f0f0fULL) << 4);
+}
+
+void bitswap_copy(uint8_t *dst, const uint8_t *src, int size)
+{
+  uint64_t v;
+  for (; size >= sizeof(v); size -= sizeof(v), src += sizeof(v), dst += sizeof(v)) {
+    memcpy(&v, src, sizeof(v));
+    v = bitswap64(v);
+    memcpy(dst, &v, sizeof(v));
+  }
+  while (size--)
+    *dst++ = bitswap64(*src++);
+}
+
 uint32_t read_inputfile(const char *filename)
 {
   static uint8_t bitfile_header[] = { 0, 9, 0xf, 0xf0, 0xf, 0xf0, 0xf, 0xf0, 0xf, 0xf0, 0, 0, 1, 'a' };
-  static uint8_t filebuf[BUFFER_MAX_LEN];
-  static uint8_t uncompressbuf[BUFFER_MAX_LEN];
   static uint8_t gzmagic[] = { 0x1f, 0x8b };
   static uint8_t elfmagic[] = { 0x7f, 'E', 'L', 'F' };
   int inputfd = 0; /* default input for '-' is stdin */
 
   if (!filename)
     return -1;
-  if (strcmp(filename, "-")) {
-    inputfd = open(filename, O_RDONLY);
-    if (inputfd == -1) {
-      printf("fpgajtag: Unable to open file '%s'\n", filename);
-      exit(-1);
+  if (input_name && !strcmp(filename, input_name)) {
+    /* read again from the start, as the caller and fpgajtag_main() both read it */
+    if (gz.active)
+      inflateEnd(&gz.strm);
+    gz.active = 0;
+    gz.start = gz.end = 0;
+    input_offset = 0;
+  }
+  else {
+    input_release();
+    if (strcmp(filename, "-")) {
+      inputfd = open(filename, O_RDONLY);
+      if (inputfd == -1) {
+        printf("fpgajtag: Unable to open file '%s'\n", filename);
+        exit(-1);
+      }
     }
+    map_input(inputfd, filename);
+    close(inputfd);
+    input_name = strdup(filename);
+  }
+  input_fileptr = input_map;
+  input_filesize = input_map_size;
+  if (input_map_size > INT32_MAX) {
+    printf("fpgajtag: Input file '%s' is too big\n", filename);
+    exit(-1);
   }
-  input_filesize = read(inputfd, filebuf, sizeof(filebuf));
-  input_fileptr = filebuf;
-  close(inputfd);
-  if (input_filesize <= 0 || input_filesize >= sizeof(filebuf) - 1)
+  if (input_filesize < 0x84 + sizeof(bitfile_header))
     goto badlen;
   if (!memcmp(input_fileptr, elfmagic, sizeof(elfmagic))) {
     int found = 0;
@@ -584,23 +887,23 @@ uint32_t read_inputfile(const char *filename)
   }
   if (!memcmp(input_fileptr, gzmagic, sizeof(gzmagic))) {
     printf("fpgajtag: unzip input file, len %d\n", input_filesize);
-    z_stream strm;
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    int ret = inflateInit2(&strm, 16 + MAX_WBITS); // inflate gzip'ed file
-    if (ret != Z_OK)
+    /* the gzip trailer ends with the uncompressed size, modulo 2^32 */
+    uint8_t *isize = input_fileptr + input_filesize - sizeof(uint32_t);
+    gz.strm.zalloc = Z_NULL;
+    gz.strm.zfree = Z_NULL;
+    gz.strm.opaque = Z_NULL;
+    gz.strm.next_in = input_fileptr;
+    gz.strm.avail_in = input_filesize;
+    if (!gz.window)
+      gz.window = malloc(INFLATE_WINDOW);
+    if (!gz.window || inflateInit2(&gz.strm, 16 + MAX_WBITS) != Z_OK) // inflate gzip'ed file
       goto badlen;
-    strm.next_in = input_fileptr;
-    strm.avail_in = input_filesize;
-    strm.next_out = uncompressbuf;
-    strm.avail_out = sizeof(uncompressbuf);
-    ret = inflate(&strm, Z_FINISH);
-    inflateEnd(&strm);
-    input_filesize = sizeof(uncompressbuf) - strm.avail_out;
-    if (ret != Z_STREAM_END)
+    gz.active = 1;
+    input_filesize = isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t)isize[3] << 24);
+    inflate_input(INFLATE_WINDOW);
+    if (input_filesize < 0x84 + sizeof(bitfile_header) || gz.end < 0x84 + sizeof(bitfile_header))
       goto badlen;
-    input_fileptr = uncompressbuf;
+    input_fileptr = gz.window;
   }
   if (!memcmp(bitfile_header, input_fileptr, sizeof(bitfile_header))) {
     uint8_t *inputtemp = input_fileptr;
@@ -613,7 +916,11 @@ uint32_t read_inputfile(const char *filename)
     if (*--input_fileptr == 'e')
       input_fileptr += 1 + sizeof(uint32_t); /* skip over 'e' and length */
     input_filesize -= input_fileptr - inputtemp;
+    if (gz.active)
+      gz.start = input_fileptr - gz.window;
   }
+  if (input_filesize < 0x84)
+    goto badlen;
 
   /*
    * Step 5: Check Device ID
@@ -624,7 +931,6 @@ uint32_t read_inputfile(const char *filename)
   tempidcode = (M(tempidcode) << 24) | (M(tempidcode >> 8) << 16) | (M(tempidcode >> 16) << 8) | M(tempidcode >> 24);
   return tempidcode;
 badlen:
-  printf(
-      "fpgajtag: Input file length exceeds static buffer size %ld.  You must recompile fpgajtag.\n", (long)sizeof(filebuf));
+  printf("fpgajtag: Input file '%s' is too short, or not a valid gzip file\n", filename);
   exit(-1);
 }
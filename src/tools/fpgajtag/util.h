@@ -93,9 +93,15 @@ extern FILE *logfile;
 extern int usb_bcddevice;
 extern uint8_t bitswap[256];
 extern int last_read_data_length;
+extern uint64_t usb_bytes_written;
+extern int usb_write_count, usb_read_count;
 extern int trace;
+/* only the start of a gzip'ed file is here: read it all with input_next() */
 extern uint8_t *input_fileptr;
 extern int input_filesize;
+/* set to compress the input with this part description, and to send
+ * only the frames that differ from this reference, see bitstream.h */
+extern const char *fpgajtag_part_file, *fpgajtag_reference_file;
 extern struct ftdi_context *global_ftdi;
 
 void memdump(const uint8_t *p, int len, char *title);
@@ -110,8 +116,34 @@ typedef struct {
 } USB_INFO;
 USB_INFO *fpgausb_init(void);
 void fpgausb_open(int device_index, int interface);
+void fpgausb_wait(void);
+void fpgausb_mark(const char *label);
 void fpgausb_close(void);
 void fpgausb_release(void);
+
+/*
+ * How the MPSSE commands get to the FTDI chip.  Normally that is libusb,
+ * but the loopback transport simulates the chip and a Xilinx FPGA, so the
+ * command stream can be measured without any hardware.
+ */
+typedef struct {
+  USB_INFO *(*init)(void); /* list the devices */
+  void (*open)(int device_index, int interface);
+  int (*write)(const uint8_t *buf, int size);
+  int (*read)(uint8_t *buf, int size); /* returns the bytes read, without the FTDI status */
+  void (*wait)(void);                  /* until all the writes have gone out */
+  void (*mark)(const char *label);     /* start of a phase, for the timeline (optional) */
+  void (*close)(void);
+  void (*release)(void);
+} JTAG_TRANSPORT;
+extern JTAG_TRANSPORT usb_transport, loopback_transport;
+extern JTAG_TRANSPORT *jtag_transport;
+
+/* loopback.c */
+extern uint32_t loopback_idcode;
+extern int loopback_latency;
+void loopback_report(FILE *f);
+int loopback_timeline(const char *filename);
 void init_ftdi(int device_index, int interface);
 
 void write_data(uint8_t *buf, int size);
@@ -124,4 +156,7 @@ uint8_t *read_data(void);
 void tmsw_delay(int delay_time, int extra);
 void idle_to_shift_dr(int extra);
 uint32_t read_inputfile(const char *filename);
+uint8_t *input_next(int size);
+void bitswap_copy(uint8_t *dst, const uint8_t *src, int size);
+void write_data_bitswap(const uint8_t *buf, int size);
 void sync_ftdi(int val);
@@ -1,112 +1,287 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #define PNG_DEBUG 3
 #include <png.h>
 
+#include "ghdlreport.h"
+
 #define MAXX 250
 #define MAXY 150
-unsigned char frame[MAXY][MAXX * 4];
 
-int maxx = 0;
-int maxy = 0;
+/*
+  Frames are parsed from the simulation output by the main thread, and
+  each complete one is handed to a pool of threads that compress and write
+  the PNG files, while the next frame is being parsed. There are a few more
+  frame buffers than threads, so parsing only waits when all the threads
+  are busy.
+*/
+struct frame {
+  int image_number;
+  int maxy;
+  unsigned char pixels[MAXY][MAXX * 4];
+  struct frame *next;
+};
 
-int image_number = 0;
+int threads = 4;
+int quiet = 0;
 
-void write_image(int image_number);
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+struct frame *free_frames = NULL;
+struct frame *queue_head = NULL, *queue_tail = NULL;
+int finished = 0;
 
-int main(int argc, char **argv)
+void write_image(struct frame *frame);
+
+void *png_writer(void *arg)
 {
+  while (1) {
+    pthread_mutex_lock(&lock);
+    while (!queue_head && !finished)
+      pthread_cond_wait(&cond, &lock);
+    struct frame *frame = queue_head;
+    if (!frame) {
+      pthread_mutex_unlock(&lock);
+      return NULL;
+    }
+    queue_head = frame->next;
+    if (!queue_head)
+      queue_tail = NULL;
+    pthread_mutex_unlock(&lock);
 
-  int count = 0;
-  int x, y, r, g, b;
+    write_image(frame);
+    // Clear frame for next one
+    memset(frame->pixels, 0, (frame->maxy + 1) * sizeof(frame->pixels[0]));
+
+    pthread_mutex_lock(&lock);
+    frame->next = free_frames;
+    free_frames = frame;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+struct frame *get_frame(void)
+{
+  pthread_mutex_lock(&lock);
+  while (!free_frames)
+    pthread_cond_wait(&cond, &lock);
+  struct frame *frame = free_frames;
+  free_frames = frame->next;
+  pthread_mutex_unlock(&lock);
+  frame->maxy = 0;
+  return frame;
+}
+
+void queue_frame(struct frame *frame)
+{
+  frame->next = NULL;
+  pthread_mutex_lock(&lock);
+  if (queue_tail)
+    queue_tail->next = frame;
+  else
+    queue_head = frame;
+  queue_tail = frame;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
 
-  char line[1024];
+int parse_number(const char **s, const char *end, int base, unsigned int *value)
+{
+  const char *p = *s;
+  *value = 0;
+  for (; p < end; p++) {
+    int digit;
+    if (*p >= '0' && *p <= '9')
+      digit = *p - '0';
+    else if (base == 16 && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+      digit = (*p | 0x20) - 'a' + 10;
+    else
+      break;
+    *value = *value * base + digit;
+  }
+  if (p == *s)
+    return -1;
+  *s = p;
+  return 0;
+}
 
-  printf("Clear frame...\n");
+int expect(const char **s, const char *end, const char *text)
+{
+  int len = strlen(text);
+  if (end - *s < len || memcmp(*s, text, len))
+    return -1;
+  *s += len;
+  return 0;
+}
 
-  for (y = 0; y < MAXY; y++)
-    for (x = 0; x < MAXX * 4; x++)
-      frame[y][x] = 0;
+int parse_signed(const char **s, const char *end, int *value)
+{
+  int negative = 0;
+  unsigned int v;
+  if (*s < end && **s == '-') {
+    negative = 1;
+    (*s)++;
+  }
+  if (parse_number(s, end, 10, &v))
+    return -1;
+  *value = negative ? -(int)v : (int)v;
+  return 0;
+}
+
+// Parse a message such as "PIXEL (12,34) = $5, RGBA = $ff00ff00"
+int parse_pixel(const ghdl_report *r, int *x, int *y, unsigned int *p, unsigned int *rgba)
+{
+  const char *s = r->message, *end = r->message + r->message_len;
+  if (expect(&s, end, "PIXEL (") || parse_signed(&s, end, x) || expect(&s, end, ",") || parse_signed(&s, end, y)
+      || expect(&s, end, ") = $") || parse_number(&s, end, 16, p) || expect(&s, end, ", RGBA = $")
+      || parse_number(&s, end, 16, rgba))
+    return -1;
+  return 0;
+}
 
-  printf("Read pixels...\n");
+void echo_line(const ghdl_report *r)
+{
+  fwrite(r->line, 1, r->line_len, stdout);
+  fputc('\n', stdout);
+}
 
-  line[0] = 0;
-  fgets(line, 1024, stdin);
+int maxx = 0;
+int maxy = 0;
+
+int image_number = 0;
+struct frame *frame = NULL;
+
+int pixel_report(const ghdl_report *report, void *context)
+{
+  int x, y, r, g, b;
   unsigned int rgba, p;
-  while (line[0]) {
-    if (sscanf(line, "%*[^\\.].vhdl:%*[^:]:%*d:%*[^:]:(report note): PIXEL (%d,%d) = $%x, RGBA = $%x", &x, &y, &p, &rgba)
-        == 4) {
-      r = (rgba >> 24) & 0xff;
-      g = (rgba >> 16) & 0xff;
-      b = (rgba >> 8) & 0xff;
-      if (rgba == 0 && p) {
-        // Palettised colour other than black, but with a black pixel
-        // so paint a different colour
-        // (this is because palette RAMs may not be functional in GHDL simulation)
-        if (p & 1)
-          r = 0xff;
-        if (p & 2)
-          g = 0xff;
-        if (p & 4)
-          b = 0xff;
-        if (!(p & 7)) {
-          r = 0x7f;
-          g = 0x7f;
-          b = p;
-        }
-        // printf("Colour patched to $%02x%02x%02x00\n",r,g,b);
-      }
-      //      printf("x=%d,y=%d, max=%d,%d\n",x,y,maxx,maxy);
-      if (y < maxy) {
-        printf("Writing image %d\n", ++image_number);
-        write_image(image_number);
-        // Clear frame for next one
-        maxx = 0;
-        maxy = 0;
-        for (y = 0; y < MAXY; y++)
-          for (x = 0; x < MAXX * 4; x++)
-            frame[y][x] = 0;
-      }
-      if (x >= 0 && x < MAXX && y >= 0 && y < MAXY) {
-        printf("%s", line);
-        frame[y][x * 4 + 0] = r;
-        frame[y][x * 4 + 1] = g;
-        frame[y][x * 4 + 2] = b;
-        frame[y][x * 4 + 3] = 0xff;
-        if (x > maxx)
-          maxx = x;
-        if (y > maxy)
-          maxy = y;
-      }
-      if (x == 20 && (maxy > 1)) {
-        // Save image progressively as each line written
-        //	      printf("  Got raster %d\n",y-1);
-        //	      count++;
-        //	      if (count==160) {
-        //	printf("  Writing raster %d\n",y-1);
-        //	write_image(image_number);
-        //	count=0;
-        //      }
+
+  if (!parse_pixel(report, &x, &y, &p, &rgba)) {
+    r = (rgba >> 24) & 0xff;
+    g = (rgba >> 16) & 0xff;
+    b = (rgba >> 8) & 0xff;
+    if (rgba == 0 && p) {
+      // Palettised colour other than black, but with a black pixel
+      // so paint a different colour
+      // (this is because palette RAMs may not be functional in GHDL simulation)
+      if (p & 1)
+        r = 0xff;
+      if (p & 2)
+        g = 0xff;
+      if (p & 4)
+        b = 0xff;
+      if (!(p & 7)) {
+        r = 0x7f;
+        g = 0x7f;
+        b = p;
       }
     }
-    else {
-      if (
-          //	  (strstr(line,"MAP"))||
-          (strstr(line, "LEGACY")))
-        printf("%s", line);
-      ;
+    if (y < maxy) {
+      ++image_number;
+      if (!quiet)
+        printf("Writing image %d\n", image_number);
+      frame->image_number = image_number;
+      frame->maxy = maxy;
+      queue_frame(frame);
+      frame = get_frame();
+      maxx = 0;
+      maxy = 0;
     }
+    if (x >= 0 && x < MAXX && y >= 0 && y < MAXY) {
+      if (!quiet)
+        echo_line(report);
+      frame->pixels[y][x * 4 + 0] = r;
+      frame->pixels[y][x * 4 + 1] = g;
+      frame->pixels[y][x * 4 + 2] = b;
+      frame->pixels[y][x * 4 + 3] = 0xff;
+      if (x > maxx)
+        maxx = x;
+      if (y > maxy)
+        maxy = y;
+    }
+  }
+  return 0;
+}
 
-    line[0] = 0;
-    fgets(line, 1024, stdin);
+int legacy_report(const ghdl_report *r, void *context)
+{
+  if (!ghdl_report_is(r, "PIXEL") && memmem(r->line, r->line_len, "LEGACY", 6))
+    echo_line(r);
+  return 0;
+}
+
+void usage(void)
+{
+  fprintf(stderr, "usage: frame2png [-q] [-j threads] < simulation output\n");
+  fprintf(stderr, "Writes frame-<n>.png for each frame of PIXEL reports from the simulation.\n");
+  fprintf(stderr, "  -q  don't echo the pixel and LEGACY lines, or report each image written.\n");
+  fprintf(stderr, "  -j  number of threads writing PNG files (default 4).\n");
+  exit(-3);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "qj:")) != -1) {
+    switch (opt) {
+    case 'q':
+      quiet = 1;
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      if (threads < 1)
+        usage();
+      break;
+    default:
+      usage();
+    }
   }
+
+  for (int i = 0; i < threads + 2; i++) {
+    struct frame *f = calloc(1, sizeof(struct frame));
+    if (!f) {
+      fprintf(stderr, "ERROR: Out of memory\n");
+      exit(-1);
+    }
+    f->next = free_frames;
+    free_frames = f;
+  }
+  frame = get_frame();
+
+  pthread_t writers[threads];
+  for (int i = 0; i < threads; i++)
+    pthread_create(&writers[i], NULL, png_writer, NULL);
+
+  if (!quiet)
+    printf("Read pixels...\n");
+
+  ghdl_log *log = ghdl_log_open(NULL);
+  if (!log)
+    exit(-1);
+  ghdl_log_on(log, "PIXEL", pixel_report, NULL);
+  if (!quiet)
+    ghdl_log_on(log, NULL, legacy_report, NULL);
+  ghdl_log_run(log);
+  ghdl_log_close(log);
+
+  pthread_mutex_lock(&lock);
+  finished = 1;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  for (int i = 0; i < threads; i++)
+    pthread_join(writers[i], NULL);
+
   return 0;
 }
 
-void write_image(int image_number)
+void write_image(struct frame *frame)
 {
   int y;
   png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -121,7 +296,7 @@ void write_image(int image_number)
     abort();
 
   char filename[1024];
-  snprintf(filename, 1024, "frame-%d.png", image_number);
+  snprintf(filename, 1024, "frame-%d.png", frame->image_number);
   FILE *f = fopen(filename, "wb");
   if (!f)
     abort();
@@ -133,10 +308,8 @@ void write_image(int image_number)
 
   png_write_info(png, info);
 
-  for (y = 0; y < maxy; y++) {
-    printf("  writing y=%d\n", y);
-    fflush(stdout);
-    png_write_row(png, frame[y]);
+  for (y = 0; y < frame->maxy; y++) {
+    png_write_row(png, frame->pixels[y]);
   }
   unsigned char empty_row[MAXX * 4];
   bzero(empty_row, sizeof(empty_row));
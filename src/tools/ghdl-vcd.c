@@ -1,21 +1,107 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-int main(int argc, char **argv)
+#include "ghdlreport.h"
+
+int active = 100000;
+time_t t;
+
+// Simulation time in ns
+long long timepoint(const ghdl_report *r)
+{
+  return r->time_fs / 1000000;
+}
+
+int register_write(const ghdl_report *r, void *context)
+{
+  static const char prefix[] = "Writing to register $";
+  if (r->message_len >= (int)sizeof(prefix) - 1 && !memcmp(r->message, prefix, sizeof(prefix) - 1))
+    active = 1000;
+  return 0;
+}
+
+// hr_cs0 = '1', hr_clk_p = '0', hr_reset = '1', hr_rwds = '0', hr_d = '0''0''0''0''0''0''0''0', ...
+int read_hyperram_state(const ghdl_report *r, const char *prefix, char *cs0, char *clk_p, char *reset, char *rwds, char *d)
+{
+  char key[64];
+  snprintf(key, sizeof(key), "%s_cs0", prefix);
+  if (ghdl_report_bits(r, key, cs0, 1) != 1)
+    return -1;
+  snprintf(key, sizeof(key), "%s_clk_p", prefix);
+  if (ghdl_report_bits(r, key, clk_p, 1) != 1)
+    return -1;
+  snprintf(key, sizeof(key), "%s_reset", prefix);
+  if (ghdl_report_bits(r, key, reset, 1) != 1)
+    return -1;
+  snprintf(key, sizeof(key), "%s_rwds", prefix);
+  if (ghdl_report_bits(r, key, rwds, 1) != 1)
+    return -1;
+  snprintf(key, sizeof(key), "%s_d", prefix);
+  if (ghdl_report_bits(r, key, d, 8) != 8)
+    return -1;
+  return 0;
+}
+
+int hyperram_state(const ghdl_report *r, void *context)
+{
+  char hr_cs0, hr_clk_p, hr_reset, hr_rwds;
+  char hr_d[8];
+  if (!active || read_hyperram_state(r, "hr", &hr_cs0, &hr_clk_p, &hr_reset, &hr_rwds, hr_d))
+    return 0;
+  printf("#%lld\n%c!\n%c\"\n%c&\n%c%%\nb%c%c%c%c%c%c%c%c ^\n", timepoint(r), hr_cs0, hr_clk_p, hr_reset, hr_rwds, hr_d[7],
+      hr_d[6], hr_d[5], hr_d[4], hr_d[3], hr_d[2], hr_d[1], hr_d[0]);
+  active--;
+  if (!active) {
+
+    exit(0);
+  }
+  return 0;
+}
+
+int hyperram_sample(const ghdl_report *r, void *context)
+{
+  char hr_sample;
+  if (!active || ghdl_report_bits(r, "hr_sample", &hr_sample, 1) != 1)
+    return 0;
+  long long t = timepoint(r);
+  if (hr_sample == '0')
+    t++;
+  printf("#%lld\n%cF\n", t, hr_sample);
+  return 0;
+}
+
+int hyperram2_state(const ghdl_report *r, void *context)
+{
+  char hr2_cs0, hr2_clk_p, hr2_reset, hr2_rwds;
+  char hr2_d[8];
+  if (!active || read_hyperram_state(r, "hr2", &hr2_cs0, &hr2_clk_p, &hr2_reset, &hr2_rwds, hr2_d))
+    return 0;
+  printf("%cA\n%cB\n%cC\n%cD\nb%c%c%c%c%c%c%c%c E\n", hr2_cs0, hr2_clk_p, hr2_reset, hr2_rwds, hr2_d[7], hr2_d[6], hr2_d[5],
+      hr2_d[4], hr2_d[3], hr2_d[2], hr2_d[1], hr2_d[0]);
+  return 0;
+}
+
+int i2c_state(const ghdl_report *r, void *context)
 {
-  char line[1024];
-  int timepoint;
-  int regnum;
-  int active = 100000;
   char sda, scl;
-  unsigned char hr_cs0, hr_clk_p, hr_reset, hr_rwds;
-  unsigned char hr_d[8];
-  unsigned char hr2_cs0, hr2_clk_p, hr2_reset, hr2_rwds;
-  unsigned char hr2_d[8];
-  unsigned char hr_sample, hr_return;
+  if (!active || ghdl_report_bits(r, "SDA", &sda, 1) != 1 || ghdl_report_bits(r, "SCL", &scl, 1) != 1)
+    return 0;
+  printf("#%lld\n%c!\n%c\"\n", timepoint(r), sda, scl);
+  return 0;
+}
 
-  time_t t = time(0);
+int check_time(const ghdl_report *r, void *context)
+{
+  if ((time(0) - t) > 20)
+    exit(0);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  t = time(0);
 
   printf("$date\n"
          "   Mon Feb 17 15:29:53 2020\n"
@@ -59,81 +145,16 @@ int main(int argc, char **argv)
          "$end\n"
          "\n");
 
-  line[0] = 0;
-  fgets(line, 1024, stdin);
-  while (line[0]) {
-    if (sscanf(line, "%*[^@]@%dns:(report note): Writing to register $%x", &timepoint, &regnum) == 2) {
-      active = 1000;
-    }
-    if (sscanf(line, "%*[^@]@%dus:(report note): Writing to register $%x", &timepoint, &regnum) == 2) {
-      timepoint *= 1000; // usec to ns
-      active = 1000;
-    }
-    if (active) {
-      int n = sscanf(line,
-          "%*[^@]@%dns:(report note): hr_cs0 = '%c', hr_clk_p = '%c', hr_reset = '%c', hr_rwds = '%c', hr_d = "
-          "'%c''%c''%c''%c''%c''%c''%c''%c', ",
-          &timepoint, &hr_cs0, &hr_clk_p, &hr_reset, &hr_rwds, &hr_d[0], &hr_d[1], &hr_d[2], &hr_d[3], &hr_d[4], &hr_d[5],
-          &hr_d[6], &hr_d[7]);
-      if (n < 13) {
-        n = sscanf(line,
-            "%*[^@]@%dus:(report note): hr_cs0 = '%c', hr_clk_p = '%c', hr_reset = '%c', hr_rwds = '%c', hr_d = "
-            "'%c''%c''%c''%c''%c''%c''%c''%c', ",
-            &timepoint, &hr_cs0, &hr_clk_p, &hr_reset, &hr_rwds, &hr_d[0], &hr_d[1], &hr_d[2], &hr_d[3], &hr_d[4], &hr_d[5],
-            &hr_d[6], &hr_d[7]);
-        timepoint *= 1000; // us to ns
-      }
-      if (n == 13) {
-        printf("#%d\n%c!\n%c\"\n%c&\n%c%%\nb%c%c%c%c%c%c%c%c ^\n", timepoint, (char)hr_cs0, (char)hr_clk_p, (char)hr_reset,
-            (char)hr_rwds, hr_d[7], hr_d[6], hr_d[5], hr_d[4], hr_d[3], hr_d[2], hr_d[1], hr_d[0]);
-        active--;
-        if (!active) {
-
-          exit(0);
-        }
-      }
-
-      if (active) {
-        int n = sscanf(line, "%*[^@]@%dns:(report note): hr_sample='%c'", &timepoint, &hr_sample);
-        if (n < 2) {
-          n = sscanf(line, "%*[^@]@%dus:(report note): hr_sample='%c'", &timepoint, &hr_sample);
-          timepoint *= 1000; // us to ns
-        }
-        if (n == 2) {
-          if (hr_sample == '0')
-            timepoint++;
-          printf("#%d\n%cF\n", timepoint, (char)hr_sample);
-        }
-      }
-
-      if (active) {
-        int n = sscanf(line,
-            "%*[^@]@%dns:(report note): hr2_cs0 = '%c', hr2_clk_p = '%c', hr2_reset = '%c', hr2_rwds = '%c', hr2_d = "
-            "'%c''%c''%c''%c''%c''%c''%c''%c', ",
-            &timepoint, &hr2_cs0, &hr2_clk_p, &hr2_reset, &hr2_rwds, &hr2_d[0], &hr2_d[1], &hr2_d[2], &hr2_d[3], &hr2_d[4],
-            &hr2_d[5], &hr2_d[6], &hr2_d[7]);
-        if (n < 13) {
-          n = sscanf(line,
-              "%*[^@]@%dus:(report note): hr2_cs0 = '%c', hr2_clk_p = '%c', hr2_reset = '%c', hr2_rwds = '%c', hr2_d = "
-              "'%c''%c''%c''%c''%c''%c''%c''%c', ",
-              &timepoint, &hr2_cs0, &hr2_clk_p, &hr2_reset, &hr2_rwds, &hr2_d[0], &hr2_d[1], &hr2_d[2], &hr2_d[3], &hr2_d[4],
-              &hr2_d[5], &hr2_d[6], &hr2_d[7]);
-          timepoint *= 1000; // us to ns
-        }
-        if (n == 13) {
-          printf("%cA\n%cB\n%cC\n%cD\nb%c%c%c%c%c%c%c%c E\n", (char)hr2_cs0, (char)hr2_clk_p, (char)hr2_reset,
-              (char)hr2_rwds, hr2_d[7], hr2_d[6], hr2_d[5], hr2_d[4], hr2_d[3], hr2_d[2], hr2_d[1], hr2_d[0]);
-        }
-      }
-      if (sscanf(line, "%*[^@]@%dns:(report note): SDA='%c', SCL='%c'", &timepoint, &sda, &scl) == 3) {
-        printf("#%d\n%c!\n%c\"\n", timepoint, (char)sda, (char)scl);
-      }
-    }
-
-    if ((time(0) - t) > 20)
-      exit(0);
-
-    line[0] = 0;
-    fgets(line, 1024, stdin);
-  }
+  ghdl_log *log = ghdl_log_open(NULL);
+  if (!log)
+    exit(-1);
+  ghdl_log_on(log, "Writing", register_write, NULL);
+  ghdl_log_on(log, "hr_cs0", hyperram_state, NULL);
+  ghdl_log_on(log, "hr_sample", hyperram_sample, NULL);
+  ghdl_log_on(log, "hr2_cs0", hyperram2_state, NULL);
+  ghdl_log_on(log, "SDA", i2c_state, NULL);
+  ghdl_log_on(log, NULL, check_time, NULL);
+  ghdl_log_run(log);
+  ghdl_log_close(log);
+  return 0;
 }
@@ -0,0 +1,364 @@
+/*
+  Reading the output of GHDL simulations. See ghdlreport.h.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ghdlreport.h"
+
+// Pipes are read this much at a time
+#define READ_BLOCK (4 * 1024 * 1024)
+
+#define MAX_HANDLERS 32
+
+struct ghdl_log {
+  int fd;
+
+  // A file mapped into memory
+  const char *map;
+  size_t map_size;
+
+  // Or a buffer of what has been read so far
+  char *buffer;
+  size_t held;
+  int eof;
+
+  // Where the next line starts, in map or buffer
+  size_t pos;
+
+  struct {
+    char *tag;
+    int tag_len;
+    ghdl_report_handler handler;
+    void *context;
+  } handlers[MAX_HANDLERS];
+  int handler_count;
+
+  ghdl_report report;
+};
+
+ghdl_log *ghdl_log_open(const char *name)
+{
+  ghdl_log *log = calloc(1, sizeof(ghdl_log));
+  if (!log)
+    return NULL;
+
+  if (!name || !strcmp(name, "-"))
+    log->fd = 0;
+  else {
+    log->fd = open(name, O_RDONLY);
+    if (log->fd < 0) {
+      fprintf(stderr, "ERROR: Could not open '%s': %s\n", name, strerror(errno));
+      free(log);
+      return NULL;
+    }
+  }
+
+  struct stat st;
+  if (!fstat(log->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, log->fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      log->map = map;
+      log->map_size = st.st_size;
+      return log;
+    }
+  }
+
+  log->buffer = malloc(READ_BLOCK);
+  if (!log->buffer) {
+    ghdl_log_close(log);
+    return NULL;
+  }
+  return log;
+}
+
+void ghdl_log_close(ghdl_log *log)
+{
+  if (log->map)
+    munmap((void *)log->map, log->map_size);
+  free(log->buffer);
+  if (log->fd > 0)
+    close(log->fd);
+  for (int i = 0; i < log->handler_count; i++)
+    free(log->handlers[i].tag);
+  free(log);
+}
+
+// Find the next line, reading more if need be
+static int next_line(ghdl_log *log, const char **line, int *len)
+{
+  if (log->map) {
+    if (log->pos >= log->map_size)
+      return 0;
+    const char *start = log->map + log->pos;
+    const char *nl = memchr(start, '\n', log->map_size - log->pos);
+    size_t n = nl ? (size_t)(nl - start) : log->map_size - log->pos;
+    *line = start;
+    *len = n;
+    log->pos += n + 1;
+    return 1;
+  }
+
+  while (1) {
+    char *start = log->buffer + log->pos;
+    char *nl = memchr(start, '\n', log->held - log->pos);
+    if (nl || (log->eof && log->pos < log->held) || (!log->pos && log->held == READ_BLOCK)) {
+      // A whole line, the last line, or as much of a very long line as fits
+      size_t n = nl ? (size_t)(nl - start) : log->held - log->pos;
+      *line = start;
+      *len = n;
+      log->pos += nl ? n + 1 : n;
+      return 1;
+    }
+    if (log->eof)
+      return 0;
+
+    memmove(log->buffer, start, log->held - log->pos);
+    log->held -= log->pos;
+    log->pos = 0;
+    ssize_t r = read(log->fd, log->buffer + log->held, READ_BLOCK - log->held);
+    if (r <= 0)
+      log->eof = 1;
+    else
+      log->held += r;
+  }
+}
+
+// Move *end back to the previous colon, returning the start of the field after it
+static const char *field_before(const char *line, const char **end)
+{
+  const char *p = *end;
+  while (p > line && p[-1] != ':')
+    p--;
+  const char *field = p;
+  *end = p > line ? p - 1 : NULL;
+  return field;
+}
+
+static int parse_int(const char *s, const char *end)
+{
+  int v = 0;
+  for (; s < end && *s >= '0' && *s <= '9'; s++)
+    v = v * 10 + *s - '0';
+  return v;
+}
+
+static void parse_report(ghdl_report *r)
+{
+  const char *line = r->line, *end = line + r->line_len;
+
+  const char *marker = memmem(line, r->line_len, ":(report ", 9);
+  int marker_len = 9;
+  if (!marker) {
+    marker = memmem(line, r->line_len, ":(assertion ", 12);
+    marker_len = 12;
+  }
+  if (!marker)
+    return;
+
+  r->severity = marker + marker_len;
+  const char *close = memchr(r->severity, ')', end - r->severity);
+  if (!close || close + 1 >= end || close[1] != ':')
+    return;
+  r->severity_len = close - r->severity;
+  r->message = close + 2;
+  if (r->message < end && *r->message == ' ')
+    r->message++;
+  r->message_len = end - r->message;
+
+  // file:line:column:@time before the marker
+  const char *field_end = marker;
+  const char *time = field_before(line, &field_end);
+  if (!field_end || *time != '@')
+    return;
+  const char *time_end = marker;
+  const char *column = field_before(line, &field_end);
+  const char *column_end = time - 1;
+  if (!field_end)
+    return;
+  const char *line_number = field_before(line, &field_end);
+  const char *line_number_end = column - 1;
+  if (!field_end)
+    return;
+  r->file = line;
+  r->file_len = field_end - line;
+  r->line_number = parse_int(line_number, line_number_end);
+  r->column = parse_int(column, column_end);
+
+  const char *t = time + 1;
+  r->time_value = 0;
+  for (; t < time_end && *t >= '0' && *t <= '9'; t++)
+    r->time_value = r->time_value * 10 + *t - '0';
+  int units_len = time_end - t < 3 ? time_end - t : 3;
+  memcpy(r->time_units, t, units_len);
+  r->time_units[units_len] = 0;
+  static const struct {
+    const char *units;
+    long long fs;
+  } scales[] = { { "fs", 1LL }, { "ps", 1000LL }, { "ns", 1000000LL }, { "us", 1000000000LL }, { "ms", 1000000000000LL },
+    { "sec", 1000000000000000LL }, { NULL, 0 } };
+  r->time_fs = 0;
+  for (int i = 0; scales[i].units; i++)
+    if (!strcmp(r->time_units, scales[i].units))
+      r->time_fs = r->time_value * scales[i].fs;
+
+  const char *tag_end = r->message;
+  while (tag_end < end && *tag_end != ' ' && *tag_end != ':' && *tag_end != '=' && *tag_end != '(' && *tag_end != ',')
+    tag_end++;
+  r->tag = r->message;
+  r->tag_len = tag_end - r->message;
+  r->is_report = 1;
+}
+
+int ghdl_log_next(ghdl_log *log, ghdl_report *r)
+{
+  const char *line;
+  int len;
+  if (!next_line(log, &line, &len))
+    return 0;
+  while (len && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+    len--;
+
+  memset(r, 0, sizeof(ghdl_report));
+  r->line = line;
+  r->line_len = len;
+  parse_report(r);
+  return 1;
+}
+
+int ghdl_log_on(ghdl_log *log, const char *tag, ghdl_report_handler handler, void *context)
+{
+  if (log->handler_count == MAX_HANDLERS)
+    return -1;
+  log->handlers[log->handler_count].tag = tag ? strdup(tag) : NULL;
+  log->handlers[log->handler_count].tag_len = tag ? strlen(tag) : 0;
+  log->handlers[log->handler_count].handler = handler;
+  log->handlers[log->handler_count].context = context;
+  log->handler_count++;
+  return 0;
+}
+
+int ghdl_log_run(ghdl_log *log)
+{
+  ghdl_report *r = &log->report;
+  while (ghdl_log_next(log, r)) {
+    for (int i = 0; i < log->handler_count; i++) {
+      if (log->handlers[i].tag
+          && (!r->is_report || r->tag_len != log->handlers[i].tag_len
+              || memcmp(r->tag, log->handlers[i].tag, r->tag_len)))
+        continue;
+      int result = log->handlers[i].handler(r, log->handlers[i].context);
+      if (result)
+        return result;
+    }
+  }
+  return 0;
+}
+
+int ghdl_report_is(const ghdl_report *r, const char *tag)
+{
+  int len = strlen(tag);
+  return r->is_report && r->tag_len == len && !memcmp(r->tag, tag, len);
+}
+
+char *ghdl_report_message(const ghdl_report *r, char *out, int size)
+{
+  int len = r->message_len < size - 1 ? r->message_len : size - 1;
+  if (len > 0)
+    memcpy(out, r->message, len);
+  out[len > 0 ? len : 0] = 0;
+  return out;
+}
+
+int ghdl_report_value(const ghdl_report *r, const char *key, const char **value, int *len)
+{
+  if (!r->is_report)
+    return -1;
+  const char *s = r->message, *end = r->message + r->message_len;
+  int key_len = strlen(key);
+  while (s < end) {
+    const char *k = memmem(s, end - s, key, key_len);
+    if (!k)
+      return -1;
+    s = k + key_len;
+    // The key must be a whole word
+    if (k > r->message && k[-1] != ' ' && k[-1] != ',')
+      continue;
+    const char *v = s;
+    while (v < end && *v == ' ')
+      v++;
+    if (v == end || *v != '=')
+      continue;
+    v++;
+    while (v < end && *v == ' ')
+      v++;
+    const char *v_end = v;
+    while (v_end < end && !(*v_end == ',' && (v_end + 1 == end || v_end[1] == ' ')))
+      v_end++;
+    *value = v;
+    *len = v_end - v;
+    return 0;
+  }
+  return -1;
+}
+
+int ghdl_report_number(const ghdl_report *r, const char *key, long long *number)
+{
+  const char *v;
+  int len;
+  if (ghdl_report_value(r, key, &v, &len) || !len)
+    return -1;
+
+  if (len == 3 && v[0] == '\'' && v[2] == '\'') {
+    if (v[1] != '0' && v[1] != '1')
+      return -1;
+    *number = v[1] - '0';
+    return 0;
+  }
+
+  int base = 10, negative = 0, i = 0;
+  if (v[0] == '$') {
+    base = 16;
+    i++;
+  }
+  else if (v[0] == '-') {
+    negative = 1;
+    i++;
+  }
+  if (i == len)
+    return -1;
+  long long n = 0;
+  for (; i < len; i++) {
+    int digit;
+    if (v[i] >= '0' && v[i] <= '9')
+      digit = v[i] - '0';
+    else if (base == 16 && (v[i] | 0x20) >= 'a' && (v[i] | 0x20) <= 'f')
+      digit = (v[i] | 0x20) - 'a' + 10;
+    else
+      break;
+    n = n * base + digit;
+  }
+  *number = negative ? -n : n;
+  return 0;
+}
+
+int ghdl_report_bits(const ghdl_report *r, const char *key, char *out, int max)
+{
+  const char *v;
+  int len;
+  if (ghdl_report_value(r, key, &v, &len))
+    return -1;
+  int n = 0;
+  for (int i = 0; i + 2 < len && v[i] == '\'' && v[i + 2] == '\'' && n < max; i += 3)
+    out[n++] = v[i + 1];
+  return n;
+}
@@ -0,0 +1,83 @@
+/*
+  Reading the output of GHDL simulations, as used by frame2png, ghdl-vcd,
+  iecwaveform and sdstates.
+
+  Report statements in the VHDL appear in the output as lines such as
+
+    /path/to/tb_iec_serial.vhdl:123:9:@6173ps:(report note): IECBUSSTATE: ATN='1', CLK(c64)='1'
+
+  Each line is split into the file, line, column, time, severity and
+  message, working back from the "(report" so that colons in the path
+  don't matter. The tag is the first word of the message ("IECBUSSTATE"
+  above), and handlers can be registered for a tag, or for every line.
+
+  Files are mapped into memory, and pipes read in large blocks, so the
+  lines and fields point into a buffer, and are not NUL terminated. They
+  are only valid until the next line is read.
+*/
+
+#ifndef GHDLREPORT_H
+#define GHDLREPORT_H
+
+typedef struct ghdl_report {
+  // The whole line, without the line ending
+  const char *line;
+  int line_len;
+
+  // Whether the line is a report (or assertion) at all. If not, only the
+  // line is set.
+  int is_report;
+  const char *file;
+  int file_len;
+  int line_number, column;
+  // The time as given, and in femtoseconds
+  long long time_value;
+  char time_units[4];
+  long long time_fs;
+  // note, warning, error or failure
+  const char *severity;
+  int severity_len;
+  const char *message;
+  int message_len;
+  const char *tag;
+  int tag_len;
+} ghdl_report;
+
+/*
+  Handlers return 0 to carry on, or anything else to stop ghdl_log_run(),
+  which returns that value. Calling ghdl_log_run() again carries on from
+  the next line.
+*/
+typedef int (*ghdl_report_handler)(const ghdl_report *r, void *context);
+
+typedef struct ghdl_log ghdl_log;
+
+// Open a file, or standard input if name is NULL or "-". Returns NULL on an error.
+ghdl_log *ghdl_log_open(const char *name);
+void ghdl_log_close(ghdl_log *log);
+
+// Read the next line. Returns 1, or 0 at the end.
+int ghdl_log_next(ghdl_log *log, ghdl_report *r);
+
+// Call handler for each report with this tag, or for every line if tag is NULL
+int ghdl_log_on(ghdl_log *log, const char *tag, ghdl_report_handler handler, void *context);
+int ghdl_log_run(ghdl_log *log);
+
+// Whether the report has this tag
+int ghdl_report_is(const ghdl_report *r, const char *tag);
+
+// Copy the message, NUL terminated, for sscanf() etc.
+char *ghdl_report_message(const ghdl_report *r, char *out, int size);
+
+/*
+  Values in messages of the form "key = value, key2='1', key3 = $1F". The
+  value runs to the next ", " or the end of the message. Returns 0 and the
+  value, or -1 if the key is not there.
+*/
+int ghdl_report_value(const ghdl_report *r, const char *key, const char **value, int *len);
+// A value that is a number, in decimal, or hex after a $, or a bit in quotes
+int ghdl_report_number(const ghdl_report *r, const char *key, long long *number);
+// A value made of quoted characters, such as '0''1''Z', into out. Returns how many.
+int ghdl_report_bits(const ghdl_report *r, const char *key, char *out, int max);
+
+#endif
@@ -7,6 +7,10 @@
 #include <strings.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "hyppotrace.h"
 
 int do_screen_shot_ascii(FILE *f);
 int do_screen_shot(char *filename);
@@ -79,6 +83,18 @@ struct cpu {
   struct termination_conditions term;
   bool stack_overflow;
   bool stack_underflow;
+  // CPU cycles used since the routine was called, including DMA. These are
+  // 4502 cycles, as at 1MHz, not 40.5MHz ones (see cycle_table).
+  unsigned long long cycles;
+
+  // Cached 16-bit to 28-bit address translation for each 4KB bank.
+  // Rebuilt lazily whenever $00/$01 or the MAP registers change.
+  bool map_valid;
+  unsigned int map_read[16];
+  unsigned int map_write[16];
+  // Direct pointer to the backing RAM for reads, if the whole bank
+  // lies within a single memory, or NULL if it must go via read_memory28()
+  unsigned char *map_read_ptr[16];
 };
 
 #define FLAG_N 0x80
@@ -93,11 +109,19 @@ struct cpu {
 // By default we log to stderr
 FILE *logfile = NULL;
 char logfilename[8192] = "";
-#define TESTLOGFILE "/tmp/hyppotest.tmp"
+#define TESTLOGFILE "/tmp/hyppotest.%d.tmp"
+char testlogfile[1024];
 
 bool fail_on_stack_overflow = true;
 bool fail_on_stack_underflow = true;
 bool log_on_failure = false;
+// Fast mode (-f) keeps only a short instruction log, and doesn't track
+// which instruction wrote each memory location, unless a test asks for the
+// complete log with "log on failure", or has failed
+bool fast_mode = false;
+bool keep_blame = true;
+// Do all DMA jobs a byte at a time (-d), to compare with the bulk path
+bool dma_byte_at_a_time = false;
 int test_passes = 0;
 int test_fails = 0;
 char test_name[1024] = "unnamed test";
@@ -121,6 +145,15 @@ unsigned char hypporam_expected[HYPPORAM_SIZE];
 unsigned char colourram_expected[COLOURRAM_SIZE];
 unsigned char ffdram_expected[65536];
 
+// Pages of memory that may differ from their expected state. Unmarked
+// pages are known to match, so they need not be copied or compared.
+#define DIRTY_PAGE_SHIFT 8
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+unsigned char chipram_dirty[CHIPRAM_SIZE >> DIRTY_PAGE_SHIFT];
+unsigned char hypporam_dirty[HYPPORAM_SIZE >> DIRTY_PAGE_SHIFT];
+unsigned char colourram_dirty[COLOURRAM_SIZE >> DIRTY_PAGE_SHIFT];
+unsigned char ffdram_dirty[65536 >> DIRTY_PAGE_SHIFT];
+
 // Instructions which modified the memory location last
 unsigned int chipram_blame[CHIPRAM_SIZE];
 unsigned int hypporam_blame[HYPPORAM_SIZE];
@@ -139,8 +172,6 @@ int hyppo_symbol_count = 0;
 hyppo_symbol symbols[MAX_SYMBOLS];
 int symbol_count = 0;
 
-hyppo_symbol *sym_by_addr[CHIPRAM_SIZE] = { NULL };
-
 struct cpu cpu;
 struct cpu cpu_expected;
 
@@ -161,13 +192,57 @@ typedef struct instruction_log {
   unsigned char pops;
   unsigned int pop_blame[MAX_POPS];
 } instruction_log;
+// Maximum number of instructions a single routine call may execute
 #define MAX_LOG_LENGTH (32 * 1024 * 1024)
-instruction_log *cpulog[MAX_LOG_LENGTH];
+// Only the most recent cpulog_depth instructions are retained in the log.
+// The log is a ring buffer allocated once, so that long running routines
+// do not thrash the allocator, and memory use stays bounded.
+#define DEFAULT_LOG_DEPTH (1024 * 1024)
+#define MIN_LOG_DEPTH 64
+#define TEST_LOG_DEPTH (fast_mode ? MIN_LOG_DEPTH : DEFAULT_LOG_DEPTH)
+instruction_log *cpulog = NULL;
+int cpulog_depth = 0;
 int cpulog_len = 0;
 
 #define INFINITE_LOOP_THRESHOLD 65536
 
-instruction_log *lastataddr[65536] = { NULL };
+// Copy of the most recent distinct instruction state at each address, and
+// the instruction number it came from (-1 = none). Kept outside of the ring
+// buffer so that loop counts survive the original entry being recycled.
+instruction_log lastataddr[65536];
+int lastataddr_instruction[65536];
+
+// Binary trace of execution ("trace to <file>"), see hyppotrace.h
+FILE *trace_file = NULL;
+uint32_t trace_instructions = 0;
+// Only memory writes done by instructions are traced
+bool trace_writes = false;
+
+// Cycles used by each routine ("profile on"), by symbol. The entries are
+// taken from the symbols known when profiling starts.
+typedef struct profile_entry {
+  char *name;
+  unsigned int addr;
+  // Cycles spent in the routine itself, and including the routines it called
+  unsigned long long exclusive;
+  unsigned long long inclusive;
+  unsigned int calls;
+  // Number of calls to the routine under way, so that recursive calls are
+  // only counted once in the inclusive cycles
+  unsigned int active;
+} profile_entry;
+profile_entry *profile_entries = NULL;
+int profile_entry_count = 0;
+// Entry owning each address, i.e., the closest symbol at or below it (-1 = none)
+int profile_owner[65536];
+// Routines called by JSR that have not yet returned
+#define MAX_PROFILE_DEPTH 256
+struct profile_frame {
+  int entry;
+  unsigned long long start;
+} profile_stack[MAX_PROFILE_DEPTH];
+int profile_depth = 0;
+int trace_close(void);
 
 char *describe_address(unsigned int addr);
 char *describe_address_label(struct cpu *cpu, unsigned int addr);
@@ -177,6 +252,55 @@ void disassemble_instruction(FILE *f, struct instruction_log *log);
 int write_mem28(struct cpu *cpu, unsigned int addr, unsigned char value);
 unsigned int memory_blame(struct cpu *cpu, unsigned int addr16);
 
+int cpulog_set_depth(int depth)
+{
+  if (depth < MIN_LOG_DEPTH) {
+    fprintf(stderr, "ERROR: Instruction log depth must be at least %d.\n", MIN_LOG_DEPTH);
+    return -1;
+  }
+  if (cpulog && depth == cpulog_depth)
+    return 0;
+  instruction_log *new_log = calloc(depth, sizeof(instruction_log));
+  if (!new_log) {
+    fprintf(stderr, "ERROR: Could not allocate instruction log of %d entries.\n", depth);
+    return -1;
+  }
+  free(cpulog);
+  cpulog = new_log;
+  cpulog_depth = depth;
+  // Discard history, as the old entries no longer map to the right slots.
+  // Entry 0 stands for the machine reset, as in cpu_log_reset().
+  cpulog_len = 1;
+  memset(lastataddr_instruction, 0xff, sizeof(lastataddr_instruction));
+  return 0;
+}
+
+// Go back to the full instruction log and memory blame, in fast mode
+int keep_full_history(void)
+{
+  keep_blame = true;
+  if (cpulog_depth < DEFAULT_LOG_DEPTH)
+    return cpulog_set_depth(DEFAULT_LOG_DEPTH);
+  return 0;
+}
+
+// Returns the log entry for instruction number i, or NULL if it has
+// already been recycled (or was never logged).
+static inline instruction_log *cpulog_entry(int i)
+{
+  if (i < 0 || i >= cpulog_len || i < cpulog_len - cpulog_depth)
+    return NULL;
+  return &cpulog[i % cpulog_depth];
+}
+
+// Oldest instruction number still present in the log
+static inline int cpulog_first_retained(void)
+{
+  if (cpulog_len > cpulog_depth)
+    return cpulog_len - cpulog_depth;
+  return 0;
+}
+
 int rel8_delta(unsigned char c)
 {
   if (c < 0x80)
@@ -230,14 +354,14 @@ void disassemble_iabs(FILE *f, struct instruction_log *log)
   // historical memory mappings.
   if (memory_blame(&fakecpu, log->zp_pointer + 0)) {
     fprintf(f, "I%d: ", memory_blame(&fakecpu, log->zp_pointer + 0));
-    disassemble_instruction(f, cpulog[memory_blame(&fakecpu, log->zp_pointer + 0)]);
+    disassemble_instruction(f, cpulog_entry(memory_blame(&fakecpu, log->zp_pointer + 0)));
   }
   else
     fprintf(f, "<uninitialised memory>");
   fprintf(f, " and ");
   if (memory_blame(&fakecpu, log->zp_pointer + 1)) {
     fprintf(f, "I%d: ", memory_blame(&fakecpu, log->zp_pointer + 1));
-    disassemble_instruction(f, cpulog[memory_blame(&fakecpu, log->zp_pointer + 1)]);
+    disassemble_instruction(f, cpulog_entry(memory_blame(&fakecpu, log->zp_pointer + 1)));
   }
   else
     fprintf(f, "<uninitialised memory>");
@@ -299,12 +423,22 @@ void disassemble_izpz32(FILE *f, struct instruction_log *log)
   fprintf(f, "[$%02X],Z {PTR=$%04X,ADDR32=$%07X}", log->bytes[1], log->zp_pointer, log->zp_pointer_addr);
 }
 
+void disassemble_logged_instruction(FILE *f, unsigned int instruction)
+{
+  struct instruction_log *log = cpulog_entry(instruction);
+  if (log) {
+    fprintf(f, "$%04X ", log->pc);
+    disassemble_instruction(f, log);
+  }
+  else
+    fprintf(f, "I%d <no longer in instruction log>", instruction);
+}
+
 void disassemble_stack_source(FILE *f, struct instruction_log *log)
 {
   fprintf(f, "  {Pushed by ");
   if (log->pop_blame[0]) {
-    fprintf(f, "$%04X ", cpulog[log->pop_blame[0]]->pc);
-    disassemble_instruction(f, cpulog[log->pop_blame[0]]);
+    disassemble_logged_instruction(f, log->pop_blame[0]);
   }
   else
     fprintf(f, "<unitialised stack location>");
@@ -313,905 +447,98 @@ void disassemble_stack_source(FILE *f, struct instruction_log *log)
 
 void disassemble_instruction(FILE *f, struct instruction_log *log)
 {
-
+  if (!log) {
+    fprintf(f, "<no longer in instruction log>");
+    return;
+  }
   if (!log->len)
     return;
-  switch (log->bytes[0]) {
-  case 0x00:
-    fprintf(f, "BRK  ");
-    disassemble_imm(f, log);
-    break;
-  case 0x01:
-    fprintf(f, "ORA  ");
-    disassemble_izpx(f, log);
-    break;
-  case 0x03:
-    fprintf(f, "SEE");
-    break;
-  case 0x04:
-    fprintf(f, "TSB  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x05:
-    fprintf(f, "ORA  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x06:
-    fprintf(f, "ASL  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x07:
-    fprintf(f, "RMB0 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x08:
-    fprintf(f, "PHP");
-    break;
-  case 0x09:
-    fprintf(f, "ORA  ");
-    disassemble_imm(f, log);
-    break;
-  case 0x0A:
-    fprintf(f, "ASL  A");
-    break;
-  case 0x0c:
-    fprintf(f, "TSB  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x0d:
-    fprintf(f, "ORA  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x0E:
-    fprintf(f, "ASL  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x0F:
-    fprintf(f, "BBR0 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x10:
-    fprintf(f, "BPL  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0x11:
-    fprintf(f, "ORA  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0x12:
-    fprintf(f, "ORA  ");
-    disassemble_izpz(f, log);
-    break;
-  case 0x13:
-    fprintf(f, "BPL  ");
-    disassemble_rel16(f, log);
-    break;
-  case 0x14:
-    fprintf(f, "TRB  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x15:
-    fprintf(f, "ORA  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x16:
-    fprintf(f, "ASL  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x17:
-    fprintf(f, "RMB1 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x18:
-    fprintf(f, "CLC");
-    break;
-  case 0x19:
-    fprintf(f, "ORA  ");
-    disassemble_absy(f, log);
-    break;
-  case 0x1A:
-    fprintf(f, "INC");
-    break;
-  case 0x1B:
-    fprintf(f, "INZ");
-    break;
-  case 0x1c:
-    fprintf(f, "TRB  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x1D:
-    fprintf(f, "ORA  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x1E:
-    fprintf(f, "ASL  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x1F:
-    fprintf(f, "BBR1 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x20:
-    fprintf(f, "JSR  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x21:
-    fprintf(f, "AND  ");
-    disassemble_izpx(f, log);
-    break;
-  case 0x22:
-    fprintf(f, "JSR  ");
-    disassemble_iabs(f, log);
-    break;
-  case 0x24:
-    fprintf(f, "BIT  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x25:
-    fprintf(f, "AND  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x26:
-    fprintf(f, "ROL  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x27:
-    fprintf(f, "RMB2 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x28:
-    fprintf(f, "PLP");
-    disassemble_stack_source(f, log);
-    break;
-  case 0x29:
-    fprintf(f, "AND  ");
-    disassemble_imm(f, log);
-    break;
-  case 0x2A:
-    fprintf(f, "ROL  A");
-    break;
-  case 0x2B:
-    fprintf(f, "TYS");
-    break;
-  case 0x2C:
-    fprintf(f, "BIT  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x2D:
-    fprintf(f, "AND  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x2E:
-    fprintf(f, "ROL  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x2F:
-    fprintf(f, "BBR2 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x30:
-    fprintf(f, "BMI  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0x31:
-    fprintf(f, "AND  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0x32:
-    fprintf(f, "AND  ");
-    disassemble_izpz(f, log);
-    break;
-  case 0x33:
-    fprintf(f, "BMI  ");
-    disassemble_rel16(f, log);
-    break;
-  case 0x34:
-    fprintf(f, "BIT  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x35:
-    fprintf(f, "AND  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x36:
-    fprintf(f, "ROL  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x37:
-    fprintf(f, "RMB3 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x38:
-    fprintf(f, "SEC");
-    break;
-  case 0x39:
-    fprintf(f, "AND  ");
-    disassemble_absy(f, log);
-    break;
-  case 0x3A:
-    fprintf(f, "DEC");
-    break;
-  case 0x3C:
-    fprintf(f, "BIT  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x3D:
-    fprintf(f, "AND  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x3E:
-    fprintf(f, "ROL  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x3F:
-    fprintf(f, "BBR3 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x40:
-    fprintf(f, "RTI");
-    break;
-  case 0x41:
-    fprintf(f, "EOR  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x45:
-    fprintf(f, "EOR  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x46:
-    fprintf(f, "LSR  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x47:
-    fprintf(f, "RMB4 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x48:
-    fprintf(f, "PHA");
-    break;
-  case 0x49:
-    fprintf(f, "EOR  ");
-    disassemble_imm(f, log);
-    break;
-  case 0x4A:
-    fprintf(f, "LSR  A");
-    break;
-  case 0x4B:
-    fprintf(f, "TAZ");
-    break;
-  case 0x4C:
-    fprintf(f, "JMP  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x4D:
-    fprintf(f, "EOR  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x4E:
-    fprintf(f, "LSR  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x4F:
-    fprintf(f, "BBR4 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x50:
-    fprintf(f, "BVC  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0x51:
-    fprintf(f, "EOR  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0x52:
-    fprintf(f, "EOR  ");
-    disassemble_izpz(f, log);
-    break;
-  case 0x56:
-    fprintf(f, "LSR  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x55:
-    fprintf(f, "EOR  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x57:
-    fprintf(f, "RMB5 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x58:
-    fprintf(f, "CLI");
-    break;
-  case 0x59:
-    fprintf(f, "EOR  ");
-    disassemble_absy(f, log);
-    break;
-  case 0x5a:
-    fprintf(f, "PHY");
-    break;
-  case 0x5b:
-    fprintf(f, "TAB");
-    break;
-  case 0x5c:
-    fprintf(f, "MAP");
-    break;
-  case 0x5d:
-    fprintf(f, "EOR  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x5e:
-    fprintf(f, "LSR  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x5F:
-    fprintf(f, "BBR5 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x60:
+  const struct opcode *op = &opcodes[log->bytes[0]];
+  if (!op->name)
+    return;
+  if (log->bytes[0] == 0x60) {
     fprintf(f, "RTS {Address pushed by ");
     if (log->pop_blame[0] != log->pop_blame[1]) {
       fprintf(f, " two different instructions: ");
       if (log->pop_blame[0]) {
-        fprintf(f, "$%04X ", cpulog[log->pop_blame[0]]->pc);
-        disassemble_instruction(f, cpulog[log->pop_blame[0]]);
+        disassemble_logged_instruction(f, log->pop_blame[0]);
       }
       else
         fprintf(f, "<unitialised stack location>");
       fprintf(f, " and ");
       if (log->pop_blame[1]) {
-        fprintf(f, "$%04X ", cpulog[log->pop_blame[1]]->pc);
-        disassemble_instruction(f, cpulog[log->pop_blame[1]]);
+        disassemble_logged_instruction(f, log->pop_blame[1]);
       }
       else
         fprintf(f, "<unitialised stack location>");
     }
     else if (log->pop_blame[0]) {
-      fprintf(f, "$%04X ", cpulog[log->pop_blame[0]]->pc);
-      disassemble_instruction(f, cpulog[log->pop_blame[0]]);
+      disassemble_logged_instruction(f, log->pop_blame[0]);
     }
     else
       fprintf(f, "<unitialised stack location>");
     fprintf(f, "}");
+    return;
+  }
+  if (op->mode == M_NONE || op->mode == M_PULL) {
+    fprintf(f, "%s", op->name);
+    if (op->mode == M_PULL)
+      disassemble_stack_source(f, log);
+    return;
+  }
+  fprintf(f, "%-5s", op->name);
+  switch (op->mode) {
+  case M_ACC:
+    fprintf(f, "A");
     break;
-  case 0x61:
-    fprintf(f, "ADC  ");
-    disassemble_izpx(f, log);
-    break;
-  case 0x64:
-    fprintf(f, "STZ  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x65:
-    fprintf(f, "ADC  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x66:
-    fprintf(f, "ROR  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x67:
-    fprintf(f, "RMB6 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x68:
-    fprintf(f, "PLA");
-    disassemble_stack_source(f, log);
-    break;
-  case 0x69:
-    fprintf(f, "ADC  ");
+  case M_IMM:
     disassemble_imm(f, log);
     break;
-  case 0x6A:
-    fprintf(f, "ROR  A");
-    break;
-  case 0x6B:
-    fprintf(f, "TZA");
-    break;
-  case 0x6C:
-    fprintf(f, "JMP  ");
-    disassemble_iabs(f, log);
-    break;
-  case 0x6D:
-    fprintf(f, "ADC  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x6E:
-    fprintf(f, "ROR  ");
+  case M_ABS:
     disassemble_abs(f, log);
     break;
-  case 0x6F:
-    fprintf(f, "BBR6 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x70:
-    fprintf(f, "BVS  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0x71:
-    fprintf(f, "ADC  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0x72:
-    fprintf(f, "ADC  ");
-    disassemble_izpz(f, log);
+  case M_ABSX:
+    disassemble_absx(f, log);
     break;
-  case 0x74:
-    fprintf(f, "STZ  ");
-    disassemble_zpx(f, log);
+  case M_ABSY:
+    disassemble_absy(f, log);
     break;
-  case 0x75:
-    fprintf(f, "ADC  ");
-    disassemble_zpx(f, log);
+  case M_IABS:
+    disassemble_iabs(f, log);
     break;
-  case 0x76:
-    fprintf(f, "ROR  ");
-    disassemble_zpx(f, log);
+  case M_IABSX:
+    disassemble_iabsx(f, log);
     break;
-  case 0x77:
-    fprintf(f, "RMB7 ");
+  case M_ZP:
     disassemble_zp(f, log);
     break;
-  case 0x78:
-    fprintf(f, "SEI");
-    break;
-  case 0x79:
-    fprintf(f, "ADC  ");
-    disassemble_absy(f, log);
-    break;
-  case 0x7A:
-    fprintf(f, "PLY");
-    disassemble_stack_source(f, log);
+  case M_ZPX:
+    disassemble_zpx(f, log);
     break;
-  case 0x7B:
-    fprintf(f, "TBA");
+  case M_ZPY:
+    disassemble_zpy(f, log);
     break;
-  case 0x7D:
-    fprintf(f, "ADC  ");
-    disassemble_absx(f, log);
+  case M_IZPX:
+    disassemble_izpx(f, log);
     break;
-  case 0x7C:
-    fprintf(f, "JMP  ");
-    disassemble_iabsx(f, log);
+  case M_IZPY:
+    disassemble_izpy(f, log);
     break;
-  case 0x7E:
-    fprintf(f, "ROR  ");
-    disassemble_absx(f, log);
+  case M_IZPZ:
+    if (log->zp32)
+      disassemble_izpz32(f, log);
+    else
+      disassemble_izpz(f, log);
     break;
-  case 0x7F:
-    fprintf(f, "BBR7 ");
+  case M_ZP_REL8:
     disassemble_zp_rel8(f, log);
     break;
-  case 0x80:
-    fprintf(f, "BRA  ");
+  case M_REL8:
     disassemble_rel8(f, log);
     break;
-  case 0x81:
-    fprintf(f, "STA  ");
-    disassemble_izpx(f, log);
-    break;
-  case 0x83:
-    fprintf(f, "BRA  ");
+  case M_REL16:
     disassemble_rel16(f, log);
     break;
-  case 0x84:
-    fprintf(f, "STY  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x85:
-    fprintf(f, "STA  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x86:
-    fprintf(f, "STX  ");
-    disassemble_zp(f, log);
-    break;
-  case 0x87:
-    fprintf(f, "SMB0 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x88:
-    fprintf(f, "DEY");
-    break;
-  case 0x89:
-    fprintf(f, "BIT  ");
-    disassemble_imm(f, log);
-    break;
-  case 0x8A:
-    fprintf(f, "TXA");
-    break;
-  case 0x8c:
-    fprintf(f, "STY  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x8d:
-    fprintf(f, "STA  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x8e:
-    fprintf(f, "STX  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x8F:
-    fprintf(f, "BBS0 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0x90:
-    fprintf(f, "BCC  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0x91:
-    fprintf(f, "STA  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0x92:
-    fprintf(f, "STA  ");
-    if (log->zp32)
-      disassemble_izpz32(f, log);
-    else
-      disassemble_izpz(f, log);
-    break;
-  case 0x93:
-    fprintf(f, "BCC  ");
-    disassemble_rel16(f, log);
-    break;
-  case 0x94:
-    fprintf(f, "STY  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x95:
-    fprintf(f, "STA  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0x96:
-    fprintf(f, "STX  ");
-    disassemble_zpy(f, log);
-    break;
-  case 0x97:
-    fprintf(f, "SMB1 ");
-    disassemble_zp(f, log);
-    break;
-  case 0x98:
-    fprintf(f, "TYA");
-    break;
-  case 0x99:
-    fprintf(f, "STA  ");
-    disassemble_absy(f, log);
-    break;
-  case 0x9A:
-    fprintf(f, "TXS");
-    break;
-  case 0x9C:
-    fprintf(f, "STZ  ");
-    disassemble_abs(f, log);
-    break;
-  case 0x9d:
-    fprintf(f, "STA  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x9E:
-    fprintf(f, "STZ  ");
-    disassemble_absx(f, log);
-    break;
-  case 0x9F:
-    fprintf(f, "BBS1 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0xa0:
-    fprintf(f, "LDY  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xa1:
-    fprintf(f, "LDA  ");
-    disassemble_izpx(f, log);
-    break;
-  case 0xa2:
-    fprintf(f, "LDX  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xa3:
-    fprintf(f, "LDZ  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xa4:
-    fprintf(f, "LDY  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xa5:
-    fprintf(f, "LDA  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xa6:
-    fprintf(f, "LDX  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xa7:
-    fprintf(f, "SMB2 ");
-    disassemble_zp(f, log);
-    break;
-  case 0xA8:
-    fprintf(f, "TAY");
-    break;
-  case 0xa9:
-    fprintf(f, "LDA  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xAA:
-    fprintf(f, "TAX");
-    break;
-  case 0xac:
-    fprintf(f, "LDY  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xad:
-    fprintf(f, "LDA  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xae:
-    fprintf(f, "LDX  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xAF:
-    fprintf(f, "BBS2 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0xB0:
-    fprintf(f, "BCS  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0xB1:
-    fprintf(f, "LDA  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0xB2:
-    fprintf(f, "LDA  ");
-    disassemble_izpz(f, log);
-    break;
-  case 0xb4:
-    fprintf(f, "LDY  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0xb5:
-    fprintf(f, "LDA  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0xb6:
-    fprintf(f, "LDX  ");
-    disassemble_zpy(f, log);
-    break;
-  case 0xb7:
-    fprintf(f, "SMB3 ");
-    disassemble_zp(f, log);
-    break;
-  case 0xb8:
-    fprintf(f, "CLV");
-    break;
-  case 0xb9:
-    fprintf(f, "LDA  ");
-    disassemble_absy(f, log);
-    break;
-  case 0xba:
-    fprintf(f, "TSX");
-    break;
-  case 0xbc:
-    fprintf(f, "LDY  ");
-    disassemble_absx(f, log);
-    break;
-  case 0xbd:
-    fprintf(f, "LDA  ");
-    disassemble_absx(f, log);
-    break;
-  case 0xbe:
-    fprintf(f, "LDX  ");
-    disassemble_absy(f, log);
-    break;
-  case 0xBF:
-    fprintf(f, "BBS3 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0xC0:
-    fprintf(f, "CPY  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xC1:
-    fprintf(f, "CMP  ");
-    disassemble_izpx(f, log);
-    break;
-  case 0xC4:
-    fprintf(f, "CPY  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xC5:
-    fprintf(f, "CMP  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xC6:
-    fprintf(f, "DEC  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xC7:
-    fprintf(f, "SMB4 ");
-    disassemble_zp(f, log);
-    break;
-  case 0xC8:
-    fprintf(f, "INY");
-    break;
-  case 0xC9:
-    fprintf(f, "CMP  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xCA:
-    fprintf(f, "DEX");
-    break;
-  case 0xCC:
-    fprintf(f, "CPY  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xCD:
-    fprintf(f, "CMP  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xce:
-    fprintf(f, "DEC  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xCF:
-    fprintf(f, "BBS4 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0xd0:
-    fprintf(f, "BNE  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0xD1:
-    fprintf(f, "CMP  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0xD2:
-    fprintf(f, "CMP  ");
-    disassemble_izpz(f, log);
-    break;
-  case 0xD5:
-    fprintf(f, "CMP  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0xD6:
-    fprintf(f, "DEC  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0xD7:
-    fprintf(f, "SMB5 ");
-    disassemble_zp(f, log);
-    break;
-  case 0xD8:
-    fprintf(f, "CLD");
-    break;
-  case 0xD9:
-    fprintf(f, "CMP  ");
-    disassemble_absy(f, log);
-    break;
-  case 0xDA:
-    fprintf(f, "PHX");
-    break;
-  case 0xDB:
-    fprintf(f, "PHZ");
-    break;
-  case 0xDD:
-    fprintf(f, "CMP  ");
-    disassemble_absx(f, log);
-    break;
-  case 0xDE:
-    fprintf(f, "DEC  ");
-    disassemble_absx(f, log);
-    break;
-  case 0xDF:
-    fprintf(f, "BBS5 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0xE0:
-    fprintf(f, "CPX  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xE1:
-    fprintf(f, "SBC  ");
-    disassemble_izpx(f, log);
-    break;
-  case 0xE4:
-    fprintf(f, "CPX  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xE5:
-    fprintf(f, "SBC  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xE6:
-    fprintf(f, "INC  ");
-    disassemble_zp(f, log);
-    break;
-  case 0xE7:
-    fprintf(f, "SMB6 ");
-    disassemble_zp(f, log);
-    break;
-  case 0xE8:
-    fprintf(f, "INX");
-    break;
-  case 0xE9:
-    fprintf(f, "SBC  ");
-    disassemble_imm(f, log);
-    break;
-  case 0xea:
-    fprintf(f, "EOM");
-    break;
-  case 0xEC:
-    fprintf(f, "CPX  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xED:
-    fprintf(f, "SBC  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xee:
-    fprintf(f, "INC  ");
-    disassemble_abs(f, log);
-    break;
-  case 0xEF:
-    fprintf(f, "BBS6 ");
-    disassemble_zp_rel8(f, log);
-    break;
-  case 0xf0:
-    fprintf(f, "BEQ  ");
-    disassemble_rel8(f, log);
-    break;
-  case 0xf1:
-    fprintf(f, "SBC  ");
-    disassemble_izpy(f, log);
-    break;
-  case 0xf2:
-    fprintf(f, "SBC  ");
-    disassemble_izpz(f, log);
-    break;
-  case 0xf3:
-    fprintf(f, "BEQ  ");
-    disassemble_rel16(f, log);
-    break;
-  case 0xf5:
-    fprintf(f, "SBC  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0xf6:
-    fprintf(f, "INC  ");
-    disassemble_zpx(f, log);
-    break;
-  case 0xf7:
-    fprintf(f, "SMB7 ");
-    disassemble_zp(f, log);
-    break;
-  case 0xf8:
-    fprintf(f, "SED");
-    break;
-  case 0xF9:
-    fprintf(f, "SBC  ");
-    disassemble_absy(f, log);
-    break;
-  case 0xFA:
-    fprintf(f, "PLX");
-    disassemble_stack_source(f, log);
-    break;
-  case 0xFB:
-    fprintf(f, "PLZ");
-    disassemble_stack_source(f, log);
-    break;
-  case 0xFD:
-    fprintf(f, "SBC  ");
-    disassemble_absx(f, log);
-    break;
-  case 0xFE:
-    fprintf(f, "INC  ");
-    disassemble_absx(f, log);
-    break;
-  case 0xFF:
-    fprintf(f, "BBS7 ");
-    disassemble_zp_rel8(f, log);
-    break;
   }
 }
 
@@ -1228,12 +555,19 @@ int show_recent_instructions(
     count -= -first_instruction;
     first_instruction = 0;
   }
+  if (first_instruction < cpulog_first_retained()) {
+    int discarded = cpulog_first_retained() - first_instruction;
+    fprintf(f, " --- %d earlier instructions are no longer in the instruction log ---\n", discarded);
+    count -= discarded;
+    first_instruction += discarded;
+  }
   for (int i = first_instruction; count > 0 && i < cpulog_len; count--, i++) {
     if (!i) {
       fprintf(f, "I0        -- Machine reset --\n");
       continue;
     }
-    if (cpulog[i]->dup && (i > first_instruction)) {
+    struct instruction_log *log = &cpulog[i % cpulog_depth];
+    if (log->dup && (i > first_instruction)) {
       if (!last_was_dup)
         fprintf(f, "                 ... duplicated instructions omitted ...\n");
       last_was_dup = 1;
@@ -1244,35 +578,35 @@ int show_recent_instructions(
         fprintf(f, "I%-7d ", i);
       else
         fprintf(f, "     >>> ");
-      if (cpulog[i]->count > 1)
-        fprintf(f, "$%04X x%-6d : ", cpulog[i]->pc, cpulog[i]->count);
+      if (log->count > 1)
+        fprintf(f, "$%04X x%-6d : ", log->pc, log->count);
       else
-        fprintf(f, "$%04X         : ", cpulog[i]->pc);
-      fprintf(f, "A:%02X ", cpulog[i]->regs.a);
-      fprintf(f, "X:%02X ", cpulog[i]->regs.x);
-      fprintf(f, "Y:%02X ", cpulog[i]->regs.y);
-      fprintf(f, "Z:%02X ", cpulog[i]->regs.z);
-      fprintf(f, "SP:%02X%02X ", cpulog[i]->regs.sph, cpulog[i]->regs.spl);
-      fprintf(f, "B:%02X ", cpulog[i]->regs.b);
-      fprintf(f, "M:%04x+%02x/%04x+%02x ", cpulog[i]->regs.maplo, cpulog[i]->regs.maplomb, cpulog[i]->regs.maphi,
-          cpulog[i]->regs.maphimb);
-      fprintf(f, "%c%c%c%c%c%c%c%c ", cpulog[i]->regs.flags & FLAG_N ? 'N' : '.', cpulog[i]->regs.flags & FLAG_V ? 'V' : '.',
-          cpulog[i]->regs.flags & FLAG_E ? 'E' : '.', cpulog[i]->regs.flags & 0x10 ? 'B' : '.',
-          cpulog[i]->regs.flags & FLAG_D ? 'D' : '.', cpulog[i]->regs.flags & FLAG_I ? 'I' : '.',
-          cpulog[i]->regs.flags & FLAG_Z ? 'Z' : '.', cpulog[i]->regs.flags & FLAG_C ? 'C' : '.');
+        fprintf(f, "$%04X         : ", log->pc);
+      fprintf(f, "A:%02X ", log->regs.a);
+      fprintf(f, "X:%02X ", log->regs.x);
+      fprintf(f, "Y:%02X ", log->regs.y);
+      fprintf(f, "Z:%02X ", log->regs.z);
+      fprintf(f, "SP:%02X%02X ", log->regs.sph, log->regs.spl);
+      fprintf(f, "B:%02X ", log->regs.b);
+      fprintf(f, "M:%04x+%02x/%04x+%02x ", log->regs.maplo, log->regs.maplomb, log->regs.maphi,
+          log->regs.maphimb);
+      fprintf(f, "%c%c%c%c%c%c%c%c ", log->regs.flags & FLAG_N ? 'N' : '.', log->regs.flags & FLAG_V ? 'V' : '.',
+          log->regs.flags & FLAG_E ? 'E' : '.', log->regs.flags & 0x10 ? 'B' : '.',
+          log->regs.flags & FLAG_D ? 'D' : '.', log->regs.flags & FLAG_I ? 'I' : '.',
+          log->regs.flags & FLAG_Z ? 'Z' : '.', log->regs.flags & FLAG_C ? 'C' : '.');
       fprintf(f, " : ");
 
-      fprintf(f, "%32s : ", describe_address_label28(cpu, addr_to_28bit(cpu, cpulog[i]->regs.pc, 0)));
+      fprintf(f, "%32s : ", describe_address_label28(cpu, addr_to_28bit(cpu, log->regs.pc, 0)));
 
       for (int j = 0; j < 3; j++) {
-        if (j < cpulog[i]->len)
-          fprintf(f, "%02X ", cpulog[i]->bytes[j]);
+        if (j < log->len)
+          fprintf(f, "%02X ", log->bytes[j]);
         else
           fprintf(f, "   ");
       }
       fprintf(f, " : ");
       // XXX - Show instruction disassembly
-      disassemble_instruction(f, cpulog[i]);
+      disassemble_instruction(f, log);
       fprintf(f, "\n");
     }
   }
@@ -1293,19 +627,153 @@ int identical_cpustates(struct instruction_log *a, struct instruction_log *b)
     return 1;
 }
 
+// Indexes over a symbol table: a hash of the names for resolve_value32(),
+// and the entries sorted by address for finding the closest label. Symbols
+// are only ever appended, except by symbol_index_invalidate() callers, so
+// the indexes catch up with new entries when they are next used.
+typedef struct symbol_index {
+  hyppo_symbol *table;
+  int *count;
+  // Open addressing hash of entry numbers (-1 = empty), holding the first
+  // entry with each name, for entries [0, named)
+  int *by_name;
+  int by_name_size;
+  int named;
+  // Entry numbers sorted by address, then by entry number, or out of date
+  // if sorted != *count
+  int *by_addr;
+  int sorted;
+} symbol_index;
+symbol_index hyppo_symbol_index = { hyppo_symbols, &hyppo_symbol_count };
+symbol_index user_symbol_index = { symbols, &symbol_count };
+
+// Entries have been removed or changed, so start the indexes again
+void symbol_index_invalidate(symbol_index *ix)
+{
+  if (ix->named && ix->by_name)
+    memset(ix->by_name, 0xff, ix->by_name_size * sizeof(int));
+  ix->named = 0;
+  ix->sorted = -1;
+}
+
+unsigned int symbol_name_hash(const char *name)
+{
+  // FNV-1a
+  unsigned int h = 2166136261u;
+  while (*name)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h;
+}
+
+void symbol_index_add_name(symbol_index *ix, int entry)
+{
+  const char *name = ix->table[entry].name;
+  unsigned int slot = symbol_name_hash(name) & (ix->by_name_size - 1);
+  while (ix->by_name[slot] >= 0) {
+    // Keep the first entry of any that share a name
+    if (!strcmp(ix->table[ix->by_name[slot]].name, name))
+      return;
+    slot = (slot + 1) & (ix->by_name_size - 1);
+  }
+  ix->by_name[slot] = entry;
+}
+
+int find_symbol_by_name(symbol_index *ix, const char *name)
+{
+  if (ix->named < *ix->count) {
+    // Keep the hash at most half full
+    if (*ix->count * 2 > ix->by_name_size) {
+      int size = 1024;
+      while (size < *ix->count * 2)
+        size *= 2;
+      int *by_name = realloc(ix->by_name, size * sizeof(int));
+      if (!by_name) {
+        fprintf(logfile, "ERROR: Could not allocate symbol index\n");
+        exit(-2);
+      }
+      ix->by_name = by_name;
+      ix->by_name_size = size;
+      ix->named = 0;
+    }
+    if (!ix->named)
+      memset(ix->by_name, 0xff, ix->by_name_size * sizeof(int));
+    for (; ix->named < *ix->count; ix->named++)
+      symbol_index_add_name(ix, ix->named);
+  }
+  if (!ix->by_name_size)
+    return -1;
+
+  unsigned int slot = symbol_name_hash(name) & (ix->by_name_size - 1);
+  for (int entry; (entry = ix->by_name[slot]) >= 0; slot = (slot + 1) & (ix->by_name_size - 1))
+    if (!strcmp(ix->table[entry].name, name))
+      return entry;
+  return -1;
+}
+
+hyppo_symbol *symbol_sort_table;
+int compare_symbol_entries(const void *a, const void *b)
+{
+  int ea = *(const int *)a, eb = *(const int *)b;
+  if (symbol_sort_table[ea].addr != symbol_sort_table[eb].addr)
+    return symbol_sort_table[ea].addr < symbol_sort_table[eb].addr ? -1 : 1;
+  return ea - eb;
+}
+
+// Find the closest symbol at or below addr. Of several at the same address,
+// this is the first in the table, or the last if last is set.
+hyppo_symbol *find_symbol_by_addr(symbol_index *ix, unsigned int addr, bool last)
+{
+  int count = *ix->count;
+  if (ix->sorted != count) {
+    int *by_addr = realloc(ix->by_addr, (count + 1) * sizeof(int));
+    if (!by_addr) {
+      fprintf(logfile, "ERROR: Could not allocate symbol index\n");
+      exit(-2);
+    }
+    ix->by_addr = by_addr;
+    for (int i = 0; i < count; i++)
+      ix->by_addr[i] = i;
+    symbol_sort_table = ix->table;
+    qsort(ix->by_addr, count, sizeof(int), compare_symbol_entries);
+    ix->sorted = count;
+  }
+
+  // First sorted entry above addr
+  int lo = 0, hi = count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ix->table[ix->by_addr[mid]].addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (!lo)
+    return NULL;
+  if (last)
+    return &ix->table[ix->by_addr[lo - 1]];
+
+  // First sorted entry at the address found
+  unsigned int found = ix->table[ix->by_addr[lo - 1]].addr;
+  hi = lo - 1;
+  lo = 0;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ix->table[ix->by_addr[mid]].addr < found)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return &ix->table[ix->by_addr[lo]];
+}
+
 char addr_description[8192];
 char *describe_address(unsigned int addr)
 {
-  struct hyppo_symbol *s = NULL;
+  struct hyppo_symbol *s = find_symbol_by_addr(&hyppo_symbol_index, addr, true);
 
-  for (int i = 0; i < hyppo_symbol_count; i++) {
-    // Check for exact address match
-    if (addr == hyppo_symbols[i].addr)
-      s = &hyppo_symbols[i];
-    // Check for best approximate match
-    if (s && s->addr < hyppo_symbols[i].addr && addr > hyppo_symbols[i].addr)
-      s = &hyppo_symbols[i];
-  }
+  // Only exact matches are described
+  if (s && s->addr != addr)
+    s = NULL;
 
   if (s) {
     if (s->addr == addr)
@@ -1320,37 +788,18 @@ char *describe_address(unsigned int addr)
 
 char *describe_address_label28(struct cpu *cpu, unsigned int addr)
 {
-  int num_symbols;
-  struct hyppo_symbol *s;
-  struct hyppo_symbol *match = NULL;
-  bool exact = false;
+  struct hyppo_symbol *match;
 
   addr_description[0] = 0;
 
   if (addr >= 0xfff8000 && addr < 0xfffc000) {
     // Hypervisor sits at $FFF8000-$FFFBFFF
-    s = hyppo_symbols;
-    num_symbols = hyppo_symbol_count;
     addr -= 0xfff0000; // The symbol table addresses are for $8000-$BFFF
+    match = find_symbol_by_addr(&hyppo_symbol_index, addr, false);
   }
-  else {
-    s = symbols;
-    num_symbols = symbol_count;
-  }
-
-  for (int i = 0; i < num_symbols; i++, s++) {
-    // Check for exact address match
-    if (addr == (s->addr)) {
-      match = s;
-      exact = true;
-      break;
-    }
-    // Check for best approximate match
-    if (match && match->addr < s->addr && addr > s->addr)
-      match = s;
-    if ((!match) && addr > s->addr)
-      match = s;
-  }
+  else
+    match = find_symbol_by_addr(&user_symbol_index, addr, false);
+  bool exact = match && match->addr == addr;
 
   if (match) {
     if (exact)
@@ -1370,32 +819,127 @@ char *describe_address_label(struct cpu *cpu, unsigned int addr)
   return describe_address_label28(cpu, addr_to_28bit(cpu, addr, 1));
 }
 
+int trace_open(char *filename)
+{
+  trace_header header;
+
+  trace_close();
+  trace_file = fopen(filename, "wb");
+  if (!trace_file) {
+    fprintf(logfile, "ERROR: Could not write trace to '%s'\n", filename);
+    return -1;
+  }
+  setvbuf(trace_file, NULL, _IOFBF, 1024 * 1024);
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.byte_order = TRACE_BYTE_ORDER_MARK;
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(trace_record);
+  fwrite(&header, sizeof(header), 1, trace_file);
+  trace_instructions = 0;
+  fprintf(logfile, "NOTE: Writing instruction trace to '%s'\n", filename);
+  return 0;
+}
+
+int trace_close(void)
+{
+  int retVal = 0;
+
+  if (!trace_file)
+    return 0;
+  if (ferror(trace_file) | fclose(trace_file)) {
+    fprintf(logfile, "ERROR: Could not write all of the instruction trace\n");
+    retVal = -1;
+  }
+  else
+    fprintf(logfile, "NOTE: Traced %u instructions\n", trace_instructions);
+  trace_file = NULL;
+  return retVal;
+}
+
+void trace_memory_write(unsigned int addr, unsigned char value)
+{
+  trace_record r;
+
+  bzero(&r, sizeof(r));
+  r.instruction = trace_instructions;
+  r.type = TRACE_WRITE;
+  r.w.addr = addr;
+  r.w.value = value;
+  fwrite(&r, sizeof(r), 1, trace_file);
+}
+
+void trace_instruction(struct instruction_log *log)
+{
+  trace_record r;
+
+  bzero(&r, sizeof(r));
+  r.instruction = trace_instructions++;
+  r.type = TRACE_INSTRUCTION;
+  r.i.len = log->len;
+  r.i.zp32 = log->zp32;
+  r.i.in_hyper = log->regs.in_hyper;
+  r.i.pc = log->pc;
+  memcpy(r.i.bytes, log->bytes, sizeof(r.i.bytes));
+  r.i.a = log->regs.a;
+  r.i.x = log->regs.x;
+  r.i.y = log->regs.y;
+  r.i.z = log->regs.z;
+  r.i.b = log->regs.b;
+  r.i.flags = log->regs.flags;
+  r.i.sp = log->regs.sp;
+  r.i.maplo = log->regs.maplo;
+  r.i.maphi = log->regs.maphi;
+  r.i.maplomb = log->regs.maplomb;
+  r.i.maphimb = log->regs.maphimb;
+  fwrite(&r, sizeof(r), 1, trace_file);
+}
+
 void cpu_log_reset(void)
 {
-  for (int i = 0; i < cpulog_len; i++)
-    free(cpulog[i]);
+  // Entry 0 stands for the machine reset, so leave it blank
+  bzero(&cpulog[0], sizeof(instruction_log));
   cpulog_len = 1;
-  cpulog[0] = NULL;
+  memset(lastataddr_instruction, 0xff, sizeof(lastataddr_instruction));
+}
+
+void mark_all_dirty(void)
+{
+  memset(chipram_dirty, 1, sizeof(chipram_dirty));
+  memset(hypporam_dirty, 1, sizeof(hypporam_dirty));
+  memset(colourram_dirty, 1, sizeof(colourram_dirty));
+  memset(ffdram_dirty, 1, sizeof(ffdram_dirty));
 }
 
 void cpu_stash_ram(void)
 {
-  // Remember the RAM contents before calling a routine
-  bcopy(chipram, chipram_expected, CHIPRAM_SIZE);
-  bcopy(hypporam, hypporam_expected, HYPPORAM_SIZE);
+  // Remember the RAM contents before calling a routine.
+  // Only pages changed since they were last stashed need copying.
+  for (int p = 0; p < (CHIPRAM_SIZE >> DIRTY_PAGE_SHIFT); p++) {
+    if (chipram_dirty[p]) {
+      bcopy(&chipram[p << DIRTY_PAGE_SHIFT], &chipram_expected[p << DIRTY_PAGE_SHIFT], DIRTY_PAGE_SIZE);
+      chipram_dirty[p] = 0;
+    }
+  }
+  for (int p = 0; p < (HYPPORAM_SIZE >> DIRTY_PAGE_SHIFT); p++) {
+    if (hypporam_dirty[p]) {
+      bcopy(&hypporam[p << DIRTY_PAGE_SHIFT], &hypporam_expected[p << DIRTY_PAGE_SHIFT], DIRTY_PAGE_SIZE);
+      hypporam_dirty[p] = 0;
+    }
+  }
+}
+
+static inline void cpu_map_changed(struct cpu *cpu)
+{
+  cpu->map_valid = false;
 }
 
-unsigned int addr_to_28bit(struct cpu *cpu, unsigned int addr, int writeP)
+// Work out where a 16-bit address ends up, without using the cached map
+unsigned int decode_addr_to_28bit(struct cpu *cpu, unsigned int addr, int writeP)
 {
   // XXX -- Royally stupid banking emulation for now
   unsigned int addr_in = addr;
 
-  if (addr > 0xffff) {
-    fprintf(logfile, "ERROR: Asked to map %s of non-16 bit address $%x\n", writeP ? "write" : "read", addr);
-    show_recent_instructions(logfile, "Instructions leading up to the request", cpu, cpulog_len - 6, 6, cpu->regs.pc);
-    cpu->term.error = true;
-    return -1;
-  }
   int lnc = chipram[1] & 7;
   lnc |= (~(chipram[0])) & 7;
   unsigned int bank = addr >> 12;
@@ -1476,6 +1020,49 @@ unsigned int addr_to_28bit(struct cpu *cpu, unsigned int addr, int writeP)
   return addr;
 }
 
+// Returns a pointer to the RAM backing the 4KB at 28-bit address addr,
+// or NULL if it is unmapped or straddles the end of a memory.
+unsigned char *ram_pointer28(unsigned int addr)
+{
+  unsigned int last = addr + 0xfff;
+  if (addr >= 0xfff8000 && last < 0xfffc000)
+    return &hypporam[addr - 0xfff8000];
+  if (last < CHIPRAM_SIZE)
+    return &chipram[addr];
+  if (addr >= 0xff80000 && last < (0xff80000 + COLOURRAM_SIZE))
+    return &colourram[addr - 0xff80000];
+  if ((addr & 0xfff0000) == 0xffd0000 && (last & 0xfff0000) == 0xffd0000)
+    return &ffdram[addr - 0xffd0000];
+  return NULL;
+}
+
+void cpu_rebuild_map(struct cpu *cpu)
+{
+  // Every mapping rule works on whole 4KB banks, so the translation of any
+  // address is the translation of the start of its bank plus the offset.
+  for (int bank = 0; bank < 16; bank++) {
+    cpu->map_read[bank] = decode_addr_to_28bit(cpu, bank << 12, 0);
+    cpu->map_write[bank] = decode_addr_to_28bit(cpu, bank << 12, 1);
+    cpu->map_read_ptr[bank] = ram_pointer28(cpu->map_read[bank]);
+  }
+  cpu->map_valid = true;
+}
+
+unsigned int addr_to_28bit(struct cpu *cpu, unsigned int addr, int writeP)
+{
+  if (addr > 0xffff) {
+    fprintf(logfile, "ERROR: Asked to map %s of non-16 bit address $%x\n", writeP ? "write" : "read", addr);
+    show_recent_instructions(logfile, "Instructions leading up to the request", cpu, cpulog_len - 6, 6, cpu->regs.pc);
+    cpu->term.error = true;
+    return -1;
+  }
+  if (!cpu->map_valid)
+    cpu_rebuild_map(cpu);
+  if (writeP)
+    return cpu->map_write[addr >> 12] + (addr & 0xfff);
+  return cpu->map_read[addr >> 12] + (addr & 0xfff);
+}
+
 unsigned char read_memory28(struct cpu *cpu, unsigned int addr)
 {
   if (addr >= 0xfff8000 && addr < 0xfffc000) {
@@ -1500,6 +1087,13 @@ unsigned char read_memory28(struct cpu *cpu, unsigned int addr)
 
 unsigned char read_memory(struct cpu *cpu, unsigned int addr16)
 {
+  if (addr16 <= 0xffff) {
+    if (!cpu->map_valid)
+      cpu_rebuild_map(cpu);
+    if (cpu->map_read_ptr[addr16 >> 12])
+      return cpu->map_read_ptr[addr16 >> 12][addr16 & 0xfff];
+  }
+
   unsigned int addr = addr_to_28bit(cpu, addr16, 0);
 
   return read_memory28(cpu, addr);
@@ -1528,6 +1122,86 @@ unsigned int memory_blame(struct cpu *cpu, unsigned int addr16)
   return 0;
 }
 
+// Cycles to fetch and set up each DMA job
+#define DMA_JOB_CYCLES 12
+
+// Plain RAM that a DMA job can fill or copy in one go, rather than a byte
+// at a time through write_mem28()
+typedef struct dma_region {
+  unsigned char *mem;
+  unsigned int *blame;
+  unsigned char *dirty;
+  unsigned int offset;
+} dma_region;
+
+// Find the memory holding addr to addr+count-1, if it is all in the same one.
+// Writes to IO or to the CPU port at $00/$01 have side effects, so they
+// are left to write_mem28().
+bool dma_find_region(unsigned int addr, unsigned int count, bool writing, dma_region *r)
+{
+  unsigned long long end = (unsigned long long)addr + count;
+
+  if (addr >= 0xfff8000 && end <= 0xfffc000) {
+    r->mem = hypporam;
+    r->blame = hypporam_blame;
+    r->dirty = hypporam_dirty;
+    r->offset = addr - 0xfff8000;
+  }
+  else if (end <= CHIPRAM_SIZE && (!writing || addr >= 2)) {
+    r->mem = chipram;
+    r->blame = chipram_blame;
+    r->dirty = chipram_dirty;
+    r->offset = addr;
+  }
+  else if (addr >= 0xff80000 && end <= (0xff80000 + COLOURRAM_SIZE)) {
+    r->mem = colourram;
+    r->blame = colourram_blame;
+    r->dirty = colourram_dirty;
+    r->offset = addr - 0xff80000;
+  }
+  else if (!writing && (addr & 0xfff0000) == 0xffd0000 && end <= 0xffe0000) {
+    r->mem = ffdram;
+    r->blame = ffdram_blame;
+    r->dirty = ffdram_dirty;
+    r->offset = addr - 0xffd0000;
+  }
+  else
+    return false;
+  return true;
+}
+
+// Do a linear fill (op 3) or copy (op 0) in one go, with the same result
+// as doing it a byte at a time. Returns false if it has to be done a byte
+// at a time after all.
+bool dma_bulk(struct cpu *cpu, int op, unsigned int src, unsigned int dest, unsigned int count)
+{
+  dma_region s, d;
+
+  // Traces need every write
+  if (dma_byte_at_a_time || trace_writes)
+    return false;
+  if (!dma_find_region(dest, count, true, &d))
+    return false;
+  if (op == 0) {
+    if (!dma_find_region(src, count, false, &s))
+      return false;
+    // Copying onto a later part of the source repeats the first bytes,
+    // which memmove() would not do
+    if (s.mem == d.mem && d.offset > s.offset && d.offset < s.offset + count)
+      return false;
+    memmove(&d.mem[d.offset], &s.mem[s.offset], count);
+  }
+  else
+    memset(&d.mem[d.offset], src & 0xff, count);
+
+  if (keep_blame)
+    for (unsigned int i = 0; i < count; i++)
+      d.blame[d.offset + i] = cpu->instruction_count;
+  for (unsigned int p = d.offset >> DIRTY_PAGE_SHIFT; p <= (d.offset + count - 1) >> DIRTY_PAGE_SHIFT; p++)
+    d.dirty[p] = 1;
+  return true;
+}
+
 int do_dma(struct cpu *cpu, int eDMA, unsigned int addr)
 {
   int f011b = 0;
@@ -1766,6 +1440,10 @@ int do_dma(struct cpu *cpu, int eDMA, unsigned int addr)
     if (!dma_count)
       dma_count = 0x10000;
 
+    // Approximate cost of the job: reading the job, then a cycle per byte
+    // filled, or a read and a write cycle per byte copied or mixed
+    cpu->cycles += DMA_JOB_CYCLES + dma_count * ((dma_cmd & 3) == 3 ? 1 : 2);
+
     switch (dma_cmd & 3) {
     case 0:
       /* Copy operation: Clone symbols from source region to destination region. */
@@ -1788,9 +1466,6 @@ int do_dma(struct cpu *cpu, int eDMA, unsigned int addr)
             }
             symbols[symbol_count].name = symbols[i].name;
             symbols[symbol_count].addr = (dest_addr >> 8) + (symbols[i].addr - (src_addr >> 8));
-            if (((dest_addr >> 8) + (symbols[i].addr - (src_addr >> 8))) < CHIPRAM_SIZE) {
-              sym_by_addr[(dest_addr >> 8) + (symbols[i].addr - (src_addr >> 8))] = &symbols[symbol_count];
-            }
             symbol_count++;
           }
         }
@@ -1813,13 +1488,21 @@ int do_dma(struct cpu *cpu, int eDMA, unsigned int addr)
             symbol_count--;
           }
         }
-        if (symbols_erased)
+        if (symbols_erased) {
+          symbol_index_invalidate(&user_symbol_index);
           fprintf(logfile, "NOTE: Erased %d symbols due to DMA fill from $%07llX to $%07llX.\n", symbols_erased,
               dest_addr >> 8, (dest_addr >> 8) + dma_count - 1);
+        }
       }
       break;
     }
 
+    // Simple linear fills and copies within RAM are done in one go
+    if (((dma_cmd & 3) == 3 || ((dma_cmd & 3) == 0 && !src_hold && !src_direction && !src_modulo && src_skip == 0x100 && !s_line_mode))
+        && !dest_hold && !dest_direction && !dest_modulo && dst_skip == 0x100 && !line_mode && !spiral_mode
+        && dma_bulk(cpu, dma_cmd & 3, src_addr >> 8, dest_addr >> 8, dma_count))
+      dma_count = 0;
+
     while (dma_count--) {
 
       // Do operation before updating addresses
@@ -1842,7 +1525,8 @@ int do_dma(struct cpu *cpu, int eDMA, unsigned int addr)
       }
 
       // Update source address
-      {
+      // (a fill takes its value from the source address, which stays put)
+      if ((dma_cmd & 3) != 3) {
         if (!s_line_mode) {
           // Normal fill / copy
           if (!src_hold) {
@@ -2198,10 +1882,15 @@ int write_mem28(struct cpu *cpu, unsigned int addr, unsigned char value)
 {
   unsigned int dma_addr;
 
+  if (trace_writes)
+    trace_memory_write(addr, value);
+
   if (addr >= 0xfff8000 && addr < 0xfffc000) {
     // Hypervisor sits at $FFF8000-$FFFBFFF
-    hypporam_blame[addr - 0xfff8000] = cpu->instruction_count;
+    if (keep_blame)
+      hypporam_blame[addr - 0xfff8000] = cpu->instruction_count;
     hypporam[addr - 0xfff8000] = value;
+    hypporam_dirty[(addr - 0xfff8000) >> DIRTY_PAGE_SHIFT] = 1;
   }
   else if (addr < CHIPRAM_SIZE) {
     // Chipram at base of address space
@@ -2212,18 +1901,28 @@ int write_mem28(struct cpu *cpu, unsigned int addr, unsigned char value)
       // Clear fast CPU
     }
     else {
-      chipram_blame[addr] = cpu->instruction_count;
+      if (keep_blame)
+        chipram_blame[addr] = cpu->instruction_count;
       chipram[addr] = value;
+      chipram_dirty[addr >> DIRTY_PAGE_SHIFT] = 1;
+      // $00/$01 control the C64 ROM and IO banking
+      if (addr < 2)
+        cpu_map_changed(cpu);
     }
   }
   else if (addr >= 0xff80000 && addr < (0xff80000 + COLOURRAM_SIZE)) {
-    colourram_blame[addr - 0xff80000] = cpu->instruction_count;
+    if (keep_blame)
+      colourram_blame[addr - 0xff80000] = cpu->instruction_count;
     colourram[addr - 0xff80000] = value;
+    colourram_dirty[(addr - 0xff80000) >> DIRTY_PAGE_SHIFT] = 1;
   }
   else if ((addr & 0xfff0000) == 0xffd0000) {
     // $FFDxxxx IO space
     ffdram[addr - 0xffd0000] = value;
-    ffdram_blame[addr - 0xffd0000] = cpu->instruction_count;
+    if (keep_blame)
+      ffdram_blame[addr - 0xffd0000] = cpu->instruction_count;
+    // (this also covers the DMA registers updated below)
+    ffdram_dirty[(addr - 0xffd0000) >> DIRTY_PAGE_SHIFT] = 1;
 
     // Now check for special address actions
     switch (addr) {
@@ -2231,20 +1930,23 @@ int write_mem28(struct cpu *cpu, unsigned int addr, unsigned char value)
       if (cpu->term.log_dma)
         fprintf(logfile, "NOTE: DMA triggered via write to $%07x at instruction #%d\n", addr, cpulog_len);
       ffdram[0x3705] = value;
-      ffdram_blame[0x3705] = cpu->instruction_count;
+      if (keep_blame)
+        ffdram_blame[0x3705] = cpu->instruction_count;
       dma_addr = (ffdram[0x3700] + (ffdram[0x3701] << 8) + ((ffdram[0x3702] & 0x7f) << 16)) | (ffdram[0x3704] << 20);
       do_dma(cpu, 0, dma_addr);
       break;
     case 0xffd3702: // Set bits 22 to 16 of DMA address
       ffdram[0x3704] &= 0xf1;
       ffdram[0x3704] |= (value >> 4) & 7;
-      ffdram_blame[0x3704] = cpu->instruction_count;
+      if (keep_blame)
+        ffdram_blame[0x3704] = cpu->instruction_count;
       break;
     case 0xffd3705: // Trigger EDMA
       if (cpu->term.log_dma)
         fprintf(logfile, "NOTE: DMA triggered via write to $%07x at instruction #%d\n", addr, cpulog_len);
       ffdram[0x3700] = value;
-      ffdram_blame[0x3700] = cpu->instruction_count;
+      if (keep_blame)
+        ffdram_blame[0x3700] = cpu->instruction_count;
       dma_addr = (ffdram[0x3700] + (ffdram[0x3701] << 8) + ((ffdram[0x3702] & 0x7f) << 16)) | (ffdram[0x3704] << 20);
       do_dma(cpu, 1, dma_addr);
       break;
@@ -2283,18 +1985,22 @@ int write_mem_expected28(unsigned int addr, unsigned char value)
   if (addr >= 0xfff8000 && addr < 0xfffc000) {
     // Hypervisor sits at $FFF8000-$FFFBFFF
     hypporam_expected[addr - 0xfff8000] = value;
+    hypporam_dirty[(addr - 0xfff8000) >> DIRTY_PAGE_SHIFT] = 1;
     fprintf(logfile, "NOTE: Writing to hypervisor RAM @ $%07x\n", addr);
   }
   else if (addr < CHIPRAM_SIZE) {
     // Chipram at base of address space
     chipram_expected[addr] = value;
+    chipram_dirty[addr >> DIRTY_PAGE_SHIFT] = 1;
   }
   else if (addr >= 0xff80000 && addr < (0xff80000 + COLOURRAM_SIZE)) {
     colourram_expected[addr - 0xff80000] = value;
+    colourram_dirty[(addr - 0xff80000) >> DIRTY_PAGE_SHIFT] = 1;
   }
   else if ((addr & 0xfff0000) == 0xffd0000) {
     // $FFDxxxx IO space
     ffdram_expected[addr - 0xffd0000] = value;
+    ffdram_dirty[(addr - 0xffd0000) >> DIRTY_PAGE_SHIFT] = 1;
   }
   else {
     // Otherwise unmapped RAM
@@ -2439,7 +2145,7 @@ unsigned char stack_pop_ext(struct cpu *cpu, unsigned short amount, struct instr
       cpu->stack_underflow = true;
     cpu->regs.sp = new_sp;
   }
-  log->pop_blame[log->pops++] = memory_blame(cpu, cpu->regs.sp);
+  log->pop_blame[log->pops++] = keep_blame ? memory_blame(cpu, cpu->regs.sp) : 0;
   return read_memory(cpu, cpu->regs.sp);
 }
 
@@ -2466,1543 +2172,3050 @@ bool stack_push(struct cpu *cpu, unsigned char v)
   return true;
 }
 
-bool execute_instruction(struct cpu *cpu, struct instruction_log *log)
+// $00: BRK
+static bool op_00(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->term.error = true;
+  cpu->term.brk = true;
+  cpu->term.done = true;
+  return true;
+}
+
+// $01: ORA ($xx,X)
+static bool op_01(struct cpu *cpu, struct instruction_log *log)
 {
   int v;
-  for (int i = 0; i < 6; i++) {
-    log->bytes[i] = read_memory(cpu, cpu->regs.pc + i);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr_izpx(cpu, log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $03: SEE
+static bool op_03(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags |= FLAG_E;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $04: TSB $xx
+static bool op_04(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_z = (v & cpu->regs.a) == 0;
+  v |= cpu->regs.a;
+  MEM_WRITE16(cpu, addr, v);
+  return true;
+}
+
+// $05: ORA $xx
+static bool op_05(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $06: ASL $nn
+static bool op_06(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  cpu->regs.flag_c = cpu->regs.a >= 0x80;
+  v = read_memory(cpu, addr) << 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $07: RMB0 $nn
+static bool op_07(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~1;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $08: PHP
+static bool op_08(struct cpu *cpu, struct instruction_log *log)
+{
+  // B flag always pushes as set
+  stack_push(cpu, cpu->regs.flags | FLAG_B);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $09: ORA #$nn
+static bool op_09(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a |= log->bytes[1];
+  update_nz(cpu->regs.a);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $0A: ASL A
+static bool op_0a(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  cpu->regs.flag_c = cpu->regs.a >= 0x80;
+  v = cpu->regs.a << 1;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 1;
+  cpu->regs.pc += 1;
+  return true;
+}
+
+// $0C: TSB $xxxx
+static bool op_0c(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_z = (v & cpu->regs.a) == 0;
+  v |= cpu->regs.a;
+  MEM_WRITE16(cpu, addr, v);
+  return true;
+}
+
+// $0D: ORA $xxxx
+static bool op_0d(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr_abs(log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $0E: ASL $nnnn
+static bool op_0e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  cpu->regs.flag_c = cpu->regs.a >= 0x80;
+  v = read_memory(cpu, addr) << 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $0F: BBR0 $nn,$rr
+static bool op_0f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 1) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
   }
-  switch (log->bytes[0]) {
-  case 0x00: // BRK
-    log->len = 2;
-    cpu->term.error = true;
-    cpu->term.brk = true;
-    cpu->term.done = true;
-    break;
-  case 0x01: // ORA ($xx,X)
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_izpx(cpu, log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x03: // SEE
-    cpu->regs.flags |= FLAG_E;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x04: // TSB $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zp(cpu, log));
-    cpu->regs.flag_z = (v & cpu->regs.a) == 0;
-    v |= cpu->regs.a;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    break;
-  case 0x05: // ORA $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zp(cpu, log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x06: // ASL $nn
-    cpu->regs.flag_c = cpu->regs.a >= 0x80;
-    v = read_memory(cpu, addr_zp(cpu, log)) << 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x07: // RMB0 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~1;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x08: // PHP
-    // B flag always pushes as set
-    stack_push(cpu, cpu->regs.flags | FLAG_B);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x09: // ORA #$nn
-    cpu->regs.a |= log->bytes[1];
-    update_nz(cpu->regs.a);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x0A: // ASL A
-    cpu->regs.flag_c = cpu->regs.a >= 0x80;
-    v = cpu->regs.a << 1;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 1;
-    cpu->regs.pc += 1;
-    break;
-  case 0x0c: // TSB $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_abs(log));
-    cpu->regs.flag_z = (v & cpu->regs.a) == 0;
-    v |= cpu->regs.a;
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    break;
-  case 0x0d: // ORA $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_abs(log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x0e: // ASL $nnnn
-    cpu->regs.flag_c = cpu->regs.a >= 0x80;
-    v = read_memory(cpu, addr_abs(log)) << 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x0F: // BBR0 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 1) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x10: // BPL $rr
-    log->len = 2;
-    if (cpu->regs.flags & FLAG_N)
-      cpu->regs.pc += 2;
-    else
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    break;
-  case 0x11: // ORA ($xx),Y
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_izpy(cpu, log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x12: // ORA ($xx),Z
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_izpz(cpu, log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x13: // BPL $rrrr
-    log->len = 3;
-    if (cpu->regs.flags & FLAG_N)
-      cpu->regs.pc += 3;
-    else
-      cpu->regs.pc += 2 + rel16_delta(log->bytes[1]);
-    break;
-  case 0x14: // TRB $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zp(cpu, log));
-    cpu->regs.flag_z = (v & cpu->regs.a) == 0;
-    v &= ~cpu->regs.a;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    break;
-  case 0x15: // ORA $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zpx(cpu, log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x16: // ASL $nn,X
-    cpu->regs.flag_c = cpu->regs.a >= 0x80;
-    v = read_memory(cpu, addr_zpx(cpu, log)) << 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x17: // RMB1 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~2;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x18: // CLC
-    cpu->regs.flags &= ~FLAG_C;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x19: // ORA $xxxx,Y
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_absy(cpu, log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x1A: // INC A
-    cpu->regs.a++;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x1B: // INZ
-    cpu->regs.z++;
-    update_nz(cpu->regs.z);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x1d: // ORA $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_absx(cpu, log));
-    v |= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    break;
-  case 0x1e: // ASL $nnnn,X
-    cpu->regs.flag_c = cpu->regs.a >= 0x80;
-    v = read_memory(cpu, addr_absx(cpu, log)) << 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_absx(cpu, log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x1c: // TRB $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_abs(log));
-    cpu->regs.flag_z = (v & cpu->regs.a) == 0;
-    v &= ~cpu->regs.a;
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    break;
-  case 0x1F: // BBR1 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 2) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x20: // JSR $nnnn
-    if (cpu->term.rts)
-      cpu->term.rts++;
-    stack_push(cpu, (cpu->regs.pc + 2) >> 8);
-    stack_push(cpu, cpu->regs.pc + 2);
-    cpu->regs.pc = addr_abs(log);
-    log->len = 3;
-    break;
-  case 0x21: // AND ($nn,X)
-    v = read_memory(cpu, addr_izpx(cpu, log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x22: // JSR ($nnnn)
-    if (cpu->term.rts)
-      cpu->term.rts++;
-    stack_push(cpu, (cpu->regs.pc + 2) >> 8);
-    stack_push(cpu, cpu->regs.pc + 2);
-    cpu->regs.pc = addr_deref16(cpu, log);
-    log->len = 3;
-    break;
-  case 0x24: // BIT $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    update_bit_flags(read_memory(cpu, addr_zp(cpu, log)));
-    break;
-  case 0x25: // AND $nn
-    v = read_memory(cpu, addr_zp(cpu, log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x26: // ROL $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) << 1;
-    if (cpu->regs.flag_c)
-      v |= 0x1;
-    cpu->regs.flag_c = v >= 0x100;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x27: // RMB2 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~4;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x28: // PLP
-    // E & B flags cannot be set via PLP
-    cpu->regs.flags &= FLAG_E | FLAG_B;
-    cpu->regs.flags |= stack_pop(cpu, log) & ~(FLAG_E | FLAG_B);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x29: // AND #$nn
-    cpu->regs.a &= log->bytes[1];
-    update_nz(cpu->regs.a);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x2A: // ROL A
-    v = cpu->regs.a << 1;
-    if (cpu->regs.flag_c)
-      v |= 0x1;
-    cpu->regs.flag_c = v >= 0x100;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 1;
-    cpu->regs.pc += 1;
-    break;
-  case 0x2b: // TYS
-    cpu->regs.sph = cpu->regs.y;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x2C: // BIT $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    update_bit_flags(read_memory(cpu, addr_abs(log)));
-    break;
-  case 0x2D: // AND $nnnn
-    v = read_memory(cpu, addr_abs(log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x2e: // ROL $nnnn
-    v = read_memory(cpu, addr_abs(log)) << 1;
-    if (cpu->regs.flag_c)
-      v |= 0x1;
-    cpu->regs.flag_c = v >= 0x100;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x2F: // BBR2 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 4) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x30: // BMI $rr
-    log->len = 2;
-    if (!(cpu->regs.flags & FLAG_N))
-      cpu->regs.pc += 2;
-    else
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    break;
-  case 0x31: // AND ($nn),Y
-    v = read_memory(cpu, addr_izpy(cpu, log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x32: // AND ($nn),Z
-    v = read_memory(cpu, addr_izpz(cpu, log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x33: // BMI $rrrr
-    log->len = 3;
-    if (!(cpu->regs.flags & FLAG_N))
-      cpu->regs.pc += 3;
-    else
-      cpu->regs.pc += 2 + rel16_delta(log->bytes[1]);
-    break;
-  case 0x34: // BIT $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    update_bit_flags(read_memory(cpu, addr_zpx(cpu, log)));
-    break;
-  case 0x35: // AND $nn,X
-    v = read_memory(cpu, addr_zpx(cpu, log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x36: // ROL $nn,X
-    v = read_memory(cpu, addr_zpx(cpu, log)) << 1;
-    if (cpu->regs.flag_c)
-      v |= 0x1;
-    cpu->regs.flag_c = v >= 0x100;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x37: // RMB3 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~8;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $10: BPL $rr
+static bool op_10(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (cpu->regs.flags & FLAG_N)
     cpu->regs.pc += 2;
-    break;
-  case 0x38: // SEC
-    cpu->regs.flags |= FLAG_C;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x39: // AND $nnnn,Y
-    v = read_memory(cpu, addr_absy(cpu, log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x3A: // DEC A
-    cpu->regs.a--;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x3C: // BIT $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    update_bit_flags(read_memory(cpu, addr_absx(cpu, log)));
-    break;
-  case 0x3D: // AND $nnnn,X
-    v = read_memory(cpu, addr_absx(cpu, log));
-    v &= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x3e: // ROL $nnnn,X
-    v = read_memory(cpu, addr_absx(cpu, log)) << 1;
-    if (cpu->regs.flag_c)
-      v |= 0x1;
-    cpu->regs.flag_c = v >= 0x100;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_absx(cpu, log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x3F: // BBR3 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 8) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
+  else
+    cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  return true;
+}
+
+// $11: ORA ($xx),Y
+static bool op_11(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr_izpy(cpu, log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $12: ORA ($xx),Z
+static bool op_12(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr_izpz(cpu, log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $13: BPL $rrrr
+static bool op_13(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  if (cpu->regs.flags & FLAG_N)
     cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x40: // RTI
-    log->len = 1;
-    // E & B flags cannot be set via RTI
-    cpu->regs.flags &= FLAG_E | FLAG_B;
-    cpu->regs.flags |= stack_pop(cpu, log) & ~(FLAG_E | FLAG_B);
-    cpu->regs.pc = stack_pop(cpu, log);
-    cpu->regs.pc |= stack_pop(cpu, log) << 8;
-    break;
-  case 0x41: // EOR ($nn,X)
-    v = read_memory(cpu, addr_izpx(cpu, log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x45: // EOR $nn
-    v = read_memory(cpu, addr_zp(cpu, log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x46: // LSR $nn
-    v = read_memory(cpu, addr_zp(cpu, log));
-    cpu->regs.flag_c = v & 1;
-    v >>= 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x47: // RMB4 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~16;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x48: // PHA
-    stack_push(cpu, cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x49: // EOR #$nn
-    cpu->regs.a ^= log->bytes[1];
-    update_nz(cpu->regs.a);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x4A: // LSR A
-    v = cpu->regs.a;
-    cpu->regs.flag_c = v & 1;
-    v >>= 1;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 1;
-    cpu->regs.pc++;
-    break;
-  case 0x4B: // TAZ
-    cpu->regs.z = cpu->regs.a;
-    update_nz(cpu->regs.z);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x4c: // JMP $nnnn
-    cpu->regs.pc = addr_abs(log);
-    log->len = 3;
-    break;
-  case 0x4d: // EOR $nnnn
-    v = read_memory(cpu, addr_abs(log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x4e: // LSR $nnnn
-    v = read_memory(cpu, addr_abs(log));
-    cpu->regs.flag_c = v & 1;
-    v >>= 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x4F: // BBR4 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 16) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x50: // BVC $rr
-    log->len = 2;
-    if (cpu->regs.flag_v)
-      cpu->regs.pc += 2;
-    else
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    break;
-  case 0x51: // EOR ($nn),Y
-    v = read_memory(cpu, addr_izpy(cpu, log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x52: // EOR ($nn),Z
-    v = read_memory(cpu, addr_izpz(cpu, log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x55: // EOR $nn,X
-    v = read_memory(cpu, addr_zpx(cpu, log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x56: // LSR $nn,X
-    v = read_memory(cpu, addr_zpx(cpu, log));
-    cpu->regs.flag_c = v & 1;
-    v >>= 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x57: // RMB5 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~32;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x58: // CLI
-    cpu->regs.flags &= ~FLAG_I;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x59: // EOR $nnnn,Y
-    v = read_memory(cpu, addr_absy(cpu, log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x5A: // PHY
-    stack_push(cpu, cpu->regs.y);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x5b: // TAB
-    cpu->regs.b = cpu->regs.a;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x5c: // MAP
-    cpu->regs.pc++;
+  else
+    cpu->regs.pc += 2 + rel16_delta(log->bytes[1]);
+  return true;
+}
 
-    if (cpu->regs.x == 0x0f)
-      cpu->regs.maplomb = cpu->regs.a;
-    else
-      cpu->regs.maplo = cpu->regs.a + (cpu->regs.x << 8);
-    if (!cpu->regs.in_hyper) {
-      if (cpu->regs.z == 0x0f)
-        cpu->regs.maphimb = cpu->regs.y;
-      else
-        cpu->regs.maplo = cpu->regs.y + (cpu->regs.z << 8);
-    }
-    cpu->regs.map_irq_inhibit = 1;
-    log->len = 1;
-    break;
-  case 0x5d: // EOR $nnnn,X
-    v = read_memory(cpu, addr_absx(cpu, log));
-    v ^= cpu->regs.a;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x5e: // LSR $nnnn,X
-    v = read_memory(cpu, addr_absx(cpu, log));
-    cpu->regs.flag_c = v & 1;
-    v >>= 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_absx(cpu, log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x5F: // BBR5 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 32) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x60: // RTS
-    log->len = 1;
-    if (cpu->term.rts) {
-      cpu->term.rts--;
-      if (!cpu->term.rts) {
-        fprintf(logfile, "INFO: Terminating via RTS\n");
-        cpu->term.done = true;
-      }
-    }
-    cpu->regs.pc = stack_pop(cpu, log);
-    cpu->regs.pc |= stack_pop(cpu, log) << 8;
-    cpu->regs.pc++;
-    break;
-  case 0x61: // ADC ($nn,X)
-    adc(cpu, read_memory(cpu, addr_izpx(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x64: // STZ $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.z);
-    break;
-  case 0x65: // ADC $nn
-    adc(cpu, read_memory(cpu, addr_zp(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x66: // ROR $nn
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if (cpu->regs.flag_c)
-      v |= 0x100;
-    cpu->regs.flag_c = v & 1;
-    v = v >> 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x67: // RMB6 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~64;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x68: // PLA
-    cpu->regs.a = stack_pop(cpu, log);
-    update_nz(cpu->regs.a);
-    log->len = 1;
-    cpu->regs.pc++;
-    break;
-  case 0x69: // ADC #$nn
-    adc(cpu, log->bytes[1]);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x6A: // ROR A
-    v = cpu->regs.a;
-    if (cpu->regs.flag_c)
-      v |= 0x100;
-    cpu->regs.flag_c = v & 1;
-    v = v >> 1;
-    update_nz(v);
-    cpu->regs.a = v;
-    log->len = 1;
-    cpu->regs.pc += 1;
-    break;
-  case 0x6B: // TZA
-    cpu->regs.a = cpu->regs.z;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x6C: // JMP ($nnnn)
-    cpu->regs.pc = addr_deref16(cpu, log);
-    log->len = 3;
-    break;
-  case 0x6D: // ADC $nnnn
-    adc(cpu, read_memory(cpu, addr_abs(log)));
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x6E: // ROR $nnnn
-    v = read_memory(cpu, addr_abs(log));
-    if (cpu->regs.flag_c)
-      v |= 0x100;
-    cpu->regs.flag_c = v & 1;
-    v = v >> 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x6F: // BBR6 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 64) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x70: // BVS $rr-
-    log->len = 2;
-    if (!cpu->regs.flag_v)
-      cpu->regs.pc += 2;
-    else
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    break;
-  case 0x71: // ADC ($nn),Y
-    adc(cpu, read_memory(cpu, addr_izpy(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x72: // ADC ($nn),Z
-    adc(cpu, read_memory(cpu, addr_izpz(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x74: // STZ $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), cpu->regs.z);
-    break;
-  case 0x75: // ADC $nn,X
-    adc(cpu, read_memory(cpu, addr_zpx(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x76: // ROR $nn,X
-    v = read_memory(cpu, addr_zpx(cpu, log));
-    if (cpu->regs.flag_c)
-      v |= 0x100;
-    cpu->regs.flag_c = v & 1;
-    v = v >> 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x77: // RMB7 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) & ~128;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
+// $14: TRB $xx
+static bool op_14(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_z = (v & cpu->regs.a) == 0;
+  v &= ~cpu->regs.a;
+  MEM_WRITE16(cpu, addr, v);
+  return true;
+}
+
+// $15: ORA $xx,X
+static bool op_15(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr_zpx(cpu, log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $16: ASL $nn,X
+static bool op_16(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zpx(cpu, log);
+  cpu->regs.flag_c = cpu->regs.a >= 0x80;
+  v = read_memory(cpu, addr) << 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $17: RMB1 $nn
+static bool op_17(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~2;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $18: CLC
+static bool op_18(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags &= ~FLAG_C;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $19: ORA $xxxx,Y
+static bool op_19(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr_absy(cpu, log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $1A: INC A
+static bool op_1a(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a++;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $1B: INZ
+static bool op_1b(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.z++;
+  update_nz(cpu->regs.z);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $1C: TRB $xxxx
+static bool op_1c(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_z = (v & cpu->regs.a) == 0;
+  v &= ~cpu->regs.a;
+  MEM_WRITE16(cpu, addr, v);
+  return true;
+}
+
+// $1D: ORA $xxxx,X
+static bool op_1d(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr_absx(cpu, log));
+  v |= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  return true;
+}
+
+// $1E: ASL $nnnn,X
+static bool op_1e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_absx(cpu, log);
+  cpu->regs.flag_c = cpu->regs.a >= 0x80;
+  v = read_memory(cpu, addr) << 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $1F: BBR1 $nn,$rr
+static bool op_1f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 2) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $20: JSR $nnnn
+static bool op_20(struct cpu *cpu, struct instruction_log *log)
+{
+  if (cpu->term.rts)
+    cpu->term.rts++;
+  stack_push(cpu, (cpu->regs.pc + 2) >> 8);
+  stack_push(cpu, cpu->regs.pc + 2);
+  cpu->regs.pc = addr_abs(log);
+  log->len = 3;
+  return true;
+}
+
+// $21: AND ($nn,X)
+static bool op_21(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_izpx(cpu, log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $22: JSR ($nnnn)
+static bool op_22(struct cpu *cpu, struct instruction_log *log)
+{
+  if (cpu->term.rts)
+    cpu->term.rts++;
+  stack_push(cpu, (cpu->regs.pc + 2) >> 8);
+  stack_push(cpu, cpu->regs.pc + 2);
+  cpu->regs.pc = addr_deref16(cpu, log);
+  log->len = 3;
+  return true;
+}
+
+// $24: BIT $xx
+static bool op_24(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  update_bit_flags(read_memory(cpu, addr_zp(cpu, log)));
+  return true;
+}
+
+// $25: AND $nn
+static bool op_25(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $26: ROL $nn
+static bool op_26(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) << 1;
+  if (cpu->regs.flag_c)
+    v |= 0x1;
+  cpu->regs.flag_c = v >= 0x100;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $27: RMB2 $nn
+static bool op_27(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~4;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $28: PLP
+static bool op_28(struct cpu *cpu, struct instruction_log *log)
+{
+  // E & B flags cannot be set via PLP
+  cpu->regs.flags &= FLAG_E | FLAG_B;
+  cpu->regs.flags |= stack_pop(cpu, log) & ~(FLAG_E | FLAG_B);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $29: AND #$nn
+static bool op_29(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a &= log->bytes[1];
+  update_nz(cpu->regs.a);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $2A: ROL A
+static bool op_2a(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a << 1;
+  if (cpu->regs.flag_c)
+    v |= 0x1;
+  cpu->regs.flag_c = v >= 0x100;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 1;
+  cpu->regs.pc += 1;
+  return true;
+}
+
+// $2B: TYS
+static bool op_2b(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.sph = cpu->regs.y;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $2C: BIT $xxxx
+static bool op_2c(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  update_bit_flags(read_memory(cpu, addr_abs(log)));
+  return true;
+}
+
+// $2D: AND $nnnn
+static bool op_2d(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_abs(log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $2E: ROL $nnnn
+static bool op_2e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  v = read_memory(cpu, addr) << 1;
+  if (cpu->regs.flag_c)
+    v |= 0x1;
+  cpu->regs.flag_c = v >= 0x100;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $2F: BBR2 $nn,$rr
+static bool op_2f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 4) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $30: BMI $rr
+static bool op_30(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (!(cpu->regs.flags & FLAG_N))
     cpu->regs.pc += 2;
-    break;
-  case 0x78: // SEI
-    cpu->regs.flags |= FLAG_I;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x79: // ADC $nnnn,Y
-    adc(cpu, read_memory(cpu, addr_absy(cpu, log)));
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x7a: // PLY
-    cpu->regs.pc++;
-    log->len = 1;
-    cpu->regs.y = stack_pop(cpu, log);
-    update_nz(cpu->regs.y);
-    break;
-  case 0x7b: // TBA
-    cpu->regs.a = cpu->regs.b;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x7C: // JMP ($nnnn,X)
-    cpu->regs.pc = addr_iabsx(cpu, log);
-    log->len = 3;
-    break;
-  case 0x7D: // ADC $nnnn,X
-    adc(cpu, read_memory(cpu, addr_absx(cpu, log)));
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x7e: // ROR $nnnn,X
-    v = read_memory(cpu, addr_absx(cpu, log));
-    if (cpu->regs.flag_c)
-      v |= 0x100;
-    cpu->regs.flag_c = v & 1;
-    v = v >> 1;
-    update_nz(v);
-    MEM_WRITE16(cpu, addr_absx(cpu, log), v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0x7F: // BBR7 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 128) == 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x80: // BRA $rr
-    log->len = 2;
+  else
     cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    break;
-  case 0x81: // STA ($xx,X)
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_izpx(cpu, log), cpu->regs.a);
-    break;
-  case 0x83: // BRA $rrrr
-    log->len = 3;
-    cpu->regs.pc += 2 + rel16_delta(log->bytes[1]);
-    break;
-  case 0x84: // STY $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.y);
-    break;
-  case 0x85: // STA $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.a);
-    break;
-  case 0x86: // STX $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.x);
-    break;
-  case 0x87: // SMB0 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 1;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x88: // DEY
-    cpu->regs.y--;
-    update_nz(cpu->regs.y);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x89: // BIT #$xx
-    // NOTE: Bit # does NOT alter the N and V flags, unlike BIT's other addressing modes.
-    //       http://forum.6502.org/viewtopic.php?f=2&t=2241&p=27243#p27239
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = log->bytes[1] & cpu->regs.a;
-    cpu->regs.flag_z = (v == 0);
-    break;
-  case 0x8a: // TXA
-    cpu->regs.a = cpu->regs.x;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x8c: // STY $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    MEM_WRITE16(cpu, addr_abs(log), cpu->regs.y);
-    break;
-  case 0x8d: // STA $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    MEM_WRITE16(cpu, addr_abs(log), cpu->regs.a);
-    break;
-  case 0x8e: // STX $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    MEM_WRITE16(cpu, addr_abs(log), cpu->regs.x);
-    break;
-  case 0x8F: // BBS0 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 1) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
+  return true;
+}
+
+// $31: AND ($nn),Y
+static bool op_31(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_izpy(cpu, log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $32: AND ($nn),Z
+static bool op_32(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_izpz(cpu, log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $33: BMI $rrrr
+static bool op_33(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  if (!(cpu->regs.flags & FLAG_N))
     cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0x90: // BCC $rr
-    log->len = 2;
-    if (cpu->regs.flags & FLAG_C)
-      cpu->regs.pc += 2;
-    else
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    break;
-  case 0x91: // STA ($xx),Y
-    log->len = 2;
-    cpu->regs.pc += 2;
-    log->zp16 = 1;
-    MEM_WRITE16(cpu, addr_izpy(cpu, log), cpu->regs.a);
-    break;
-  case 0x92: // STA ($xx),Z
-    log->len = 2;
+  else
+    cpu->regs.pc += 2 + rel16_delta(log->bytes[1]);
+  return true;
+}
+
+// $34: BIT $xx,X
+static bool op_34(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  update_bit_flags(read_memory(cpu, addr_zpx(cpu, log)));
+  return true;
+}
+
+// $35: AND $nn,X
+static bool op_35(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zpx(cpu, log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $36: ROL $nn,X
+static bool op_36(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zpx(cpu, log);
+  v = read_memory(cpu, addr) << 1;
+  if (cpu->regs.flag_c)
+    v |= 0x1;
+  cpu->regs.flag_c = v >= 0x100;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $37: RMB3 $nn
+static bool op_37(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~8;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $38: SEC
+static bool op_38(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags |= FLAG_C;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $39: AND $nnnn,Y
+static bool op_39(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_absy(cpu, log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $3A: DEC A
+static bool op_3a(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a--;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $3C: BIT $xxxx,X
+static bool op_3c(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  update_bit_flags(read_memory(cpu, addr_absx(cpu, log)));
+  return true;
+}
+
+// $3D: AND $nnnn,X
+static bool op_3d(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_absx(cpu, log));
+  v &= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $3E: ROL $nnnn,X
+static bool op_3e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_absx(cpu, log);
+  v = read_memory(cpu, addr) << 1;
+  if (cpu->regs.flag_c)
+    v |= 0x1;
+  cpu->regs.flag_c = v >= 0x100;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $3F: BBR3 $nn,$rr
+static bool op_3f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 8) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $40: RTI
+static bool op_40(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 1;
+  // E & B flags cannot be set via RTI
+  cpu->regs.flags &= FLAG_E | FLAG_B;
+  cpu->regs.flags |= stack_pop(cpu, log) & ~(FLAG_E | FLAG_B);
+  cpu->regs.pc = stack_pop(cpu, log);
+  cpu->regs.pc |= stack_pop(cpu, log) << 8;
+  return true;
+}
+
+// $41: EOR ($nn,X)
+static bool op_41(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_izpx(cpu, log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $45: EOR $nn
+static bool op_45(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $46: LSR $nn
+static bool op_46(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_c = v & 1;
+  v >>= 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $47: RMB4 $nn
+static bool op_47(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~16;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $48: PHA
+static bool op_48(struct cpu *cpu, struct instruction_log *log)
+{
+  stack_push(cpu, cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $49: EOR #$nn
+static bool op_49(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a ^= log->bytes[1];
+  update_nz(cpu->regs.a);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $4A: LSR A
+static bool op_4a(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a;
+  cpu->regs.flag_c = v & 1;
+  v >>= 1;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 1;
+  cpu->regs.pc++;
+  return true;
+}
+
+// $4B: TAZ
+static bool op_4b(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.z = cpu->regs.a;
+  update_nz(cpu->regs.z);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $4C: JMP $nnnn
+static bool op_4c(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.pc = addr_abs(log);
+  log->len = 3;
+  return true;
+}
+
+// $4D: EOR $nnnn
+static bool op_4d(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_abs(log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $4E: LSR $nnnn
+static bool op_4e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_c = v & 1;
+  v >>= 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $4F: BBR4 $nn,$rr
+static bool op_4f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 16) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $50: BVC $rr
+static bool op_50(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (cpu->regs.flag_v)
     cpu->regs.pc += 2;
-    if ((cpulog_len > 1) && cpulog[cpulog_len - 2]->bytes[0] == 0xEA) {
-      // NOP prefix means 32-bit ZP pointer
-      fprintf(logfile, "ZP32 address = $%07x\n", addr_izpz32(cpu, log));
-      log->zp32 = 1;
-      MEM_WRITE28(cpu, addr_izpz32(cpu, log), cpu->regs.a);
-    }
-    else {
-      // Normal 16-bit ZP pointer
-      log->zp16 = 1;
-      MEM_WRITE16(cpu, addr_izpz(cpu, log), cpu->regs.a);
-    }
-    break;
-  case 0x93: // BCC $rrrr
-    log->len = 3;
-    if (cpu->regs.flags & FLAG_C)
-      cpu->regs.pc += 3;
+  else
+    cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  return true;
+}
+
+// $51: EOR ($nn),Y
+static bool op_51(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_izpy(cpu, log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $52: EOR ($nn),Z
+static bool op_52(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_izpz(cpu, log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $55: EOR $nn,X
+static bool op_55(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zpx(cpu, log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $56: LSR $nn,X
+static bool op_56(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zpx(cpu, log);
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_c = v & 1;
+  v >>= 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $57: RMB5 $nn
+static bool op_57(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~32;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $58: CLI
+static bool op_58(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags &= ~FLAG_I;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $59: EOR $nnnn,Y
+static bool op_59(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_absy(cpu, log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $5A: PHY
+static bool op_5a(struct cpu *cpu, struct instruction_log *log)
+{
+  stack_push(cpu, cpu->regs.y);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $5B: TAB
+static bool op_5b(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.b = cpu->regs.a;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $5C: MAP
+static bool op_5c(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.pc++;
+
+  if (cpu->regs.x == 0x0f)
+    cpu->regs.maplomb = cpu->regs.a;
+  else
+    cpu->regs.maplo = cpu->regs.a + (cpu->regs.x << 8);
+  if (!cpu->regs.in_hyper) {
+    if (cpu->regs.z == 0x0f)
+      cpu->regs.maphimb = cpu->regs.y;
     else
-      cpu->regs.pc += 3 + rel16_delta(log->bytes[1] + (log->bytes[2] << 8));
-    break;
-  case 0x94: // STA $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), cpu->regs.y);
-    break;
-  case 0x95: // STA $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), cpu->regs.a);
-    break;
-  case 0x96: // STX $xx,Y
-    log->len = 2;
-    cpu->regs.pc += 2;
-    MEM_WRITE16(cpu, addr_zpy(cpu, log), cpu->regs.x);
-    break;
-  case 0x97: // SMB1 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 2;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0x98: // TYA
-    cpu->regs.a = cpu->regs.y;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x99: // STA $xxxx,Y
-    log->len = 3;
-    cpu->regs.pc += 3;
-    MEM_WRITE16(cpu, addr_absy(cpu, log), cpu->regs.a);
-    break;
-  case 0x9a: // TXS
-    cpu->regs.spl = cpu->regs.x;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0x9c: // STZ $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    MEM_WRITE16(cpu, addr_abs(log), cpu->regs.z);
-    break;
-  case 0x9d: // STA $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    MEM_WRITE16(cpu, addr_absx(cpu, log), cpu->regs.a);
-    break;
-  case 0x9E: // STZ $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    MEM_WRITE16(cpu, addr_absx(cpu, log), cpu->regs.z);
-    break;
-  case 0x9F: // BBS1 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 2) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0xa0: // LDY #$nn
-    cpu->regs.y = log->bytes[1];
-    update_nz(cpu->regs.y);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xA1: // LDA ($xx,X)
-    log->len = 2;
-    cpu->regs.pc += 2;
-    log->zp16 = 1;
-    cpu->regs.a = read_memory(cpu, addr_izpx(cpu, log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xa2: // LDX #$nn
-    cpu->regs.x = log->bytes[1];
-    update_nz(cpu->regs.x);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xa3: // LDZ #$nn
-    cpu->regs.z = log->bytes[1];
-    update_nz(cpu->regs.z);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xa4: // LDY $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    cpu->regs.y = read_memory(cpu, addr_zp(cpu, log));
-    update_nz(cpu->regs.y);
-    break;
-  case 0xa5: // LDA $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    cpu->regs.a = read_memory(cpu, addr_zp(cpu, log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xa6: // LDX $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    cpu->regs.x = read_memory(cpu, addr_zp(cpu, log));
-    update_nz(cpu->regs.x);
-    break;
-  case 0xa7: // SMB2 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 4;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xa8: // TAY
-    cpu->regs.y = cpu->regs.a;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xa9: // LDA #$nn
-    cpu->regs.a = log->bytes[1];
-    update_nz(cpu->regs.a);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xaa: // TAX
-    cpu->regs.x = cpu->regs.a;
-    update_nz(cpu->regs.a);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xac: // LDY $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    cpu->regs.y = read_memory(cpu, addr_abs(log));
-    update_nz(cpu->regs.y);
-    break;
-  case 0xad: // LDA $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    cpu->regs.a = read_memory(cpu, addr_abs(log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xae: // LDX $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    cpu->regs.x = read_memory(cpu, addr_abs(log));
-    update_nz(cpu->regs.x);
-    break;
-  case 0xAF: // BBS2 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 4) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
+      cpu->regs.maplo = cpu->regs.y + (cpu->regs.z << 8);
+  }
+  cpu_map_changed(cpu);
+  cpu->regs.map_irq_inhibit = 1;
+  log->len = 1;
+  return true;
+}
+
+// $5D: EOR $nnnn,X
+static bool op_5d(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_absx(cpu, log));
+  v ^= cpu->regs.a;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $5E: LSR $nnnn,X
+static bool op_5e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_absx(cpu, log);
+  v = read_memory(cpu, addr);
+  cpu->regs.flag_c = v & 1;
+  v >>= 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $5F: BBR5 $nn,$rr
+static bool op_5f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 32) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $60: RTS
+static bool op_60(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 1;
+  if (cpu->term.rts) {
+    cpu->term.rts--;
+    if (!cpu->term.rts) {
+      fprintf(logfile, "INFO: Terminating via RTS\n");
+      cpu->term.done = true;
     }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0xB0: // BCS $rr
-    log->len = 2;
-    if (cpu->regs.flags & FLAG_C)
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    else
-      cpu->regs.pc += 2;
-    break;
-  case 0xb1: // LDA ($xx),Y
-    log->len = 2;
+  }
+  cpu->regs.pc = stack_pop(cpu, log);
+  cpu->regs.pc |= stack_pop(cpu, log) << 8;
+  cpu->regs.pc++;
+  return true;
+}
+
+// $61: ADC ($nn,X)
+static bool op_61(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_izpx(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $64: STZ $xx
+static bool op_64(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.z);
+  return true;
+}
+
+// $65: ADC $nn
+static bool op_65(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_zp(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $66: ROR $nn
+static bool op_66(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr);
+  if (cpu->regs.flag_c)
+    v |= 0x100;
+  cpu->regs.flag_c = v & 1;
+  v = v >> 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $67: RMB6 $nn
+static bool op_67(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~64;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $68: PLA
+static bool op_68(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a = stack_pop(cpu, log);
+  update_nz(cpu->regs.a);
+  log->len = 1;
+  cpu->regs.pc++;
+  return true;
+}
+
+// $69: ADC #$nn
+static bool op_69(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, log->bytes[1]);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $6A: ROR A
+static bool op_6a(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a;
+  if (cpu->regs.flag_c)
+    v |= 0x100;
+  cpu->regs.flag_c = v & 1;
+  v = v >> 1;
+  update_nz(v);
+  cpu->regs.a = v;
+  log->len = 1;
+  cpu->regs.pc += 1;
+  return true;
+}
+
+// $6B: TZA
+static bool op_6b(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a = cpu->regs.z;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $6C: JMP ($nnnn)
+static bool op_6c(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.pc = addr_deref16(cpu, log);
+  log->len = 3;
+  return true;
+}
+
+// $6D: ADC $nnnn
+static bool op_6d(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_abs(log)));
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $6E: ROR $nnnn
+static bool op_6e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  v = read_memory(cpu, addr);
+  if (cpu->regs.flag_c)
+    v |= 0x100;
+  cpu->regs.flag_c = v & 1;
+  v = v >> 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $6F: BBR6 $nn,$rr
+static bool op_6f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 64) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $70: BVS $rr-
+static bool op_70(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (!cpu->regs.flag_v)
     cpu->regs.pc += 2;
-    log->zp16 = 1;
-    cpu->regs.a = read_memory(cpu, addr_izpy(cpu, log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xb2: // LDA ($xx),Z
-    log->len = 2;
+  else
+    cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  return true;
+}
+
+// $71: ADC ($nn),Y
+static bool op_71(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_izpy(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $72: ADC ($nn),Z
+static bool op_72(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_izpz(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $74: STZ $xx,X
+static bool op_74(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zpx(cpu, log), cpu->regs.z);
+  return true;
+}
+
+// $75: ADC $nn,X
+static bool op_75(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_zpx(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $76: ROR $nn,X
+static bool op_76(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zpx(cpu, log);
+  v = read_memory(cpu, addr);
+  if (cpu->regs.flag_c)
+    v |= 0x100;
+  cpu->regs.flag_c = v & 1;
+  v = v >> 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $77: RMB7 $nn
+static bool op_77(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) & ~128;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $78: SEI
+static bool op_78(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags |= FLAG_I;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $79: ADC $nnnn,Y
+static bool op_79(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_absy(cpu, log)));
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $7A: PLY
+static bool op_7a(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.pc++;
+  log->len = 1;
+  cpu->regs.y = stack_pop(cpu, log);
+  update_nz(cpu->regs.y);
+  return true;
+}
+
+// $7B: TBA
+static bool op_7b(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a = cpu->regs.b;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $7C: JMP ($nnnn,X)
+static bool op_7c(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.pc = addr_iabsx(cpu, log);
+  log->len = 3;
+  return true;
+}
+
+// $7D: ADC $nnnn,X
+static bool op_7d(struct cpu *cpu, struct instruction_log *log)
+{
+  adc(cpu, read_memory(cpu, addr_absx(cpu, log)));
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $7E: ROR $nnnn,X
+static bool op_7e(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_absx(cpu, log);
+  v = read_memory(cpu, addr);
+  if (cpu->regs.flag_c)
+    v |= 0x100;
+  cpu->regs.flag_c = v & 1;
+  v = v >> 1;
+  update_nz(v);
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $7F: BBR7 $nn,$rr
+static bool op_7f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 128) == 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $80: BRA $rr
+static bool op_80(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  return true;
+}
+
+// $81: STA ($xx,X)
+static bool op_81(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_izpx(cpu, log), cpu->regs.a);
+  return true;
+}
+
+// $83: BRA $rrrr
+static bool op_83(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 2 + rel16_delta(log->bytes[1]);
+  return true;
+}
+
+// $84: STY $xx
+static bool op_84(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.y);
+  return true;
+}
+
+// $85: STA $xx
+static bool op_85(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.a);
+  return true;
+}
+
+// $86: STX $xx
+static bool op_86(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zp(cpu, log), cpu->regs.x);
+  return true;
+}
+
+// $87: SMB0 $nn
+static bool op_87(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 1;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $88: DEY
+static bool op_88(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.y--;
+  update_nz(cpu->regs.y);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $89: BIT #$xx
+static bool op_89(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  // NOTE: Bit # does NOT alter the N and V flags, unlike BIT's other addressing modes.
+  //       http://forum.6502.org/viewtopic.php?f=2&t=2241&p=27243#p27239
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = log->bytes[1] & cpu->regs.a;
+  cpu->regs.flag_z = (v == 0);
+  return true;
+}
+
+// $8A: TXA
+static bool op_8a(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a = cpu->regs.x;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $8C: STY $xxxx
+static bool op_8c(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  MEM_WRITE16(cpu, addr_abs(log), cpu->regs.y);
+  return true;
+}
+
+// $8D: STA $xxxx
+static bool op_8d(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  MEM_WRITE16(cpu, addr_abs(log), cpu->regs.a);
+  return true;
+}
+
+// $8E: STX $xxxx
+static bool op_8e(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  MEM_WRITE16(cpu, addr_abs(log), cpu->regs.x);
+  return true;
+}
+
+// $8F: BBS0 $nn,$rr
+static bool op_8f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 1) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $90: BCC $rr
+static bool op_90(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (cpu->regs.flags & FLAG_C)
     cpu->regs.pc += 2;
+  else
+    cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  return true;
+}
+
+// $91: STA ($xx),Y
+static bool op_91(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  log->zp16 = 1;
+  MEM_WRITE16(cpu, addr_izpy(cpu, log), cpu->regs.a);
+  return true;
+}
+
+// $92: STA ($xx),Z
+static bool op_92(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  if ((cpulog_len > 1) && cpulog_entry(cpulog_len - 2) && cpulog_entry(cpulog_len - 2)->bytes[0] == 0xEA) {
+    // NOP prefix means 32-bit ZP pointer
+    unsigned int addr = addr_izpz32(cpu, log);
+    fprintf(logfile, "ZP32 address = $%07x\n", addr);
+    log->zp32 = 1;
+    MEM_WRITE28(cpu, addr, cpu->regs.a);
+  }
+  else {
+    // Normal 16-bit ZP pointer
     log->zp16 = 1;
-    cpu->regs.a = read_memory(cpu, addr_izpz(cpu, log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xb4: // LDY $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    cpu->regs.y = read_memory(cpu, addr_zpx(cpu, log));
-    update_nz(cpu->regs.y);
-    break;
-  case 0xb5: // LDA $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    cpu->regs.a = read_memory(cpu, addr_zpx(cpu, log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xb6: // LDX $xx,Y
-    log->len = 2;
-    cpu->regs.pc += 2;
-    cpu->regs.x = read_memory(cpu, addr_zpy(cpu, log));
-    update_nz(cpu->regs.x);
-    break;
-  case 0xb7: // SMB3 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 8;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xb8: // CLV
-    cpu->regs.flags &= ~FLAG_V;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xb9: // LDA $xxxx,Y
-    log->len = 3;
-    cpu->regs.pc += 3;
-    cpu->regs.a = read_memory(cpu, addr_absy(cpu, log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xba: // TSX
-    log->len = 1;
-    cpu->regs.pc += 1;
-    cpu->regs.x = cpu->regs.spl;
-    update_nz(cpu->regs.x);
-    break;
-  case 0xbc: // LDY $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    cpu->regs.y = read_memory(cpu, addr_absx(cpu, log));
-    update_nz(cpu->regs.y);
-    break;
-  case 0xbd: // LDA $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    cpu->regs.a = read_memory(cpu, addr_absx(cpu, log));
-    update_nz(cpu->regs.a);
-    break;
-  case 0xbe: // LDX $xxxx,Y
-    log->len = 3;
-    cpu->regs.pc += 3;
-    cpu->regs.x = read_memory(cpu, addr_absy(cpu, log));
-    update_nz(cpu->regs.x);
-    break;
-  case 0xBF: // BBS3 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 8) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0xC0: // CPY #$nn
-    v = cpu->regs.y - log->bytes[1];
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xC1: // CMP ($nn,X)
-    v = cpu->regs.a - read_memory(cpu, addr_izpx(cpu, log));
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xC4: // CPY $nn
-    v = cpu->regs.y - read_memory(cpu, addr_zp(cpu, log));
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xC5: // CMP $nn
-    v = cpu->regs.a - read_memory(cpu, addr_zp(cpu, log));
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xC6: // DEC $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zp(cpu, log));
-    v--;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    update_nz(v);
-    break;
-  case 0xC7: // SMB4 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 16;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xC8: // INY
-    cpu->regs.y++;
-    update_nz(cpu->regs.y);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xC9: // CMP #$nn
-    v = cpu->regs.a - log->bytes[1];
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xCA: // DEX
-    cpu->regs.x--;
-    update_nz(cpu->regs.x);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xCC: // CPY $nnnn
-    v = cpu->regs.y - read_memory(cpu, addr_abs(log));
-    update_cmp_flags(v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0xCD: // CMP $nnnn
-    v = cpu->regs.a - read_memory(cpu, addr_abs(log));
-    update_cmp_flags(v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0xCE: // DEC $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_abs(log));
-    v--;
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    update_nz(v);
-    break;
-  case 0xCF: // BBS4 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 16) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0xd0: // BNE $rr
-    log->len = 2;
-    if (cpu->regs.flags & FLAG_Z)
-      cpu->regs.pc += 2;
-    else
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    break;
-  case 0xD1: // CMP ($nn),Y
-    v = cpu->regs.a - read_memory(cpu, addr_izpy(cpu, log));
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xD2: // CMP ($nn),Z
-    v = cpu->regs.a - read_memory(cpu, addr_izpz(cpu, log));
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xD5: // CMP $nn,X
-    v = cpu->regs.a - read_memory(cpu, addr_zpx(cpu, log));
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xD6: // DEC $xx,X
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zpx(cpu, log));
-    v--;
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), v);
-    update_nz(v);
-    break;
-  case 0xD7: // SMB5 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 32;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xD8: // CLD
-    cpu->regs.flags &= ~FLAG_D;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xD9: // CMP $nnnn,Y
-    v = cpu->regs.a - read_memory(cpu, addr_absy(cpu, log));
-    update_cmp_flags(v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0xDA: // PHX
-    stack_push(cpu, cpu->regs.x);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xDB: // PHZ
-    stack_push(cpu, cpu->regs.z);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xDD: // CMP $nnnn,X
-    v = cpu->regs.a - read_memory(cpu, addr_absx(cpu, log));
-    update_cmp_flags(v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0xDE: // DEC $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_absx(cpu, log));
-    v--;
-    MEM_WRITE16(cpu, addr_absx(cpu, log), v);
-    update_nz(v);
-    break;
-  case 0xDF: // BBS5 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 32) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
-    cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0xE0: // CPX #$nn
-    v = cpu->regs.x - log->bytes[1];
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xe1: // SBC ($nn,X)
-    sbc(cpu, read_memory(cpu, addr_izpx(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xE4: // CPX $nn
-    v = cpu->regs.x - read_memory(cpu, addr_zp(cpu, log));
-    update_cmp_flags(v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xe5: // SBC $nn
-    sbc(cpu, read_memory(cpu, addr_zp(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xE6: // INC $xx
-    log->len = 2;
-    cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zp(cpu, log));
-    v++;
-    v &= 0xff;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    update_nz(v);
-    break;
-  case 0xE7: // SMB6 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 64;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xE8: // INX
-    cpu->regs.x++;
-    update_nz(cpu->regs.x);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xe9: // SBC #$nn
-    sbc(cpu, log->bytes[1]);
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xea: // EOM / NOP
-    cpu->regs.pc++;
-    cpu->regs.map_irq_inhibit = 0;
-    log->len = 1;
-    break;
-  case 0xEC: // CPX $nnnn
-    v = cpu->regs.x - read_memory(cpu, addr_abs(log));
-    update_cmp_flags(v);
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0xed: // SBC $nnnn
-    sbc(cpu, read_memory(cpu, addr_abs(log)));
-    log->len = 3;
-    cpu->regs.pc += 3;
-    break;
-  case 0xEE: // INC $xxxx
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_abs(log));
-    v++;
-    MEM_WRITE16(cpu, addr_abs(log), v);
-    update_nz(v);
-    break;
-  case 0xEF: // BBS6 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 64) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
-    }
+    MEM_WRITE16(cpu, addr_izpz(cpu, log), cpu->regs.a);
+  }
+  return true;
+}
+
+// $93: BCC $rrrr
+static bool op_93(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  if (cpu->regs.flags & FLAG_C)
     cpu->regs.pc += 3;
-    log->len = 3;
-    break;
-  case 0xf0: // BEQ $rr
-    log->len = 2;
-    if (cpu->regs.flags & FLAG_Z)
-      cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
-    else
-      cpu->regs.pc += 2;
-    break;
-  case 0xf1: // SBC ($nn),Y
-    sbc(cpu, read_memory(cpu, addr_izpy(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xf2: // SBC ($nn),Z
-    sbc(cpu, read_memory(cpu, addr_izpz(cpu, log)));
-    log->len = 2;
-    cpu->regs.pc += 2;
-    break;
-  case 0xf3: // BEQ $rrrr
-    log->len = 3;
-    if (cpu->regs.flags & FLAG_Z)
-      cpu->regs.pc += 3 + rel16_delta(log->bytes[1]);
-    else
-      cpu->regs.pc += 3;
-    break;
-  case 0xf5: // SBC $nn,X
-    sbc(cpu, read_memory(cpu, addr_zpx(cpu, log)));
-    log->len = 2;
+  else
+    cpu->regs.pc += 3 + rel16_delta(log->bytes[1] + (log->bytes[2] << 8));
+  return true;
+}
+
+// $94: STA $xx,X
+static bool op_94(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zpx(cpu, log), cpu->regs.y);
+  return true;
+}
+
+// $95: STA $xx,X
+static bool op_95(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zpx(cpu, log), cpu->regs.a);
+  return true;
+}
+
+// $96: STX $xx,Y
+static bool op_96(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  MEM_WRITE16(cpu, addr_zpy(cpu, log), cpu->regs.x);
+  return true;
+}
+
+// $97: SMB1 $nn
+static bool op_97(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 2;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $98: TYA
+static bool op_98(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a = cpu->regs.y;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $99: STA $xxxx,Y
+static bool op_99(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  MEM_WRITE16(cpu, addr_absy(cpu, log), cpu->regs.a);
+  return true;
+}
+
+// $9A: TXS
+static bool op_9a(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.spl = cpu->regs.x;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $9C: STZ $xxxx
+static bool op_9c(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  MEM_WRITE16(cpu, addr_abs(log), cpu->regs.z);
+  return true;
+}
+
+// $9D: STA $xxxx,X
+static bool op_9d(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  MEM_WRITE16(cpu, addr_absx(cpu, log), cpu->regs.a);
+  return true;
+}
+
+// $9E: STZ $xxxx,X
+static bool op_9e(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  MEM_WRITE16(cpu, addr_absx(cpu, log), cpu->regs.z);
+  return true;
+}
+
+// $9F: BBS1 $nn,$rr
+static bool op_9f(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 2) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $A0: LDY #$nn
+static bool op_a0(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.y = log->bytes[1];
+  update_nz(cpu->regs.y);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $A1: LDA ($xx,X)
+static bool op_a1(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  log->zp16 = 1;
+  cpu->regs.a = read_memory(cpu, addr_izpx(cpu, log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $A2: LDX #$nn
+static bool op_a2(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.x = log->bytes[1];
+  update_nz(cpu->regs.x);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $A3: LDZ #$nn
+static bool op_a3(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.z = log->bytes[1];
+  update_nz(cpu->regs.z);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $A4: LDY $xx
+static bool op_a4(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  cpu->regs.y = read_memory(cpu, addr_zp(cpu, log));
+  update_nz(cpu->regs.y);
+  return true;
+}
+
+// $A5: LDA $xx
+static bool op_a5(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  cpu->regs.a = read_memory(cpu, addr_zp(cpu, log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $A6: LDX $xx
+static bool op_a6(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  cpu->regs.x = read_memory(cpu, addr_zp(cpu, log));
+  update_nz(cpu->regs.x);
+  return true;
+}
+
+// $A7: SMB2 $nn
+static bool op_a7(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 4;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $A8: TAY
+static bool op_a8(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.y = cpu->regs.a;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $A9: LDA #$nn
+static bool op_a9(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.a = log->bytes[1];
+  update_nz(cpu->regs.a);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $AA: TAX
+static bool op_aa(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.x = cpu->regs.a;
+  update_nz(cpu->regs.a);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $AC: LDY $xxxx
+static bool op_ac(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  cpu->regs.y = read_memory(cpu, addr_abs(log));
+  update_nz(cpu->regs.y);
+  return true;
+}
+
+// $AD: LDA $xxxx
+static bool op_ad(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  cpu->regs.a = read_memory(cpu, addr_abs(log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $AE: LDX $xxxx
+static bool op_ae(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  cpu->regs.x = read_memory(cpu, addr_abs(log));
+  update_nz(cpu->regs.x);
+  return true;
+}
+
+// $AF: BBS2 $nn,$rr
+static bool op_af(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 4) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $B0: BCS $rr
+static bool op_b0(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (cpu->regs.flags & FLAG_C)
+    cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  else
     cpu->regs.pc += 2;
-    break;
-  case 0xf6: // INC $xx,X
-    log->len = 2;
+  return true;
+}
+
+// $B1: LDA ($xx),Y
+static bool op_b1(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  log->zp16 = 1;
+  cpu->regs.a = read_memory(cpu, addr_izpy(cpu, log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $B2: LDA ($xx),Z
+static bool op_b2(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  log->zp16 = 1;
+  cpu->regs.a = read_memory(cpu, addr_izpz(cpu, log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $B4: LDY $xx,X
+static bool op_b4(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  cpu->regs.y = read_memory(cpu, addr_zpx(cpu, log));
+  update_nz(cpu->regs.y);
+  return true;
+}
+
+// $B5: LDA $xx,X
+static bool op_b5(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  cpu->regs.a = read_memory(cpu, addr_zpx(cpu, log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $B6: LDX $xx,Y
+static bool op_b6(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  cpu->regs.pc += 2;
+  cpu->regs.x = read_memory(cpu, addr_zpy(cpu, log));
+  update_nz(cpu->regs.x);
+  return true;
+}
+
+// $B7: SMB3 $nn
+static bool op_b7(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 8;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $B8: CLV
+static bool op_b8(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags &= ~FLAG_V;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $B9: LDA $xxxx,Y
+static bool op_b9(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  cpu->regs.a = read_memory(cpu, addr_absy(cpu, log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $BA: TSX
+static bool op_ba(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 1;
+  cpu->regs.pc += 1;
+  cpu->regs.x = cpu->regs.spl;
+  update_nz(cpu->regs.x);
+  return true;
+}
+
+// $BC: LDY $xxxx,X
+static bool op_bc(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  cpu->regs.y = read_memory(cpu, addr_absx(cpu, log));
+  update_nz(cpu->regs.y);
+  return true;
+}
+
+// $BD: LDA $xxxx,X
+static bool op_bd(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  cpu->regs.a = read_memory(cpu, addr_absx(cpu, log));
+  update_nz(cpu->regs.a);
+  return true;
+}
+
+// $BE: LDX $xxxx,Y
+static bool op_be(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  cpu->regs.pc += 3;
+  cpu->regs.x = read_memory(cpu, addr_absy(cpu, log));
+  update_nz(cpu->regs.x);
+  return true;
+}
+
+// $BF: BBS3 $nn,$rr
+static bool op_bf(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 8) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $C0: CPY #$nn
+static bool op_c0(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.y - log->bytes[1];
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $C1: CMP ($nn,X)
+static bool op_c1(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_izpx(cpu, log));
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $C4: CPY $nn
+static bool op_c4(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.y - read_memory(cpu, addr_zp(cpu, log));
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $C5: CMP $nn
+static bool op_c5(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_zp(cpu, log));
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $C6: DEC $xx
+static bool op_c6(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr);
+  v--;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $C7: SMB4 $nn
+static bool op_c7(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 16;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $C8: INY
+static bool op_c8(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.y++;
+  update_nz(cpu->regs.y);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $C9: CMP #$nn
+static bool op_c9(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - log->bytes[1];
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $CA: DEX
+static bool op_ca(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.x--;
+  update_nz(cpu->regs.x);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $CC: CPY $nnnn
+static bool op_cc(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.y - read_memory(cpu, addr_abs(log));
+  update_cmp_flags(v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $CD: CMP $nnnn
+static bool op_cd(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_abs(log));
+  update_cmp_flags(v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $CE: DEC $xxxx
+static bool op_ce(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr);
+  v--;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $CF: BBS4 $nn,$rr
+static bool op_cf(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 16) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $D0: BNE $rr
+static bool op_d0(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (cpu->regs.flags & FLAG_Z)
     cpu->regs.pc += 2;
-    v = read_memory(cpu, addr_zpx(cpu, log));
-    v++;
-    v &= 0xff;
-    MEM_WRITE16(cpu, addr_zpx(cpu, log), v);
-    update_nz(v);
-    break;
-  case 0xF7: // SMB7 $nn
-    v = read_memory(cpu, addr_zp(cpu, log)) | 128;
-    MEM_WRITE16(cpu, addr_zp(cpu, log), v);
-    log->len = 2;
+  else
+    cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  return true;
+}
+
+// $D1: CMP ($nn),Y
+static bool op_d1(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_izpy(cpu, log));
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $D2: CMP ($nn),Z
+static bool op_d2(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_izpz(cpu, log));
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $D5: CMP $nn,X
+static bool op_d5(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_zpx(cpu, log));
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $D6: DEC $xx,X
+static bool op_d6(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zpx(cpu, log);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr);
+  v--;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $D7: SMB5 $nn
+static bool op_d7(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 32;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $D8: CLD
+static bool op_d8(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags &= ~FLAG_D;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $D9: CMP $nnnn,Y
+static bool op_d9(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_absy(cpu, log));
+  update_cmp_flags(v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $DA: PHX
+static bool op_da(struct cpu *cpu, struct instruction_log *log)
+{
+  stack_push(cpu, cpu->regs.x);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $DB: PHZ
+static bool op_db(struct cpu *cpu, struct instruction_log *log)
+{
+  stack_push(cpu, cpu->regs.z);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $DD: CMP $nnnn,X
+static bool op_dd(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.a - read_memory(cpu, addr_absx(cpu, log));
+  update_cmp_flags(v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $DE: DEC $xxxx,X
+static bool op_de(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_absx(cpu, log);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr);
+  v--;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $DF: BBS5 $nn,$rr
+static bool op_df(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 32) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $E0: CPX #$nn
+static bool op_e0(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.x - log->bytes[1];
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $E1: SBC ($nn,X)
+static bool op_e1(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_izpx(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $E4: CPX $nn
+static bool op_e4(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.x - read_memory(cpu, addr_zp(cpu, log));
+  update_cmp_flags(v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $E5: SBC $nn
+static bool op_e5(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_zp(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $E6: INC $xx
+static bool op_e6(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr);
+  v++;
+  v &= 0xff;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $E7: SMB6 $nn
+static bool op_e7(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 64;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $E8: INX
+static bool op_e8(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.x++;
+  update_nz(cpu->regs.x);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $E9: SBC #$nn
+static bool op_e9(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, log->bytes[1]);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $EA: EOM / NOP
+static bool op_ea(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.pc++;
+  cpu->regs.map_irq_inhibit = 0;
+  log->len = 1;
+  return true;
+}
+
+// $EC: CPX $nnnn
+static bool op_ec(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = cpu->regs.x - read_memory(cpu, addr_abs(log));
+  update_cmp_flags(v);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $ED: SBC $nnnn
+static bool op_ed(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_abs(log)));
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $EE: INC $xxxx
+static bool op_ee(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_abs(log);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr);
+  v++;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $EF: BBS6 $nn,$rr
+static bool op_ef(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 64) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// $F0: BEQ $rr
+static bool op_f0(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 2;
+  if (cpu->regs.flags & FLAG_Z)
+    cpu->regs.pc += 2 + rel8_delta(log->bytes[1]);
+  else
     cpu->regs.pc += 2;
-    break;
-  case 0xf8: // SED
-    cpu->regs.flags |= FLAG_D;
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xF9: // SBC $nnnn,Y
-    sbc(cpu, read_memory(cpu, addr_absy(cpu, log)));
-    log->len = 3;
+  return true;
+}
+
+// $F1: SBC ($nn),Y
+static bool op_f1(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_izpy(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $F2: SBC ($nn),Z
+static bool op_f2(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_izpz(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $F3: BEQ $rrrr
+static bool op_f3(struct cpu *cpu, struct instruction_log *log)
+{
+  log->len = 3;
+  if (cpu->regs.flags & FLAG_Z)
+    cpu->regs.pc += 3 + rel16_delta(log->bytes[1]);
+  else
     cpu->regs.pc += 3;
+  return true;
+}
+
+// $F5: SBC $nn,X
+static bool op_f5(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_zpx(cpu, log)));
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $F6: INC $xx,X
+static bool op_f6(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zpx(cpu, log);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  v = read_memory(cpu, addr);
+  v++;
+  v &= 0xff;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $F7: SMB7 $nn
+static bool op_f7(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_zp(cpu, log);
+  v = read_memory(cpu, addr) | 128;
+  MEM_WRITE16(cpu, addr, v);
+  log->len = 2;
+  cpu->regs.pc += 2;
+  return true;
+}
+
+// $F8: SED
+static bool op_f8(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.flags |= FLAG_D;
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $F9: SBC $nnnn,Y
+static bool op_f9(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_absy(cpu, log)));
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $FA: PLX
+static bool op_fa(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.x = stack_pop(cpu, log);
+  update_nz(cpu->regs.x);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $FB: PLZ
+static bool op_fb(struct cpu *cpu, struct instruction_log *log)
+{
+  cpu->regs.z = stack_pop(cpu, log);
+  update_nz(cpu->regs.z);
+  cpu->regs.pc++;
+  log->len = 1;
+  return true;
+}
+
+// $FD: SBC $nnnn,X
+static bool op_fd(struct cpu *cpu, struct instruction_log *log)
+{
+  sbc(cpu, read_memory(cpu, addr_absx(cpu, log)));
+  log->len = 3;
+  cpu->regs.pc += 3;
+  return true;
+}
+
+// $FE: INC $xxxx,X
+static bool op_fe(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  unsigned int addr = addr_absx(cpu, log);
+  log->len = 3;
+  cpu->regs.pc += 3;
+  v = read_memory(cpu, addr);
+  v++;
+  MEM_WRITE16(cpu, addr, v);
+  update_nz(v);
+  return true;
+}
+
+// $FF: BBS7 $nn,$rr
+static bool op_ff(struct cpu *cpu, struct instruction_log *log)
+{
+  int v;
+  v = read_memory(cpu, addr_zp(cpu, log));
+  if ((v & 128) != 0) {
+    cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  cpu->regs.pc += 3;
+  log->len = 3;
+  return true;
+}
+
+// Opcode dispatch table. NULL entries are unimplemented opcodes.
+static bool (*const opcode_handlers[256])(struct cpu *cpu, struct instruction_log *log) = {
+  [0x00] = op_00,
+  [0x01] = op_01,
+  [0x03] = op_03,
+  [0x04] = op_04,
+  [0x05] = op_05,
+  [0x06] = op_06,
+  [0x07] = op_07,
+  [0x08] = op_08,
+  [0x09] = op_09,
+  [0x0A] = op_0a,
+  [0x0C] = op_0c,
+  [0x0D] = op_0d,
+  [0x0E] = op_0e,
+  [0x0F] = op_0f,
+  [0x10] = op_10,
+  [0x11] = op_11,
+  [0x12] = op_12,
+  [0x13] = op_13,
+  [0x14] = op_14,
+  [0x15] = op_15,
+  [0x16] = op_16,
+  [0x17] = op_17,
+  [0x18] = op_18,
+  [0x19] = op_19,
+  [0x1A] = op_1a,
+  [0x1B] = op_1b,
+  [0x1C] = op_1c,
+  [0x1D] = op_1d,
+  [0x1E] = op_1e,
+  [0x1F] = op_1f,
+  [0x20] = op_20,
+  [0x21] = op_21,
+  [0x22] = op_22,
+  [0x24] = op_24,
+  [0x25] = op_25,
+  [0x26] = op_26,
+  [0x27] = op_27,
+  [0x28] = op_28,
+  [0x29] = op_29,
+  [0x2A] = op_2a,
+  [0x2B] = op_2b,
+  [0x2C] = op_2c,
+  [0x2D] = op_2d,
+  [0x2E] = op_2e,
+  [0x2F] = op_2f,
+  [0x30] = op_30,
+  [0x31] = op_31,
+  [0x32] = op_32,
+  [0x33] = op_33,
+  [0x34] = op_34,
+  [0x35] = op_35,
+  [0x36] = op_36,
+  [0x37] = op_37,
+  [0x38] = op_38,
+  [0x39] = op_39,
+  [0x3A] = op_3a,
+  [0x3C] = op_3c,
+  [0x3D] = op_3d,
+  [0x3E] = op_3e,
+  [0x3F] = op_3f,
+  [0x40] = op_40,
+  [0x41] = op_41,
+  [0x45] = op_45,
+  [0x46] = op_46,
+  [0x47] = op_47,
+  [0x48] = op_48,
+  [0x49] = op_49,
+  [0x4A] = op_4a,
+  [0x4B] = op_4b,
+  [0x4C] = op_4c,
+  [0x4D] = op_4d,
+  [0x4E] = op_4e,
+  [0x4F] = op_4f,
+  [0x50] = op_50,
+  [0x51] = op_51,
+  [0x52] = op_52,
+  [0x55] = op_55,
+  [0x56] = op_56,
+  [0x57] = op_57,
+  [0x58] = op_58,
+  [0x59] = op_59,
+  [0x5A] = op_5a,
+  [0x5B] = op_5b,
+  [0x5C] = op_5c,
+  [0x5D] = op_5d,
+  [0x5E] = op_5e,
+  [0x5F] = op_5f,
+  [0x60] = op_60,
+  [0x61] = op_61,
+  [0x64] = op_64,
+  [0x65] = op_65,
+  [0x66] = op_66,
+  [0x67] = op_67,
+  [0x68] = op_68,
+  [0x69] = op_69,
+  [0x6A] = op_6a,
+  [0x6B] = op_6b,
+  [0x6C] = op_6c,
+  [0x6D] = op_6d,
+  [0x6E] = op_6e,
+  [0x6F] = op_6f,
+  [0x70] = op_70,
+  [0x71] = op_71,
+  [0x72] = op_72,
+  [0x74] = op_74,
+  [0x75] = op_75,
+  [0x76] = op_76,
+  [0x77] = op_77,
+  [0x78] = op_78,
+  [0x79] = op_79,
+  [0x7A] = op_7a,
+  [0x7B] = op_7b,
+  [0x7C] = op_7c,
+  [0x7D] = op_7d,
+  [0x7E] = op_7e,
+  [0x7F] = op_7f,
+  [0x80] = op_80,
+  [0x81] = op_81,
+  [0x83] = op_83,
+  [0x84] = op_84,
+  [0x85] = op_85,
+  [0x86] = op_86,
+  [0x87] = op_87,
+  [0x88] = op_88,
+  [0x89] = op_89,
+  [0x8A] = op_8a,
+  [0x8C] = op_8c,
+  [0x8D] = op_8d,
+  [0x8E] = op_8e,
+  [0x8F] = op_8f,
+  [0x90] = op_90,
+  [0x91] = op_91,
+  [0x92] = op_92,
+  [0x93] = op_93,
+  [0x94] = op_94,
+  [0x95] = op_95,
+  [0x96] = op_96,
+  [0x97] = op_97,
+  [0x98] = op_98,
+  [0x99] = op_99,
+  [0x9A] = op_9a,
+  [0x9C] = op_9c,
+  [0x9D] = op_9d,
+  [0x9E] = op_9e,
+  [0x9F] = op_9f,
+  [0xA0] = op_a0,
+  [0xA1] = op_a1,
+  [0xA2] = op_a2,
+  [0xA3] = op_a3,
+  [0xA4] = op_a4,
+  [0xA5] = op_a5,
+  [0xA6] = op_a6,
+  [0xA7] = op_a7,
+  [0xA8] = op_a8,
+  [0xA9] = op_a9,
+  [0xAA] = op_aa,
+  [0xAC] = op_ac,
+  [0xAD] = op_ad,
+  [0xAE] = op_ae,
+  [0xAF] = op_af,
+  [0xB0] = op_b0,
+  [0xB1] = op_b1,
+  [0xB2] = op_b2,
+  [0xB4] = op_b4,
+  [0xB5] = op_b5,
+  [0xB6] = op_b6,
+  [0xB7] = op_b7,
+  [0xB8] = op_b8,
+  [0xB9] = op_b9,
+  [0xBA] = op_ba,
+  [0xBC] = op_bc,
+  [0xBD] = op_bd,
+  [0xBE] = op_be,
+  [0xBF] = op_bf,
+  [0xC0] = op_c0,
+  [0xC1] = op_c1,
+  [0xC4] = op_c4,
+  [0xC5] = op_c5,
+  [0xC6] = op_c6,
+  [0xC7] = op_c7,
+  [0xC8] = op_c8,
+  [0xC9] = op_c9,
+  [0xCA] = op_ca,
+  [0xCC] = op_cc,
+  [0xCD] = op_cd,
+  [0xCE] = op_ce,
+  [0xCF] = op_cf,
+  [0xD0] = op_d0,
+  [0xD1] = op_d1,
+  [0xD2] = op_d2,
+  [0xD5] = op_d5,
+  [0xD6] = op_d6,
+  [0xD7] = op_d7,
+  [0xD8] = op_d8,
+  [0xD9] = op_d9,
+  [0xDA] = op_da,
+  [0xDB] = op_db,
+  [0xDD] = op_dd,
+  [0xDE] = op_de,
+  [0xDF] = op_df,
+  [0xE0] = op_e0,
+  [0xE1] = op_e1,
+  [0xE4] = op_e4,
+  [0xE5] = op_e5,
+  [0xE6] = op_e6,
+  [0xE7] = op_e7,
+  [0xE8] = op_e8,
+  [0xE9] = op_e9,
+  [0xEA] = op_ea,
+  [0xEC] = op_ec,
+  [0xED] = op_ed,
+  [0xEE] = op_ee,
+  [0xEF] = op_ef,
+  [0xF0] = op_f0,
+  [0xF1] = op_f1,
+  [0xF2] = op_f2,
+  [0xF3] = op_f3,
+  [0xF5] = op_f5,
+  [0xF6] = op_f6,
+  [0xF7] = op_f7,
+  [0xF8] = op_f8,
+  [0xF9] = op_f9,
+  [0xFA] = op_fa,
+  [0xFB] = op_fb,
+  [0xFD] = op_fd,
+  [0xFE] = op_fe,
+  [0xFF] = op_ff,
+};
+
+bool execute_instruction(struct cpu *cpu, struct instruction_log *log)
+{
+  for (int i = 0; i < 6; i++) {
+    log->bytes[i] = read_memory(cpu, cpu->regs.pc + i);
+  }
+  if (!opcode_handlers[log->bytes[0]]) {
+    fprintf(stderr, "ERROR: Unimplemented opcode $%02X\n", log->bytes[0]);
+    log->len = 6;
+    return false;
+  }
+  return opcode_handlers[log->bytes[0]](cpu, log);
+}
+
+// Cycles taken by each opcode, from the 4502 timings of cycle_count_lut in
+// gs4510.vhdl, which the 45GS02 follows when running at 1, 2 or 3.5MHz.
+// At 40.5MHz an instruction takes as long as its memory accesses do, which
+// no table says, so routines are timed in these 1MHz equivalent cycles.
+// They are for comparing one version of a routine with another, and are
+// what "profile on" reports and "expect cycles" checks.
+static const unsigned char cycle_table[256] = {
+  7, 5, 2, 2, 4, 3, 4, 4, 3, 2, 1, 1, 5, 4, 5, 4, //
+  2, 5, 5, 3, 4, 3, 4, 4, 1, 4, 1, 1, 5, 4, 5, 4, //
+  5, 5, 7, 7, 3, 3, 4, 4, 3, 2, 1, 1, 4, 4, 5, 4, //
+  2, 5, 5, 3, 3, 3, 4, 4, 1, 4, 1, 1, 4, 4, 5, 4, //
+  5, 5, 2, 2, 4, 3, 4, 4, 3, 2, 1, 1, 3, 4, 5, 4, //
+  2, 5, 5, 3, 4, 3, 4, 4, 1, 4, 3, 3, 4, 4, 5, 4, //
+  4, 5, 7, 5, 3, 3, 4, 4, 3, 2, 1, 1, 5, 4, 5, 4, //
+  2, 5, 5, 3, 3, 3, 4, 4, 2, 4, 3, 1, 5, 4, 5, 4, //
+  2, 5, 6, 3, 3, 3, 3, 4, 1, 2, 1, 4, 4, 4, 4, 4, //
+  2, 5, 5, 3, 3, 3, 3, 4, 1, 4, 1, 4, 4, 4, 4, 4, //
+  2, 5, 2, 2, 3, 3, 3, 4, 1, 2, 1, 4, 4, 4, 4, 4, //
+  2, 5, 5, 3, 3, 3, 3, 4, 1, 4, 1, 4, 4, 4, 4, 4, //
+  2, 5, 2, 6, 3, 3, 4, 4, 1, 2, 1, 7, 4, 4, 5, 4, //
+  2, 5, 5, 3, 3, 3, 4, 4, 1, 4, 3, 3, 4, 4, 5, 4, //
+  2, 5, 6, 6, 3, 3, 4, 4, 1, 2, 1, 6, 4, 4, 5, 4, //
+  2, 5, 5, 3, 5, 3, 4, 4, 1, 4, 3, 3, 7, 4, 5, 4, //
+};
+
+// Indexed reads that take an extra cycle when the index crosses a page
+#define PAGE_CROSS_ABSX 1
+#define PAGE_CROSS_ABSY 2
+#define PAGE_CROSS_IZPY 3
+#define PAGE_CROSS_IZPZ 4
+static const unsigned char page_cross_mode[256] = {
+  [0x1D] = PAGE_CROSS_ABSX,
+  [0x3C] = PAGE_CROSS_ABSX,
+  [0x3D] = PAGE_CROSS_ABSX,
+  [0x5D] = PAGE_CROSS_ABSX,
+  [0x7D] = PAGE_CROSS_ABSX,
+  [0xBB] = PAGE_CROSS_ABSX,
+  [0xBC] = PAGE_CROSS_ABSX,
+  [0xBD] = PAGE_CROSS_ABSX,
+  [0xDD] = PAGE_CROSS_ABSX,
+  [0xFD] = PAGE_CROSS_ABSX,
+  [0x19] = PAGE_CROSS_ABSY,
+  [0x39] = PAGE_CROSS_ABSY,
+  [0x59] = PAGE_CROSS_ABSY,
+  [0x79] = PAGE_CROSS_ABSY,
+  [0xB9] = PAGE_CROSS_ABSY,
+  [0xBE] = PAGE_CROSS_ABSY,
+  [0xD9] = PAGE_CROSS_ABSY,
+  [0xF9] = PAGE_CROSS_ABSY,
+  [0x11] = PAGE_CROSS_IZPY,
+  [0x31] = PAGE_CROSS_IZPY,
+  [0x51] = PAGE_CROSS_IZPY,
+  [0x71] = PAGE_CROSS_IZPY,
+  [0xB1] = PAGE_CROSS_IZPY,
+  [0xD1] = PAGE_CROSS_IZPY,
+  [0xF1] = PAGE_CROSS_IZPY,
+  [0x12] = PAGE_CROSS_IZPZ,
+  [0x32] = PAGE_CROSS_IZPZ,
+  [0x52] = PAGE_CROSS_IZPZ,
+  [0x72] = PAGE_CROSS_IZPZ,
+  [0xB2] = PAGE_CROSS_IZPZ,
+  [0xD2] = PAGE_CROSS_IZPZ,
+  [0xF2] = PAGE_CROSS_IZPZ,
+};
+
+// Extra cycles to read the upper half of a 32-bit [zp],z pointer
+#define ZP32_EXTRA_CYCLES 2
+
+// Cycles taken by an instruction that has just been executed.
+// log->regs still has the registers from before the instruction.
+unsigned int instruction_cycles(struct instruction_log *log)
+{
+  unsigned int cycles = cycle_table[log->bytes[0]];
+  unsigned int base = log->bytes[1] + (log->bytes[2] << 8);
+
+  switch (page_cross_mode[log->bytes[0]]) {
+  case PAGE_CROSS_ABSX:
+    cycles += ((base + log->regs.x) ^ base) >> 8 & 1;
     break;
-  case 0xFA: // PLX
-    cpu->regs.x = stack_pop(cpu, log);
-    update_nz(cpu->regs.x);
-    cpu->regs.pc++;
-    log->len = 1;
-    break;
-  case 0xFB: // PLZ
-    cpu->regs.z = stack_pop(cpu, log);
-    update_nz(cpu->regs.z);
-    cpu->regs.pc++;
-    log->len = 1;
+  case PAGE_CROSS_ABSY:
+    cycles += ((base + log->regs.y) ^ base) >> 8 & 1;
     break;
-  case 0xFD: // SBC $nnnn,X
-    sbc(cpu, read_memory(cpu, addr_absx(cpu, log)));
-    log->len = 3;
-    cpu->regs.pc += 3;
+  case PAGE_CROSS_IZPY:
+    base = log->zp_pointer_addr - log->regs.y;
+    cycles += ((base + log->regs.y) ^ base) >> 8 & 1;
     break;
-  case 0xFE: // INC $xxxx,X
-    log->len = 3;
-    cpu->regs.pc += 3;
-    v = read_memory(cpu, addr_absx(cpu, log));
-    v++;
-    MEM_WRITE16(cpu, addr_absx(cpu, log), v);
-    update_nz(v);
+  case PAGE_CROSS_IZPZ:
+    base = log->zp_pointer_addr - log->regs.z;
+    cycles += ((base + log->regs.z) ^ base) >> 8 & 1;
     break;
-  case 0xFF: // BBS7 $nn,$rr
-    v = read_memory(cpu, addr_zp(cpu, log));
-    if ((v & 128) != 0) {
-      cpu->regs.pc += rel8_delta(log->bytes[2]);
+  }
+  if (log->zp32)
+    cycles += ZP32_EXTRA_CYCLES;
+  return cycles;
+}
+
+void profile_enter(unsigned int addr)
+{
+  int entry = profile_owner[addr & 0xffff];
+  if (profile_depth < MAX_PROFILE_DEPTH) {
+    profile_stack[profile_depth].entry = entry;
+    profile_stack[profile_depth].start = cpu.cycles;
+    if (entry >= 0) {
+      profile_entries[entry].calls++;
+      profile_entries[entry].active++;
     }
-    cpu->regs.pc += 3;
-    log->len = 3;
+  }
+  profile_depth++;
+}
+
+void profile_leave(void)
+{
+  if (!profile_depth)
+    return;
+  profile_depth--;
+  if (profile_depth >= MAX_PROFILE_DEPTH)
+    return;
+  int entry = profile_stack[profile_depth].entry;
+  if (entry >= 0 && !--profile_entries[entry].active)
+    profile_entries[entry].inclusive += cpu.cycles - profile_stack[profile_depth].start;
+}
+
+// Charge the cycles of an instruction to the routine it belongs to, and
+// follow calls and returns
+void profile_instruction(struct instruction_log *log, unsigned int cycles)
+{
+  int entry = profile_owner[log->pc & 0xffff];
+  if (entry >= 0)
+    profile_entries[entry].exclusive += cycles;
+
+  switch (log->bytes[0]) {
+  case 0x20: // JSR $nnnn
+  case 0x22: // JSR ($nnnn)
+  case 0x23: // JSR ($nnnn,X)
+    profile_enter(cpu.regs.pc);
+    break;
+  case 0x40: // RTI
+  case 0x60: // RTS
+  case 0x62: // RTS #$nn
+    profile_leave();
     break;
-  default:
-    fprintf(stderr, "ERROR: Unimplemented opcode $%02X\n", log->bytes[0]);
-    log->len = 6;
-    return false;
   }
-  return true;
+}
+
+void profile_free(void)
+{
+  for (int i = 0; i < profile_entry_count; i++)
+    free(profile_entries[i].name);
+  free(profile_entries);
+  profile_entries = NULL;
+  profile_entry_count = 0;
+  profile_depth = 0;
+}
+
+int compare_profile_entry_addr(const void *a, const void *b)
+{
+  const profile_entry *pa = a, *pb = b;
+  if (pa->addr != pb->addr)
+    return pa->addr < pb->addr ? -1 : 1;
+  return strcmp(pa->name, pb->name);
+}
+
+int profile_start(void)
+{
+  profile_free();
+  profile_entries = calloc(hyppo_symbol_count + symbol_count + 1, sizeof(profile_entry));
+  if (!profile_entries) {
+    fprintf(logfile, "ERROR: Could not allocate cycle profile\n");
+    return -1;
+  }
+  for (int i = 0; i < hyppo_symbol_count; i++) {
+    profile_entries[profile_entry_count].name = strdup(hyppo_symbols[i].name);
+    profile_entries[profile_entry_count++].addr = hyppo_symbols[i].addr;
+  }
+  for (int i = 0; i < symbol_count; i++) {
+    if (symbols[i].addr > 0xffff)
+      continue;
+    profile_entries[profile_entry_count].name = strdup(symbols[i].name);
+    profile_entries[profile_entry_count++].addr = symbols[i].addr;
+  }
+  qsort(profile_entries, profile_entry_count, sizeof(profile_entry), compare_profile_entry_addr);
+
+  int entry = -1;
+  for (int addr = 0, i = 0; addr < 65536; addr++) {
+    while (i < profile_entry_count && profile_entries[i].addr == addr)
+      entry = i++;
+    profile_owner[addr] = entry;
+  }
+  fprintf(logfile, "INFO: Profiling cycles of %d routines\n", profile_entry_count);
+  return 0;
+}
+
+int compare_profile_entry_inclusive(const void *a, const void *b)
+{
+  const profile_entry *pa = a, *pb = b;
+  if (pa->inclusive != pb->inclusive)
+    return pa->inclusive < pb->inclusive ? 1 : -1;
+  return (pa->exclusive < pb->exclusive) - (pa->exclusive > pb->exclusive);
+}
+
+void profile_report(FILE *f)
+{
+  if (!profile_entries) {
+    fprintf(f, "ERROR: No cycle profile. Use \"profile on\" first.\n");
+    cpu.term.error = true;
+    return;
+  }
+  qsort(profile_entries, profile_entry_count, sizeof(profile_entry), compare_profile_entry_inclusive);
+  fprintf(f, "INFO: Cycle profile (4502 cycles, as at 1MHz):\n");
+  fprintf(f, "         inclusive        exclusive      calls  routine\n");
+  for (int i = 0; i < profile_entry_count; i++) {
+    profile_entry *e = &profile_entries[i];
+    if (!e->exclusive && !e->calls)
+      continue;
+    fprintf(f, "  %16llu %16llu %10u  %s ($%04X)\n", e->inclusive, e->exclusive, e->calls, e->name, e->addr);
+  }
+  // Put the entries back in address order for profile_owner[]
+  qsort(profile_entries, profile_entry_count, sizeof(profile_entry), compare_profile_entry_addr);
 }
 
 bool cpu_step(FILE *f)
@@ -4013,24 +5226,36 @@ bool cpu_step(FILE *f)
     return false;
   }
 
-  struct instruction_log *log = malloc(sizeof(instruction_log));
+  // Add instruction to the log, recycling the oldest entry in the ring
+  struct instruction_log *log = &cpulog[cpulog_len % cpulog_depth];
+  bzero(log, sizeof(instruction_log));
   log->regs = cpu.regs;
   log->pc = cpu.regs.pc;
   log->len = 0; // byte count of instruction
   log->count = 1;
   log->dup = 0;
 
-  // Add instruction to the log
-  cpu.instruction_count = cpulog_len;
-  cpulog[cpulog_len++] = log;
+  cpu.instruction_count = cpulog_len++;
+  unsigned long long cycles_before = cpu.cycles;
 
+  trace_writes = (trace_file != NULL);
   if (!execute_instruction(&cpu, log)) {
+    trace_writes = false;
     cpu.term.error = true;
     fprintf(f, "ERROR: Exception occurred executing instruction at %s\n       Aborted.\n", describe_address(cpu.regs.pc));
     show_recent_instructions(f, "Instructions leading up to the exception", &cpu, cpulog_len - 16, 16, cpu.regs.pc);
     return false;
   }
 
+  trace_writes = false;
+  if (trace_file)
+    trace_instruction(log);
+
+  // Any DMA job has already added its cycles
+  cpu.cycles += instruction_cycles(log);
+  if (profile_entries)
+    profile_instruction(log, cpu.cycles - cycles_before);
+
   // Ignore stack underflows/overflows if execution is complete, so that
   // terminal RTS doesn't cause a stack underflow error
   if (cpu.term.done)
@@ -4060,14 +5285,25 @@ bool cpu_step(FILE *f)
   cpu.instruction_count = cpulog_len;
 
   // And to most recent instruction at this address, but only if the last instruction
-  // there was not identical on all registers and instruction to this one
-  if (lastataddr[cpu.regs.pc] && identical_cpustates(lastataddr[cpu.regs.pc], log)) {
+  // there was not identical on all registers and instruction to this one.
+  // Without blame, an instruction that pops is never taken for a repeat, as
+  // the bytes it pops have nearly always been pushed again since.
+  if (lastataddr_instruction[cpu.regs.pc] >= 0 && (keep_blame || !log->pops)
+      && identical_cpustates(&lastataddr[cpu.regs.pc], log)) {
     // If identical, increase the count, so that we can keep track of infinite loops
-    lastataddr[cpu.regs.pc]->count++;
+    lastataddr[cpu.regs.pc].count++;
+    // Keep the count on the original log entry too, if it is still around
+    // (not in fast mode, where the short log is only there for error reports)
+    if (keep_blame) {
+      struct instruction_log *first = cpulog_entry(lastataddr_instruction[cpu.regs.pc]);
+      if (first)
+        first->count = lastataddr[cpu.regs.pc].count;
+    }
     log->dup = 1;
   }
   else {
-    lastataddr[cpu.regs.pc] = log;
+    lastataddr[cpu.regs.pc] = *log;
+    lastataddr_instruction[cpu.regs.pc] = cpulog_len - 1;
   }
   return true;
 }
@@ -4089,13 +5325,13 @@ bool cpu_run(FILE *f)
     if (!cpu_step(f))
       return false;
     // Detect infinite loops
-    if (lastataddr[cpu.regs.pc]->count > INFINITE_LOOP_THRESHOLD) {
+    if (lastataddr[cpu.regs.pc].count > INFINITE_LOOP_THRESHOLD) {
       cpu.term.error = true;
       fprintf(stderr, "ERROR: Infinite loop detected at %s.\n       Aborted after %d iterations.\n",
-          describe_address(cpu.regs.pc), lastataddr[cpu.regs.pc]->count);
+          describe_address(cpu.regs.pc), lastataddr[cpu.regs.pc].count);
       // Show upto 32 instructions prior to the infinite loop
       show_recent_instructions(stderr, "Instructions leading into the infinite loop for the first time", &cpu,
-          cpulog_len - lastataddr[cpu.regs.pc]->count - 30, 32, start_addr);
+          cpulog_len - lastataddr[cpu.regs.pc].count - 30, 32, start_addr);
       return false;
     }
   }
@@ -4124,11 +5360,26 @@ bool cpu_call_routine(FILE *f, unsigned int addr)
   cpu_stash_ram();
   cpu_expected = cpu;
 
+  // Once a test has failed in fast mode, keep everything for the error
+  // reports of the rest of it
+  if (!keep_blame && cpu.term.error && keep_full_history())
+    return false;
+
   // Reset the CPU instruction log
   cpu_log_reset();
 
+  // Count the cycles of this routine, and everything it calls
+  while (profile_depth)
+    profile_leave();
+  cpu.cycles = 0;
+  if (profile_entries)
+    profile_enter(addr);
+
   cpu.regs.pc = addr;
-  if (!cpu_run(f))
+  bool ok = cpu_run(f);
+  while (profile_depth)
+    profile_leave();
+  if (!ok)
     return false;
 
   if (cpulog_len == MAX_LOG_LENGTH) {
@@ -4208,83 +5459,117 @@ int ignore_ram_changes(unsigned int low, unsigned int high)
   return 0;
 }
 
-int compare_ram_contents(FILE *f, struct cpu *cpu)
+// Count the bytes that differ from what was expected. Only dirty pages
+// can differ, and those that turn out to match are marked clean again.
+int count_unexpected_values(unsigned char *mem, unsigned char *expected, unsigned char *dirty, int size)
 {
   int errors = 0;
 
-  for (int i = 0; i < CHIPRAM_SIZE; i++) {
-    if (chipram[i] != chipram_expected[i]) {
-      errors++;
-    }
-  }
-  for (int i = 0; i < HYPPORAM_SIZE; i++) {
-    if (hypporam[i] != hypporam_expected[i]) {
-      errors++;
-    }
-  }
-  for (int i = 0; i < COLOURRAM_SIZE; i++) {
-    if (colourram[i] != colourram_expected[i]) {
-      errors++;
+  for (int p = 0; p < (size >> DIRTY_PAGE_SHIFT); p++) {
+    if (!dirty[p])
+      continue;
+    int first = p << DIRTY_PAGE_SHIFT;
+    if (!memcmp(&mem[first], &expected[first], DIRTY_PAGE_SIZE)) {
+      dirty[p] = 0;
+      continue;
     }
-  }
-  for (int i = 0; i < 65536; i++) {
-    if (ffdram[i] != ffdram_expected[i]) {
-      errors++;
+    for (int i = first; i < first + DIRTY_PAGE_SIZE; i++) {
+      if (mem[i] != expected[i]) {
+        errors++;
+      }
     }
   }
+  return errors;
+}
+
+int compare_ram_contents(FILE *f, struct cpu *cpu)
+{
+  int errors = 0;
+
+  errors += count_unexpected_values(chipram, chipram_expected, chipram_dirty, CHIPRAM_SIZE);
+  errors += count_unexpected_values(hypporam, hypporam_expected, hypporam_dirty, HYPPORAM_SIZE);
+  errors += count_unexpected_values(colourram, colourram_expected, colourram_dirty, COLOURRAM_SIZE);
+  errors += count_unexpected_values(ffdram, ffdram_expected, ffdram_dirty, 65536);
 
   if (errors) {
     fprintf(f, "ERROR: %d memory locations contained unexpected values.\n", errors);
     cpu->term.error = true;
+    if (!keep_blame)
+      fprintf(f, "NOTE: Fast mode (-f) doesn't record which instructions wrote them. Add \"log on failure\" to the test to "
+                 "see them.\n");
 
     int displayed = 0;
 
     for (int i = 0; i < CHIPRAM_SIZE; i++) {
+      if (!chipram_dirty[i >> DIRTY_PAGE_SHIFT]) {
+        // Skip to the next page
+        i |= DIRTY_PAGE_SIZE - 1;
+        continue;
+      }
       if (chipram[i] != chipram_expected[i]) {
         fprintf(f, "ERROR: Saw $%02X at $%07x (%s), but expected to see $%02X\n", chipram[i], i,
             describe_address_label28(cpu, i), chipram_expected[i]);
         int first_instruction = chipram_blame[i] - 3;
         if (first_instruction < 0)
           first_instruction = 0;
-        show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
+        if (keep_blame)
+          show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
         displayed++;
       }
       if (displayed >= 100)
         break;
     }
     for (int i = 0; i < HYPPORAM_SIZE; i++) {
+      if (!hypporam_dirty[i >> DIRTY_PAGE_SHIFT]) {
+        // Skip to the next page
+        i |= DIRTY_PAGE_SIZE - 1;
+        continue;
+      }
       if (hypporam[i] != hypporam_expected[i]) {
         fprintf(f, "ERROR: Saw $%02X at $%07x (%s), but expected to see $%02x\n", hypporam[i], i + 0xfff8000,
             describe_address_label28(cpu, i + 0xfff8000), hypporam_expected[i]);
         int first_instruction = hypporam_blame[i] - 3;
         if (first_instruction < 0)
           first_instruction = 0;
-        show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
+        if (keep_blame)
+          show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
       }
       if (displayed >= 100)
         break;
     }
     for (int i = 0; i < COLOURRAM_SIZE; i++) {
+      if (!colourram_dirty[i >> DIRTY_PAGE_SHIFT]) {
+        // Skip to the next page
+        i |= DIRTY_PAGE_SIZE - 1;
+        continue;
+      }
       if (colourram[i] != colourram_expected[i]) {
         fprintf(f, "ERROR: Saw $%02X at $%07x (%s), but expected to see $%02X\n", colourram[i], i + 0xff80000,
             describe_address_label28(cpu, i + 0xff80000), colourram_expected[i]);
         int first_instruction = colourram_blame[i] - 3;
         if (first_instruction < 0)
           first_instruction = 0;
-        show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
+        if (keep_blame)
+          show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
         displayed++;
       }
       if (displayed >= 100)
         break;
     }
     for (int i = 0; i < 65536; i++) {
+      if (!ffdram_dirty[i >> DIRTY_PAGE_SHIFT]) {
+        // Skip to the next page
+        i |= DIRTY_PAGE_SIZE - 1;
+        continue;
+      }
       if (ffdram[i] != ffdram_expected[i]) {
         fprintf(f, "ERROR: Saw $%02X at $%07x (%s), but expected to see $%02X\n", ffdram[i], i + 0xffd0000,
             describe_address_label28(cpu, i + 0xffd0000), ffdram_expected[i]);
         int first_instruction = ffdram_blame[i] - 3;
         if (first_instruction < 0)
           first_instruction = 0;
-        show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
+        if (keep_blame)
+          show_recent_instructions(f, "Instructions leading to this value being written", cpu, first_instruction, 4, -1);
         displayed++;
       }
       if (displayed >= 100)
@@ -4341,6 +5626,8 @@ void machine_init(struct cpu *cpu)
   chipram_expected[1] = 0x27;
   chipram[0] = 0x3f;
   chipram[1] = 0x27;
+  cpu_map_changed(cpu);
+  mark_all_dirty();
 
   // Reset blame for contents of memory
   bzero(chipram_blame, sizeof(chipram_blame));
@@ -4351,42 +5638,53 @@ void machine_init(struct cpu *cpu)
     free(hyppo_symbols[i].name);
   }
   hyppo_symbol_count = 0;
+  symbol_index_invalidate(&hyppo_symbol_index);
 
   // Reset instruction logs
-  for (int i = 0; i < cpulog_len; i++) {
-    free(cpulog[i]);
-  }
+  if (!cpulog && cpulog_set_depth(TEST_LOG_DEPTH))
+    exit(-2);
   cpulog_len = 0;
-  bzero(lastataddr, sizeof(lastataddr));
+  memset(lastataddr_instruction, 0xff, sizeof(lastataddr_instruction));
 }
 
 void test_init(struct cpu *cpu)
 {
 
+  // Each test starts with the default instruction log depth
+  if (cpulog_set_depth(TEST_LOG_DEPTH))
+    exit(-2);
+  keep_blame = !fast_mode;
+
   machine_init(cpu);
 
   fail_on_stack_overflow = true;
   fail_on_stack_underflow = true;
   log_on_failure = false;
+  profile_free();
 
+  // Only clear what was used, so that -j workers do not have to copy
+  // these large tables
   for (int i = 0; i < hyppo_symbol_count; i++)
     free(hyppo_symbols[i].name);
-  bzero(hyppo_symbols, sizeof(hyppo_symbols));
+  bzero(hyppo_symbols, hyppo_symbol_count * sizeof(hyppo_symbol));
   hyppo_symbol_count = 0;
-  bzero(sym_by_addr, sizeof(sym_by_addr));
+  symbol_index_invalidate(&hyppo_symbol_index);
   for (int i = 0; i < symbol_count; i++)
     free(symbols[i].name);
-  bzero(symbols, sizeof(symbols));
+  bzero(symbols, symbol_count * sizeof(hyppo_symbol));
   symbol_count = 0;
+  symbol_index_invalidate(&user_symbol_index);
 
   bzero(breakpoints, sizeof(breakpoints));
 
   // Log to temporary file, so that we can rename it to PASS.* or FAIL.*
   // after.
-  unlink(TESTLOGFILE);
-  logfile = fopen(TESTLOGFILE, "w");
+  // (named by process, as -j runs several tests at once)
+  snprintf(testlogfile, sizeof(testlogfile), TESTLOGFILE, (int)getpid());
+  unlink(testlogfile);
+  logfile = fopen(testlogfile, "w");
   if (!logfile) {
-    fprintf(stderr, "ERROR: Could not write to '%s'\n", TESTLOGFILE);
+    fprintf(stderr, "ERROR: Could not write to '%s'\n", testlogfile);
     exit(-2);
   }
 
@@ -4408,6 +5706,10 @@ void test_init(struct cpu *cpu)
 void test_conclude(struct cpu *cpu)
 {
   char cmd[8192];
+  char result[8192];
+
+  if (trace_close())
+    cpu->term.error = true;
 
   // Report test status
   snprintf(cmd, 8192, "FAIL.%s", safe_name);
@@ -4416,7 +5718,7 @@ void test_conclude(struct cpu *cpu)
   unlink(cmd);
 
   if (cpu->term.error) {
-    snprintf(cmd, 8192, "mv %s FAIL.%s", TESTLOGFILE, safe_name);
+    snprintf(result, 8192, "FAIL.%s", safe_name);
     test_fails++;
     if (log_on_failure) {
       if (cpulog_len < 500000)
@@ -4431,7 +5733,7 @@ void test_conclude(struct cpu *cpu)
     printf("\r[FAIL] %s\n", test_name);
   }
   else {
-    snprintf(cmd, 8192, "mv %s PASS.%s", TESTLOGFILE, safe_name);
+    snprintf(result, 8192, "PASS.%s", safe_name);
     test_passes++;
 
     //    show_recent_instructions(logfile,"Complete instruction log follows",cpu,1,cpulog_len,-1);
@@ -4441,14 +5743,32 @@ void test_conclude(struct cpu *cpu)
 
   if (logfile != stderr) {
     fclose(logfile);
-    system(cmd);
+    // Fall back to mv if the log is on a different file system
+    if (rename(testlogfile, result)) {
+      snprintf(cmd, 8192, "mv %s %s", testlogfile, result);
+      system(cmd);
+    }
   }
 
   logfile = stderr;
 }
 
+// Most tests start by loading the same HICKUP image and symbols, so keep
+// a snapshot of the last ones read, and restore from that instead.
+char *hyppo_image_file = NULL;
+unsigned char hyppo_image[HYPPORAM_SIZE];
+char *hyppo_symbols_file = NULL;
+hyppo_symbol *hyppo_symbols_snapshot = NULL;
+int hyppo_symbols_snapshot_count = 0;
+
 int load_hyppo(char *filename)
 {
+  memset(hypporam_dirty, 1, sizeof(hypporam_dirty));
+  if (hyppo_image_file && !strcmp(hyppo_image_file, filename)) {
+    bcopy(hyppo_image, hypporam, HYPPORAM_SIZE);
+    return 0;
+  }
+
   FILE *f = fopen(filename, "rb");
   if (!f) {
     fprintf(logfile, "ERROR: Could not read HICKUP file from '%s'\n", filename);
@@ -4460,6 +5780,10 @@ int load_hyppo(char *filename)
     return -1;
   }
   fclose(f);
+
+  free(hyppo_image_file);
+  hyppo_image_file = strdup(filename);
+  bcopy(hypporam, hyppo_image, HYPPORAM_SIZE);
   return 0;
 }
 
@@ -4483,6 +5807,21 @@ int load_file(char *filename, unsigned int location)
 
 int load_hyppo_symbols(char *filename)
 {
+  if (hyppo_symbols_file && !strcmp(hyppo_symbols_file, filename)) {
+    for (int i = 0; i < hyppo_symbols_snapshot_count; i++) {
+      if (hyppo_symbol_count >= MAX_HYPPO_SYMBOLS) {
+        fprintf(logfile, "ERROR: Too many symbols. Increase MAX_HYPPO_SYMBOLS.\n");
+        return -1;
+      }
+      hyppo_symbols[hyppo_symbol_count].name = strdup(hyppo_symbols_snapshot[i].name);
+      hyppo_symbols[hyppo_symbol_count].addr = hyppo_symbols_snapshot[i].addr;
+      hyppo_symbol_count++;
+    }
+    fprintf(logfile, "INFO: Read %d HYPPO symbols.\n", hyppo_symbol_count);
+    return 0;
+  }
+
+  int first_symbol = hyppo_symbol_count;
   FILE *f = fopen(filename, "r");
   if (!f) {
     fprintf(logfile, "ERROR: Could not read HICKUP symbol list from '%s'\n", filename);
@@ -4501,7 +5840,6 @@ int load_hyppo_symbols(char *filename)
       }
       hyppo_symbols[hyppo_symbol_count].name = strdup(sym);
       hyppo_symbols[hyppo_symbol_count].addr = addr;
-      sym_by_addr[addr] = &hyppo_symbols[hyppo_symbol_count];
       hyppo_symbol_count++;
     }
     line[0] = 0;
@@ -4509,6 +5847,22 @@ int load_hyppo_symbols(char *filename)
   }
   fclose(f);
   fprintf(logfile, "INFO: Read %d HYPPO symbols.\n", hyppo_symbol_count);
+
+  // Remember the symbols just read, for the next test that loads them
+  hyppo_symbol *snapshot = malloc((hyppo_symbol_count - first_symbol + 1) * sizeof(hyppo_symbol));
+  if (snapshot) {
+    for (int i = 0; i < hyppo_symbols_snapshot_count; i++)
+      free(hyppo_symbols_snapshot[i].name);
+    free(hyppo_symbols_snapshot);
+    free(hyppo_symbols_file);
+    hyppo_symbols_snapshot = snapshot;
+    hyppo_symbols_snapshot_count = hyppo_symbol_count - first_symbol;
+    for (int i = 0; i < hyppo_symbols_snapshot_count; i++) {
+      hyppo_symbols_snapshot[i].name = strdup(hyppo_symbols[first_symbol + i].name);
+      hyppo_symbols_snapshot[i].addr = hyppo_symbols[first_symbol + i].addr;
+    }
+    hyppo_symbols_file = strdup(filename);
+  }
   return 0;
 }
 
@@ -4532,9 +5886,6 @@ int load_symbols(char *filename, unsigned int offset)
       }
       symbols[symbol_count].name = strdup(sym);
       symbols[symbol_count].addr = addr + offset;
-      if (addr + offset < CHIPRAM_SIZE) {
-        sym_by_addr[addr + offset] = &symbols[symbol_count];
-      }
       symbol_count++;
     }
     else if (sscanf(line, "al %x %s", &addr, sym) == 2) {
@@ -4545,9 +5896,6 @@ int load_symbols(char *filename, unsigned int offset)
       }
       symbols[symbol_count].name = strdup(sym);
       symbols[symbol_count].addr = addr + offset;
-      if (addr + offset < CHIPRAM_SIZE) {
-        sym_by_addr[addr + offset] = &symbols[symbol_count];
-      }
       symbol_count++;
     }
     line[0] = 0;
@@ -4592,19 +5940,12 @@ int resolve_value32(char *in)
   if (label[v] == ',')
     label[v] = 0;
 
-  int i;
-  for (i = 0; i < hyppo_symbol_count; i++) {
-    if (!strcmp(label, hyppo_symbols[i].name))
-      break;
-  }
-  if (i == hyppo_symbol_count) {
+  int i = find_symbol_by_name(&hyppo_symbol_index, label);
+  if (i < 0) {
 
     // Now look for non-hyppo symbols
-    for (i = 0; i < symbol_count; i++) {
-      if (!strcmp(label, symbols[i].name))
-        break;
-    }
-    if (i == symbol_count) {
+    i = find_symbol_by_name(&user_symbol_index, label);
+    if (i < 0) {
       fprintf(logfile, "ERROR: Cannot call find non-existent symbol '%s'\n", label);
       cpu.term.error = true;
       return 0;
@@ -4722,15 +6063,162 @@ cleanup:
   free(sym_file_name);
 }
 
+/* ----------------------------------------------------------------------------------------------------------
+   Parallel test runner (-j)
+
+   Each test is run in its own forked worker process, which starts from the machine state set up by the
+   directives outside of the tests, and exits at the end of its test. Workers write their stdout and stderr
+   to temporary files, which are copied to stdout and stderr in script order once the test has finished.
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+typedef struct test_job {
+  pid_t pid;
+  // What the worker writes to stdout and stderr
+  FILE *out, *err;
+  char name[1024];
+  bool done;
+  int status;
+} test_job;
+test_job *jobs = NULL;
+int job_count = 0;
+int jobs_running = 0;
+int jobs_reported = 0;
+int max_jobs = 1;
+bool in_worker = false;
+
+void copy_job_output(FILE **from, FILE *to)
+{
+  char buf[8192];
+  size_t n;
+
+  rewind(*from);
+  while ((n = fread(buf, 1, sizeof(buf), *from)) > 0)
+    fwrite(buf, 1, n, to);
+  fclose(*from);
+  *from = NULL;
+}
+
+void report_job(test_job *job)
+{
+  copy_job_output(&job->out, stdout);
+  fflush(stdout);
+  copy_job_output(&job->err, stderr);
+
+  if (WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0)
+    test_passes++;
+  else {
+    test_fails++;
+    if (!WIFEXITED(job->status))
+      printf("\r[FAIL] %s (worker terminated by signal %d)\n", job->name, WTERMSIG(job->status));
+  }
+  fflush(stdout);
+}
+
+void wait_for_job(void)
+{
+  int status;
+  pid_t pid = wait(&status);
+  if (pid < 0)
+    return;
+  for (int i = 0; i < job_count; i++) {
+    if (jobs[i].pid == pid && !jobs[i].done) {
+      jobs[i].done = true;
+      jobs[i].status = status;
+      jobs_running--;
+    }
+  }
+  // Report finished tests in the order they appear in the script
+  while (jobs_reported < job_count && jobs[jobs_reported].done)
+    report_job(&jobs[jobs_reported++]);
+}
+
+// Fork a worker for the test that starts at the current script line.
+// Returns 1 in the worker, 0 in the parent, or -1 if the test could not
+// be started in a worker, and should be run in-process instead.
+int start_job(const char *name)
+{
+  while (jobs_running >= max_jobs)
+    wait_for_job();
+
+  test_job *new_jobs = realloc(jobs, (job_count + 1) * sizeof(test_job));
+  if (!new_jobs)
+    return -1;
+  jobs = new_jobs;
+  test_job *job = &jobs[job_count];
+  bzero(job, sizeof(test_job));
+  job->out = tmpfile();
+  job->err = tmpfile();
+  if (!job->out || !job->err) {
+    if (job->out)
+      fclose(job->out);
+    if (job->err)
+      fclose(job->err);
+    return -1;
+  }
+  snprintf(job->name, sizeof(job->name), "%s", name);
+
+  fflush(stdout);
+  fflush(stderr);
+  job->pid = fork();
+  if (job->pid < 0) {
+    fprintf(stderr, "ERROR: Could not start worker for test \"%s\"\n", name);
+    fclose(job->out);
+    fclose(job->err);
+    return -1;
+  }
+  if (!job->pid) {
+    // Worker: console output goes to the job's output files, for the
+    // parent to show in the order of the tests
+    dup2(fileno(job->out), STDOUT_FILENO);
+    dup2(fileno(job->err), STDERR_FILENO);
+    in_worker = true;
+    // Tests already reported belong to the parent: exit only with this one's result
+    test_passes = test_fails = 0;
+    return 1;
+  }
+  job_count++;
+  jobs_running++;
+  return 0;
+}
+
+// Ends a worker once its test has concluded
+void finish_job(void)
+{
+  if (!in_worker)
+    return;
+  fflush(stdout);
+  fflush(stderr);
+  exit(test_fails ? 1 : 0);
+}
+
 int main(int argc, char **argv)
 {
-  if (argc < 2 || argc > 3) {
-    fprintf(stderr, "usage: hyppotest <test script> [<test>]\n");
+  while (argc > 1 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-f"))
+      fast_mode = true;
+    else if (!strcmp(argv[1], "-d"))
+      dma_byte_at_a_time = true;
+    else if (!strcmp(argv[1], "-j") && argc > 2) {
+      max_jobs = atoi(argv[2]);
+      argc--;
+      argv++;
+    }
+    else if (!strncmp(argv[1], "-j", 2) && argv[1][2])
+      max_jobs = atoi(&argv[1][2]);
+    else
+      break;
+    argc--;
+    argv++;
+  }
+  if (argc < 2 || argc > 3 || max_jobs < 1) {
+    fprintf(stderr, "usage: hyppotest [-f] [-d] [-j <jobs>] <test script> [<test>]\n");
     exit(-2);
   }
 
   // Setup for anonymous tests, if user doesn't supply any test directives
   machine_init(&cpu);
+  keep_blame = !fast_mode;
   logfile = stderr;
 
   // Open test script, and start interpreting it
@@ -4739,6 +6227,23 @@ int main(int argc, char **argv)
     fprintf(stderr, "ERROR: Could not read test procedure from '%s'\n", argv[1]);
     exit(-2);
   }
+  if (max_jobs > 1) {
+    // Workers each read their own test from the script, so read it into
+    // memory, rather than sharing the file offset between processes
+    char *script = NULL;
+    size_t script_len = 0;
+    FILE *m = open_memstream(&script, &script_len);
+    char buf[8192];
+    size_t n;
+    while (m && (n = fread(buf, 1, sizeof(buf), f)) > 0)
+      fwrite(buf, 1, n, m);
+    fclose(f);
+    // (fmemopen() rejects empty buffers, so include the terminating NUL)
+    if (!m || fclose(m) || !(f = fmemopen(script, script_len + 1, "r"))) {
+      fprintf(stderr, "ERROR: Could not read test procedure from '%s'\n", argv[1]);
+      exit(-2);
+    }
+  }
   const char *test_target = (argc == 3 ? argv[2] : NULL);
   if (test_target) {
     printf("INFO: Only running test \"%s\"\n", test_target);
@@ -4754,6 +6259,7 @@ int main(int argc, char **argv)
     char start[1024];
     char end[1024];
     unsigned int addr, addr2, first, last;
+    unsigned long long max_cycles;
     char *line_ptr = line;
     // Skip any leading whitespace
     while (isspace(*line_ptr))
@@ -4788,6 +6294,26 @@ int main(int argc, char **argv)
     else if (sscanf(line_ptr, "dump instructions %d to %d", &first, &last) == 2) {
       show_recent_instructions(logfile, line_ptr, &cpu, first, last - first + 1, -1);
     }
+    else if (!strncasecmp(line_ptr, "trace off", strlen("trace off"))) {
+      if (trace_close())
+        cpu.term.error = true;
+    }
+    else if (sscanf(line_ptr, "trace to %s", routine) == 1) {
+      // Stream a binary trace of the instructions executed, for hyppotrace
+      if (trace_open(routine))
+        cpu.term.error = true;
+    }
+    else if (!strncasecmp(line_ptr, "profile on", strlen("profile on"))) {
+      // Count cycles by routine, using the symbols loaded so far
+      if (profile_start())
+        cpu.term.error = true;
+    }
+    else if (!strncasecmp(line_ptr, "profile off", strlen("profile off"))) {
+      profile_free();
+    }
+    else if (!strncasecmp(line_ptr, "report profile", strlen("report profile"))) {
+      profile_report(logfile);
+    }
     else if (!strncasecmp(line_ptr, "log dma off", strlen("log dma off"))) {
       cpu.term.log_dma = false;
       fprintf(logfile, "NOTE: DMA jobs will not be reported\n");
@@ -4796,9 +6322,19 @@ int main(int argc, char **argv)
       cpu.term.log_dma = true;
       fprintf(logfile, "NOTE: DMA jobs will be reported\n");
     }
+    else if (sscanf(line_ptr, "log depth %u", &first) == 1) {
+      // Number of most recent instructions to keep in the instruction log
+      if (cpulog_set_depth(first))
+        cpu.term.error = true;
+      else
+        fprintf(logfile, "NOTE: Keeping the last %u instructions in the instruction log\n", first);
+    }
     else if (!strncasecmp(line_ptr, "log on failure", strlen("log on failure"))) {
       // Dump all instructions on test failure
       log_on_failure = true;
+      // which needs the full instruction log, even in fast mode
+      if (keep_full_history())
+        cpu.term.error = true;
     }
     else if (sscanf(line_ptr, "jmp %s", routine) == 1) {
       int addr32 = resolve_value32(routine);
@@ -4868,9 +6404,15 @@ int main(int argc, char **argv)
     else if (strncasecmp(line_ptr, "test end", strlen("test end")) == 0
              || strncasecmp(line_ptr, "end test", strlen("end test")) == 0) {
       test_conclude(&cpu);
+      finish_job();
     }
     else if (sscanf(line_ptr, "test \"%[^\"]\"", test_name) == 1) {
       if (!test_target || strcmp(test_target, test_name) == 0) {
+        if (max_jobs > 1 && !in_worker && !start_job(test_name)) {
+          // The worker runs this test
+          skipping_test = true;
+          continue;
+        }
         // Set test name
         test_init(&cpu);
         fflush(stdout);
@@ -4968,6 +6510,16 @@ int main(int argc, char **argv)
         cpu.term.error = true;
       }
     }
+    else if (sscanf(line_ptr, "expect cycles <= %llu", &max_cycles) == 1) {
+      // Fail if the last routine took too long, in 4502 cycles (see cycle_table)
+      if (cpu.cycles > max_cycles) {
+        fprintf(logfile, "ERROR: Routine took %llu cycles (4502, as at 1MHz), more than the expected %llu cycles\n",
+            cpu.cycles, max_cycles);
+        cpu.term.error = true;
+      }
+      else
+        fprintf(logfile, "INFO: Routine took %llu cycles (4502, as at 1MHz)\n", cpu.cycles);
+    }
     else if (sscanf(line_ptr, "expect flag %s is %s", location, value) == 2) {
       bool v;
       if (strcasecmp(value, "set") == 0) {
@@ -5042,9 +6594,6 @@ int main(int argc, char **argv)
       }
       symbols[symbol_count].name = strdup(routine);
       symbols[symbol_count].addr = addr;
-      if (addr < CHIPRAM_SIZE) {
-        sym_by_addr[addr] = &symbols[symbol_count];
-      }
       symbol_count++;
     }
     else if (sscanf(line_ptr, "poke%s%n", location, &last) == 1) {
@@ -5150,7 +6699,17 @@ int main(int argc, char **argv)
   }
   if (logfile != stderr)
     test_conclude(&cpu);
+  finish_job();
   fclose(f);
+
+  if (max_jobs > 1) {
+    while (jobs_running)
+      wait_for_job();
+    printf("INFO: %d tests passed, %d tests failed\n", test_passes, test_fails);
+    // so that -j can be used to fail a build
+    return test_fails ? 1 : 0;
+  }
+  return 0;
 }
 
 /* ----------------------------------------------------------------------------------------------------------
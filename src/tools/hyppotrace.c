@@ -0,0 +1,363 @@
+/*
+  Offline viewer for the binary instruction traces written by hyppotest
+  ("trace to <file>" directive).
+
+  Traces can be many gigabytes, so the file is mapped rather than read,
+  and the first instruction to show is found by binary search, so that
+  only the part of the trace being looked at is ever paged in.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hyppotrace.h"
+
+#define FLAG_C 0x01
+#define FLAG_Z 0x02
+#define FLAG_I 0x04
+#define FLAG_D 0x08
+#define FLAG_E 0x20
+#define FLAG_V 0x40
+#define FLAG_N 0x80
+
+typedef struct symbol {
+  char *name;
+  unsigned int addr;
+} symbol;
+symbol *symbols = NULL;
+int symbol_count = 0;
+
+int compare_symbols(const void *a, const void *b)
+{
+  const symbol *sa = a, *sb = b;
+  if (sa->addr != sb->addr)
+    return sa->addr < sb->addr ? -1 : 1;
+  return strcmp(sa->name, sb->name);
+}
+
+int load_symbols(char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    fprintf(stderr, "ERROR: Could not read symbols from '%s'\n", filename);
+    return -1;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    char sym[1024];
+    unsigned int addr;
+    if (sscanf(line, " %s = $%x", sym, &addr) == 2) {
+      symbol *s = realloc(symbols, (symbol_count + 1) * sizeof(symbol));
+      if (!s) {
+        fprintf(stderr, "ERROR: Out of memory reading symbols\n");
+        fclose(f);
+        return -1;
+      }
+      symbols = s;
+      symbols[symbol_count].name = strdup(sym);
+      symbols[symbol_count].addr = addr;
+      symbol_count++;
+    }
+  }
+  fclose(f);
+  qsort(symbols, symbol_count, sizeof(symbol), compare_symbols);
+  return 0;
+}
+
+// Index of the last symbol at or below addr, or -1 if there is none
+int find_symbol(unsigned int addr)
+{
+  int low = 0, high = symbol_count - 1, found = -1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    if (symbols[mid].addr <= addr) {
+      found = mid;
+      low = mid + 1;
+    }
+    else
+      high = mid - 1;
+  }
+  return found;
+}
+
+char *describe_address(unsigned int addr)
+{
+  static char description[1100];
+  int s = find_symbol(addr);
+
+  if (s < 0)
+    return "";
+  if (symbols[s].addr == addr)
+    snprintf(description, sizeof(description), "%s", symbols[s].name);
+  else
+    snprintf(description, sizeof(description), "%s+$%X", symbols[s].name, addr - symbols[s].addr);
+  return description;
+}
+
+int rel8_delta(unsigned char c)
+{
+  if (c < 0x80)
+    return c;
+  return c - 0x100;
+}
+
+void disassemble(trace_record *r)
+{
+  const struct opcode *op = &opcodes[r->i.bytes[0]];
+  unsigned char *b = r->i.bytes;
+
+  if (!op->name) {
+    printf("???");
+    return;
+  }
+  // (A trace doesn't say where pulled bytes were pushed)
+  if (op->mode == M_NONE || op->mode == M_PULL) {
+    printf("%s", op->name);
+    return;
+  }
+  printf("%-5s", op->name);
+  switch (op->mode) {
+  case M_ACC:
+    printf("A");
+    break;
+  case M_IMM:
+    printf("#$%02X", b[1]);
+    break;
+  case M_ABS:
+    printf("$%02X%02X", b[2], b[1]);
+    break;
+  case M_ABSX:
+    printf("$%02X%02X,X", b[2], b[1]);
+    break;
+  case M_ABSY:
+    printf("$%02X%02X,Y", b[2], b[1]);
+    break;
+  case M_IABS:
+    printf("($%02X%02X)", b[2], b[1]);
+    break;
+  case M_IABSX:
+    printf("($%02X%02X,X)", b[2], b[1]);
+    break;
+  case M_ZP:
+    printf("$%02X", b[1]);
+    break;
+  case M_ZPX:
+    printf("$%02X,X", b[1]);
+    break;
+  case M_ZPY:
+    printf("$%02X,Y", b[1]);
+    break;
+  case M_IZPX:
+    printf("($%02X,X)", b[1]);
+    break;
+  case M_IZPY:
+    printf("($%02X),Y", b[1]);
+    break;
+  case M_IZPZ:
+    if (r->i.zp32)
+      printf("[$%02X],Z", b[1]);
+    else
+      printf("($%02X),Z", b[1]);
+    break;
+  case M_ZP_REL8:
+    printf("$%02X,$%04X", b[1], (r->i.pc + 3 + rel8_delta(b[2])) & 0xffff);
+    break;
+  case M_REL8:
+    printf("$%04X", (r->i.pc + 2 + rel8_delta(b[1])) & 0xffff);
+    break;
+  case M_REL16:
+    printf("$%04X", (r->i.pc + 2 + (short)(b[1] + (b[2] << 8))) & 0xffff);
+    break;
+  }
+}
+
+void show_instruction(trace_record *r)
+{
+  printf("I%-9u $%04X %-24s : ", r->instruction, r->i.pc, describe_address(r->i.pc));
+  printf("A:%02X X:%02X Y:%02X Z:%02X SP:%04X B:%02X ", r->i.a, r->i.x, r->i.y, r->i.z, r->i.sp, r->i.b);
+  printf("M:%04x+%02x/%04x+%02x ", r->i.maplo, r->i.maplomb, r->i.maphi, r->i.maphimb);
+  printf("%c%c%c%c%c%c%c%c%c : ", r->i.flags & FLAG_N ? 'N' : '.', r->i.flags & FLAG_V ? 'V' : '.',
+      r->i.flags & FLAG_E ? 'E' : '.', r->i.flags & 0x10 ? 'B' : '.', r->i.flags & FLAG_D ? 'D' : '.',
+      r->i.flags & FLAG_I ? 'I' : '.', r->i.flags & FLAG_Z ? 'Z' : '.', r->i.flags & FLAG_C ? 'C' : '.',
+      r->i.in_hyper ? 'H' : ' ');
+  for (int j = 0; j < 3; j++) {
+    if (j < r->i.len)
+      printf("%02X ", r->i.bytes[j]);
+    else
+      printf("   ");
+  }
+  printf(" : ");
+  disassemble(r);
+  printf("\n");
+}
+
+void show_write(trace_record *r)
+{
+  printf("           $%07X <- $%02X", r->w.addr, r->w.value);
+  if (r->w.addr < 0x10000 && find_symbol(r->w.addr) >= 0)
+    printf("  %s", describe_address(r->w.addr));
+  printf("\n");
+}
+
+int parse_address(char *s, unsigned int *addr)
+{
+  char *end;
+  if (*s == '$')
+    s++;
+  *addr = strtoul(s, &end, 16);
+  return end == s ? -1 : 0;
+}
+
+void usage(void)
+{
+  fprintf(stderr, "usage: hyppotrace [-s first] [-n count] [-p low-high] [-y symbols] [-r symbol] [-w] <trace file>\n");
+  fprintf(stderr, "  -s  first instruction to show (default 0)\n");
+  fprintf(stderr, "  -n  number of instructions to show (default 100, 0 for all)\n");
+  fprintf(stderr, "  -p  only show instructions with a PC in this range, e.g., $8000-$80FF\n");
+  fprintf(stderr, "  -y  read symbols from an acme symbol list, such as HICKUP.sym\n");
+  fprintf(stderr, "  -r  only show instructions within this symbol, up to the next symbol\n");
+  fprintf(stderr, "  -w  show the memory writes done by each instruction\n");
+  exit(-3);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int first = 0, count = 100;
+  unsigned int pc_low = 0, pc_high = 0xffff;
+  char *range_symbol = NULL;
+  int show_writes = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:p:r:s:wy:")) != -1) {
+    switch (opt) {
+    case 'n':
+      count = strtoul(optarg, NULL, 0);
+      break;
+    case 'p': {
+      char *dash = strchr(optarg, '-');
+      if (!dash)
+        usage();
+      *dash = 0;
+      if (parse_address(optarg, &pc_low) || parse_address(dash + 1, &pc_high))
+        usage();
+    } break;
+    case 'r':
+      range_symbol = optarg;
+      break;
+    case 's':
+      first = strtoul(optarg, NULL, 0);
+      break;
+    case 'w':
+      show_writes = 1;
+      break;
+    case 'y':
+      if (load_symbols(optarg))
+        exit(-1);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1)
+    usage();
+
+  if (range_symbol) {
+    int i;
+    for (i = 0; i < symbol_count; i++)
+      if (!strcmp(symbols[i].name, range_symbol))
+        break;
+    if (i == symbol_count) {
+      fprintf(stderr, "ERROR: Unknown symbol '%s'\n", range_symbol);
+      exit(-1);
+    }
+    pc_low = symbols[i].addr;
+    // The routine ends where the next symbol at a higher address starts
+    while (i < symbol_count && symbols[i].addr == pc_low)
+      i++;
+    pc_high = i < symbol_count ? symbols[i].addr - 1 : 0xffff;
+  }
+
+  int fd = open(argv[optind], O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: Could not open trace '%s'\n", argv[optind]);
+    exit(-1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(trace_header)) {
+    fprintf(stderr, "ERROR: '%s' is not a hyppotest trace\n", argv[optind]);
+    exit(-1);
+  }
+  unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    exit(-1);
+  }
+  trace_header *header = (trace_header *)map;
+  if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic))) {
+    fprintf(stderr, "ERROR: '%s' is not a hyppotest trace\n", argv[optind]);
+    exit(-1);
+  }
+  if (header->byte_order != TRACE_BYTE_ORDER_MARK || header->version != TRACE_VERSION
+      || header->record_size != sizeof(trace_record)) {
+    fprintf(stderr, "ERROR: '%s' was written by an incompatible version of hyppotest, or on another platform\n",
+        argv[optind]);
+    exit(-1);
+  }
+  trace_record *records = (trace_record *)(map + sizeof(trace_header));
+  size_t record_count = (st.st_size - sizeof(trace_header)) / sizeof(trace_record);
+
+  // Find the first record of the first instruction
+  size_t low = 0, high = record_count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (records[mid].instruction < first)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  // Memory writes come just before the instruction that did them
+  size_t writes = low;
+  unsigned int shown = 0;
+  for (size_t i = low; i < record_count && (!count || shown < count); i++) {
+    if (records[i].type != TRACE_INSTRUCTION)
+      continue;
+    if (records[i].i.pc >= pc_low && records[i].i.pc <= pc_high) {
+      show_instruction(&records[i]);
+      if (show_writes)
+        for (size_t j = writes; j < i; j++)
+          show_write(&records[j]);
+      shown++;
+    }
+    writes = i + 1;
+  }
+
+  munmap(map, st.st_size);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,355 @@
+/*
+  Binary instruction trace format written by hyppotest ("trace to <file>"),
+  and read by hyppotrace.
+
+  The file is a header followed by fixed size records, so that a reader can
+  seek straight to any record. Records are in the order they happened, and
+  their instruction numbers never decrease, so a reader can also binary
+  search for an instruction. The memory writes done by an instruction come
+  just before the record of the instruction itself.
+
+  The opcode table that both use to disassemble instructions is here too.
+
+  Values are stored in host byte order. The header tells a reader whether
+  that matches its own.
+*/
+
+#ifndef HYPPOTRACE_H
+#define HYPPOTRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "M65TRACE"
+#define TRACE_VERSION 1
+#define TRACE_BYTE_ORDER_MARK 0x01020304
+
+#define TRACE_INSTRUCTION 1
+#define TRACE_WRITE 2
+
+typedef struct __attribute__((__packed__)) trace_header {
+  char magic[8];
+  uint32_t byte_order;
+  uint16_t version;
+  uint16_t record_size;
+  uint8_t reserved[16];
+} trace_header;
+
+typedef struct __attribute__((__packed__)) trace_record {
+  // Number of the instruction in the trace, which for a memory write is
+  // the instruction that did the write.
+  uint32_t instruction;
+  uint8_t type;
+  union __attribute__((__packed__)) {
+    // TRACE_INSTRUCTION: the instruction, and the registers before it ran
+    struct __attribute__((__packed__)) {
+      uint8_t len;
+      uint8_t zp32;
+      uint8_t in_hyper;
+      uint16_t pc;
+      uint8_t bytes[6];
+      uint8_t a, x, y, z, b, flags;
+      uint16_t sp;
+      uint16_t maplo, maphi;
+      uint8_t maplomb, maphimb;
+    } i;
+    // TRACE_WRITE: a write to the 28-bit address space
+    struct __attribute__((__packed__)) {
+      uint8_t value;
+      uint32_t addr;
+    } w;
+    uint8_t pad[27];
+  };
+} trace_record;
+
+/*
+  The 45GS02 instructions, for disassembling, shared by hyppotest and
+  hyppotrace. NULL names are opcodes that hyppotest doesn't implement.
+*/
+
+// Addressing modes, named after hyppotest's disassemble_*() functions
+enum {
+  M_NONE,
+  M_ACC,  // ASL A etc.
+  M_PULL, // PLA etc., for which hyppotest shows where the byte was pushed
+  M_IMM,
+  M_ABS,
+  M_ABSX,
+  M_ABSY,
+  M_IABS,
+  M_IABSX,
+  M_ZP,
+  M_ZPX,
+  M_ZPY,
+  M_IZPX,
+  M_IZPY,
+  M_IZPZ, // or [$nn],Z with a 32-bit pointer
+  M_ZP_REL8,
+  M_REL8,
+  M_REL16
+};
+
+struct opcode {
+  const char *name;
+  int mode;
+};
+
+static const struct opcode opcodes[256] = {
+  /* $00 */ { "BRK", M_IMM },
+  /* $01 */ { "ORA", M_IZPX },
+  /* $02 */ { NULL, M_NONE },
+  /* $03 */ { "SEE", M_NONE },
+  /* $04 */ { "TSB", M_ZP },
+  /* $05 */ { "ORA", M_ZP },
+  /* $06 */ { "ASL", M_ZP },
+  /* $07 */ { "RMB0", M_ZP },
+  /* $08 */ { "PHP", M_NONE },
+  /* $09 */ { "ORA", M_IMM },
+  /* $0A */ { "ASL", M_ACC },
+  /* $0B */ { NULL, M_NONE },
+  /* $0C */ { "TSB", M_ABS },
+  /* $0D */ { "ORA", M_ABS },
+  /* $0E */ { "ASL", M_ABS },
+  /* $0F */ { "BBR0", M_ZP_REL8 },
+  /* $10 */ { "BPL", M_REL8 },
+  /* $11 */ { "ORA", M_IZPY },
+  /* $12 */ { "ORA", M_IZPZ },
+  /* $13 */ { "BPL", M_REL16 },
+  /* $14 */ { "TRB", M_ZP },
+  /* $15 */ { "ORA", M_ZPX },
+  /* $16 */ { "ASL", M_ZPX },
+  /* $17 */ { "RMB1", M_ZP },
+  /* $18 */ { "CLC", M_NONE },
+  /* $19 */ { "ORA", M_ABSY },
+  /* $1A */ { "INC", M_NONE },
+  /* $1B */ { "INZ", M_NONE },
+  /* $1C */ { "TRB", M_ABS },
+  /* $1D */ { "ORA", M_ABSX },
+  /* $1E */ { "ASL", M_ABSX },
+  /* $1F */ { "BBR1", M_ZP_REL8 },
+  /* $20 */ { "JSR", M_ABS },
+  /* $21 */ { "AND", M_IZPX },
+  /* $22 */ { "JSR", M_IABS },
+  /* $23 */ { NULL, M_NONE },
+  /* $24 */ { "BIT", M_ZP },
+  /* $25 */ { "AND", M_ZP },
+  /* $26 */ { "ROL", M_ZP },
+  /* $27 */ { "RMB2", M_ZP },
+  /* $28 */ { "PLP", M_PULL },
+  /* $29 */ { "AND", M_IMM },
+  /* $2A */ { "ROL", M_ACC },
+  /* $2B */ { "TYS", M_NONE },
+  /* $2C */ { "BIT", M_ABS },
+  /* $2D */ { "AND", M_ABS },
+  /* $2E */ { "ROL", M_ABS },
+  /* $2F */ { "BBR2", M_ZP_REL8 },
+  /* $30 */ { "BMI", M_REL8 },
+  /* $31 */ { "AND", M_IZPY },
+  /* $32 */ { "AND", M_IZPZ },
+  /* $33 */ { "BMI", M_REL16 },
+  /* $34 */ { "BIT", M_ZPX },
+  /* $35 */ { "AND", M_ZPX },
+  /* $36 */ { "ROL", M_ZPX },
+  /* $37 */ { "RMB3", M_ZP },
+  /* $38 */ { "SEC", M_NONE },
+  /* $39 */ { "AND", M_ABSY },
+  /* $3A */ { "DEC", M_NONE },
+  /* $3B */ { NULL, M_NONE },
+  /* $3C */ { "BIT", M_ABSX },
+  /* $3D */ { "AND", M_ABSX },
+  /* $3E */ { "ROL", M_ABSX },
+  /* $3F */ { "BBR3", M_ZP_REL8 },
+  /* $40 */ { "RTI", M_NONE },
+  /* $41 */ { "EOR", M_IZPX },
+  /* $42 */ { NULL, M_NONE },
+  /* $43 */ { NULL, M_NONE },
+  /* $44 */ { NULL, M_NONE },
+  /* $45 */ { "EOR", M_ZP },
+  /* $46 */ { "LSR", M_ZP },
+  /* $47 */ { "RMB4", M_ZP },
+  /* $48 */ { "PHA", M_NONE },
+  /* $49 */ { "EOR", M_IMM },
+  /* $4A */ { "LSR", M_ACC },
+  /* $4B */ { "TAZ", M_NONE },
+  /* $4C */ { "JMP", M_ABS },
+  /* $4D */ { "EOR", M_ABS },
+  /* $4E */ { "LSR", M_ABS },
+  /* $4F */ { "BBR4", M_ZP_REL8 },
+  /* $50 */ { "BVC", M_REL8 },
+  /* $51 */ { "EOR", M_IZPY },
+  /* $52 */ { "EOR", M_IZPZ },
+  /* $53 */ { NULL, M_NONE },
+  /* $54 */ { NULL, M_NONE },
+  /* $55 */ { "EOR", M_ZPX },
+  /* $56 */ { "LSR", M_ZPX },
+  /* $57 */ { "RMB5", M_ZP },
+  /* $58 */ { "CLI", M_NONE },
+  /* $59 */ { "EOR", M_ABSY },
+  /* $5A */ { "PHY", M_NONE },
+  /* $5B */ { "TAB", M_NONE },
+  /* $5C */ { "MAP", M_NONE },
+  /* $5D */ { "EOR", M_ABSX },
+  /* $5E */ { "LSR", M_ABSX },
+  /* $5F */ { "BBR5", M_ZP_REL8 },
+  /* $60 */ { "RTS", M_NONE },
+  /* $61 */ { "ADC", M_IZPX },
+  /* $62 */ { NULL, M_NONE },
+  /* $63 */ { NULL, M_NONE },
+  /* $64 */ { "STZ", M_ZP },
+  /* $65 */ { "ADC", M_ZP },
+  /* $66 */ { "ROR", M_ZP },
+  /* $67 */ { "RMB6", M_ZP },
+  /* $68 */ { "PLA", M_PULL },
+  /* $69 */ { "ADC", M_IMM },
+  /* $6A */ { "ROR", M_ACC },
+  /* $6B */ { "TZA", M_NONE },
+  /* $6C */ { "JMP", M_IABS },
+  /* $6D */ { "ADC", M_ABS },
+  /* $6E */ { "ROR", M_ABS },
+  /* $6F */ { "BBR6", M_ZP_REL8 },
+  /* $70 */ { "BVS", M_REL8 },
+  /* $71 */ { "ADC", M_IZPY },
+  /* $72 */ { "ADC", M_IZPZ },
+  /* $73 */ { NULL, M_NONE },
+  /* $74 */ { "STZ", M_ZPX },
+  /* $75 */ { "ADC", M_ZPX },
+  /* $76 */ { "ROR", M_ZPX },
+  /* $77 */ { "RMB7", M_ZP },
+  /* $78 */ { "SEI", M_NONE },
+  /* $79 */ { "ADC", M_ABSY },
+  /* $7A */ { "PLY", M_PULL },
+  /* $7B */ { "TBA", M_NONE },
+  /* $7C */ { "JMP", M_IABSX },
+  /* $7D */ { "ADC", M_ABSX },
+  /* $7E */ { "ROR", M_ABSX },
+  /* $7F */ { "BBR7", M_ZP_REL8 },
+  /* $80 */ { "BRA", M_REL8 },
+  /* $81 */ { "STA", M_IZPX },
+  /* $82 */ { NULL, M_NONE },
+  /* $83 */ { "BRA", M_REL16 },
+  /* $84 */ { "STY", M_ZP },
+  /* $85 */ { "STA", M_ZP },
+  /* $86 */ { "STX", M_ZP },
+  /* $87 */ { "SMB0", M_ZP },
+  /* $88 */ { "DEY", M_NONE },
+  /* $89 */ { "BIT", M_IMM },
+  /* $8A */ { "TXA", M_NONE },
+  /* $8B */ { NULL, M_NONE },
+  /* $8C */ { "STY", M_ABS },
+  /* $8D */ { "STA", M_ABS },
+  /* $8E */ { "STX", M_ABS },
+  /* $8F */ { "BBS0", M_ZP_REL8 },
+  /* $90 */ { "BCC", M_REL8 },
+  /* $91 */ { "STA", M_IZPY },
+  /* $92 */ { "STA", M_IZPZ },
+  /* $93 */ { "BCC", M_REL16 },
+  /* $94 */ { "STY", M_ZPX },
+  /* $95 */ { "STA", M_ZPX },
+  /* $96 */ { "STX", M_ZPY },
+  /* $97 */ { "SMB1", M_ZP },
+  /* $98 */ { "TYA", M_NONE },
+  /* $99 */ { "STA", M_ABSY },
+  /* $9A */ { "TXS", M_NONE },
+  /* $9B */ { NULL, M_NONE },
+  /* $9C */ { "STZ", M_ABS },
+  /* $9D */ { "STA", M_ABSX },
+  /* $9E */ { "STZ", M_ABSX },
+  /* $9F */ { "BBS1", M_ZP_REL8 },
+  /* $A0 */ { "LDY", M_IMM },
+  /* $A1 */ { "LDA", M_IZPX },
+  /* $A2 */ { "LDX", M_IMM },
+  /* $A3 */ { "LDZ", M_IMM },
+  /* $A4 */ { "LDY", M_ZP },
+  /* $A5 */ { "LDA", M_ZP },
+  /* $A6 */ { "LDX", M_ZP },
+  /* $A7 */ { "SMB2", M_ZP },
+  /* $A8 */ { "TAY", M_NONE },
+  /* $A9 */ { "LDA", M_IMM },
+  /* $AA */ { "TAX", M_NONE },
+  /* $AB */ { NULL, M_NONE },
+  /* $AC */ { "LDY", M_ABS },
+  /* $AD */ { "LDA", M_ABS },
+  /* $AE */ { "LDX", M_ABS },
+  /* $AF */ { "BBS2", M_ZP_REL8 },
+  /* $B0 */ { "BCS", M_REL8 },
+  /* $B1 */ { "LDA", M_IZPY },
+  /* $B2 */ { "LDA", M_IZPZ },
+  /* $B3 */ { NULL, M_NONE },
+  /* $B4 */ { "LDY", M_ZPX },
+  /* $B5 */ { "LDA", M_ZPX },
+  /* $B6 */ { "LDX", M_ZPY },
+  /* $B7 */ { "SMB3", M_ZP },
+  /* $B8 */ { "CLV", M_NONE },
+  /* $B9 */ { "LDA", M_ABSY },
+  /* $BA */ { "TSX", M_NONE },
+  /* $BB */ { NULL, M_NONE },
+  /* $BC */ { "LDY", M_ABSX },
+  /* $BD */ { "LDA", M_ABSX },
+  /* $BE */ { "LDX", M_ABSY },
+  /* $BF */ { "BBS3", M_ZP_REL8 },
+  /* $C0 */ { "CPY", M_IMM },
+  /* $C1 */ { "CMP", M_IZPX },
+  /* $C2 */ { NULL, M_NONE },
+  /* $C3 */ { NULL, M_NONE },
+  /* $C4 */ { "CPY", M_ZP },
+  /* $C5 */ { "CMP", M_ZP },
+  /* $C6 */ { "DEC", M_ZP },
+  /* $C7 */ { "SMB4", M_ZP },
+  /* $C8 */ { "INY", M_NONE },
+  /* $C9 */ { "CMP", M_IMM },
+  /* $CA */ { "DEX", M_NONE },
+  /* $CB */ { NULL, M_NONE },
+  /* $CC */ { "CPY", M_ABS },
+  /* $CD */ { "CMP", M_ABS },
+  /* $CE */ { "DEC", M_ABS },
+  /* $CF */ { "BBS4", M_ZP_REL8 },
+  /* $D0 */ { "BNE", M_REL8 },
+  /* $D1 */ { "CMP", M_IZPY },
+  /* $D2 */ { "CMP", M_IZPZ },
+  /* $D3 */ { NULL, M_NONE },
+  /* $D4 */ { NULL, M_NONE },
+  /* $D5 */ { "CMP", M_ZPX },
+  /* $D6 */ { "DEC", M_ZPX },
+  /* $D7 */ { "SMB5", M_ZP },
+  /* $D8 */ { "CLD", M_NONE },
+  /* $D9 */ { "CMP", M_ABSY },
+  /* $DA */ { "PHX", M_NONE },
+  /* $DB */ { "PHZ", M_NONE },
+  /* $DC */ { NULL, M_NONE },
+  /* $DD */ { "CMP", M_ABSX },
+  /* $DE */ { "DEC", M_ABSX },
+  /* $DF */ { "BBS5", M_ZP_REL8 },
+  /* $E0 */ { "CPX", M_IMM },
+  /* $E1 */ { "SBC", M_IZPX },
+  /* $E2 */ { NULL, M_NONE },
+  /* $E3 */ { NULL, M_NONE },
+  /* $E4 */ { "CPX", M_ZP },
+  /* $E5 */ { "SBC", M_ZP },
+  /* $E6 */ { "INC", M_ZP },
+  /* $E7 */ { "SMB6", M_ZP },
+  /* $E8 */ { "INX", M_NONE },
+  /* $E9 */ { "SBC", M_IMM },
+  /* $EA */ { "EOM", M_NONE },
+  /* $EB */ { NULL, M_NONE },
+  /* $EC */ { "CPX", M_ABS },
+  /* $ED */ { "SBC", M_ABS },
+  /* $EE */ { "INC", M_ABS },
+  /* $EF */ { "BBS6", M_ZP_REL8 },
+  /* $F0 */ { "BEQ", M_REL8 },
+  /* $F1 */ { "SBC", M_IZPY },
+  /* $F2 */ { "SBC", M_IZPZ },
+  /* $F3 */ { "BEQ", M_REL16 },
+  /* $F4 */ { NULL, M_NONE },
+  /* $F5 */ { "SBC", M_ZPX },
+  /* $F6 */ { "INC", M_ZPX },
+  /* $F7 */ { "SMB7", M_ZP },
+  /* $F8 */ { "SED", M_NONE },
+  /* $F9 */ { "SBC", M_ABSY },
+  /* $FA */ { "PLX", M_PULL },
+  /* $FB */ { "PLZ", M_PULL },
+  /* $FC */ { NULL, M_NONE },
+  /* $FD */ { "SBC", M_ABSX },
+  /* $FE */ { "INC", M_ABSX },
+  /* $FF */ { "BBS7", M_ZP_REL8 },
+};
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 
 #include <stdlib.h>
@@ -21,10 +22,20 @@
 
 #include <libpng16/png.h>
 
-FILE *f=NULL;
+#include "ghdlreport.h"
 
-unsigned char dbg_vals[4096]={0};
-unsigned char dbg_states[4096]={0};
+/*
+  Each sample of the bus is its value in the form that the debug register
+  gives it, and the state of the IEC controller, if it changed then.
+*/
+struct sample {
+  unsigned char val;
+  unsigned char state;
+};
+
+struct sample *samples=NULL;
+int sample_count=0;
+int samples_allocated=0;
 
 int jiffyDOS = 0 ;
 int c1581 = 0;
@@ -156,44 +167,46 @@ char *digits[10][8]={
 };
 
 #define MAXX 320
-#define MAXY 2048
+// Height of one band of the waveform, and how many samples fit across it
+#define BAND_HEIGHT (9*8)
+#define BAND_SAMPLES ((MAXX-32)/8)
 
-unsigned int pixels[MAXY][MAXX]={0};
+unsigned int pixels[BAND_HEIGHT][MAXX]={0};
 
 /*
   Our waveform displays use 8x8 blocks to show each signal,
   and the simple 8x8 font elements defined above.
 
-  Each row has room for 1020 ~1usec ticks, and is 40 pixels 
-  tall.  Thus for all 4096 ticks, we need four such rows. 
+  The image is a series of bands, each with the signal legend and
+  BAND_SAMPLES samples, 5 signals tall with the IEC state numbers
+  under them. Only one band is drawn at a time, and written out
+  before the next, so there is no limit on the number of samples.
  */
-void build_image(void)
+void draw_band(const struct sample *band_samples, int count)
 {
-  // Clear image to white initially
-  for(int y=0;y<MAXY;y++)
+  // Clear band to white initially
+  for(int y=0;y<BAND_HEIGHT;y++)
     for(int x=0;x<MAXX;x++)
       pixels[y][x]=0xffffffff;
   
   // Draw signal legend down the left side
-  for(int row = 0; ((row+1)*(9*8)) <= MAXY; row++) {
-    for(int sig = 0; sig<5; sig++) {
-      for (int charrow=0;charrow<8;charrow++) {
-	char *bits=sigs[sig][charrow];
-	for(int x=0;bits[x];x++) if (bits[x]!=' ') pixels[row*(9*8)+sig*8+charrow][x]=0xff000000;
-      }
+  for(int sig = 0; sig<5; sig++) {
+    for (int charrow=0;charrow<8;charrow++) {
+      char *bits=sigs[sig][charrow];
+      for(int x=0;bits[x];x++) if (bits[x]!=' ') pixels[sig*8+charrow][x]=0xff000000;
     }
   }
   
   int x=32;
   int y=0;
 
-  for(int n=0;n<4096;n++) {
+  for(int n=0;n<count&&n<BAND_SAMPLES;n++) {
 
     // Draw state numbers under cells
 
-    if (dbg_states[n]) {
+    if (band_samples[n].state) {
       char num[16];
-      snprintf(num,16,"%d",dbg_states[n]);
+      snprintf(num,16,"%d",band_samples[n].state);
       int yy=y+5*8;
       for(int c=0;num[c];c++) {
 	for(int charrow=0;charrow<8;charrow++) {
@@ -219,7 +232,7 @@ void build_image(void)
       int controller=5;
       int device=5;
 
-      int v=dbg_vals[n]^0xc0;
+      int v=band_samples[n].val^0xc0;
       
       switch(sig) {
       case 0: // RST
@@ -276,14 +289,11 @@ void build_image(void)
     }
 
     x+=8;
-    if (x>=MAXX) {
-      x=32; y+=(9*8);
-    }
-    if (y>(MAXY-(9*8)+1)) break;
   }
 }
 
-void write_png(char *filename)
+// Write the samples as an image of as many bands as they need
+void write_png(char *filename,const struct sample *image_samples,int count)
 {
   int y;
   png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -311,13 +321,19 @@ void write_png(char *filename)
 
   png_init_io(png, f);
 
+  int bands = (count + BAND_SAMPLES - 1) / BAND_SAMPLES;
+  if (!bands) bands = 1;
+
   png_set_IHDR(
-      png, info, MAXX, MAXY, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_DEFAULT);
+      png, info, MAXX, bands * BAND_HEIGHT, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_DEFAULT);
 
   png_write_info(png, info);
 
-  for (y = 0; y < MAXY; y++) {
-    png_write_row(png, (unsigned char *)pixels[y]);
+  for (int band = 0; band < bands; band++) {
+    draw_band(&image_samples[band * BAND_SAMPLES], count - band * BAND_SAMPLES);
+    for (y = 0; y < BAND_HEIGHT; y++) {
+      png_write_row(png, (unsigned char *)pixels[y]);
+    }
   }
   
   png_write_end(png, info);
@@ -329,77 +345,19 @@ void write_png(char *filename)
 }
 
 
-int openFile(char *port)
-{
-  f = fopen(port, "rb");
-  if (f == NULL) {
-    perror("fopen");
-    return -1;
-  }
-
-  return 0;
-}
+ghdl_log *trace_log=NULL;
 
-long long time_val;
+double time_us;
 unsigned int atn, clk_c64, clk_1541, data_c64, data_1541, data_dummy;
-unsigned int iec_state,instr_num,pc,reg_a;
-char time_units[8192];
+// Latest IEC controller state, and whether it has been shown yet
+int iec_state=0;
+int iec_state_shown=1;
 
 int bit_num=0;
 
-int getUpdate(void)
+// Describe what the drive ROM is doing at this address
+void describe_drive_pc(unsigned int pc, unsigned int reg_a)
 {
-
-  int line_len=0;
- char line[1024];
-
-  char bytes[1024];
-
-  while(!feof(f)) {   
-    int n = fread(bytes,1,1,f);
-    if (n>0) {
-      for(int i=0;i<n;i++) {
-	int c=bytes[i];
-	if (c=='\n'||c=='\r') {
-	  if (line_len) {
-	    // Parse lines like this:	    
-	    // /home/paul/Projects/mega65/mega65-core/src/vhdl/tb_iec_serial.vhdl:%*d:9:@6173ps:(report note): IECBUSSTATE: ATN='1', CLK(c64)='1', CLK(1541)='1', DATA(c64)='1', DATA(1541)='1', DATA(dummy)='1'
-	    int r = sscanf(line,"/home/paul/Projects/mega65/mega65-core/src/vhdl/tb_iec_serial.vhdl:%*d:%*d:@%lld%[^:]:(report note): IECBUSSTATE: ATN='%d', CLK(c64)='%d', CLK(1541)='%d', DATA(c64)='%d', DATA(1541)='%d', DATA(dummy)='%d'",
-			   &time_val,time_units,
-			   &atn,&clk_c64,&clk_1541,&data_c64,&data_1541,&data_dummy);
-	    if (strstr(line,"IECBUSSTATE")) fprintf(stderr,"DEBUG: r=%d, Line = '%s'\n",r,line);
-
-	    if (r==8) {
-	      int ofs=0;
-	      int colons=5;
-	      while(colons) if (line[ofs++]==':') colons--;
-	      // fprintf(stderr,"%s\n",&line[ofs+1]);
-	      return 0;
-	    }
-
-	    {
-	      char drive_cap[1024];
-	      if (sscanf(line,"/home/paul/Projects/mega65/mega65-core/src/vhdl/tb_iec_serial.vhdl:%*d:%*d:@%lld%[^:]:(report note): DRIVEINFO: %[^\n]",&time_val,time_units,drive_cap)==3) {
-		fprintf(stderr,"DRIVEINFO: %s\n",drive_cap);		       
-		}
-	  }
-	    
-	    if (sscanf(line,"/home/paul/Projects/mega65/mega65-core/src/vhdl/iec_serial.vhdl:%*d:%*d:@%lld%[^:]:(report note): iec_state = %d",
-		       &time_val,time_units,&iec_state)==3) {
-	      fprintf(stderr,"            iec_state = %d\n",iec_state);
-	    }
-
-	    if (strstr(line,"IEC:")) { fprintf(stderr,"%s\n",&line[99]); fflush(stderr); }
-	    if (strstr(line,": MOS6522")) {
-	      int ofs=0;
-	      int colons=5;
-	      while(colons) if (line[ofs++]==':') colons--;
-	      fprintf(stderr,"%s\n",&line[ofs+1]);
-	    }
-	    
-	    if (sscanf(line,"/home/paul/Projects/mega65/mega65-core/src/vhdl/simple_cpu6502.vhdl:%*d:%*d:@%lld%[^:]:(report note): Instr#:%d PC: $%x, A:%02X",
-		       &time_val,time_units,&instr_num,&pc,&reg_a)==5) {
-
 	      pc=pc &0xffff;
 	      
 	      switch(pc) {
@@ -1060,18 +1018,79 @@ int getUpdate(void)
 		  }
 		}
 	      }
-	    }
-	  }
-	  line[0]=0; line_len=0;
-	} else {
-	  if (line_len<1024) { line[line_len++]=c;  line[line_len]=0; }
-	}
-      }
-    }
+}
+
+int bus_state(const ghdl_report *r, void *context)
+{
+  // IECBUSSTATE: ATN='1', CLK(c64)='1', CLK(1541)='1', DATA(c64)='1', DATA(1541)='1', DATA(dummy)='1'
+  long long v[6];
+  if (ghdl_report_number(r, "ATN", &v[0]) || ghdl_report_number(r, "CLK(c64)", &v[1])
+      || ghdl_report_number(r, "CLK(1541)", &v[2]) || ghdl_report_number(r, "DATA(c64)", &v[3])
+      || ghdl_report_number(r, "DATA(1541)", &v[4]) || ghdl_report_number(r, "DATA(dummy)", &v[5])) {
+    char message[1024];
+    fprintf(stderr,"DEBUG: Could not parse '%s'\n",ghdl_report_message(r,message,sizeof(message)));
+    return 0;
+  }
+  atn=v[0]; clk_c64=v[1]; clk_1541=v[2]; data_c64=v[3]; data_1541=v[4]; data_dummy=v[5];
+  time_us = r->time_fs / 1000000000.0;
+  return 1;
+}
+
+int drive_info(const ghdl_report *r, void *context)
+{
+  char message[1024];
+  fprintf(stderr,"%s\n",ghdl_report_message(r,message,sizeof(message)));
+  return 0;
+}
+
+int iec_state_report(const ghdl_report *r, void *context)
+{
+  long long state;
+  if (!ghdl_report_number(r,"iec_state",&state)) {
+    fprintf(stderr,"            iec_state = %lld\n",state);
+    if (state!=iec_state) iec_state_shown=0;
+    iec_state=state;
   }
+  return 0;
+}
+
+int other_report(const ghdl_report *r, void *context)
+{
+  char message[1024];
+  if (r->is_report && (ghdl_report_is(r,"MOS6522") || memmem(r->message,r->message_len,"IEC:",4))) {
+    fprintf(stderr,"%s\n",ghdl_report_message(r,message,sizeof(message)));
+    fflush(stderr);
+  }
+  return 0;
+}
+
+int cpu_instruction(const ghdl_report *r, void *context)
+{
+  char message[1024];
+  unsigned int instr_num,pc,reg_a;
+  if (sscanf(ghdl_report_message(r,message,sizeof(message)),"Instr#:%d PC: $%x, A:%02X",&instr_num,&pc,&reg_a)==3)
+    describe_drive_pc(pc,reg_a);
+  return 0;
+}
+
+// Read up to the next IEC bus state
+int getUpdate(void)
+{
+  return ghdl_log_run(trace_log)==1?0:-1;
+}
 
-  return -1;
+int openFile(char *port)
+{
+  trace_log = ghdl_log_open(port);
+  if (!trace_log)
+    return -1;
 
+  ghdl_log_on(trace_log, "IECBUSSTATE", bus_state, NULL);
+  ghdl_log_on(trace_log, "DRIVEINFO", drive_info, NULL);
+  ghdl_log_on(trace_log, "iec_state", iec_state_report, NULL);
+  ghdl_log_on(trace_log, NULL, other_report, NULL);
+  ghdl_log_on(trace_log, "Instr#", cpu_instruction, NULL);
+  return 0;
 }
 
 char *describe_line(int c64, int drive, int dummy)
@@ -1094,23 +1113,58 @@ char *describe_line(int c64, int drive, int dummy)
   return "UNKNOWN";
 }
 
+// Bands per image, when writing a series of images rather than a single one
+int tile_bands=0;
+int tile_number=0;
+
+void write_tile(void)
+{
+  char filename[1024];
+  snprintf(filename,1024,"iectrace-%04d.png",tile_number++);
+  write_png(filename,samples,sample_count);
+}
+
+void add_sample(void)
+{
+  if (sample_count==samples_allocated) {
+    samples_allocated=samples_allocated?samples_allocated*2:4096;
+    samples=realloc(samples,samples_allocated*sizeof(struct sample));
+    if (!samples) {
+      fprintf(stderr,"FATAL: Out of memory\n");
+      exit(-1);
+    }
+  }
+
+  // In the form the debug register gives: RST, ATN, SRQ, CLK, DATA from the controller,
+  // then SRQ, CLK, DATA from the devices, with RST and ATN inverted
+  int v=0x80|0x20|0x04;
+  if (atn) v|=0x40;
+  if (clk_c64) v|=0x10;
+  if (data_c64) v|=0x08;
+  if (clk_1541) v|=0x02;
+  if (data_1541&&data_dummy) v|=0x01;
+  samples[sample_count].val=v^0xc0;
+  samples[sample_count].state=iec_state_shown?0:iec_state;
+  iec_state_shown=1;
+  sample_count++;
+
+  // Write each tile as soon as it is full, so that only one is kept
+  if (tile_bands&&sample_count==tile_bands*BAND_SAMPLES) {
+    write_tile();
+    sample_count=0;
+  }
+}
+
 int iecDataTrace(char *msg)
 {
 
   double prev_time = 0;
   
   fprintf(stderr,"DEBUG: Fetching IEC data trace...\n");
-  for(int i=0;i<4096;i++) {
-    if (getUpdate()) break;
-
-    double time_norm = time_val;
-    if (!strcmp(time_units,"ps")) time_norm /= 1000000.0;
-    else if (!strcmp(time_units,"ns")) time_norm /= 1000.0;
-    else if (!strcmp(time_units,"us")) time_norm *= 1.0;
-    else if (!strcmp(time_units,"ms")) time_norm *= 1000.0;
-    else {
-      fprintf(stderr,"FATAL: Unknown time units '%s'\n",time_units);
-    }
+  while (!getUpdate()) {
+    add_sample();
+
+    double time_norm = time_us;
 
     double time_diff = time_norm - prev_time;
     prev_time = time_norm;
@@ -1124,30 +1178,49 @@ int iecDataTrace(char *msg)
     fflush(stdout);
   }
     
-  build_image();
-  write_png("iectrace.png");
+  if (!tile_bands)
+    write_png("iectrace.png",samples,sample_count);
+  else if (sample_count||!tile_number)
+    write_tile();
 
   printf("\n");
   return 0;
 }
 
+void usage(void)
+{
+  fprintf(stderr,"usage: iecwaveform [-t bands] <VUnit output.txt> [JD|81]\n");
+  fprintf(stderr,"Draws the IEC bus in iectrace.png, or with -t, in a series of images of that many\n"
+	  "bands (%d samples each), iectrace-0000.png and so on.\n",BAND_SAMPLES);
+  exit(-1);
+}
+
 int main(int argc,char **argv)
 {
-  if (argc<2) {
-    fprintf(stderr,"usage: iecwaveform <VUnit output.txt> [JD|81]\n");
-    exit(-1);
+  int opt;
+  while ((opt=getopt(argc,argv,"t:"))!=-1) {
+    switch(opt) {
+    case 't':
+      tile_bands=atoi(optarg);
+      if (tile_bands<1) usage();
+      break;
+    default:
+      usage();
+    }
   }
+  
+  if (argc-optind<1) usage();
 
-  if (argc>2) {
-    if (!strcasecmp(argv[2],"JD")) jiffyDOS=1;
-    if (!strcasecmp(argv[2],"81")) c1581=1;
+  if (argc-optind>1) {
+    if (!strcasecmp(argv[optind+1],"JD")) jiffyDOS=1;
+    else if (!strcasecmp(argv[optind+1],"81")) c1581=1;
     else {
       fprintf(stderr,"ERROR: JD and 81 are the only supported drive ROM variants (default is stock 1541).\n");
       exit(-1);
     }
   }
   
-  openFile(argv[1]);
+  if (openFile(argv[optind])) exit(-1);
 
   iecDataTrace("VHDL IEC Simulation");
 
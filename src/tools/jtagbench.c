@@ -0,0 +1,121 @@
+/*
+  Model uploading a bitstream with fpgajtag, without a board.
+
+  fpgajtag runs exactly as monitor_load would run it, but over the loopback
+  transport (fpgajtag/loopback.c), which simulates the FTDI chip and the
+  FPGA. At the end we report the bytes on the wire, the USB round trips and
+  the modelled time for each phase of the upload, and can write out the
+  timeline of every transfer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "fpgajtag/util.h"
+
+// Set by fpgajtag when it finds the serial port of a real board
+char *serial_port = NULL;
+
+void init_fpgajtag(const char *serialno, const char *filename, uint32_t file_idcode);
+int fpgajtag_main(char *bitstream, char *serialport);
+
+// fpgajtag's boundary scan expects these from monitor_load
+unsigned long long gettime_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+int dump_bytes(int col, char *msg, unsigned char *b, int count)
+{
+  fprintf(stderr, "%*s%s:\n", col, "", msg);
+  for (int i = 0; i < count; i += 16) {
+    fprintf(stderr, "%*s%04x:", col, "", i);
+    for (int j = i; j < i + 16 && j < count; j++)
+      fprintf(stderr, " %02x", b[j]);
+    fprintf(stderr, "\n");
+  }
+  return 0;
+}
+
+void usage(void)
+{
+  fprintf(stderr, "usage: jtagbench [-q] [-l latency] [-i idcode] [-t timeline.csv] [-z part [-r reference]] <bitstream>\n");
+  fprintf(stderr, "Models uploading a bitstream with fpgajtag, over a simulated FTDI JTAG cable.\n");
+  fprintf(stderr, "  -q  don't show fpgajtag's own output.\n");
+  fprintf(stderr, "  -l  USB round trip time in microseconds (default %d).\n", loopback_latency);
+  fprintf(stderr, "  -i  IDCODE of the simulated FPGA, in hex (default from the bitstream).\n");
+  fprintf(stderr, "  -t  write the timeline of every USB transfer to this CSV file.\n");
+  fprintf(stderr, "  -z  compress the bitstream for this part before sending it (see bitstream.h).\n");
+  fprintf(stderr, "  -r  send only the frames that differ from this bitstream, without programming.\n");
+  exit(-3);
+}
+
+int main(int argc, char **argv)
+{
+  int opt, quiet = 0, idcode_given = 0;
+  char *timeline = NULL;
+
+  while ((opt = getopt(argc, argv, "ql:i:t:z:r:")) != -1) {
+    switch (opt) {
+    case 'q':
+      quiet = 1;
+      break;
+    case 'l':
+      loopback_latency = atoi(optarg);
+      break;
+    case 'i':
+      loopback_idcode = strtoul(optarg, NULL, 16);
+      idcode_given = 1;
+      break;
+    case 't':
+      timeline = optarg;
+      break;
+    case 'z':
+      fpgajtag_part_file = optarg;
+      break;
+    case 'r':
+      fpgajtag_reference_file = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1 || (fpgajtag_reference_file && !fpgajtag_part_file))
+    usage();
+  char *bitstream = argv[optind];
+
+  // fpgajtag closes stdout when it is done
+  FILE *report = fdopen(dup(1), "w");
+  if (!report) {
+    perror("ERROR: Could not duplicate stdout");
+    exit(-1);
+  }
+  if (quiet && !freopen("/dev/null", "w", stdout)) {
+    perror("ERROR: Could not open /dev/null");
+    exit(-1);
+  }
+
+  jtag_transport = &loopback_transport;
+  uint32_t file_idcode = read_inputfile(bitstream);
+  // IDCODEs always have bit 0 set
+  if (!idcode_given && (file_idcode & 1) && file_idcode != 0xffffffff)
+    loopback_idcode = file_idcode;
+
+  init_fpgajtag(NULL, bitstream, file_idcode);
+  fpgajtag_main(bitstream, NULL);
+
+  fprintf(report, "%s: %d bytes of configuration data\n", bitstream, input_filesize);
+  loopback_report(report);
+  if (timeline && loopback_timeline(timeline)) {
+    fprintf(stderr, "ERROR: Could not write timeline to '%s'\n", timeline);
+    exit(-1);
+  }
+  fclose(report);
+  return 0;
+}
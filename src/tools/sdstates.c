@@ -3,6 +3,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "ghdlreport.h"
+
 #define MAX_STATES 1024
 char *state_names[MAX_STATES];
 int state_transitions[MAX_STATES][MAX_STATES];
@@ -35,9 +37,14 @@ int main(int argc,char **argv)
   int current_states[MAX_STATES];
 
   int if_depth=0;
-  
-  fgets(line,1024,stdin);
-  while(line[0]) {
+
+  ghdl_log *log=ghdl_log_open(NULL);
+  if (!log) exit(-1);
+  ghdl_report r;
+  while(ghdl_log_next(log,&r)) {
+    int len=r.line_len<1023?r.line_len:1023;
+    memcpy(line,r.line,len);
+    line[len]=0;
 
     // Trim trailing CRLF and spaces
     while(line[0]&&(line[strlen(line)-1]=='\n'||line[strlen(line)-1]=='\r'||line[strlen(line)-1]==' '))
@@ -140,9 +147,8 @@ int main(int argc,char **argv)
 	}
       }
     }
-      
-    fgets(line,1024,stdin);
   }
+  ghdl_log_close(log);
 
   /*
     Work out the worst-case propagation of sdio_busy status.
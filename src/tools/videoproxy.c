@@ -4,6 +4,9 @@
   separate the packet sniffer which needs root, from the part that listens
   to connections from the internet.
 
+  Any number of programs can subscribe to the packets, or to whole frames
+  decoded from them (see vncdecode.h), at once.
+
   (C) Paul Gardner-Stephen 2014, 2018.
 
   This program is free software; you can redistribute it and/or
@@ -42,9 +45,11 @@
 #include <signal.h>
 #include <netdb.h>
 #include <time.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include <pcap.h>
 
-int client_sock = -1;
+#include "vncdecode.h"
 
 int create_listen_socket(int port)
 {
@@ -92,68 +97,633 @@ int accept_incoming(int sock)
   return -1;
 }
 
+// Size of the packets of compressed video that the C65GS sends
+#define VIDEO_PACKET_SIZE 2132
+
+#define MAX_SUBSCRIBERS 16
+// Most packets handed to a single writev()
+#define MAX_IOV 64
+
+/*
+  Each video packet is copied once out of the capture buffer, and is then
+  shared by the queues of all subscribers until the last one has sent it.
+*/
+typedef struct video_buffer {
+  unsigned char data[VIDEO_PACKET_SIZE];
+  int refs;
+  struct video_buffer *next_free;
+} video_buffer;
+
+video_buffer *free_buffers = NULL;
+
+// What to do when a subscriber's queue is full
+enum { DROP_OLDEST, DROP_NEWEST, DROP_SUBSCRIBER };
+int drop_policy = DROP_OLDEST;
+int queue_length = 64;
+
+typedef struct subscriber {
+  int sock;
+  // Packets waiting to be sent, oldest first, in a ring of queue_length
+  video_buffer **queue;
+  int head, count;
+  // Bytes of the oldest packet that have already been sent
+  int sent;
+  unsigned long long forwarded, dropped;
+} subscriber;
+
+subscriber subscribers[MAX_SUBSCRIBERS];
+int subscriber_count = 0;
+
+unsigned long long captured = 0, video_packets = 0, forwarded = 0, dropped = 0;
+
+/*
+  Frames are also decoded here, once, and published whole to subscribers
+  on a second port. A subscriber gets the frame it is sending and the
+  newest one after that: frames in between are skipped, so that a slow
+  subscriber never holds up the others.
+*/
+#define FRAME_WIDTH 800
+#define FRAME_HEIGHT 600
+
+typedef struct frame_buffer {
+  video_frame_header header;
+  unsigned char pixels[FRAME_WIDTH * FRAME_HEIGHT * 4];
+  int refs;
+  struct frame_buffer *next_free;
+} frame_buffer;
+
+#define FRAME_SIZE (sizeof(video_frame_header) + FRAME_WIDTH * FRAME_HEIGHT * 4)
+
+frame_buffer *free_frames = NULL;
+
+typedef struct frame_subscriber {
+  int sock;
+  frame_buffer *sending, *next;
+  // Bytes of the frame being sent that have already been sent
+  int sent;
+  unsigned long long frames, skipped;
+} frame_subscriber;
+
+frame_subscriber frame_subscribers[MAX_SUBSCRIBERS];
+int frame_subscriber_count = 0;
+
+video_decoder decoder;
+pcap_t *capture = NULL;
+int replaying = 0;
+uint32_t frame_sequence = 0;
+unsigned long long frames_sent = 0, frames_skipped = 0;
+
+volatile sig_atomic_t show_counters = 0, quit = 0;
+
+video_buffer *get_buffer(void)
+{
+  video_buffer *b = free_buffers;
+  if (b)
+    free_buffers = b->next_free;
+  else {
+    b = malloc(sizeof(video_buffer));
+    if (!b) {
+      fprintf(stderr, "ERROR: Out of memory\n");
+      exit(-1);
+    }
+  }
+  b->refs = 0;
+  return b;
+}
+
+void release_buffer(video_buffer *b)
+{
+  if (!--b->refs) {
+    b->next_free = free_buffers;
+    free_buffers = b;
+  }
+}
+
+void drop_subscriber(int n, char *why)
+{
+  subscriber *s = &subscribers[n];
+  fprintf(stderr, "Dropping subscriber %d: %s (forwarded %llu, dropped %llu packets)\n", s->sock, why, s->forwarded,
+      s->dropped);
+  close(s->sock);
+  for (; s->count; s->count--) {
+    release_buffer(s->queue[s->head]);
+    s->head = (s->head + 1) % queue_length;
+  }
+  free(s->queue);
+  subscribers[n] = subscribers[--subscriber_count];
+}
+
+void add_subscriber(int sock)
+{
+  if (subscriber_count == MAX_SUBSCRIBERS) {
+    fprintf(stderr, "Too many subscribers, refusing connection.\n");
+    close(sock);
+    return;
+  }
+  int on = 1;
+  ioctl(sock, FIONBIO, (char *)&on);
+  subscriber *s = &subscribers[subscriber_count];
+  memset(s, 0, sizeof(subscriber));
+  s->sock = sock;
+  s->queue = malloc(queue_length * sizeof(video_buffer *));
+  if (!s->queue) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    exit(-1);
+  }
+  subscriber_count++;
+  fprintf(stderr, "New subscriber %d (%d in all)\n", sock, subscriber_count);
+}
+
+// Queue a packet to every subscriber, applying the drop policy to those
+// whose queues are full
+void queue_packet(video_buffer *b)
+{
+  for (int i = 0; i < subscriber_count; i++) {
+    subscriber *s = &subscribers[i];
+    if (s->count == queue_length) {
+      s->dropped++;
+      dropped++;
+      if (drop_policy == DROP_NEWEST)
+        continue;
+      if (drop_policy == DROP_SUBSCRIBER) {
+        drop_subscriber(i--, "too slow");
+        continue;
+      }
+      // Drop the oldest packet that has not been started, as the rest of a
+      // started one must still follow to keep the stream in step.
+      int victim = (s->head + (s->sent ? 1 : 0)) % queue_length;
+      release_buffer(s->queue[victim]);
+      if (s->sent)
+        s->queue[victim] = s->queue[s->head];
+      s->head = (s->head + 1) % queue_length;
+      s->count--;
+    }
+    b->refs++;
+    s->queue[(s->head + s->count) % queue_length] = b;
+    s->count++;
+  }
+  if (!b->refs) {
+    b->refs = 1;
+    release_buffer(b);
+  }
+}
+
+frame_buffer *get_frame(void)
+{
+  frame_buffer *f = free_frames;
+  if (f)
+    free_frames = f->next_free;
+  else {
+    f = malloc(sizeof(frame_buffer));
+    if (!f) {
+      fprintf(stderr, "ERROR: Out of memory\n");
+      exit(-1);
+    }
+  }
+  f->refs = 0;
+  return f;
+}
+
+void release_frame(frame_buffer *f)
+{
+  if (!--f->refs) {
+    f->next_free = free_frames;
+    free_frames = f;
+  }
+}
+
+void drop_frame_subscriber(int n, char *why)
+{
+  frame_subscriber *s = &frame_subscribers[n];
+  fprintf(stderr, "Dropping frame subscriber %d: %s (sent %llu, skipped %llu frames)\n", s->sock, why, s->frames,
+      s->skipped);
+  close(s->sock);
+  if (s->sending)
+    release_frame(s->sending);
+  if (s->next)
+    release_frame(s->next);
+  frame_subscribers[n] = frame_subscribers[--frame_subscriber_count];
+}
+
+void add_frame_subscriber(int sock)
+{
+  if (frame_subscriber_count == MAX_SUBSCRIBERS) {
+    fprintf(stderr, "Too many frame subscribers, refusing connection.\n");
+    close(sock);
+    return;
+  }
+  int on = 1;
+  ioctl(sock, FIONBIO, (char *)&on);
+  frame_subscriber *s = &frame_subscribers[frame_subscriber_count++];
+  memset(s, 0, sizeof(frame_subscriber));
+  s->sock = sock;
+  fprintf(stderr, "New frame subscriber %d (%d in all)\n", sock, frame_subscriber_count);
+}
+
+// Called by the decoder each time a frame is complete
+void publish_frame(video_decoder *d)
+{
+  frame_sequence++;
+  if (!frame_subscriber_count)
+    return;
+
+  frame_buffer *f = get_frame();
+  f->header.magic = htonl(VIDEO_FRAME_MAGIC);
+  f->header.sequence = htonl(frame_sequence);
+  f->header.width = htons(FRAME_WIDTH);
+  f->header.height = htons(FRAME_HEIGHT);
+  f->header.length = htonl(FRAME_WIDTH * FRAME_HEIGHT * 4);
+  memcpy(f->pixels, d->frame_buffer, FRAME_WIDTH * FRAME_HEIGHT * 4);
+
+  for (int i = 0; i < frame_subscriber_count; i++) {
+    frame_subscriber *s = &frame_subscribers[i];
+    f->refs++;
+    if (!s->sending)
+      s->sending = f;
+    else {
+      if (s->next) {
+        release_frame(s->next);
+        s->skipped++;
+        frames_skipped++;
+      }
+      s->next = f;
+    }
+  }
+  if (!f->refs) {
+    f->refs = 1;
+    release_frame(f);
+  }
+
+  // Replaying, read no further until this frame is on its way, so that
+  // none are skipped
+  if (replaying)
+    pcap_breakloop(capture);
+}
+
+void handle_packet(u_char *user, const struct pcap_pkthdr *hdr, const u_char *packet)
+{
+  captured++;
+  // probably a C65GS compressed video frame.
+  if (hdr->caplen != VIDEO_PACKET_SIZE)
+    return;
+  video_packets++;
+  if (frame_subscriber_count)
+    video_decode_packet(&decoder, packet, VIDEO_PACKET_SIZE);
+  if (!subscriber_count)
+    return;
+  video_buffer *b = get_buffer();
+  memcpy(b->data, packet, VIDEO_PACKET_SIZE);
+  queue_packet(b);
+}
+
+// Send as much of a subscriber's queue as its socket will take
+void send_queued(int n)
+{
+  subscriber *s = &subscribers[n];
+  while (s->count) {
+    struct iovec iov[MAX_IOV];
+    int iovcnt = 0;
+    for (; iovcnt < s->count && iovcnt < MAX_IOV; iovcnt++) {
+      video_buffer *b = s->queue[(s->head + iovcnt) % queue_length];
+      iov[iovcnt].iov_base = b->data;
+      iov[iovcnt].iov_len = VIDEO_PACKET_SIZE;
+    }
+    iov[0].iov_base = (char *)iov[0].iov_base + s->sent;
+    iov[0].iov_len -= s->sent;
+
+    ssize_t r = writev(s->sock, iov, iovcnt);
+    if (r == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno == EINTR)
+        continue;
+      drop_subscriber(n, strerror(errno));
+      return;
+    }
+    while (r > 0) {
+      int part = VIDEO_PACKET_SIZE - s->sent;
+      if (r < part) {
+        s->sent += r;
+        break;
+      }
+      r -= part;
+      s->sent = 0;
+      release_buffer(s->queue[s->head]);
+      s->head = (s->head + 1) % queue_length;
+      s->count--;
+      s->forwarded++;
+      forwarded++;
+    }
+    if (s->count && s->sent)
+      // Socket is full
+      return;
+  }
+}
+
+// Send as much of a subscriber's frames as its socket will take
+void send_frames(int n)
+{
+  frame_subscriber *s = &frame_subscribers[n];
+  while (s->sending) {
+    ssize_t r = write(s->sock, (unsigned char *)&s->sending->header + s->sent, FRAME_SIZE - s->sent);
+    if (r == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno == EINTR)
+        continue;
+      drop_frame_subscriber(n, strerror(errno));
+      return;
+    }
+    s->sent += r;
+    if (s->sent < FRAME_SIZE)
+      continue;
+    release_frame(s->sending);
+    s->sending = s->next;
+    s->next = NULL;
+    s->sent = 0;
+    s->frames++;
+    frames_sent++;
+  }
+}
+
+// A subscriber that has nothing waiting can only be readable because it
+// has gone away (or sent something, which is ignored).
+int gone_away(int sock)
+{
+  char buffer[256];
+  ssize_t r = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+  return !r || (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+void print_counters(pcap_t *descr, int live)
+{
+  fprintf(stderr, "Captured %llu packets, %llu video packets. Forwarded %llu, dropped %llu.", captured, video_packets,
+      forwarded, dropped);
+  struct pcap_stat stats;
+  if (live && !pcap_stats(descr, &stats))
+    fprintf(stderr, " Kernel dropped %u.", stats.ps_drop);
+  fprintf(stderr, "\n");
+  for (int i = 0; i < subscriber_count; i++)
+    fprintf(stderr, "  Subscriber %d: forwarded %llu, dropped %llu, %d queued.\n", subscribers[i].sock,
+        subscribers[i].forwarded, subscribers[i].dropped, subscribers[i].count);
+  fprintf(stderr, "Assembled %u frames. Sent %llu, skipped %llu.\n", frame_sequence, frames_sent, frames_skipped);
+  for (int i = 0; i < frame_subscriber_count; i++)
+    fprintf(stderr, "  Frame subscriber %d: sent %llu, skipped %llu.\n", frame_subscribers[i].sock,
+        frame_subscribers[i].frames, frame_subscribers[i].skipped);
+}
+
+void signal_handler(int sig)
+{
+  if (sig == SIGUSR1)
+    show_counters = 1;
+  else
+    quit = 1;
+}
+
+int usage(void)
+{
+  fprintf(stderr, "usage: videoproxy [-p port] [-f frame port] [-q queue length] [-d oldest|newest|subscriber] "
+                  "[-w subscribers] <network interface>\n"
+                  "       videoproxy [options] -r <pcap file>\n");
+  fprintf(stderr, "Video packets are forwarded to everyone connected to the port (default 6565).\n");
+  fprintf(stderr, "Decoded frames, each with a sequence number, are sent to everyone connected to the frame port\n"
+                  "   (default 6566). Those too slow to take every frame have frames skipped.\n");
+  fprintf(stderr, "-q sets how many packets can be waiting for each subscriber, and -d what is dropped when that\n"
+                  "   is exceeded: the oldest (default) or newest packet, or the subscriber.\n");
+  fprintf(stderr, "-w waits until that many subscribers (of either port) have connected before capturing.\n");
+  fprintf(stderr, "-r replays a capture file, as fast as the slowest subscriber takes it (with no frames\n"
+                  "   skipped), then exits.\n");
+  fprintf(stderr, "Counters are shown on exit, or on SIGUSR1.\n");
+  exit(-3);
+}
+
 int main(int argc, char **argv)
 {
-  char *dev;
+  char *dev = NULL;
+  char *replay_file = NULL;
   char errbuf[PCAP_ERRBUF_SIZE];
   pcap_t *descr;
-  //    struct bpf_program fp;        /* to hold compiled program */
-  bpf_u_int32 pMask; /* subnet mask */
-  bpf_u_int32 pNet;  /* ip address*/
-  pcap_if_t *alldevs;
+  int port = 6565;
+  int frame_port = 6566;
+  int wait_for = 0;
 
-  // Prepare a list of all the devices
-  if (pcap_findalldevs(&alldevs, errbuf) == -1) {
-    fprintf(stderr, "Error in pcap_findalldevs: %s\n", errbuf);
-    exit(1);
+  int opt;
+  while ((opt = getopt(argc, argv, "d:f:p:q:r:w:")) != -1) {
+    switch (opt) {
+    case 'd':
+      if (!strcasecmp(optarg, "oldest"))
+        drop_policy = DROP_OLDEST;
+      else if (!strcasecmp(optarg, "newest"))
+        drop_policy = DROP_NEWEST;
+      else if (!strcasecmp(optarg, "subscriber"))
+        drop_policy = DROP_SUBSCRIBER;
+      else
+        usage();
+      break;
+    case 'f':
+      frame_port = atoi(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'q':
+      queue_length = atoi(optarg);
+      if (queue_length < 2) {
+        fprintf(stderr, "ERROR: Queue length must be at least 2.\n");
+        exit(-1);
+      }
+      break;
+    case 'r':
+      replay_file = optarg;
+      break;
+    case 'w':
+      wait_for = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
   }
 
-  if (argv[1])
-    dev = argv[1];
+  if (replay_file) {
+    if (optind != argc)
+      usage();
+    descr = pcap_open_offline(replay_file, errbuf);
+    if (descr == NULL) {
+      fprintf(stderr, "ERROR: pcap_open_offline() failed due to [%s]\n", errbuf);
+      return -1;
+    }
+  }
   else {
-    fprintf(stderr, "You must specify the interface to listen on.\n");
-    exit(-1);
+    if (optind + 1 != argc) {
+      fprintf(stderr, "You must specify the interface to listen on.\n");
+      usage();
+    }
+    dev = argv[optind];
+
+    // Open device for sniffing with big snaplen and promiscuous mode
+    // enabled. Packets are delivered as soon as they arrive, and read in
+    // batches of as many as have arrived.
+    descr = pcap_create(dev, errbuf);
+    if (descr == NULL) {
+      fprintf(stderr, "ERROR: pcap_create() failed due to [%s]\n", errbuf);
+      return -1;
+    }
+    pcap_set_snaplen(descr, 3000);
+    pcap_set_promisc(descr, 1);
+    pcap_set_timeout(descr, 10);
+    pcap_set_immediate_mode(descr, 1);
+    pcap_set_buffer_size(descr, 8 * 1024 * 1024);
+    if (pcap_activate(descr) < 0) {
+      fprintf(stderr, "ERROR: pcap_activate() failed due to [%s]\n", pcap_geterr(descr));
+      return -1;
+    }
+    if (pcap_setnonblock(descr, 1, errbuf) == -1) {
+      fprintf(stderr, "ERROR: pcap_setnonblock() failed due to [%s]\n", errbuf);
+      return -1;
+    }
   }
+  int capture_fd = replay_file ? -1 : pcap_get_selectable_fd(descr);
+  capture = descr;
+  replaying = replay_file != NULL;
 
-  // If something was not provided
-  // return error.
-  if (dev == NULL) {
-    printf("\n[%s]\n", errbuf);
+  int listen_sock = create_listen_socket(port);
+  if (listen_sock == -1) {
+    fprintf(stderr, "ERROR: Could not listen on port %d\n", port);
     return -1;
   }
-
-  // fetch the network address and network mask
-  pcap_lookupnet(dev, &pNet, &pMask, errbuf);
-
-  // Now, open device for sniffing with big snaplen and
-  // promiscuous mode enabled.
-  descr = pcap_open_live(dev, 3000, 1, 10, errbuf);
-  if (descr == NULL) {
-    printf("pcap_open_live() failed due to [%s]\n", errbuf);
+  int frame_listen_sock = create_listen_socket(frame_port);
+  if (frame_listen_sock == -1) {
+    fprintf(stderr, "ERROR: Could not listen on port %d\n", frame_port);
     return -1;
   }
 
+  unsigned char *decoded = calloc(FRAME_WIDTH * FRAME_HEIGHT * 4, 1);
+  if (!decoded) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    exit(-1);
+  }
+  video_decoder_init(&decoder, decoded, FRAME_WIDTH, FRAME_HEIGHT);
+  decoder.new_frame = publish_frame;
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGUSR1, signal_handler);
+  signal(SIGINT, signal_handler);
+  signal(SIGTERM, signal_handler);
+
   printf("Started.\n");
   fflush(stdout);
 
-  int listen_sock = create_listen_socket(6565);
+  int replay_done = 0;
+  while (!quit) {
+    struct pollfd fds[3 + 2 * MAX_SUBSCRIBERS];
+    int nfds = 0;
+    memset(fds, 0, sizeof(fds));
+    fds[nfds].fd = listen_sock;
+    fds[nfds++].events = POLLIN;
+    fds[nfds].fd = frame_listen_sock;
+    fds[nfds++].events = POLLIN;
+    int capturing = subscriber_count + frame_subscriber_count >= wait_for && !replay_done;
+    if (capturing && capture_fd != -1) {
+      fds[nfds].fd = capture_fd;
+      fds[nfds++].events = POLLIN;
+    }
+    int first_subscriber = nfds;
+    for (int i = 0; i < subscriber_count; i++) {
+      fds[nfds].fd = subscribers[i].sock;
+      fds[nfds++].events = subscribers[i].count ? POLLOUT : POLLIN;
+    }
+    int first_frame_subscriber = nfds;
+    for (int i = 0; i < frame_subscriber_count; i++) {
+      fds[nfds].fd = frame_subscribers[i].sock;
+      fds[nfds++].events = frame_subscribers[i].sending ? POLLOUT : POLLIN;
+    }
 
-  while (1) {
-    if (client_sock == -1) {
-      client_sock = accept_incoming(listen_sock);
+    // Replaying, there is always more to read, unless the subscribers are
+    // all still busy with what was read before.
+    int room = queue_length;
+    for (int i = 0; i < subscriber_count; i++)
+      if (queue_length - subscribers[i].count < room)
+        room = queue_length - subscribers[i].count;
+    for (int i = 0; i < frame_subscriber_count; i++)
+      if (frame_subscribers[i].next)
+        room = 0;
+    int timeout = 100;
+    if (capturing && replay_file && room)
+      timeout = 0;
+    else if (capturing && capture_fd == -1)
+      timeout = 10;
+
+    if (poll(fds, nfds, timeout) == -1 && errno != EINTR) {
+      perror("poll");
+      break;
     }
 
-    struct pcap_pkthdr hdr;
-    hdr.caplen = 0;
-    const unsigned char *packet = pcap_next(descr, &hdr);
-    if (packet) {
-      if (hdr.caplen == 2132) {
-        // probably a C65GS compressed video frame.
-        if (client_sock != -1)
-          write(client_sock, packet, 2132);
+    // (Backwards, as dropping a subscriber moves the last one into its place)
+    for (int i = frame_subscriber_count - 1; i >= 0; i--)
+      if (!frame_subscribers[i].sending && (fds[first_frame_subscriber + i].revents & (POLLIN | POLLHUP | POLLERR))
+          && gone_away(frame_subscribers[i].sock))
+        drop_frame_subscriber(i, "disconnected");
+    for (int i = subscriber_count - 1; i >= 0; i--)
+      if (!subscribers[i].count && (fds[first_subscriber + i].revents & (POLLIN | POLLHUP | POLLERR))
+          && gone_away(subscribers[i].sock))
+        drop_subscriber(i, "disconnected");
+
+    if (fds[0].revents & POLLIN) {
+      int sock;
+      while ((sock = accept_incoming(listen_sock)) != -1)
+        add_subscriber(sock);
+    }
+    if (fds[1].revents & POLLIN) {
+      int sock;
+      while ((sock = accept_incoming(frame_listen_sock)) != -1)
+        add_frame_subscriber(sock);
+    }
+
+    if (capturing) {
+      if (replay_file) {
+        if (room) {
+          int r = pcap_dispatch(descr, room, handle_packet, NULL);
+          if (r == -1)
+            fprintf(stderr, "ERROR: pcap_dispatch() failed due to [%s]\n", pcap_geterr(descr));
+          // (-2 is from pcap_breakloop() at the end of a frame)
+          if (r == 0 || r == -1)
+            replay_done = 1;
+        }
+      }
+      else if (pcap_dispatch(descr, -1, handle_packet, NULL) == -1) {
+        fprintf(stderr, "ERROR: pcap_dispatch() failed due to [%s]\n", pcap_geterr(descr));
+        break;
       }
     }
+
+    for (int i = subscriber_count - 1; i >= 0; i--)
+      send_queued(i);
+    for (int i = frame_subscriber_count - 1; i >= 0; i--)
+      send_frames(i);
+
+    if (show_counters) {
+      show_counters = 0;
+      print_counters(descr, !replay_file);
+    }
+
+    if (replay_done) {
+      int waiting = 0;
+      for (int i = 0; i < subscriber_count; i++)
+        waiting += subscribers[i].count;
+      for (int i = 0; i < frame_subscriber_count; i++)
+        if (frame_subscribers[i].sending)
+          waiting++;
+      if (!waiting)
+        break;
+    }
   }
+
+  print_counters(descr, !replay_file);
+  while (subscriber_count)
+    drop_subscriber(0, "exiting");
+  while (frame_subscriber_count)
+    drop_frame_subscriber(0, "exiting");
+  pcap_close(descr);
   printf("Exiting.\n");
 
   return 0;
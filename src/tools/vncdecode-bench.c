@@ -0,0 +1,460 @@
+/*
+  Benchmark and check of the vncserver video decoder (vncdecode.c).
+
+  Decodes a capture of video packets with vncdecode.c, and with the
+  original bit string decoder that it replaced, checks that both give the
+  same pixels after every packet, and reports the frames per second of each.
+
+  A capture is the packets as videoproxy sends them, 2132 bytes each, e.g.
+    nc localhost 6565 > capture.bin
+  Without one, a synthetic stream of frames is used.
+
+  (C) Paul Gardner-Stephen 2014, 2018.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "vncdecode.h"
+
+#define PACKET_SIZE 2132
+
+static int maxx = 800, maxy = 600;
+
+long long gettime_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/* ----------------------------------------------------------------------------------------------------------
+   The original decoder of vncserver.c, as the reference
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+int colour0, colour1, colour2, colour3, colour4;
+int ref_x = 0, ref_y = -1;
+int ref_frames = 0;
+
+int setPixel(unsigned char *frameBuffer, int x, int y, uint32_t v)
+{
+  if (y >= 0 && y < maxy && x >= 0 && x < maxx) {
+    frameBuffer[(y * maxx * 4) + x * 4 + 3] = 0;
+    frameBuffer[(y * maxx * 4) + x * 4 + 2] = v & 0xff;
+    frameBuffer[(y * maxx * 4) + x * 4 + 1] = (v >> 8) & 0xff;
+    frameBuffer[(y * maxx * 4) + x * 4 + 0] = (v >> 16) & 0xff;
+  }
+  return 0;
+}
+
+int setRaster(unsigned char *frameBuffer, int y, uint32_t v)
+{
+  if (y >= 0 && y < maxy) {
+    unsigned char *raster = &frameBuffer[y * maxx * 4];
+    raster[3] = 0;
+    raster[2] = v & 0xff;
+    raster[1] = (v >> 8) & 0xff;
+    raster[0] = (v >> 16) & 0xff;
+    // (the frame buffer has room for this to run off the end)
+    bcopy(&raster[0], &raster[4], maxx * 4 - 1);
+  }
+  return 0;
+}
+
+void reference_decode_packet(unsigned char *frameBuffer, unsigned char *packet, int len)
+{
+  char bit_sequence[21];
+  int x = ref_x, y;
+
+  // Put end of string marker in place
+  bit_sequence[20] = 0;
+  // Erase any banked up bits before starting decode of next packet
+  memset(bit_sequence, '.', 20);
+
+  int offset = 0x56;
+  int bn = 0;
+  int lasty = -1;
+  y = -1;
+
+  for (; offset < len; offset++) {
+    for (bn = 7; bn >= 0; bn--) {
+      int bit = (packet[offset] >> bn) & 1;
+      // Shuffle bits down
+      bcopy(&bit_sequence[1], &bit_sequence[0], 19);
+      bit_sequence[19] = '0' + bit;
+
+      if (!strncmp("11110", bit_sequence, 5)) {
+        // Explcit colour (12 bits)
+        int s = bit_sequence[17];
+        bit_sequence[17] = 0;
+        int c = strtol(&bit_sequence[5], NULL, 2);
+        colour4 = colour3;
+        colour3 = colour2;
+        colour2 = colour1;
+        colour1 = colour0;
+        colour0 = ((c & 0xf) << 4) | ((c & 0xf0) << 8) | ((c & 0xf00) << 12);
+        bit_sequence[17] = s;
+        memset(bit_sequence, '.', 17);
+        setPixel(frameBuffer, x++, y, colour0);
+      }
+      else if (!strncmp("111110", bit_sequence, 6)) {
+        // Indicate raster (10 bits)
+        int s = bit_sequence[16];
+        bit_sequence[16] = 0;
+        setRaster(frameBuffer, y, colour0);
+        y = strtol(&bit_sequence[6], NULL, 2);
+        if (lasty == -1) {
+          lasty = y;
+          y = -1;
+        }
+        else {
+          if ((y != (1 + lasty)) && (y != lasty)) {
+            lasty = y;
+            y = -1;
+          }
+          else
+            lasty = y;
+        }
+        bit_sequence[16] = s;
+        x = 0;
+        colour0 = 0x000000;
+        colour1 = 0xf0f0f0;
+        colour2 = 0x303030;
+        colour3 = 0x707070;
+        colour4 = 0xb0b0b0;
+        memset(bit_sequence, '.', 16);
+      }
+      else if (!strncmp("11111110", bit_sequence, 8)) {
+        // RLE run of 0 - 255 pixels
+        int s = bit_sequence[16];
+        bit_sequence[16] = 0;
+        int r = strtol(&bit_sequence[8], NULL, 2);
+        bit_sequence[16] = s;
+        if (x != -1)
+          for (; r && (x < 800); r--) {
+            setPixel(frameBuffer, x++, y, colour0);
+          }
+        memset(bit_sequence, '.', 16);
+      }
+      else if (!strncmp("11111100", bit_sequence, 8)) {
+        // New frame
+        if (y != -1)
+          setRaster(frameBuffer, y, colour0);
+        y = -1;
+        x = -1;
+        memset(bit_sequence, '.', 8);
+        colour0 = 0x000000;
+        colour1 = 0xf0f0f0;
+        colour2 = 0x303030;
+        colour3 = 0x707070;
+        colour4 = 0xb0b0b0;
+        ref_frames++;
+      }
+      else if (!strncmp("11111101", bit_sequence, 8)) {
+        // Reserved -- this is an error for now
+        memset(bit_sequence, '.', 8);
+      }
+      else if (!strncmp("1100", bit_sequence, 4)) {
+        // Colour 2
+        int t = colour2;
+        colour2 = colour1;
+        colour1 = colour0;
+        colour0 = t;
+        if (x != -1)
+          setPixel(frameBuffer, x++, y, colour0);
+        memset(bit_sequence, '.', 4);
+      }
+      else if (!strncmp("1101", bit_sequence, 4)) {
+        // Colour 3
+        int t = colour3;
+        colour3 = colour2;
+        colour2 = colour1;
+        colour1 = colour0;
+        colour0 = t;
+        if (x != -1)
+          setPixel(frameBuffer, x++, y, colour0);
+        memset(bit_sequence, '.', 4);
+      }
+      else if (!strncmp("1110", bit_sequence, 4)) {
+        // Colour 4
+        int t = colour4;
+        colour4 = colour3;
+        colour3 = colour2;
+        colour2 = colour1;
+        colour1 = colour0;
+        colour0 = t;
+        if (x != -1)
+          setPixel(frameBuffer, x++, y, colour0);
+        memset(bit_sequence, '.', 4);
+      }
+      else if (!strncmp("10", bit_sequence, 2)) {
+        // Colour 1
+        int t = colour1;
+        colour1 = colour0;
+        colour0 = t;
+        if (x != -1)
+          setPixel(frameBuffer, x++, y, colour0);
+        memset(bit_sequence, '.', 2);
+      }
+      else if (!strncmp("0", bit_sequence, 1)) {
+        // Repeat last colour
+        if (x != -1)
+          setPixel(frameBuffer, x++, y, colour0);
+        memset(bit_sequence, '.', 1);
+      }
+    }
+  }
+  ref_x = x;
+  ref_y = y;
+}
+
+/* ----------------------------------------------------------------------------------------------------------
+   Synthetic video stream
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+unsigned char *stream = NULL;
+int stream_len = 0;
+int stream_bits = 0;
+unsigned char packet[PACKET_SIZE];
+int packet_bits = 0;
+
+void flush_packet(void)
+{
+  stream = realloc(stream, stream_len + PACKET_SIZE);
+  if (!stream) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    exit(-1);
+  }
+  memcpy(&stream[stream_len], packet, PACKET_SIZE);
+  stream_len += PACKET_SIZE;
+  memset(packet, 0, PACKET_SIZE);
+  packet_bits = 0;
+}
+
+void put_bits(unsigned int v, int n)
+{
+  for (int i = n - 1; i >= 0; i--) {
+    int bit_offset = VIDEO_PACKET_HEADER * 8 + packet_bits++;
+    if ((v >> i) & 1)
+      packet[bit_offset >> 3] |= 0x80 >> (bit_offset & 7);
+  }
+}
+
+// Tokens never straddle packets, and the last 19 bits of each packet are
+// padding, as they are never decoded
+void put_token(unsigned int v, int n)
+{
+  if (VIDEO_PACKET_HEADER * 8 + packet_bits + n > PACKET_SIZE * 8 - 19) {
+    // Pad with 1 bits, which are skipped over
+    while (VIDEO_PACKET_HEADER * 8 + packet_bits < PACKET_SIZE * 8)
+      put_bits(1, 1);
+    flush_packet();
+  }
+  put_bits(v, n);
+}
+
+// A text screen: border, and lines of 8x8 characters. The text scrolls,
+// or with still set, stays put but for a blinking cursor.
+int still = 0;
+
+void synthesise_frame(int frame)
+{
+  put_token(0xfc, 8);
+  for (int y = 0; y < maxy; y++) {
+    put_token((0x3e << 10) | y, 16);
+    int in_text = y >= 100 && y < 500;
+    int x = 0;
+    // Border
+    put_token((0x1e << 12) | 0x6e6, 17);
+    x++;
+    if (!in_text) {
+      for (; x + 255 <= maxx; x += 255)
+        put_token(0xfeff, 16);
+      put_token(0xfe00 | (maxx - x), 16);
+      continue;
+    }
+    put_token(0xfe00 | 79, 16);
+    x += 79;
+    put_token((0x1e << 12) | 0x22b, 17);
+    x++;
+    // Text: a pseudo random bit pattern for each character
+    for (int c = 0; c < 80; c++) {
+      unsigned int pattern = ((c + (y >> 3) * 7 + (still ? 0 : frame)) * 2654435761u) >> ((y & 7) * 3);
+      if (still && c == 10 && (y >> 3) == 30 && (frame & 1))
+        pattern = ~0;
+      for (int b = 0; b < 8; b++, x++) {
+        if ((pattern >> b) & 1)
+          put_token(0x2, 2); // swap to the previous colour
+        else
+          put_token(0, 1);
+      }
+    }
+    put_token(0xfe00 | (maxx - x), 16);
+  }
+}
+
+/* ----------------------------------------------------------------------------------------------------------
+   Benchmark
+   ----------------------------------------------------------------------------------------------------------
+*/
+
+int frames = 0;
+// What the changes reported at each frame give, when checking them
+unsigned char *shown = NULL;
+long long changed_pixels = 0;
+
+void copy_rect(video_decoder *d, int x1, int y1, int x2, int y2)
+{
+  changed_pixels += (x2 - x1) * (y2 - y1);
+  if (shown)
+    for (int y = y1; y < y2; y++)
+      memcpy(&shown[(y * d->width + x1) * 4], &d->frame_buffer[(y * d->width + x1) * 4], (x2 - x1) * 4);
+}
+
+void count_frame(video_decoder *d)
+{
+  frames++;
+  video_decoder_changes(d, copy_rect);
+  if (shown && memcmp(shown, d->frame_buffer, d->width * d->height * 4)) {
+    fprintf(stderr, "ERROR: Changes to frame %d were not all reported\n", frames);
+    exit(1);
+  }
+}
+
+void usage(void)
+{
+  fprintf(stderr, "usage: vncdecode-bench [-n <repeats>] [-s <synthetic frames>] [-c] [<capture file>]\n");
+  fprintf(stderr, "  -c - synthetic screen is still, but for a blinking cursor\n");
+  exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+  int repeats = 10;
+  int synthetic_frames = 50;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:c")) != -1) {
+    switch (opt) {
+    case 'n':
+      repeats = atoi(optarg);
+      break;
+    case 's':
+      synthetic_frames = atoi(optarg);
+      break;
+    case 'c':
+      still = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind > 1 || repeats < 1)
+    usage();
+
+  if (optind < argc) {
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+      perror("fopen");
+      exit(-1);
+    }
+    unsigned char buffer[PACKET_SIZE];
+    int len;
+    while ((len = fread(buffer, 1, PACKET_SIZE, f)) == PACKET_SIZE) {
+      stream = realloc(stream, stream_len + PACKET_SIZE);
+      if (!stream) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        exit(-1);
+      }
+      memcpy(&stream[stream_len], buffer, PACKET_SIZE);
+      stream_len += PACKET_SIZE;
+    }
+    fclose(f);
+    printf("Read %d packets from %s\n", stream_len / PACKET_SIZE, argv[optind]);
+  }
+  else {
+    for (int i = 0; i < synthetic_frames; i++)
+      synthesise_frame(i);
+    put_token(0xfc, 8);
+    flush_packet();
+    printf("Synthesised %d frames in %d packets\n", synthetic_frames, stream_len / PACKET_SIZE);
+  }
+  int packets = stream_len / PACKET_SIZE;
+  if (!packets) {
+    fprintf(stderr, "ERROR: No packets to decode\n");
+    exit(-1);
+  }
+
+  // Room for the reference decoder to run off the end of the last raster
+  unsigned char *ref_fb = calloc(maxx * maxy * 4 + 4, 1);
+  unsigned char *fb = calloc(maxx * maxy * 4, 1);
+  shown = calloc(maxx * maxy * 4, 1);
+  video_decoder decoder;
+  video_decoder_init(&decoder, fb, maxx, maxy);
+  decoder.new_frame = count_frame;
+  if (video_decoder_track_changes(&decoder)) {
+    fprintf(stderr, "ERROR: Out of memory\n");
+    exit(-1);
+  }
+
+  // Check that both decoders draw the same pixels
+  for (int p = 0; p < packets; p++) {
+    reference_decode_packet(ref_fb, &stream[p * PACKET_SIZE], PACKET_SIZE);
+    video_decode_packet(&decoder, &stream[p * PACKET_SIZE], PACKET_SIZE);
+    if (memcmp(ref_fb, fb, maxx * maxy * 4) || ref_x != decoder.x || ref_y != decoder.y) {
+      for (int i = 0; i < maxx * maxy * 4; i++)
+        if (ref_fb[i] != fb[i]) {
+          fprintf(stderr, "ERROR: Decoders differ after packet %d, first at (%d,%d)\n", p, (i / 4) % maxx, i / 4 / maxx);
+          exit(1);
+        }
+      fprintf(stderr, "ERROR: Decoders differ after packet %d, at x=%d,y=%d instead of x=%d,y=%d\n", p, decoder.x,
+          decoder.y, ref_x, ref_y);
+      exit(1);
+    }
+  }
+  printf("Decoders agree on %d packets, %d frames\n", packets, frames);
+  if (frames)
+    printf("Changes reported cover %.1f%% of the screen per frame\n", changed_pixels * 100.0 / frames / (maxx * maxy));
+  free(shown);
+  shown = NULL;
+
+  long long start = gettime_us();
+  ref_frames = 0;
+  for (int r = 0; r < repeats; r++)
+    for (int p = 0; p < packets; p++)
+      reference_decode_packet(ref_fb, &stream[p * PACKET_SIZE], PACKET_SIZE);
+  long long ref_us = gettime_us() - start;
+
+  start = gettime_us();
+  frames = 0;
+  for (int r = 0; r < repeats; r++)
+    for (int p = 0; p < packets; p++)
+      video_decode_packet(&decoder, &stream[p * PACKET_SIZE], PACKET_SIZE);
+  long long us = gettime_us() - start;
+
+  printf("Bit string decoder: %8.1f frames/sec, %8.1f packets/sec\n", ref_frames * 1e6 / ref_us,
+      packets * repeats * 1e6 / ref_us);
+  printf("Table decoder:      %8.1f frames/sec, %8.1f packets/sec\n", frames * 1e6 / us, packets * repeats * 1e6 / us);
+  return 0;
+}
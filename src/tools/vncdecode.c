@@ -0,0 +1,437 @@
+/*
+  Decoder for the compressed video stream of the MEGA65, see vncdecode.h.
+
+  (C) Paul Gardner-Stephen 2014, 2018.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vncdecode.h"
+
+// Longest token, in bits. A token is only decoded once this many bits
+// from its start have arrived, which is why the end of a packet is lost.
+#define LOOKAHEAD_BITS 20
+
+enum {
+  TOKEN_NONE,
+  TOKEN_SAME,
+  TOKEN_PREVIOUS,
+  TOKEN_COLOUR2,
+  TOKEN_COLOUR3,
+  TOKEN_COLOUR4,
+  TOKEN_EXPLICIT,
+  TOKEN_RASTER,
+  TOKEN_FRAME,
+  TOKEN_RESERVED,
+  TOKEN_RUN
+};
+
+// Token and its length in bits, by the first 8 bits of the stream.
+// 11111111 is no token, and just the first bit is skipped.
+static unsigned char token_type[256];
+static unsigned char token_len[256];
+
+// The same and previous colour pixel tokens, which are most of a picture,
+// at the start of the first 8 bits of the stream: how many, how many bits
+// they take, and which of them are previous colour (bit 0 first).
+static unsigned char pixel_tokens[256];
+static unsigned char pixel_bits[256];
+static unsigned char pixel_swaps[256];
+
+static void build_token_table(void)
+{
+  for (int b = 0; b < 256; b++) {
+    int type, len;
+    if (!(b & 0x80)) {
+      type = TOKEN_SAME;
+      len = 1;
+    }
+    else if ((b & 0xc0) == 0x80) {
+      type = TOKEN_PREVIOUS;
+      len = 2;
+    }
+    else if ((b & 0xf0) == 0xc0) {
+      type = TOKEN_COLOUR2;
+      len = 4;
+    }
+    else if ((b & 0xf0) == 0xd0) {
+      type = TOKEN_COLOUR3;
+      len = 4;
+    }
+    else if ((b & 0xf0) == 0xe0) {
+      type = TOKEN_COLOUR4;
+      len = 4;
+    }
+    else if ((b & 0xf8) == 0xf0) {
+      type = TOKEN_EXPLICIT;
+      len = 17;
+    }
+    else if ((b & 0xfc) == 0xf8) {
+      type = TOKEN_RASTER;
+      len = 16;
+    }
+    else if (b == 0xfc) {
+      type = TOKEN_FRAME;
+      len = 8;
+    }
+    else if (b == 0xfd) {
+      type = TOKEN_RESERVED;
+      len = 8;
+    }
+    else if (b == 0xfe) {
+      type = TOKEN_RUN;
+      len = 16;
+    }
+    else {
+      type = TOKEN_NONE;
+      len = 1;
+    }
+    token_type[b] = type;
+    token_len[b] = len;
+
+    int n = 0, bit = 7;
+    pixel_swaps[b] = 0;
+    while (bit >= 0) {
+      if (!(b & (1 << bit)))
+        bit--;
+      else if (bit >= 1 && !(b & (1 << (bit - 1)))) {
+        pixel_swaps[b] |= 1 << n;
+        bit -= 2;
+      }
+      else
+        break;
+      n++;
+    }
+    pixel_tokens[b] = n;
+    pixel_bits[b] = 7 - bit;
+  }
+}
+
+void video_decoder_init(video_decoder *d, unsigned char *frame_buffer, int width, int height)
+{
+  if (!token_len[0])
+    build_token_table();
+  memset(d, 0, sizeof(video_decoder));
+  d->frame_buffer = frame_buffer;
+  d->width = width;
+  d->height = height;
+  d->x = 0;
+  d->y = -1;
+}
+
+// Start tracking changes to the picture, from how it is now
+int video_decoder_track_changes(video_decoder *d)
+{
+  d->previous = malloc(d->width * d->height * 4);
+  d->changed = calloc(d->height, sizeof(struct video_span));
+  if (!d->previous || !d->changed) {
+    video_decoder_free(d);
+    return -1;
+  }
+  memcpy(d->previous, d->frame_buffer, d->width * d->height * 4);
+  return 0;
+}
+
+void video_decoder_free(video_decoder *d)
+{
+  free(d->previous);
+  free(d->changed);
+  d->previous = NULL;
+  d->changed = NULL;
+}
+
+// Compare the first n pixels of a raster line with how they were, and
+// note those that changed
+static void note_changes(video_decoder *d, int y, int n)
+{
+  if (!d->previous || y < 0 || y >= d->height)
+    return;
+  int offset = y * d->width * 4;
+  const uint32_t *now = (const uint32_t *)&d->frame_buffer[offset];
+  uint32_t *was = (uint32_t *)&d->previous[offset];
+  if (!memcmp(now, was, n * 4))
+    return;
+
+  int x1 = 0, x2 = n;
+  while (now[x1] == was[x1])
+    x1++;
+  while (now[x2 - 1] == was[x2 - 1])
+    x2--;
+  memcpy(&was[x1], &now[x1], (x2 - x1) * 4);
+
+  struct video_span *span = &d->changed[y];
+  if (span->x1 == span->x2) {
+    span->x1 = x1;
+    span->x2 = x2;
+  }
+  else {
+    if (x1 < span->x1)
+      span->x1 = x1;
+    if (x2 > span->x2)
+      span->x2 = x2;
+  }
+}
+
+// Note the changes when the whole picture has been replaced, rather than
+// decoded from packets
+void video_decoder_frame_replaced(video_decoder *d)
+{
+  for (int y = 0; y < d->height; y++)
+    note_changes(d, y, d->width);
+}
+
+// Report what has changed since last time, as rectangles x1 <= x < x2,
+// y1 <= y < y2. Successive changed raster lines are joined together.
+void video_decoder_changes(video_decoder *d, void (*rect)(video_decoder *d, int x1, int y1, int x2, int y2))
+{
+  if (!d->changed)
+    return;
+  for (int y = 0; y < d->height; y++) {
+    if (d->changed[y].x1 == d->changed[y].x2)
+      continue;
+    int y1 = y, x1 = d->width, x2 = 0;
+    for (; y < d->height && d->changed[y].x1 != d->changed[y].x2; y++) {
+      if (d->changed[y].x1 < x1)
+        x1 = d->changed[y].x1;
+      if (d->changed[y].x2 > x2)
+        x2 = d->changed[y].x2;
+      d->changed[y].x1 = d->changed[y].x2 = 0;
+    }
+    rect(d, x1, y1, x2, y);
+  }
+}
+
+// A colour as it is stored in the frame buffer
+static inline uint32_t pixel_word(uint32_t v)
+{
+  unsigned char pixel[4] = { (v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff, 0 };
+  uint32_t word;
+  memcpy(&word, pixel, 4);
+  return word;
+}
+
+// End of a raster line: the line moves along by one pixel, with the
+// colour in the first pixel. The move carries all but the last byte of
+// the line, so it also reaches into the start of the next line (but not
+// past the end of the frame buffer). The line is then complete, so
+// this is where changes to it are noted.
+static void set_raster(video_decoder *d, int y, uint32_t v)
+{
+  if (y >= 0 && y < d->height) {
+    unsigned char *raster = &d->frame_buffer[y * d->width * 4];
+    int len = d->width * 4 - 1;
+    if (y == d->height - 1)
+      len -= 3;
+    raster[3] = 0;
+    raster[2] = v & 0xff;
+    raster[1] = (v >> 8) & 0xff;
+    raster[0] = (v >> 16) & 0xff;
+    memmove(&raster[4], &raster[0], len);
+    note_changes(d, y, d->width);
+    note_changes(d, y + 1, 1);
+  }
+}
+
+static void reset_colours(uint32_t *colour)
+{
+  colour[0] = 0x000000;
+  colour[1] = 0xf0f0f0;
+  colour[2] = 0x303030;
+  colour[3] = 0x707070;
+  colour[4] = 0xb0b0b0;
+}
+
+void video_decode_packet(video_decoder *d, const unsigned char *packet, int len)
+{
+  if (len <= VIDEO_PACKET_HEADER)
+    return;
+
+  const unsigned char *next = &packet[VIDEO_PACKET_HEADER];
+  const unsigned char *end = &packet[len];
+  // Bits not yet decoded, most significant first
+  uint64_t bits = 0;
+  int avail = 0;
+
+  // The state is kept in locals while decoding, as the compiler cannot
+  // otherwise tell that writing pixels leaves it unchanged
+  int x = d->x, y, lasty;
+  const int width = d->width, debug = d->debug;
+  uint32_t colour[5];
+  memcpy(colour, d->colour, sizeof(colour));
+  // The line being drawn, or NULL when it is outside the frame buffer
+  uint32_t *row = NULL;
+
+  // Start outside frame so that we can synchronise without visible artefacts
+  lasty = -1;
+  y = -1;
+
+  while (1) {
+    while (avail <= 56 && next < end) {
+      bits |= (uint64_t)*next++ << (56 - avail);
+      avail += 8;
+    }
+    if (avail < LOOKAHEAD_BITS)
+      break;
+
+    unsigned int top = bits >> 56;
+
+    if (pixel_tokens[top] && avail >= LOOKAHEAD_BITS + 7 && row && x >= 0 && x + 8 <= width && !(debug & 4)) {
+      // Several pixel tokens at once, swapping colours without branching
+      int swaps = pixel_swaps[top];
+      for (int i = pixel_tokens[top]; i; i--, swaps >>= 1) {
+        uint32_t t = (colour[0] ^ colour[1]) & -(uint32_t)(swaps & 1);
+        colour[0] ^= t;
+        colour[1] ^= t;
+        row[x++] = pixel_word(colour[0]);
+      }
+      bits <<= pixel_bits[top];
+      avail -= pixel_bits[top];
+      continue;
+    }
+
+    unsigned int field = bits >> (64 - LOOKAHEAD_BITS);
+    int type = token_type[top];
+    bits <<= token_len[top];
+    avail -= token_len[top];
+
+    switch (type) {
+    case TOKEN_SAME:
+      if (debug & 4)
+        printf("Same colour at %d,%d\n", x, y);
+      if (x != -1) {
+        if (row && x < width)
+          row[x] = pixel_word(colour[0]);
+        x++;
+      }
+      break;
+    case TOKEN_PREVIOUS:
+    case TOKEN_COLOUR2:
+    case TOKEN_COLOUR3:
+    case TOKEN_COLOUR4: {
+      // Make colour n the current colour, moving the more recent ones down
+      int n = type == TOKEN_PREVIOUS ? 1 : type - TOKEN_COLOUR2 + 2;
+      uint32_t t = colour[n];
+      for (; n; n--)
+        colour[n] = colour[n - 1];
+      colour[0] = t;
+      if (debug & 4) {
+        if (type == TOKEN_PREVIOUS)
+          printf("Previous colour @ %d,%d\n", x, y);
+        else
+          printf("Colour %d @ %d,%d (colour=#%06x)\n", type - TOKEN_COLOUR2 + 2, x, y, colour[0]);
+      }
+      if (x != -1) {
+        if (row && x < width)
+          row[x] = pixel_word(colour[0]);
+        x++;
+      }
+    } break;
+    case TOKEN_EXPLICIT: {
+      // Explicit colour (12 bits)
+      int c = (field >> 3) & 0xfff;
+      colour[4] = colour[3];
+      colour[3] = colour[2];
+      colour[2] = colour[1];
+      colour[1] = colour[0];
+      colour[0] = ((c & 0xf) << 4) | ((c & 0xf0) << 8) | ((c & 0xf00) << 12);
+      if (debug & 0x800)
+        printf("Saw new colour #%06x at (%d,%d)\n", colour[0], x, y);
+      if (row && x >= 0 && x < width)
+        row[x] = pixel_word(colour[0]);
+      x++;
+    } break;
+    case TOKEN_RASTER:
+      // Raster number (10 bits)
+      set_raster(d, y, colour[0]);
+      y = (field >> 4) & 0x3ff;
+      if (lasty == -1) {
+        lasty = y;
+        y = -1;
+      }
+      else {
+        if ((y != (1 + lasty)) && (y != lasty)) {
+          // Non successive raster lines, block drawing
+          if (debug & 2)
+            printf("lasty was %d, new y = %d\n", lasty, y);
+          lasty = y;
+          y = -1;
+        }
+        else
+          lasty = y;
+      }
+      if (debug & 2)
+        printf("Raster #%d (MAX X value seen was %d)\n", y, x);
+      row = y >= 0 && y < d->height ? (uint32_t *)&d->frame_buffer[y * width * 4] : NULL;
+      x = 0;
+      reset_colours(colour);
+      break;
+    case TOKEN_RUN: {
+      // RLE run of 0 - 255 pixels
+      int r = (field >> 4) & 0xff;
+      if (debug & 8)
+        printf("Run of %d at %d,%d\n", r, x, y);
+      if (x != -1) {
+        if (r > width - x)
+          r = width - x;
+        if (r > 0) {
+          if (row) {
+            uint32_t word = pixel_word(colour[0]);
+            for (int i = 0; i < r; i++)
+              row[x + i] = word;
+          }
+          x += r;
+        }
+      }
+      if (debug & 8)
+        printf("After run, x=%d\n", x);
+    } break;
+    case TOKEN_FRAME:
+      if (debug & 1)
+        printf("New frame (y got to %d)\n", y);
+      if (y != -1)
+        set_raster(d, y, colour[0]);
+      y = -1;
+      x = -1;
+      row = NULL;
+      reset_colours(colour);
+      if (d->new_frame) {
+        d->x = x;
+        d->y = y;
+        d->lasty = lasty;
+        memcpy(d->colour, colour, sizeof(colour));
+        d->new_frame(d);
+      }
+      break;
+    case TOKEN_RESERVED:
+      // Reserved -- this is an error for now
+      if (debug & 0x100)
+        printf("Reserved token.\n");
+      break;
+    }
+  }
+
+  // The line the packet ended in may not be finished in the next one
+  note_changes(d, y, d->width);
+
+  d->x = x;
+  d->y = y;
+  d->lasty = lasty;
+  memcpy(d->colour, colour, sizeof(colour));
+}
@@ -0,0 +1,77 @@
+/*
+  Decoder for the compressed video stream that the MEGA65 sends over
+  ethernet, as shown by vncserver.
+
+  Each packet is a 0x56 byte header followed by a bit stream, most
+  significant bit first, of these tokens:
+
+    0                    pixel in the current colour
+    10                   pixel in the previous colour
+    1100, 1101, 1110     pixel in the 3rd, 4th or 5th most recent colour
+    11110 + 12 bits      pixel in a new colour ($RGB)
+    111110 + 10 bits     start of raster line
+    11111100             start of frame
+    11111101             reserved
+    11111110 + 8 bits    run of 0 - 255 pixels in the current colour
+
+  A packet's last 19 bits are never decoded.
+
+  The decoder can also track which parts of the picture have changed,
+  by comparing each raster line with how it was when changes were last
+  collected, so that only those need to be sent on.
+*/
+
+#ifndef VNCDECODE_H
+#define VNCDECODE_H
+
+#include <stdint.h>
+
+#define VIDEO_PACKET_HEADER 0x56
+
+/*
+  videoproxy also publishes whole decoded frames, each as this header
+  followed by width * height 32-bit pixels. The fields are in network byte
+  order. The sequence number counts the frames the proxy has assembled,
+  so a gap shows that frames were skipped.
+*/
+#define VIDEO_FRAME_MAGIC 0x4d363546 // "M65F"
+
+typedef struct __attribute__((__packed__)) video_frame_header {
+  uint32_t magic;
+  uint32_t sequence;
+  uint16_t width, height;
+  uint32_t length;
+} video_frame_header;
+
+typedef struct video_decoder {
+  // 32-bit pixels, width * height of them
+  unsigned char *frame_buffer;
+  int width, height;
+
+  int x, y, lasty;
+  // Most recently used colours, most recent first
+  uint32_t colour[5];
+
+  int debug;
+
+  // Change tracking (see video_decoder_track_changes): the picture when
+  // changes were last collected, and per raster line the pixels x1 to x2-1
+  // that have changed since, with x1 == x2 when none have.
+  unsigned char *previous;
+  struct video_span {
+    int x1, x2;
+  } *changed;
+
+  // Called at the start of each frame, once the previous one is complete
+  void (*new_frame)(struct video_decoder *d);
+  void *context;
+} video_decoder;
+
+void video_decoder_init(video_decoder *d, unsigned char *frame_buffer, int width, int height);
+void video_decode_packet(video_decoder *d, const unsigned char *packet, int len);
+int video_decoder_track_changes(video_decoder *d);
+void video_decoder_frame_replaced(video_decoder *d);
+void video_decoder_changes(video_decoder *d, void (*rect)(video_decoder *d, int x1, int y1, int x2, int y2));
+void video_decoder_free(video_decoder *d);
+
+#endif
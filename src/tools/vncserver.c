@@ -23,8 +23,6 @@ int sendScanCode(int scan_code);
 int raster_line_number = -1;
 unsigned int raster_line[800];
 
-int colour0, colour1, colour2, colour3, colour4;
-
 int image_offset = 0;
 int drawing = 0;
 int y;
@@ -38,6 +36,8 @@ int y;
 #include <rfb/rfb.h>
 #include <rfb/keysym.h>
 
+#include "vncdecode.h"
+
 static const int bpp = 4;
 static int maxx = 800, maxy = 600;
 
@@ -612,31 +612,6 @@ int openSerialPort(char *port)
   return 0;
 }
 
-int setPixel(rfbScreenInfoPtr screen, int x, int y, uint32_t v)
-{
-  //  printf("(%d,%d) = %08x\n",x,y,v);
-  if (y >= 0 && y < maxy && x >= 0 && x < maxx) {
-    ((unsigned char *)screen->frameBuffer)[(y * maxx * 4) + x * 4 + 3] = 0;
-    ((unsigned char *)screen->frameBuffer)[(y * maxx * 4) + x * 4 + 2] = v & 0xff;
-    ((unsigned char *)screen->frameBuffer)[(y * maxx * 4) + x * 4 + 1] = (v >> 8) & 0xff;
-    ((unsigned char *)screen->frameBuffer)[(y * maxx * 4) + x * 4 + 0] = (v >> 16) & 0xff;
-  }
-  return 0;
-}
-
-int setRaster(rfbScreenInfoPtr screen, int y, uint32_t v)
-{
-  if (y >= 0 && y < maxy) {
-    unsigned char *raster = &((unsigned char *)screen->frameBuffer)[y * maxx * 4];
-    raster[3] = 0;
-    raster[2] = v & 0xff;
-    raster[1] = (v >> 8) & 0xff;
-    raster[0] = (v >> 16) & 0xff;
-    bcopy(&raster[0], &raster[4], maxx * 4 - 1);
-  }
-  return 0;
-}
-
 int dump_bytes(char *msg, unsigned char *bytes, int length)
 {
   fprintf(stdout, "%s:\n", msg);
@@ -650,19 +625,77 @@ int dump_bytes(char *msg, unsigned char *bytes, int length)
   return 0;
 }
 
+void markModified(video_decoder *d, int x1, int y1, int x2, int y2)
+{
+  rfbMarkRectAsModified(d->context, x1, y1, x2, y2);
+}
+
+void newFrame(video_decoder *d)
+{
+  // Only tell VNC about the parts of the screen that have changed, if we
+  // are keeping track of them.
+  if (d->changed)
+    video_decoder_changes(d, markModified);
+  else
+    updateFrameBuffer(d->context);
+}
+
+// Read exactly len bytes, returning 0 if they were read
+int read_fully(int sock, unsigned char *buffer, int len)
+{
+  while (len > 0) {
+    int r = read(sock, buffer, len);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r < 1)
+      return -1;
+    buffer += r;
+    len -= r;
+  }
+  return 0;
+}
+
+int usage(void)
+{
+  fprintf(stderr, "usage: vncserver [libvncserver options] [-f] [-p video proxy port] [serial port]\n");
+  fprintf(stderr, "If -f is specified, whole frames are read from the video proxy (by default on port 6566), rather\n"
+                  "than packets of compressed video (by default on port 6565).\n");
+  exit(-3);
+}
+
 int main(int argc, char **argv)
 {
   int do_dummy = 0;
   int debug = 0; // x806; //0x21b;
 
-  if (!do_dummy) {
-    if (argc > 1)
-      openSerialPort(argv[1]);
-  }
-
   rfbScreenInfoPtr rfbScreen = rfbGetScreen(&argc, argv, maxx, maxy, 8, 3, bpp);
   if (!rfbScreen)
     return 0;
+
+  // (libvncserver has removed the options it knows from argv)
+  int read_frames = 0;
+  int port = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "fp:")) != -1) {
+    switch (opt) {
+    case 'f':
+      read_frames = 1;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (!port)
+    port = read_frames ? 6566 : 6565;
+
+  if (!do_dummy) {
+    if (optind < argc)
+      openSerialPort(argv[optind]);
+  }
+
   rfbScreen->desktopName = "MEGA65 Remote Display";
   rfbScreen->frameBuffer = (char *)malloc(maxx * maxy * bpp);
   rfbScreen->alwaysShared = TRUE;
@@ -680,10 +713,10 @@ int main(int argc, char **argv)
   rfbRunEventLoop(rfbScreen, -1, TRUE);
   fprintf(stderr, "Running background loop...\n");
 
-  int sock = connect_to_port(6565);
+  int sock = connect_to_port(port);
   if (!do_dummy) {
     if (sock == -1) {
-      fprintf(stderr, "Could not connect to video proxy on port 6565.\n");
+      fprintf(stderr, "Could not connect to video proxy on port %d.\n", port);
       exit(-1);
     }
   }
@@ -691,13 +724,13 @@ int main(int argc, char **argv)
   printf("Started.\n");
   fflush(stdout);
 
-  int y = -1;
-  int x = 0;
-
-  char bit_sequence[21];
-
-  // Put end of string marker in place
-  bit_sequence[20] = 0;
+  video_decoder decoder;
+  video_decoder_init(&decoder, (unsigned char *)rfbScreen->frameBuffer, maxx, maxy);
+  decoder.debug = debug;
+  decoder.new_frame = newFrame;
+  decoder.context = rfbScreen;
+  if (video_decoder_track_changes(&decoder))
+    fprintf(stderr, "WARNING: Could not allocate memory to track changes, so will update the whole screen each frame.\n");
 
   while (1) {
     unsigned char packet[8192];
@@ -719,10 +752,28 @@ int main(int argc, char **argv)
         fclose(f);
       }
     }
+    else if (read_frames) {
+      // The proxy has already decoded the frame, so just take it
+      video_frame_header header;
+      if (read_fully(sock, (unsigned char *)&header, sizeof(header)) || ntohl(header.magic) != VIDEO_FRAME_MAGIC
+          || ntohs(header.width) != maxx || ntohs(header.height) != maxy || ntohl(header.length) != maxx * maxy * bpp
+          || read_fully(sock, (unsigned char *)rfbScreen->frameBuffer, maxx * maxy * bpp)) {
+        fprintf(stderr, "ERROR: Lost the stream of frames from the video proxy.\n");
+        exit(-1);
+      }
+      if (debug & 1)
+        printf("Frame #%u\n", ntohl(header.sequence));
+      video_decoder_frame_replaced(&decoder);
+      newFrame(&decoder);
+      continue;
+    }
     else {
-      len = read(sock, packet, 2132);
-      if (len < 1)
+      // Packets are always whole, so that the stream stays in step
+      len = 2132;
+      if (read_fully(sock, packet, len)) {
+        len = 0;
         usleep(10000);
+      }
     }
 
     if (len > 2100) {
@@ -735,193 +786,11 @@ int main(int argc, char **argv)
       }
 
       // Packet consists solely of bit-packed data
-
-      // Erase any banked up bits before starting decode of next packet
-      memset(bit_sequence, '.', 20);
-
-      // Start from beginning of data
-      int offset = 0x56;
-      int bn = 0;
-
-      int counter = 0;
-
-      // Process all bits in packet
-
-      // Start outside frame so that we can synchronise without visible artefacts
-      int lasty = -1;
-      y = -1;
-
-      for (; offset < len; offset++) {
-        if (debug & 0x200)
-          printf("> 0x%02x\n", packet[offset]);
-        for (bn = 7; bn >= 0; bn--) {
-          counter++;
-
-          int bit = (packet[offset] >> bn) & 1;
-          // Shuffle bits down
-          bcopy(&bit_sequence[1], &bit_sequence[0], 19);
-          bit_sequence[19] = '0' + bit;
-          if (debug & 0x200) {
-            if (bit_sequence[0] != '.')
-              printf(">> %-8d %s\n", counter, bit_sequence);
-          }
-
-          if (!strncmp("11110", bit_sequence, 5)) {
-            // Explcit colour (12 bits)
-            int s = bit_sequence[17];
-            bit_sequence[17] = 0;
-            int c = strtol(&bit_sequence[5], NULL, 2);
-            colour4 = colour3;
-            colour3 = colour2;
-            colour2 = colour1;
-            colour1 = colour0;
-            colour0 = ((c & 0xf) << 4) | ((c & 0xf0) << 8) | ((c & 0xf00) << 12);
-            if (debug & 0x800)
-              printf("Saw new colour #%06x at (%d,%d)\n", colour0, x, y);
-            bit_sequence[17] = s;
-            memset(bit_sequence, '.', 17);
-            setPixel(rfbScreen, x++, y, colour0);
-          }
-          else if (!strncmp("111110", bit_sequence, 6)) {
-            // Indicate raster (10 bits)
-            int s = bit_sequence[16];
-            bit_sequence[16] = 0;
-            setRaster(rfbScreen, y, colour0);
-            // if (x!=-1) for(;x<maxx;x++) setPixel(rfbScreen,x,y,colour0);
-            y = strtol(&bit_sequence[6], NULL, 2);
-            if (lasty == -1) {
-              lasty = y;
-              y = -1;
-            }
-            else {
-              if ((y != (1 + lasty)) && (y != lasty)) {
-                // Non successive raster lines, block drawing
-                if (debug & 2)
-                  printf("lasty was %d, new y = %d\n", lasty, y);
-                lasty = y;
-                y = -1;
-              }
-              else
-                lasty = y;
-            }
-
-            bit_sequence[16] = s;
-            if (debug & 2)
-              printf("Raster #%d (MAX X value seen was %d)\n", y, x);
-            x = 0;
-            colour0 = 0x000000;
-            colour1 = 0xf0f0f0;
-            colour2 = 0x303030;
-            colour3 = 0x707070;
-            colour4 = 0xb0b0b0;
-            memset(bit_sequence, '.', 16);
-          }
-          else if (!strncmp("11111110", bit_sequence, 8)) {
-            // RLE run of 0 - 255 pixels
-            int s = bit_sequence[16];
-            bit_sequence[16] = 0;
-            int r = strtol(&bit_sequence[8], NULL, 2);
-            bit_sequence[16] = s;
-            if (debug & 8)
-              printf("Run of %d at %d,%d\n", r, x, y);
-            if (x != -1)
-              for (; r && (x < 800); r--) {
-                setPixel(rfbScreen, x++, y, colour0);
-              }
-            memset(bit_sequence, '.', 16);
-            if (debug & 8)
-              printf("After run, x=%d\n", x);
-          }
-          else if (!strncmp("11111100", bit_sequence, 8)) {
-            // New frame
-            if (debug & 1)
-              printf("New frame (y got to %d)\n", y);
-            if (y != -1)
-              setRaster(rfbScreen, y, colour0);
-            // if (x!=-1) for(;x<maxx;x++) setPixel(rfbScreen,x,y,colour0);
-            y = -1;
-            x = -1;
-            memset(bit_sequence, '.', 8);
-            colour0 = 0x000000;
-            colour1 = 0xf0f0f0;
-            colour2 = 0x303030;
-            colour3 = 0x707070;
-            colour4 = 0xb0b0b0;
-            updateFrameBuffer(rfbScreen);
-          }
-          else if (!strncmp("11111101", bit_sequence, 8)) {
-            // Reserved -- this is an error for now
-            if (debug & 0x100)
-              printf("Reserved token.\n");
-            memset(bit_sequence, '.', 8);
-          }
-          else if (!strncmp("1100", bit_sequence, 4)) {
-            // Colour 2
-            int t = colour2;
-            colour2 = colour1;
-            colour1 = colour0;
-            colour0 = t;
-            if (debug & 4)
-              printf("Colour 2 @ x=%d (colour=#%06x)\n", x, colour0);
-            if (x != -1)
-              setPixel(rfbScreen, x++, y, colour0);
-            memset(bit_sequence, '.', 4);
-          }
-          else if (!strncmp("1101", bit_sequence, 4)) {
-            // Colour 3
-            int t = colour3;
-            colour3 = colour2;
-            colour2 = colour1;
-            colour1 = colour0;
-            colour0 = t;
-            if (debug & 4)
-              printf("Colour 3\n");
-            if (x != -1)
-              setPixel(rfbScreen, x++, y, colour0);
-            memset(bit_sequence, '.', 4);
-          }
-          else if (!strncmp("1110", bit_sequence, 4)) {
-            // Colour 4
-            int t = colour4;
-            colour4 = colour3;
-            colour3 = colour2;
-            colour2 = colour1;
-            colour1 = colour0;
-            colour0 = t;
-            if (debug & 4)
-              printf("Colour 4 @ %d,%d\n", x, y);
-            if (x != -1)
-              setPixel(rfbScreen, x++, y, colour0);
-            memset(bit_sequence, '.', 4);
-          }
-          else if (!strncmp("10", bit_sequence, 2)) {
-            // Colour 1
-            int t = colour1;
-            colour1 = colour0;
-            colour0 = t;
-            if (debug & 4)
-              printf("Previous colour @ %d,%d\n", x, y);
-            if (x != -1)
-              setPixel(rfbScreen, x++, y, colour0);
-            //	    if (debug&4)
-            memset(bit_sequence, '.', 2);
-          }
-          else if (!strncmp("0", bit_sequence, 1)) {
-            // Repeat last colour
-            if (debug & 4)
-              printf("Same colour at %d,%d\n", x, y);
-            if (x != -1)
-              setPixel(rfbScreen, x++, y, colour0);
-            memset(bit_sequence, '.', 1);
-          }
-          //	  if (debug&0x800)
-          if (0)
-            printf("Colours = #%06x, #%06x, #%06x, #%06x, #%06x\n", colour0, colour1, colour2, colour3, colour4);
-        }
-      }
+      video_decode_packet(&decoder, packet, len);
     }
   }
 
+  video_decoder_free(&decoder);
   free(rfbScreen->frameBuffer);
   rfbScreenCleanup(rfbScreen);
 